@@ -0,0 +1,326 @@
+/**
+ * @file    AggregationWindow.cpp
+ * @brief   mbed Edge Tumbling/Sliding Aggregation Window Implementation
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "AggregationWindow.h"
+
+// system includes
+#include <stdio.h>
+#include <stdlib.h>
+
+// constructor
+AggregationWindow::AggregationWindow() { this->initialize(); }
+
+// destructor
+AggregationWindow::~AggregationWindow() { this->release(); }
+
+// copy constructor
+AggregationWindow::AggregationWindow(const AggregationWindow &window) {}
+
+// initialize (disabled)
+void AggregationWindow::initialize() {
+  this->m_function = AGGREGATE_COUNT;
+  this->m_window_ms = 0;
+  this->m_slide_ms = 0;
+  this->m_samples = NULL;
+  this->m_candidates = NULL;
+  this->m_mask = 0;
+  this->reset();
+}
+
+// free the sliding window state
+void AggregationWindow::release() {
+  if (this->m_samples != NULL) {
+    free(this->m_samples);
+    this->m_samples = NULL;
+  }
+  if (this->m_candidates != NULL) {
+    free(this->m_candidates);
+    this->m_candidates = NULL;
+  }
+  this->m_mask = 0;
+}
+
+// (re)configure the window
+bool AggregationWindow::configure(AGGREGATION_FUNCTION function, int window_ms,
+                                  int slide_ms, int sample_interval_ms) {
+  this->release();
+  this->m_function = function;
+  this->m_window_ms = 0;
+  this->m_slide_ms = 0;
+  this->reset();
+  if (window_ms <= 0) {
+    return (window_ms == 0);
+  }
+  if (slide_ms <= 0 || slide_ms > window_ms) {
+    slide_ms = window_ms;
+  }
+
+  // only sliding windows need to remember their samples (and only min/max
+  // need the candidate queue)
+  if (slide_ms < window_ms) {
+    uint64_t capacity = AGGREGATION_WINDOW_MIN_SAMPLES;
+    uint64_t needed = AggregationWindow::samplesNeeded(window_ms,
+                                                       sample_interval_ms);
+    while (capacity < needed && capacity < AGGREGATION_WINDOW_MAX_SAMPLES) {
+      capacity *= 2;
+    }
+    this->m_mask = capacity - 1;
+    this->m_samples = (aggregation_sample_t *)calloc(
+        capacity, sizeof(aggregation_sample_t));
+    if (function == AGGREGATE_MIN || function == AGGREGATE_MAX) {
+      this->m_candidates = (uint64_t *)calloc(capacity, sizeof(uint64_t));
+    }
+    if (this->m_samples == NULL ||
+        ((function == AGGREGATE_MIN || function == AGGREGATE_MAX) &&
+         this->m_candidates == NULL)) {
+      printf("AggregationWindow: ERROR. Unable to allocate a sliding window "
+             "of %d ms\n",
+             window_ms);
+      this->release();
+      return false;
+    }
+  }
+  this->m_window_ms = window_ms;
+  this->m_slide_ms = slide_ms;
+  return true;
+}
+
+// discard any samples
+void AggregationWindow::reset() {
+  this->m_window_end_ms = 0;
+  this->m_count = 0;
+  this->m_sum = 0;
+  this->m_min = 0;
+  this->m_max = 0;
+  this->m_head = 0;
+  this->m_tail = 0;
+  this->m_candidates_head = 0;
+  this->m_candidates_tail = 0;
+  this->m_num_emitted = 0;
+  this->m_num_dropped = 0;
+}
+
+// are we enabled?
+bool AggregationWindow::isEnabled() { return (this->m_window_ms > 0); }
+
+// are we a sliding window?
+bool AggregationWindow::isSliding() { return (this->m_samples != NULL); }
+
+// add a sample
+bool AggregationWindow::add(int64_t timestamp_ms, long value, long *result) {
+  if (this->m_window_ms <= 0) {
+    return false;
+  }
+  if (this->m_samples != NULL) {
+    return this->addSliding(timestamp_ms, value, result);
+  }
+  return this->addTumbling(timestamp_ms, value, result);
+}
+
+// the aggregate of the samples in the window
+long AggregationWindow::compute() {
+  switch (this->m_function) {
+  case AGGREGATE_COUNT:
+    return (long)this->m_count;
+  case AGGREGATE_SUM:
+    return (long)this->m_sum;
+  case AGGREGATE_MIN:
+  case AGGREGATE_MAX:
+    if (this->m_candidates != NULL) {
+      uint64_t sequence =
+          this->m_candidates[this->m_candidates_head & this->m_mask];
+      return this->m_samples[sequence & this->m_mask].value;
+    }
+    return (this->m_function == AGGREGATE_MIN) ? this->m_min : this->m_max;
+  case AGGREGATE_MEAN:
+    return (this->m_count > 0) ? (long)(this->m_sum / (int64_t)this->m_count)
+                               : 0;
+  }
+  return 0;
+}
+
+// tumbling: hand out the running totals when the window closes... and start
+// over with the new sample
+bool AggregationWindow::addTumbling(int64_t timestamp_ms, long value,
+                                    long *result) {
+  bool closed = false;
+  if (this->m_count > 0 && timestamp_ms >= this->m_window_end_ms) {
+    *result = this->compute();
+    ++this->m_num_emitted;
+    this->m_count = 0;
+    this->m_sum = 0;
+    closed = true;
+  }
+  if (this->m_count == 0) {
+    this->m_window_end_ms =
+        (timestamp_ms / this->m_window_ms + 1) * this->m_window_ms;
+    this->m_min = value;
+    this->m_max = value;
+  } else if (value < this->m_min) {
+    this->m_min = value;
+  } else if (value > this->m_max) {
+    this->m_max = value;
+  }
+  ++this->m_count;
+  this->m_sum += value;
+  return closed;
+}
+
+// sliding: the window [end - window_ms, end) closes every slide_ms
+bool AggregationWindow::addSliding(int64_t timestamp_ms, long value,
+                                   long *result) {
+  bool closed = false;
+  if (this->m_window_end_ms == 0) {
+    this->m_window_end_ms =
+        (timestamp_ms / this->m_slide_ms + 1) * this->m_slide_ms;
+  }
+  if (timestamp_ms >= this->m_window_end_ms) {
+    // drop whatever is older than the closing window
+    int64_t start_ms = this->m_window_end_ms - this->m_window_ms;
+    while (this->m_head < this->m_tail &&
+           this->m_samples[this->m_head & this->m_mask]
+                   .timestamp_ms < start_ms) {
+      this->evictOldest();
+    }
+    if (this->m_count > 0) {
+      *result = this->compute();
+      ++this->m_num_emitted;
+      closed = true;
+    }
+    this->m_window_end_ms =
+        (timestamp_ms / this->m_slide_ms + 1) * this->m_slide_ms;
+  }
+
+  // samples that are older than the next window are not needed anymore
+  int64_t start_ms = this->m_window_end_ms - this->m_window_ms;
+  while (this->m_head < this->m_tail &&
+         this->m_samples[this->m_head & this->m_mask]
+                 .timestamp_ms < start_ms) {
+    this->evictOldest();
+  }
+
+  // a full ring grows... or, at its maximum, drops its oldest sample early
+  if (this->m_tail - this->m_head == this->m_mask + 1 &&
+      this->grow() == false) {
+    this->evictOldest();
+    ++this->m_num_dropped;
+  }
+
+  // add the sample... a min/max candidate makes any older candidate it
+  // dominates redundant (it can never be the answer again)
+  uint64_t sequence = this->m_tail++;
+  aggregation_sample_t *sample =
+      &this->m_samples[sequence & this->m_mask];
+  sample->timestamp_ms = timestamp_ms;
+  sample->value = value;
+  ++this->m_count;
+  this->m_sum += value;
+  if (this->m_candidates != NULL) {
+    while (this->m_candidates_tail > this->m_candidates_head) {
+      uint64_t last =
+          this->m_candidates[(this->m_candidates_tail - 1) & this->m_mask];
+      if (this->dominates(value, this->m_samples[last & this->m_mask].value) ==
+          false) {
+        break;
+      }
+      --this->m_candidates_tail;
+    }
+    this->m_candidates[this->m_candidates_tail++ & this->m_mask] = sequence;
+  }
+  return closed;
+}
+
+// drop the oldest sample of a sliding window
+void AggregationWindow::evictOldest() {
+  uint64_t sequence = this->m_head++;
+  const aggregation_sample_t *sample =
+      &this->m_samples[sequence & this->m_mask];
+  --this->m_count;
+  this->m_sum -= sample->value;
+  if (this->m_candidates != NULL &&
+      this->m_candidates_head < this->m_candidates_tail &&
+      this->m_candidates[this->m_candidates_head & this->m_mask] ==
+          sequence) {
+    ++this->m_candidates_head;
+  }
+}
+
+// double the ring of a sliding window (false if it is at its maximum, or out
+// of memory). Samples and candidates keep their sequence numbers
+bool AggregationWindow::grow() {
+  uint64_t capacity = (this->m_mask + 1) * 2;
+  if (capacity > AGGREGATION_WINDOW_MAX_SAMPLES) {
+    return false;
+  }
+  aggregation_sample_t *samples = (aggregation_sample_t *)malloc(
+      capacity * sizeof(aggregation_sample_t));
+  uint64_t *candidates = NULL;
+  if (this->m_candidates != NULL) {
+    candidates = (uint64_t *)malloc(capacity * sizeof(uint64_t));
+  }
+  if (samples == NULL || (this->m_candidates != NULL && candidates == NULL)) {
+    free(samples);
+    free(candidates);
+    return false;
+  }
+  for (uint64_t i = this->m_head; i < this->m_tail; ++i) {
+    samples[i & (capacity - 1)] = this->m_samples[i & this->m_mask];
+  }
+  free(this->m_samples);
+  this->m_samples = samples;
+  if (candidates != NULL) {
+    for (uint64_t i = this->m_candidates_head; i < this->m_candidates_tail;
+         ++i) {
+      candidates[i & (capacity - 1)] = this->m_candidates[i & this->m_mask];
+    }
+    free(this->m_candidates);
+    this->m_candidates = candidates;
+  }
+  this->m_mask = capacity - 1;
+  return true;
+}
+
+// samples a sliding window holds at a given sample interval (one more than
+// fit in the window: both of its ends may hold one)
+uint64_t AggregationWindow::samplesNeeded(int window_ms,
+                                          int sample_interval_ms) {
+  if (window_ms <= 0 || sample_interval_ms <= 0) {
+    return 0;
+  }
+  return (uint64_t)window_ms / sample_interval_ms + 1;
+}
+
+// is "value" at least as good a min/max candidate as "other"?
+bool AggregationWindow::dominates(long value, long other) {
+  if (this->m_function == AGGREGATE_MIN) {
+    return (value <= other);
+  }
+  return (value >= other);
+}
+
+// number of windows closed
+uint64_t AggregationWindow::getNumEmitted() { return this->m_num_emitted; }
+
+// number of samples dropped early (sliding window ring full)
+uint64_t AggregationWindow::getNumDropped() { return this->m_num_dropped; }
+
+size_t AggregationWindow::getCapacity() { return this->m_mask + 1; }
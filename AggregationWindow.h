@@ -0,0 +1,124 @@
+/**
+ * @file    AggregationWindow.h
+ * @brief   mbed Edge Tumbling/Sliding Aggregation Window
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __AGGREGATION_WINDOW_H__
+#define __AGGREGATION_WINDOW_H__
+
+// system includes
+#include <stddef.h>
+#include <stdint.h>
+
+// Tunables for the aggregation windows: a sliding window's ring starts big
+// enough for a window of samples at the expected sample interval (or at the
+// minimum) and doubles when it fills, up to the maximum
+#define AGGREGATION_WINDOW_MIN_SAMPLES 64
+#define AGGREGATION_WINDOW_MAX_SAMPLES 65536
+
+// what a window computes over its samples
+enum AGGREGATION_FUNCTION {
+  AGGREGATE_COUNT = 0,
+  AGGREGATE_SUM,
+  AGGREGATE_MIN,
+  AGGREGATE_MAX,
+  AGGREGATE_MEAN // integer mean (sum / count)
+};
+
+// a sample held by a sliding window
+typedef struct aggregation_sample {
+  int64_t timestamp_ms;
+  long value;
+} aggregation_sample_t;
+
+// A time window over a stream of samples that produces one aggregate per
+// "slide_ms". With slide_ms == window_ms the window is tumbling: running
+// totals that are handed out and restarted as each window closes. With a
+// shorter slide the window is sliding: the samples of the last window_ms are
+// kept in a ring (sized for the sample interval, growing up to
+// AGGREGATION_WINDOW_MAX_SAMPLES... beyond that the oldest are dropped early)
+// and min/max come from a monotonic queue, so every sample is O(1) (amortized)
+// whatever the window size.
+//
+// Windows are aligned to multiples of slide_ms and close when the first
+// sample past their end arrives. Single threaded (the owning shard).
+class AggregationWindow {
+public:
+  AggregationWindow();
+  virtual ~AggregationWindow();
+
+  // (re)configure the window... window_ms == 0 disables it. slide_ms == 0 (or
+  // window_ms) makes it tumbling. "sample_interval_ms" sizes a sliding
+  // window's ring (0: unknown). Any state is discarded
+  bool configure(AGGREGATION_FUNCTION function, int window_ms, int slide_ms,
+                 int sample_interval_ms);
+  void reset();
+  bool isEnabled();
+  bool isSliding();
+
+  // add a sample... true if a window closed, its aggregate is in "result"
+  bool add(int64_t timestamp_ms, long value, long *result);
+
+  // statistics
+  uint64_t getNumEmitted();
+  uint64_t getNumDropped();
+  size_t getCapacity();
+
+  // samples a sliding window holds at a given sample interval
+  static uint64_t samplesNeeded(int window_ms, int sample_interval_ms);
+
+private:
+  AggregationWindow(const AggregationWindow &window);
+  void initialize();
+  void release();
+  long compute();
+  bool addTumbling(int64_t timestamp_ms, long value, long *result);
+  bool addSliding(int64_t timestamp_ms, long value, long *result);
+  void evictOldest();
+  bool grow();
+  bool dominates(long value, long other);
+
+private:
+  AGGREGATION_FUNCTION m_function;
+  int m_window_ms;
+  int m_slide_ms;
+  int64_t m_window_end_ms; // end of the window that closes next (0: none)
+
+  // running totals over the samples in the window
+  uint64_t m_count;
+  int64_t m_sum;
+  long m_min;
+  long m_max;
+
+  // sliding windows: the samples in the window (by sequence number) and the
+  // monotonic min/max queue (sequence numbers of the candidates)
+  aggregation_sample_t *m_samples;
+  uint64_t *m_candidates;
+  uint64_t m_mask; // ring capacity - 1 (a power of two)
+  uint64_t m_head; // oldest sample
+  uint64_t m_tail; // next sample
+  uint64_t m_candidates_head;
+  uint64_t m_candidates_tail;
+
+  uint64_t m_num_emitted;
+  uint64_t m_num_dropped;
+};
+
+#endif // __AGGREGATION_WINDOW_H__
@@ -0,0 +1,684 @@
+/**
+ * @file    ControlSocket.cpp
+ * @brief   mbed Edge Orchestrator local admin control socket
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ControlSocket.h"
+
+// Orchestrator (registry, statistics and tuning)
+#include "Orchestrator.h"
+
+// PT connections
+#include "PTConnection.h"
+
+// log levels
+#include "Log.h"
+
+// CPU profiling
+#include "Profiler.h"
+
+// worker threads (process signals blocked)
+#include "Threads.h"
+
+// system includes
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// max length of a formatted reply line
+#define CONTROL_SOCKET_FORMAT_LENGTH 1024
+
+// lane names (SHARD_LANE order)
+static const char *lane_names[SHARD_NUM_LANES] = {"control", "state",
+                                                  "telemetry"};
+
+// the commands (see "help")
+static const char *help_text =
+    "help                    this list\n"
+    "shadows [prefix] [max]  shadows and their cached resource values\n"
+    "stats                   queue depths, lane latencies, PT connections,\n"
+    "                        backpressure\n"
+    "poll <endpoint> <ms>    change a device's poll interval (0: stop)\n"
+    "poll-scale <percent>    scale every poll interval\n"
+    "coalesce <ms>           coalescing window at ELEVATED backpressure\n"
+    "loglevel [level]        get/set the log level (warning|info|debug)\n"
+    "snapshot <path>         write every shadow's values to a file\n"
+    "trace                   export the traced spans\n"
+    "profile                 start/stop the CPU profile\n"
+    "quit                    close this connection\n";
+
+// append a formatted line to a reply
+static void appendf(std::string *reply, const char *format, ...) {
+  char buffer[CONTROL_SOCKET_FORMAT_LENGTH];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (length > 0) {
+    reply->append(buffer, ((size_t)length < sizeof(buffer))
+                              ? (size_t)length
+                              : sizeof(buffer) - 1);
+  }
+}
+
+// parse a bounded integer argument
+static bool parseInt(const char *token, long min, long max, int *value) {
+  if (token == NULL) {
+    return false;
+  }
+  char *end = NULL;
+  errno = 0;
+  long parsed = strtol(token, &end, 10);
+  if (errno != 0 || end == token || *end != '\0' || parsed < min ||
+      parsed > max) {
+    return false;
+  }
+  *value = (int)parsed;
+  return true;
+}
+
+// format a shadow and its cached values as one line (the value cache is read
+// through a lock-free snapshot, so its owner shard never waits on us)
+static int formatShadow(DeviceShadow *shadow, char *buffer, size_t length) {
+  OrchestratorShard *shard = (OrchestratorShard *)shadow->getShard();
+  int used = snprintf(buffer, length, "%s shard=%d registered=%d poll_ms=%d",
+                      shadow->getEndpointID(),
+                      (shard != NULL) ? shard->getIndex() : -1,
+                      (shadow->isRegistered() == true) ? 1 : 0,
+                      shadow->getPollIntervalMs());
+  value_cache_snapshot_t values;
+  shadow->getValueCache()->snapshot(&values);
+  for (int i = 0; i < values.num_values && used > 0 && (size_t)used < length;
+       ++i) {
+    used += snprintf(buffer + used, length - used, " /%u/%u/%u=%ld",
+                     values.values[i].object_id, values.values[i].instance_id,
+                     values.values[i].resource_id, values.values[i].value);
+  }
+  if (used < 0) {
+    return 0;
+  }
+  if ((size_t)used >= length - 1) {
+    used = (int)length - 2;
+  }
+  buffer[used++] = '\n';
+  buffer[used] = '\0';
+  return used;
+}
+
+// "shadows" listing state
+typedef struct control_listing {
+  const char *prefix;
+  size_t prefix_length;
+  size_t max_shadows;
+  size_t num_listed;
+  size_t num_matched;
+  std::string *reply;
+} control_listing_t;
+
+// list a shadow (registry read lock held)
+static void listShadowCB(DeviceShadow *shadow, void *ctx) {
+  control_listing_t *listing = (control_listing_t *)ctx;
+  if (listing->prefix != NULL &&
+      strncmp(shadow->getEndpointID(), listing->prefix,
+              listing->prefix_length) != 0) {
+    return;
+  }
+  ++listing->num_matched;
+  if (listing->num_listed >= listing->max_shadows ||
+      listing->reply->size() >= CONTROL_SOCKET_MAX_REPLY_BYTES) {
+    return;
+  }
+  char line[CONTROL_SOCKET_FORMAT_LENGTH];
+  int length = formatShadow(shadow, line, sizeof(line));
+  listing->reply->append(line, length);
+  ++listing->num_listed;
+}
+
+// "snapshot" state
+typedef struct control_snapshot {
+  FILE *fp;
+  size_t num_written;
+  bool failed;
+} control_snapshot_t;
+
+// write a shadow to a snapshot (registry read lock held)
+static void snapshotShadowCB(DeviceShadow *shadow, void *ctx) {
+  control_snapshot_t *snapshot = (control_snapshot_t *)ctx;
+  char line[CONTROL_SOCKET_FORMAT_LENGTH];
+  int length = formatShadow(shadow, line, sizeof(line));
+  if (fwrite(line, 1, length, snapshot->fp) != (size_t)length) {
+    snapshot->failed = true;
+  }
+  ++snapshot->num_written;
+}
+
+// set a descriptor nonblocking
+static bool setNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  return (flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0);
+}
+
+// default constructor
+ControlSocket::ControlSocket(void *orchestrator, const char *path) {
+  this->initialize(orchestrator, path);
+}
+
+// destructor
+ControlSocket::~ControlSocket() {
+  this->stop();
+  free(this->m_path);
+}
+
+// copy constructor
+ControlSocket::ControlSocket(const ControlSocket &socket) {}
+
+// initialize
+void ControlSocket::initialize(void *orchestrator, const char *path) {
+  this->m_orchestrator = orchestrator;
+  this->m_path = strdup(path);
+  this->m_listen_fd = -1;
+  this->m_wake_fds[0] = -1;
+  this->m_wake_fds[1] = -1;
+  this->m_is_running = false;
+  this->m_is_started = false;
+}
+
+// open our listening socket... a stale socket left by an earlier run is
+// replaced, anything else at the path is left alone
+bool ControlSocket::openListener() {
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(this->m_path) >= sizeof(address.sun_path)) {
+    printf("ControlSocket: ERROR. Socket path too long: %s\n", this->m_path);
+    return false;
+  }
+  strncpy(address.sun_path, this->m_path, sizeof(address.sun_path) - 1);
+  struct stat st;
+  if (lstat(this->m_path, &st) == 0) {
+    if (S_ISSOCK(st.st_mode) == 0) {
+      printf("ControlSocket: ERROR. %s exists and is not a socket\n",
+             this->m_path);
+      return false;
+    }
+    unlink(this->m_path);
+  }
+  this->m_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (this->m_listen_fd < 0) {
+    printf("ControlSocket: ERROR. Unable to create socket: %s\n",
+           strerror(errno));
+    return false;
+  }
+
+  // local admins only
+  mode_t mask = umask(0077);
+  int bound =
+      bind(this->m_listen_fd, (struct sockaddr *)&address, sizeof(address));
+  umask(mask);
+  if (bound != 0 ||
+      listen(this->m_listen_fd, CONTROL_SOCKET_MAX_CLIENTS) != 0 ||
+      setNonBlocking(this->m_listen_fd) == false) {
+    printf("ControlSocket: ERROR. Unable to listen on %s: %s\n", this->m_path,
+           strerror(errno));
+    close(this->m_listen_fd);
+    this->m_listen_fd = -1;
+    return false;
+  }
+  return true;
+}
+
+// start the control thread
+bool ControlSocket::start() {
+  if (this->m_is_started == true || this->openListener() == false) {
+    return false;
+  }
+  if (pipe(this->m_wake_fds) != 0) {
+    printf("ControlSocket: ERROR. Unable to create wake pipe: %s\n",
+           strerror(errno));
+    this->m_wake_fds[0] = -1;
+    this->m_wake_fds[1] = -1;
+    this->stop();
+    return false;
+  }
+  setNonBlocking(this->m_wake_fds[1]);
+  this->m_is_running = true;
+  this->m_is_started = Threads::create(
+      &this->m_thread, &ControlSocket::controlProcessor, (void *)this);
+  if (this->m_is_started == false) {
+    this->stop();
+    return false;
+  }
+
+  // DEBUG
+  printf("ControlSocket: listening on %s\n", this->m_path);
+  return true;
+}
+
+// stop the control thread, drop our clients and remove the socket
+void ControlSocket::stop() {
+  if (this->m_is_started == true) {
+    __atomic_store_n(&this->m_is_running, false, __ATOMIC_RELEASE);
+    char wake = 0;
+    while (write(this->m_wake_fds[1], &wake, 1) < 0 && errno == EINTR) {
+    }
+    pthread_join(this->m_thread, NULL);
+    this->m_is_started = false;
+  }
+  while (this->m_clients.empty() == false) {
+    this->closeClient(this->m_clients.size() - 1);
+  }
+  for (int i = 0; i < 2; ++i) {
+    if (this->m_wake_fds[i] >= 0) {
+      close(this->m_wake_fds[i]);
+      this->m_wake_fds[i] = -1;
+    }
+  }
+  if (this->m_listen_fd >= 0) {
+    close(this->m_listen_fd);
+    this->m_listen_fd = -1;
+    unlink(this->m_path);
+  }
+}
+
+// STATIC: control thread
+void *ControlSocket::controlProcessor(void *ctx) {
+  ControlSocket *control = (ControlSocket *)ctx;
+  if (control != NULL) {
+    control->controlRunLoop();
+  }
+  return NULL;
+}
+
+// control loop: wait for the wake pipe, new clients and client I/O
+void ControlSocket::controlRunLoop() {
+  // admin work yields the CPU to the shards, the PT thread and the ticker
+  if (setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid),
+                  CONTROL_SOCKET_NICE) != 0) {
+    printf("ControlSocket: WARNING. Unable to lower our priority: %s\n",
+           strerror(errno));
+  }
+  Profiler::shared()->registerThread("control");
+  std::vector<struct pollfd> fds;
+  while (__atomic_load_n(&this->m_is_running, __ATOMIC_ACQUIRE) == true) {
+    fds.clear();
+    struct pollfd pfd;
+    pfd.fd = this->m_wake_fds[0];
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    fds.push_back(pfd);
+    pfd.fd = (this->m_clients.size() < CONTROL_SOCKET_MAX_CLIENTS)
+                 ? this->m_listen_fd
+                 : -1;
+    fds.push_back(pfd);
+    for (size_t i = 0; i < this->m_clients.size(); ++i) {
+      pfd.fd = this->m_clients[i]->fd;
+      pfd.events = (this->m_clients[i]->closing == true) ? 0 : POLLIN;
+      if (this->m_clients[i]->output.empty() == false) {
+        pfd.events |= POLLOUT;
+      }
+      fds.push_back(pfd);
+    }
+    if (poll(&fds[0], fds.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      printf("ControlSocket: ERROR. poll() failed: %s\n", strerror(errno));
+      break;
+    }
+    if (fds[0].revents != 0) {
+      // stop() woke us up
+      continue;
+    }
+    if (fds[1].revents != 0) {
+      this->acceptClients();
+    }
+
+    // serve the clients we polled (accepted ones are only appended)
+    for (size_t i = 2; i < fds.size(); ++i) {
+      control_client_t *client = this->m_clients[i - 2];
+      if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) != 0 &&
+          client->closing == false) {
+        this->readClient(client);
+      }
+      if (client->fd >= 0 && client->output.empty() == false) {
+        this->writeClient(client);
+      }
+      if (client->fd >= 0 && client->closing == true &&
+          client->output.empty() == true) {
+        close(client->fd);
+        client->fd = -1;
+      }
+    }
+    for (size_t i = this->m_clients.size(); i > 0; --i) {
+      if (this->m_clients[i - 1]->fd < 0) {
+        this->closeClient(i - 1);
+      }
+    }
+  }
+  Profiler::shared()->unregisterThread();
+}
+
+// accept waiting clients
+void ControlSocket::acceptClients() {
+  while (this->m_clients.size() < CONTROL_SOCKET_MAX_CLIENTS) {
+    int fd = accept(this->m_listen_fd, NULL, NULL);
+    if (fd < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        printf("ControlSocket: ERROR. accept() failed: %s\n",
+               strerror(errno));
+      }
+      return;
+    }
+    if (setNonBlocking(fd) == false) {
+      close(fd);
+      continue;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    control_client_t *client = new control_client_t();
+    client->fd = fd;
+    client->closing = false;
+    this->m_clients.push_back(client);
+  }
+}
+
+// read from a client and run the complete command lines it sent
+void ControlSocket::readClient(control_client_t *client) {
+  char buffer[4096];
+  for (;;) {
+    ssize_t length = recv(client->fd, buffer, sizeof(buffer), 0);
+    if (length > 0) {
+      client->input.append(buffer, length);
+      continue;
+    }
+    if (length < 0 && errno == EINTR) {
+      continue;
+    }
+    if (length == 0 ||
+        (length < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+      // gone... drop whatever we still owe it
+      close(client->fd);
+      client->fd = -1;
+      return;
+    }
+    break;
+  }
+  size_t newline;
+  while (client->closing == false &&
+         (newline = client->input.find('\n')) != std::string::npos) {
+    std::string line = client->input.substr(0, newline);
+    client->input.erase(0, newline + 1);
+    if (line.empty() == false && line[line.size() - 1] == '\r') {
+      line.erase(line.size() - 1);
+    }
+    if (line == "quit") {
+      client->closing = true;
+      break;
+    }
+    this->execute(line.c_str(), &client->output);
+  }
+  if (client->closing == false &&
+      client->input.size() > CONTROL_SOCKET_LINE_LENGTH) {
+    client->output.append("ERROR line too long\n");
+    client->input.clear();
+    client->closing = true;
+  }
+}
+
+// write as much of a client's reply as it takes without blocking
+void ControlSocket::writeClient(control_client_t *client) {
+  size_t written = 0;
+  while (written < client->output.size()) {
+    ssize_t length = send(client->fd, client->output.data() + written,
+                          client->output.size() - written, MSG_NOSIGNAL);
+    if (length > 0) {
+      written += length;
+      continue;
+    }
+    if (length < 0 && errno == EINTR) {
+      continue;
+    }
+    if (length < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      close(client->fd);
+      client->fd = -1;
+    }
+    break;
+  }
+  client->output.erase(0, written);
+}
+
+// drop a client
+void ControlSocket::closeClient(size_t index) {
+  control_client_t *client = this->m_clients[index];
+  if (client->fd >= 0) {
+    close(client->fd);
+  }
+  delete client;
+  this->m_clients.erase(this->m_clients.begin() + index);
+}
+
+// run a command line
+void ControlSocket::execute(const char *line, std::string *reply) {
+  Orchestrator *orchestrator = (Orchestrator *)this->m_orchestrator;
+  char buffer[CONTROL_SOCKET_LINE_LENGTH + 1];
+  strncpy(buffer, line, sizeof(buffer) - 1);
+  buffer[sizeof(buffer) - 1] = '\0';
+  char *save = NULL;
+  const char *command = strtok_r(buffer, " \t", &save);
+  const char *arg1 = (command != NULL) ? strtok_r(NULL, " \t", &save) : NULL;
+  const char *arg2 = (arg1 != NULL) ? strtok_r(NULL, " \t", &save) : NULL;
+  int value = 0;
+  if (command == NULL) {
+    // empty line: nothing to do
+    reply->append("OK\n");
+  } else if (strcmp(command, "help") == 0) {
+    reply->append(help_text);
+    reply->append("OK\n");
+  } else if (strcmp(command, "shadows") == 0) {
+    // "shadows <max>" lists every shadow up to <max>
+    const char *prefix = arg1;
+    const char *max = arg2;
+    if (arg1 != NULL && arg2 == NULL &&
+        parseInt(arg1, 0, 0x7fffffff, &value) == true) {
+      prefix = NULL;
+      max = arg1;
+    }
+    value = CONTROL_SOCKET_DEFAULT_MAX_SHADOWS;
+    if (max != NULL && parseInt(max, 0, 0x7fffffff, &value) == false) {
+      reply->append("ERROR invalid max\n");
+      return;
+    }
+    this->listShadows(prefix, (size_t)value, reply);
+  } else if (strcmp(command, "stats") == 0) {
+    this->dumpStats(reply);
+  } else if (strcmp(command, "poll") == 0) {
+    if (arg1 == NULL || parseInt(arg2, 0, 86400000, &value) == false) {
+      reply->append("ERROR usage: poll <endpoint> <ms>\n");
+    } else if (orchestrator->setPollInterval(arg1, value) == false) {
+      appendf(reply, "ERROR unknown endpoint: %s\n", arg1);
+    } else {
+      reply->append("OK\n");
+    }
+  } else if (strcmp(command, "poll-scale") == 0) {
+    if (parseInt(arg1, 1, 100000, &value) == false) {
+      reply->append("ERROR usage: poll-scale <percent>\n");
+    } else {
+      orchestrator->setPollScalePercent(value);
+      reply->append("OK\n");
+    }
+  } else if (strcmp(command, "coalesce") == 0) {
+    if (parseInt(arg1, 1, 60000, &value) == false) {
+      reply->append("ERROR usage: coalesce <ms>\n");
+    } else {
+      orchestrator->setCoalesceIntervalMs(value);
+      reply->append("OK\n");
+    }
+  } else if (strcmp(command, "loglevel") == 0) {
+    LOG_LEVEL level;
+    if (arg1 == NULL) {
+      appendf(reply, "%s\nOK\n", Log::levelName(Log::getLevel()));
+    } else if (Log::parseLevel(arg1, &level) == false) {
+      reply->append("ERROR usage: loglevel [warning|info|debug]\n");
+    } else {
+      Log::setLevel(level);
+      reply->append("OK\n");
+    }
+  } else if (strcmp(command, "snapshot") == 0) {
+    if (arg1 == NULL) {
+      reply->append("ERROR usage: snapshot <path>\n");
+    } else if (this->writeSnapshot(arg1, reply) == true) {
+      reply->append("OK\n");
+    }
+  } else if (strcmp(command, "trace") == 0) {
+    // exported by the orchestrator loop (as on SIGUSR1)
+    orchestrator->requestTraceExport(0);
+    reply->append("OK\n");
+  } else if (strcmp(command, "profile") == 0) {
+    // ... as on SIGUSR2
+    orchestrator->requestProfileToggle(0);
+    appendf(reply, "profile %s\nOK\n",
+            (Profiler::shared()->isRunning() == true) ? "stopping"
+                                                       : "starting");
+  } else {
+    appendf(reply, "ERROR unknown command: %s (try \"help\")\n", command);
+  }
+}
+
+// list the shadows whose endpoint starts with "prefix" (all if NULL)
+void ControlSocket::listShadows(const char *prefix, size_t max_shadows,
+                                std::string *reply) {
+  Orchestrator *orchestrator = (Orchestrator *)this->m_orchestrator;
+  control_listing_t listing;
+  listing.prefix = prefix;
+  listing.prefix_length = (prefix != NULL) ? strlen(prefix) : 0;
+  listing.max_shadows = max_shadows;
+  listing.num_listed = 0;
+  listing.num_matched = 0;
+  listing.reply = reply;
+  size_t from = 0;
+  while (orchestrator->visitDeviceShadows(&from,
+                                          CONTROL_SOCKET_SHADOWS_PER_LOCK,
+                                          &listShadowCB, &listing) == true) {
+  }
+  appendf(reply, "%zu of %zu shadow(s) listed\nOK\n", listing.num_listed,
+          listing.num_matched);
+}
+
+// dump our queues, latencies and backpressure
+void ControlSocket::dumpStats(std::string *reply) {
+  Orchestrator *orchestrator = (Orchestrator *)this->m_orchestrator;
+  uint64_t buckets[SHARD_NUM_LANES][SHARD_LATENCY_BUCKETS];
+  uint64_t num_events[SHARD_NUM_LANES];
+  memset(buckets, 0, sizeof(buckets));
+  memset(num_events, 0, sizeof(num_events));
+  for (size_t i = 0; i < orchestrator->getNumShards(); ++i) {
+    OrchestratorShard *shard = orchestrator->getShardAt(i);
+    appendf(reply,
+            "shard %d: %zu shadow(s), queued control %zu state %zu telemetry "
+            "%zu, %llu event(s), %llu renewal(s), %llu compacted\n",
+            shard->getIndex(), shard->getNumDeviceShadows(),
+            shard->getLaneQueueDepth(SHARD_LANE_CONTROL),
+            shard->getLaneQueueDepth(SHARD_LANE_STATE),
+            shard->getLaneQueueDepth(SHARD_LANE_TELEMETRY),
+            (unsigned long long)shard->getNumEventsProcessed(),
+            (unsigned long long)shard->getNumRenewals(),
+            (unsigned long long)shard->getNumDematerialized());
+    for (int lane = 0; lane < SHARD_NUM_LANES; ++lane) {
+      num_events[lane] += shard->getLaneNumEvents((SHARD_LANE)lane);
+      shard->getLaneLatency((SHARD_LANE)lane, buckets[lane]);
+    }
+  }
+
+  // lane latency histograms across the shards ("<N": below N usec)
+  for (int lane = 0; lane < SHARD_NUM_LANES; ++lane) {
+    appendf(reply, "lane %s: %llu event(s), p50 %.0f us, p99 %.0f us,",
+            lane_names[lane], (unsigned long long)num_events[lane],
+            OrchestratorShard::latencyPercentileUs(buckets[lane], 50.0),
+            OrchestratorShard::latencyPercentileUs(buckets[lane], 99.0));
+    for (int b = 0; b < SHARD_LATENCY_BUCKETS; ++b) {
+      if (buckets[lane][b] != 0) {
+        appendf(reply, " <%llu:%llu", 1ULL << b,
+                (unsigned long long)buckets[lane][b]);
+      }
+    }
+    reply->append("\n");
+  }
+  for (size_t i = 0; i < orchestrator->getNumPTConnections(); ++i) {
+    PTConnection *connection = orchestrator->getPTConnectionAt(i);
+    appendf(reply, "pt %s: %s, %zu shadow(s), %d connect(s)\n",
+            connection->getName(),
+            (connection->isConnected() == true) ? "connected" : "down",
+            connection->getNumDeviceShadows(),
+            connection->getNumConnects());
+  }
+  appendf(reply,
+          "%zu shadow(s), %zu write(s) in flight (peak %zu), backpressure "
+          "%s, %llu forward(s) coalesced, %llu tick(s) dropped, %llu "
+          "event(s) shed\n",
+          orchestrator->getNumDeviceShadows(),
+          orchestrator->getNumWritesInFlight(),
+          orchestrator->getMaxWritesInFlight(),
+          Orchestrator::pressureName(orchestrator->getPressure()),
+          (unsigned long long)orchestrator->getNumCoalesced(),
+          (unsigned long long)orchestrator->getNumDropped(),
+          (unsigned long long)orchestrator->getNumShed());
+  appendf(reply, "poll scale %d%%, coalesce %d ms, log level %s\nOK\n",
+          orchestrator->getPollScalePercent(),
+          orchestrator->getCoalesceIntervalMs(),
+          Log::levelName(Log::getLevel()));
+}
+
+// write every shadow's line to "path" (via a temporary file, so a reader
+// never sees half a snapshot)
+bool ControlSocket::writeSnapshot(const char *path, std::string *reply) {
+  Orchestrator *orchestrator = (Orchestrator *)this->m_orchestrator;
+  std::string tmp_path = std::string(path) + ".tmp";
+  control_snapshot_t snapshot;
+  snapshot.fp = fopen(tmp_path.c_str(), "wb");
+  snapshot.num_written = 0;
+  snapshot.failed = false;
+  if (snapshot.fp == NULL) {
+    appendf(reply, "ERROR unable to open %s: %s\n", tmp_path.c_str(),
+            strerror(errno));
+    return false;
+  }
+  size_t from = 0;
+  while (orchestrator->visitDeviceShadows(
+             &from, CONTROL_SOCKET_SHADOWS_PER_LOCK, &snapshotShadowCB,
+             &snapshot) == true) {
+  }
+  if (fclose(snapshot.fp) != 0 || snapshot.failed == true ||
+      rename(tmp_path.c_str(), path) != 0) {
+    appendf(reply, "ERROR unable to write %s: %s\n", path, strerror(errno));
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  appendf(reply, "%zu shadow(s) written to %s\n", snapshot.num_written, path);
+  return true;
+}
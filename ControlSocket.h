@@ -0,0 +1,114 @@
+/**
+ * @file    ControlSocket.h
+ * @brief   mbed Edge Orchestrator local admin control socket
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CONTROL_SOCKET_H__
+#define __CONTROL_SOCKET_H__
+
+// system includes
+#include <pthread.h>
+#include <stddef.h>
+
+// client buffers
+#include <string>
+#include <vector>
+
+// Tunables for the control socket
+#define CONTROL_SOCKET_MAX_CLIENTS 8            // connected admin clients
+#define CONTROL_SOCKET_LINE_LENGTH 512          // max command line length
+#define CONTROL_SOCKET_MAX_REPLY_BYTES 4194304  // "shadows" stops listing here
+#define CONTROL_SOCKET_SHADOWS_PER_LOCK 256     // per registry read lock
+#define CONTROL_SOCKET_DEFAULT_MAX_SHADOWS 1000 // "shadows" listing cap
+#define CONTROL_SOCKET_NICE 10 // control thread priority (below the shards)
+
+// a connected admin client
+typedef struct control_client {
+  int fd;
+  std::string input;  // received, up to the next newline
+  std::string output; // reply bytes not yet written
+  bool closing;       // close once the output is written
+} control_client_t;
+
+// Local admin control socket (Unix domain, line oriented). Clients send one
+// command per line and every reply ends with "OK" or "ERROR <reason>" on a
+// line of its own:
+//
+//   help                       list the commands
+//   shadows [prefix] [max]     shadows (endpoint, shard, registered, poll
+//                              interval) and their cached resource values
+//   stats                      per-shard queue depths, lane latency
+//                              histograms, writes in flight and backpressure
+//   poll <endpoint> <ms>       change a device's poll interval (0: stop)
+//   poll-scale <percent>       scale every poll interval
+//   coalesce <ms>              coalescing window at ELEVATED backpressure
+//   loglevel [level]           get/set the log level (warning|info|debug)
+//   snapshot <path>            write every shadow's values to a file
+//   trace                      export the traced spans (as SIGUSR1 does)
+//   profile                    start/stop the CPU profile (as SIGUSR2 does)
+//
+// The socket is served by a poll() loop on a thread of its own (at a lower
+// priority than the data path), with nonblocking client I/O. Commands only read racy statistics, lock-free
+// value cache snapshots and the registry (read locked a slice at a time),
+// or queue their change to the owner like a fleet reload would... so none of
+// them ever holds up a shard, the PT thread or the ticker.
+class ControlSocket {
+public:
+  ControlSocket(void *orchestrator, const char *path);
+  virtual ~ControlSocket();
+
+  // start/stop the control thread (the socket file is removed on stop)
+  bool start();
+  void stop();
+
+  // run a single command line, appending its reply to "reply" (any thread)
+  void execute(const char *line, std::string *reply);
+
+  // control thread (pthread)
+  static void *controlProcessor(void *ctx);
+  void controlRunLoop();
+
+private:
+  ControlSocket(const ControlSocket &socket);
+  void initialize(void *orchestrator, const char *path);
+  bool openListener();
+  void acceptClients();
+  void readClient(control_client_t *client);
+  void writeClient(control_client_t *client);
+  void closeClient(size_t index);
+  void listShadows(const char *prefix, size_t max_shadows,
+                   std::string *reply);
+  void dumpStats(std::string *reply);
+  bool writeSnapshot(const char *path, std::string *reply);
+
+private:
+  void *m_orchestrator;
+  char *m_path;
+  int m_listen_fd;
+  int m_wake_fds[2]; // written to by stop()
+  bool m_is_running;
+  bool m_is_started;
+  pthread_t m_thread;
+
+  // connected clients (control thread only)
+  std::vector<control_client_t *> m_clients;
+};
+
+#endif // __CONTROL_SOCKET_H__
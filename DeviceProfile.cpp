@@ -0,0 +1,200 @@
+/**
+ * @file    DeviceProfile.cpp
+ * @brief   mbed Edge Shared Device Profile Table Implementation
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DeviceProfile.h"
+
+// default profile (SAMPLE_DEVICE_ENDPOINT_TYPE)
+#include "DeviceShadow.h"
+
+// system includes
+#include <stdlib.h>
+#include <string.h>
+
+// release function of PTDevicePtr: the values our profiles share with the
+// device object (/3/0) are handed back, then PT frees the rest of the device.
+// checkPTDeviceObject() has made sure PT kept our pointers as they were, and
+// isShared() is O(1), so this costs a few hash probes per device
+void releasePTDevice(pt_device_t *device) {
+  pt_object_t *object = pt_device_find_object(device, 3);
+  pt_object_instance_t *instance =
+      (object != NULL) ? pt_object_find_object_instance(object, 0) : NULL;
+  if (instance != NULL) {
+    DeviceProfileTable *profiles = DeviceProfileTable::shared();
+    ns_list_foreach(pt_resource_opaque_t, resource, instance->resources) {
+      if (resource->type == LWM2M_STRING && resource->value != NULL &&
+          profiles->isShared(resource->value) == true) {
+        resource->value = NULL;
+        resource->value_size = 0;
+      }
+    }
+  }
+  pt_device_free(device);
+}
+
+// check the device object contract releasePTDevice() relies on
+bool checkPTDeviceObject(pt_device_t *device, const device_profile_t *profile,
+                         const char *serial_number) {
+  const uint16_t ids[] = {0, 1, 2, 3, 17, 18, 19};
+  const char *values[] = {profile->manufacturer,     profile->model_number,
+                          serial_number,             profile->firmware_version,
+                          profile->device_type,      profile->hardware_version,
+                          profile->software_version};
+  pt_object_t *object = pt_device_find_object(device, 3);
+  pt_object_instance_t *instance =
+      (object != NULL) ? pt_object_find_object_instance(object, 0) : NULL;
+  if (instance == NULL) {
+    return false;
+  }
+  DeviceProfileTable *profiles = DeviceProfileTable::shared();
+  for (size_t i = 0; i < sizeof(ids) / sizeof(ids[0]); ++i) {
+    pt_resource_opaque_t *resource =
+        pt_object_instance_find_resource(instance, ids[i]);
+    if (resource == NULL || resource->value == NULL) {
+      continue;
+    }
+    // a copy of its own is freed by PT as usual... ours must be kept as is,
+    // and never be written (PT would free it to set the new value)
+    bool shared = profiles->isShared(resource->value);
+    if (shared == true && (resource->value != (const uint8_t *)values[i] ||
+                           (resource->operations & OPERATION_WRITE) != 0)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// constructor
+DeviceProfileTable::DeviceProfileTable() { this->initialize(); }
+
+// destructor
+DeviceProfileTable::~DeviceProfileTable() {
+  for (size_t i = 0; i < this->m_profiles.size(); ++i) {
+    free(this->m_profiles[i]);
+  }
+  pthread_mutex_destroy(&this->m_mutex);
+}
+
+// copy constructor
+DeviceProfileTable::DeviceProfileTable(const DeviceProfileTable &table) {}
+
+// initialize
+void DeviceProfileTable::initialize() {
+  pthread_mutex_init(&this->m_mutex, NULL);
+  this->m_default = NULL;
+
+  // the built-in profile
+  device_profile_t profile;
+  profile.manufacturer = "ARM";
+  profile.model_number = "1.0";
+  profile.firmware_version = "N/A";
+  profile.device_type = SAMPLE_DEVICE_ENDPOINT_TYPE;
+  profile.hardware_version = "N/A";
+  profile.software_version = "N/A";
+  this->m_default = this->intern(&profile);
+}
+
+// STATIC: the table shared by all of our shadows
+DeviceProfileTable *DeviceProfileTable::shared() {
+  static DeviceProfileTable table;
+  return &table;
+}
+
+// find an interned profile (lock held)... its strings are interned, so
+// comparing pointers is enough
+const device_profile_t *
+DeviceProfileTable::findLocked(const device_profile_t *profile) {
+  for (size_t i = 0; i < this->m_profiles.size(); ++i) {
+    if (memcmp(this->m_profiles[i], profile, sizeof(device_profile_t)) == 0) {
+      return this->m_profiles[i];
+    }
+  }
+  return NULL;
+}
+
+// intern a profile
+const device_profile_t *
+DeviceProfileTable::intern(const device_profile_t *profile) {
+  // (the built-in profile itself is complete)
+  const device_profile_t *defaults =
+      (this->m_default != NULL) ? this->m_default : profile;
+  device_profile_t interned;
+  interned.manufacturer = this->internString(
+      (profile->manufacturer != NULL) ? profile->manufacturer
+                                      : defaults->manufacturer);
+  interned.model_number = this->internString(
+      (profile->model_number != NULL) ? profile->model_number
+                                      : defaults->model_number);
+  interned.firmware_version = this->internString(
+      (profile->firmware_version != NULL) ? profile->firmware_version
+                                          : defaults->firmware_version);
+  interned.device_type = this->internString(
+      (profile->device_type != NULL) ? profile->device_type
+                                     : defaults->device_type);
+  interned.hardware_version = this->internString(
+      (profile->hardware_version != NULL) ? profile->hardware_version
+                                          : defaults->hardware_version);
+  interned.software_version = this->internString(
+      (profile->software_version != NULL) ? profile->software_version
+                                          : defaults->software_version);
+
+  pthread_mutex_lock(&this->m_mutex);
+  const device_profile_t *found = this->findLocked(&interned);
+  if (found == NULL) {
+    device_profile_t *copy =
+        (device_profile_t *)malloc(sizeof(device_profile_t));
+    *copy = interned;
+    this->m_profiles.push_back(copy);
+    found = copy;
+  }
+  pthread_mutex_unlock(&this->m_mutex);
+  return found;
+}
+
+// get the built-in profile
+const device_profile_t *DeviceProfileTable::getDefault() {
+  return this->m_default;
+}
+
+// intern a per-device string
+const char *DeviceProfileTable::internString(const char *value) {
+  return this->m_strings.lookup(this->m_strings.intern(value));
+}
+
+// is "value" shared through us (or an interned endpoint ID)?
+bool DeviceProfileTable::isShared(const void *value) {
+  return (this->m_strings.isInterned(value) == true ||
+          EndpointTable::shared()->isInterned(value) == true);
+}
+
+// get the number of interned profiles
+size_t DeviceProfileTable::getNumProfiles() {
+  pthread_mutex_lock(&this->m_mutex);
+  size_t num_profiles = this->m_profiles.size();
+  pthread_mutex_unlock(&this->m_mutex);
+  return num_profiles;
+}
+
+// get the number of bytes used by the interned profiles and strings
+size_t DeviceProfileTable::getNumBytes() {
+  return this->getNumProfiles() * sizeof(device_profile_t) +
+         this->m_strings.getNumBytes();
+}
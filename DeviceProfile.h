@@ -0,0 +1,116 @@
+/**
+ * @file    DeviceProfile.h
+ * @brief   mbed Edge Shared Device Profile Table
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __DEVICE_PROFILE_H__
+#define __DEVICE_PROFILE_H__
+
+// system includes
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// profiles
+#include <vector>
+
+// profile strings are interned like endpoint IDs
+#include "EndpointTable.h"
+
+// PT device (device object resources)
+#include "PTResource.h"
+
+// Tunables for device profiles
+#define DEVICE_PROFILE_VALUE_LENGTH 64 // max length of a profile string
+
+// The LwM2M device object (/3/0) metadata shared by a class of devices... the
+// serial number (/3/0/2) is the only per-device field, and is kept with the
+// device's configuration
+typedef struct device_profile {
+  const char *manufacturer;     // /3/0/0
+  const char *model_number;     // /3/0/1
+  const char *firmware_version; // /3/0/3
+  const char *device_type;      // /3/0/17
+  const char *hardware_version; // /3/0/18
+  const char *software_version; // /3/0/19
+} device_profile_t;
+
+// One immutable copy of every distinct device profile, shared by all of the
+// shadows that use it. Like endpoint IDs, profiles and their strings are
+// never freed or moved (a fleet reload may go back to a profile), so a
+// profile pointer can be kept for the life of the process and two profiles
+// are identical exactly when their pointers are.
+//
+// A shadow's PT device object references the profile's strings rather than
+// owning copies of them: PTDevicePtr hands them back (see releasePTDevice())
+// before pt_device_free() frees the device's values. That relies on
+// ptdo_initialize_device_object() keeping the pointers it is given (as PT
+// does: it takes ownership of resource values) in read-only resources that
+// nothing but pt_device_free() frees... checkPTDeviceObject() verifies it for
+// every device object we build.
+class DeviceProfileTable {
+public:
+  DeviceProfileTable();
+  virtual ~DeviceProfileTable();
+
+  // the table shared by all of our shadows
+  static DeviceProfileTable *shared();
+
+  // intern a profile (returns the existing one if an identical profile has
+  // already been interned)... NULL fields are taken from the default profile
+  const device_profile_t *intern(const device_profile_t *profile);
+
+  // the built-in profile
+  const device_profile_t *getDefault();
+
+  // intern a per-device string (e.g. a serial number)
+  const char *internString(const char *value);
+
+  // is "value" a string shared through us (or an interned endpoint ID)?
+  bool isShared(const void *value);
+
+  // statistics
+  size_t getNumProfiles();
+  size_t getNumBytes();
+
+private:
+  DeviceProfileTable(const DeviceProfileTable &table);
+  void initialize();
+  const device_profile_t *findLocked(const device_profile_t *profile);
+
+private:
+  pthread_mutex_t m_mutex;
+
+  // profile strings (interned, never freed)
+  EndpointTable m_strings;
+
+  // interned profiles (never freed)
+  std::vector<device_profile_t *> m_profiles;
+  const device_profile_t *m_default;
+};
+
+// does the device object (/3/0) of "device", initialized from "profile" and
+// "serial_number", meet the contract releasePTDevice() relies on? Each of its
+// strings must hold either its own copy or exactly the (shared) pointer we
+// gave, read-only
+bool checkPTDeviceObject(pt_device_t *device, const device_profile_t *profile,
+                         const char *serial_number);
+
+#endif // __DEVICE_PROFILE_H__
@@ -21,53 +21,150 @@
  */
 
 #include "DeviceShadow.h"
+#include "Log.h"
+#include "LwM2MPath.h"
 #include "NonMbedDevice.h"
 #include "Orchestrator.h"
+#include "Tracer.h"
 #include "byte_order.h"
 
+// system includes
+#include <stdlib.h>
+#include <time.h>
+
 // constructor
 DeviceShadow::DeviceShadow(void *orchestrator) {
-  this->initialize(orchestrator, (char *)SAMPLE_DEVICE_PREFIX, (char *)"-0");
+  fleet_device_config_t config;
+  FleetConfig::initializeDefaultDevice(&config, SAMPLE_DEVICE_PREFIX);
+  this->initialize(orchestrator, NULL, &config, "-0");
 }
 
 // constructor
 DeviceShadow::DeviceShadow(void *orchestrator, char *device_id, char *suffix) {
-  this->initialize(orchestrator, device_id, suffix);
+  fleet_device_config_t config;
+  FleetConfig::initializeDefaultDevice(&config, device_id);
+  this->initialize(orchestrator, NULL, &config, suffix);
+}
+
+// constructor
+DeviceShadow::DeviceShadow(void *orchestrator, void *device,
+                           const fleet_device_config_t *config,
+                           const char *suffix) {
+  this->initialize(orchestrator, device, config, suffix);
 }
 
-// destructor
+// destructor (our PT device releases itself)
 DeviceShadow::~DeviceShadow() {
-  if (this->m_endpoint_id != NULL) {
-    free(this->m_endpoint_id);
-  }
-  if (this->m_pt_device != NULL) {
-    free(this->m_pt_device);
-  }
+  this->detachSubscriptions();
+  delete[] this->m_windows;
 }
 
 // copy constructor
 DeviceShadow::DeviceShadow(const DeviceShadow &device) {}
 
 // initialize
-void DeviceShadow::initialize(void *orchestrator, char *device_id,
-                              char *suffix) {
+void DeviceShadow::initialize(void *orchestrator, void *device,
+                              const fleet_device_config_t *config,
+                              const char *suffix) {
   this->m_orchestrator = orchestrator;
-  this->m_pt_device = NULL;
-  this->m_device_id = device_id;
-  this->m_suffix = suffix;
+  this->m_device = device;
+  this->m_shard = NULL;
+  this->m_pt_connection = NULL;
+  this->m_windows = NULL;
+  this->m_config = *config;
   this->m_is_registered = false;
   this->m_new_counter_value = -1;
   this->m_counter_value_changed = false;
+  this->m_live_epoch = 0;
+  this->m_last_forwarded_value = 0;
+  this->m_has_forwarded = false;
+  this->m_is_retired = false;
+  this->m_reregister_pending = false;
+  this->m_is_renewing = false;
+  this->m_renewal_due_ms = 0;
+  this->m_num_renewal_failures = 0;
+  this->m_restore_values = false;
+  this->m_pt_calls_pending = 0;
+  this->m_pt_write_queued = false;
+  this->touch();
+  memset(&this->m_last_forwarded_at, 0, sizeof(this->m_last_forwarded_at));
+
+  // find the resource bound to the device counter (if any)
+  this->m_counter_resource = NULL;
+  for (int i = 0; i < this->m_config.num_resources; ++i) {
+    if (this->m_config.resources[i].binding == FLEET_BINDING_COUNTER) {
+      this->m_counter_resource = &this->m_config.resources[i];
+    }
+  }
+
+  // create the FQ endpoint ID... interned, so every shadow (and any shadow
+  // re-created for the same device) shares one stable copy
+  char endpoint_id[FLEET_CONFIG_ENDPOINT_ID_LENGTH + 32];
+  snprintf(endpoint_id, sizeof(endpoint_id), "%s%s", this->m_config.endpoint_id,
+           (suffix != NULL) ? suffix : "");
+  this->m_endpoint_handle = EndpointTable::shared()->intern(endpoint_id);
+  this->m_endpoint_id = EndpointTable::shared()->lookup(this->m_endpoint_handle);
+
+  // one cached value (and history) per resource in our schema
+  this->resetValueCache();
+  this->resetHistory();
+  this->resetWindows();
+}
 
-  // create the FQ endpoint ID
-  this->m_endpoint_id =
-      (char *)malloc(strlen(this->m_device_id) + strlen(this->m_suffix) + 1);
-  sprintf(this->m_endpoint_id, "%s%s", this->m_device_id, this->m_suffix);
+// reset our value cache to our schema's resources
+void DeviceShadow::resetValueCache() {
+  value_cache_entry_t entries[FLEET_CONFIG_MAX_RESOURCES];
+  for (int i = 0; i < this->m_config.num_resources; ++i) {
+    entries[i].object_id = this->m_config.resources[i].object_id;
+    entries[i].instance_id = this->m_config.resources[i].instance_id;
+    entries[i].resource_id = this->m_config.resources[i].resource_id;
+    entries[i].value = 0;
+  }
+  this->m_value_cache.reset(entries, this->m_config.num_resources);
+}
+
+// reset our history to our schema's resources (a resource keeps its history
+// if it is still in the same position)
+void DeviceShadow::resetHistory() {
+  for (int i = 0; i < FLEET_CONFIG_MAX_RESOURCES; ++i) {
+    if (i >= this->m_config.num_resources) {
+      this->m_history[i].clear();
+      continue;
+    }
+    const fleet_resource_config_t *config = &this->m_config.resources[i];
+    if (this->m_history[i].isResource(config->object_id, config->instance_id,
+                                      config->resource_id) == false) {
+      this->m_history[i].reset(config->object_id, config->instance_id,
+                               config->resource_id);
+    }
+  }
+}
+
+// append a sample to a resource's history
+void DeviceShadow::recordHistory(const uint16_t object_id,
+                                 const uint16_t instance_id,
+                                 const uint16_t resource_id, long value) {
+  for (int i = 0; i < this->m_config.num_resources; ++i) {
+    const fleet_resource_config_t *config = &this->m_config.resources[i];
+    if (config->object_id == object_id &&
+        config->instance_id == instance_id &&
+        config->resource_id == resource_id) {
+      struct timespec now;
+      clock_gettime(CLOCK_REALTIME, &now);
+      this->m_history[i].append(
+          (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000, value);
+      return;
+    }
+  }
 }
 
 // write success
 void DeviceShadow::writeSuccess(const char *device_id) {
-  printf("DeviceShadow: write SUCCESS for device %s\n", device_id);
+  LOG_DEBUG("DeviceShadow: write SUCCESS for device %s\n", device_id);
+  Tracer::shared()->end(TRACE_SPAN_ACK, this->m_endpoint_handle);
+  Orchestrator *orchestrator = (Orchestrator *)this->m_orchestrator;
+  orchestrator->writeCompleted();
+  this->ptCallCompleted();
 }
 
 // STATIC: write success CB
@@ -81,6 +178,10 @@ void DeviceShadow::writeSuccessCB(const char *device_id, void *ctx) {
 // write failure
 void DeviceShadow::writeFailure(const char *device_id) {
   printf("DeviceShadow: write FAILURE for device %s\n", device_id);
+  Tracer::shared()->end(TRACE_SPAN_ACK, this->m_endpoint_handle);
+  Orchestrator *orchestrator = (Orchestrator *)this->m_orchestrator;
+  orchestrator->writeCompleted();
+  this->ptCallCompleted();
 }
 
 // STATIC: write failure CB
@@ -93,21 +194,105 @@ void DeviceShadow::writeFailureCB(const char *device_id, void *ctx) {
 
 // create and register the shadow
 bool DeviceShadow::createAndRegister() {
-  if (this->createShadowWithPT() == true) {
+  // after a PT reconnect we may already have our PT device... either way we
+  // register it with its current (in-memory) resource values
+  if (this->materialize() == true) {
     return this->registerShadowWithPT();
   }
   return false;
 }
 
+// build our PT device if we do not have it
+bool DeviceShadow::materialize() {
+  if (this->m_pt_device.isNull() == false) {
+    return true;
+  }
+  return this->createShadowWithPT();
+}
+
+// drop our PT device if we have been idle for "idle_ms" (and nothing is
+// waiting on it... our PT thread may still be reading it)... true if it was
+// dropped
+bool DeviceShadow::dematerializeIfIdle(uint64_t now_ms, uint64_t idle_ms) {
+  if (this->m_pt_device.isNull() == true || this->m_is_renewing == true ||
+      this->m_is_retired == true || this->m_reregister_pending == true ||
+      now_ms < this->m_last_active_ms + idle_ms ||
+      this->hasPendingPTCalls() == true) {
+    return false;
+  }
+  this->m_pt_device.reset(NULL);
+  this->m_restore_values = true;
+  return true;
+}
+
+// do we have our PT device?
+bool DeviceShadow::isMaterialized() {
+  return (this->m_pt_device.isNull() == false);
+}
+
+// note that we are in use (renewals do not count... they only need our PT
+// device for a moment)
+void DeviceShadow::touch() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  this->m_last_active_ms = (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// the PT connection has been lost (its PT thread)
+void DeviceShadow::connectionLost() {
+  // edge-core has forgotten about us... pending changes are held until we
+  // have re-registered
+  __atomic_store_n(&this->m_is_registered, false, __ATOMIC_RELEASE);
+}
+
+// renew our registration (re-registers the PT device as it stands)
+bool DeviceShadow::renewRegistration() {
+  if (this->isRegistered() == false || this->materialize() == false) {
+    return false;
+  }
+
+  // DEBUG
+  printf("DeviceShadow: Renewing registration of %s (lifetime: %d sec)\n",
+         this->m_endpoint_id, this->m_config.lifetime);
+  this->m_is_renewing = true;
+  if (this->registerShadowWithPT() == false) {
+    this->m_is_renewing = false;
+    return false;
+  }
+  return true;
+}
+
+// get our registration lifetime (seconds)
+int DeviceShadow::getLifetime() { return this->m_config.lifetime; }
+
+// set when our next renewal is due
+void DeviceShadow::setRenewalDueMs(uint64_t due_ms) {
+  this->m_renewal_due_ms = due_ms;
+}
+
+// get when our next renewal is due
+uint64_t DeviceShadow::getRenewalDueMs() { return this->m_renewal_due_ms; }
+
+// renewals that have failed in a row
+int DeviceShadow::getNumRenewalFailures() {
+  return this->m_num_renewal_failures;
+}
+
 // create the device in PT
-pt_device_t *DeviceShadow::createPTDevice() {
+PTDevicePtr DeviceShadow::createPTDevice() {
   pt_status_t status = PT_STATUS_SUCCESS;
-  pt_device_t *device =
-      pt_create_device(this->m_endpoint_id, LIFETIME, QUEUE, &status);
+  // PT takes ownership of the device ID (pt_device_free() frees it)... our
+  // interned copy stays with the endpoint table
+  char *device_id = strdup(this->m_endpoint_id);
+  PTDevicePtr device(
+      pt_create_device(device_id, this->m_config.lifetime, QUEUE, &status));
   if (status != PT_STATUS_SUCCESS) {
     printf("DeviceShadow: ERROR. Could not create the device(%s) in PT...\n",
            this->m_endpoint_id);
-    return NULL;
+    if (device.isNull() == true) {
+      free(device_id);
+    }
+    device.reset(NULL);
   }
   return device;
 }
@@ -116,12 +301,10 @@ pt_device_t *DeviceShadow::createPTDevice() {
 void DeviceShadow::updateCounterValue(const pt_resource_opaque_t *resource,
                                       const uint8_t *value,
                                       const uint32_t value_size) {
-  NonMbedDevice *device = (NonMbedDevice *)this->getDevice();
-
-  long counter_value = 0;
-  convert_value_to_host_order_long((uint8_t *)value, &counter_value);
-  printf("DeviceShadow: Counter Value set to: %ld\n", counter_value);
-  device->setCounterValue(counter_value);
+  device_shadow_value_t decoded;
+  if (DeviceShadow::decodeValue(value, value_size, &decoded) == true) {
+    this->setDeviceValue(FLEET_BINDING_COUNTER, &decoded);
+  }
 }
 
 // STATIC: update counter value
@@ -134,58 +317,59 @@ void DeviceShadow::updateCounterValueCB(const pt_resource_opaque_t *resource,
   }
 }
 
-// create the LWM2M Counter Resource
-void DeviceShadow::createCounterLWM2MResource() {
-  pt_status_t status = PT_STATUS_SUCCESS;
-  NonMbedDevice *device = (NonMbedDevice *)this->getDevice();
-
-  pt_object_t *object =
-      pt_device_add_object(this->m_pt_device, COUNTER_OBJECT_ID, &status);
-  if (status != PT_STATUS_SUCCESS) {
-    printf("DeviceShadow: Could not create an object with id (%d) to the "
-           "device (%s).\n",
-           COUNTER_OBJECT_ID, this->m_pt_device->device_id);
+// update the switch state
+void DeviceShadow::updateSwitchState(const pt_resource_opaque_t *resource,
+                                     const uint8_t *value,
+                                     const uint32_t value_size) {
+  device_shadow_value_t decoded;
+  if (DeviceShadow::decodeValue(value, value_size, &decoded) == true) {
+    this->setDeviceValue(FLEET_BINDING_SWITCH, &decoded);
   }
+}
 
-  pt_object_instance_t *instance =
-      pt_object_add_object_instance(object, 0, &status);
-  if (status != PT_STATUS_SUCCESS) {
-    printf("DeviceShadow: Could not create an object instance with id: 0 to "
-           "the object (%d).\n",
-           COUNTER_OBJECT_ID);
+// STATIC: decode a write request value: a big-endian (two's complement)
+// integer of up to 8 bytes, as LwM2M encodes them. No value at all is fine
+// (an execute)
+bool DeviceShadow::decodeValue(const uint8_t *value, const uint32_t value_size,
+                               device_shadow_value_t *decoded) {
+  decoded->type = DEVICE_SHADOW_VALUE_NONE;
+  decoded->integer = 0;
+  if (value == NULL || value_size == 0) {
+    return true;
   }
-
-  uint8_t *counter_data = (uint8_t *)malloc(sizeof(long));
-  convert_long_value_to_network_byte_order((long)device->getCounterValue(), (uint8_t *)counter_data);
-
-  (void)pt_object_instance_add_resource_with_callback(
-      instance, COUNTER_RESOURCE_ID, LWM2M_INTEGER,
-      OPERATION_READ | OPERATION_WRITE, counter_data, sizeof(long), &status,
-      &DeviceShadow::updateCounterValueCB);
-
-  if (status != PT_STATUS_SUCCESS) {
-    printf("DeviceShadow: Could not create a resource with id (%d) to the "
-           "object_instance 0.\n",
-           COUNTER_RESOURCE_ID);
+  if (value_size > sizeof(int64_t)) {
+    printf("DeviceShadow: write value too large (%u bytes)\n", value_size);
+    return false;
+  }
+  uint64_t bits = (value[0] & 0x80) ? ~0ULL : 0ULL; // sign extension
+  for (uint32_t i = 0; i < value_size; ++i) {
+    bits = (bits << 8) | value[i];
   }
+  decoded->type = DEVICE_SHADOW_VALUE_INTEGER;
+  decoded->integer = (long)(int64_t)bits;
+  return true;
 }
 
-// update the switch state
-void DeviceShadow::updateSwitchState(const pt_resource_opaque_t *resource,
-                                     const uint8_t *value,
-                                     const uint32_t value_size) {
+// push a decoded value to whatever the resource is bound to on our device
+void DeviceShadow::setDeviceValue(FLEET_RESOURCE_BINDING binding,
+                                  const device_shadow_value_t *value) {
+  TraceScope trace(TRACE_SPAN_DEVICE_SET, this->m_endpoint_handle);
   NonMbedDevice *device = (NonMbedDevice *)this->getDevice();
-
-  long long_switch_state = 0;
-  convert_value_to_host_order_long((uint8_t *)value, &long_switch_state);
-
-  bool switch_state = false;
-  if (long_switch_state != 0) {
-    switch_state = true;
+  if (device == NULL || value->type != DEVICE_SHADOW_VALUE_INTEGER) {
+    return;
+  }
+  switch (binding) {
+  case FLEET_BINDING_COUNTER:
+    LOG_DEBUG("DeviceShadow: Counter Value set to: %ld\n", value->integer);
+    device->setCounterValue(value->integer);
+    break;
+  case FLEET_BINDING_SWITCH:
+    device->setSwitchState(value->integer != 0);
+    break;
+  default:
+    // the value only lives in the shadow
+    break;
   }
-
-  // set the switch state
-  device->setSwitchState(switch_state);
 }
 
 // STATIC: update switch state
@@ -198,44 +382,82 @@ void DeviceShadow::updateSwitchStateCB(const pt_resource_opaque_t *resource,
   }
 }
 
-// create the LWM2M Switch Resource
-void DeviceShadow::createSwitchLWM2MResource() {
+// create a LWM2M resource from our schema
+void DeviceShadow::createLWM2MResource(const fleet_resource_config_t *config) {
   pt_status_t status = PT_STATUS_SUCCESS;
   NonMbedDevice *device = (NonMbedDevice *)this->getDevice();
 
+  // resources may share an object/object instance...
   pt_object_t *object =
-      pt_device_add_object(this->m_pt_device, SWITCH_OBJECT_ID, &status);
-  if (status != PT_STATUS_SUCCESS) {
+      pt_device_find_object(this->m_pt_device.get(), config->object_id);
+  if (object == NULL) {
+    object =
+        pt_device_add_object(this->m_pt_device.get(), config->object_id,
+                             &status);
+  }
+  if (object == NULL || status != PT_STATUS_SUCCESS) {
     printf("DeviceShadow: Could not create an object with id (%d) to the "
            "device (%s).\n",
-           SWITCH_OBJECT_ID, this->m_pt_device->device_id);
+           config->object_id, this->m_pt_device->device_id);
+    return;
   }
 
   pt_object_instance_t *instance =
-      pt_object_add_object_instance(object, 0, &status);
-  if (status != PT_STATUS_SUCCESS) {
-    printf("DeviceShadow: Could not create an object instance with id 0 to the "
-           "object (%d).\n",
-           SWITCH_OBJECT_ID);
+      pt_object_find_object_instance(object, config->instance_id);
+  if (instance == NULL) {
+    instance =
+        pt_object_add_object_instance(object, config->instance_id, &status);
+  }
+  if (instance == NULL || status != PT_STATUS_SUCCESS) {
+    printf("DeviceShadow: Could not create an object instance with id: %d to "
+           "the object (%d).\n",
+           config->instance_id, config->object_id);
+    return;
   }
 
-  uint8_t *sw_data = (uint8_t *)malloc(sizeof(long));
-
-  if (device->getSwitchState() == true) {
-    convert_long_value_to_network_byte_order((long)1, (uint8_t *)sw_data);
-  } else {
-    convert_long_value_to_network_byte_order((long)0, (uint8_t *)sw_data);
+  // initial value and write callback come from what the resource is bound to
+  long initial_value = 0;
+  pt_resource_callback callback = NULL;
+  switch (config->binding) {
+  case FLEET_BINDING_COUNTER:
+    initial_value = (long)device->getCounterValue();
+    callback = &DeviceShadow::updateCounterValueCB;
+    break;
+  case FLEET_BINDING_SWITCH:
+    initial_value = (device->getSwitchState() == true) ? 1 : 0;
+    callback = &DeviceShadow::updateSwitchStateCB;
+    break;
+  case FLEET_BINDING_NONE:
+    break;
+  case FLEET_BINDING_COUNT:
+  case FLEET_BINDING_SUM:
+  case FLEET_BINDING_MIN:
+  case FLEET_BINDING_MAX:
+  case FLEET_BINDING_MEAN:
+    // aggregates read 0 until their first window closes
+    break;
   }
+  if (this->m_restore_values == true) {
+    // rebuilt after being dropped while idle: the shadow's values stand
+    this->m_value_cache.read(config->object_id, config->instance_id,
+                             config->resource_id, &initial_value);
+  }
+  PTValueBuffer data((uint8_t *)malloc(sizeof(long)));
+  convert_long_value_to_network_byte_order(initial_value, data.get());
+  this->m_value_cache.publish(config->object_id, config->instance_id,
+                              config->resource_id, initial_value);
 
   (void)pt_object_instance_add_resource_with_callback(
-      instance, SWITCH_RESOURCE_ID, LWM2M_INTEGER,
-      OPERATION_READ | OPERATION_WRITE, sw_data, sizeof(long), &status,
-      &DeviceShadow::updateSwitchStateCB);
+      instance, config->resource_id, LWM2M_INTEGER, config->operations,
+      data.get(), sizeof(long), &status, callback);
 
-  if (status != PT_STATUS_SUCCESS) {
+  if (status == PT_STATUS_SUCCESS) {
+    // the resource (and so our device) owns the value buffer now
+    data.release();
+  } else {
     printf("DeviceShadow: Could not create a resource with id (%d) to the "
-           "object_instance 0.\n",
-           SWITCH_RESOURCE_ID);
+           "object_instance %d.\n",
+           config->resource_id, config->instance_id);
   }
 }
 
@@ -260,31 +482,46 @@ void DeviceShadow::rebootDeviceCB(const pt_resource_opaque_t *resource,
 bool DeviceShadow::createShadowWithPT() {
   // create the device
   this->m_pt_device = this->createPTDevice();
-  if (this->m_pt_device != NULL) {
-    // for our example, our shadow will contain a Counter LWM2M resource and a
-    // Switch LWM2M resource
-    this->createCounterLWM2MResource();
-    this->createSwitchLWM2MResource();
-
-    // create a device object data
-    ptdo_device_object_data_t *device_object_data =
-        (ptdo_device_object_data_t *)malloc(sizeof(ptdo_device_object_data_t));
-    device_object_data->manufacturer = strdup("ARM");
-    device_object_data->model_number = strdup("1.0");
-    device_object_data->serial_number = strdup("0123456789");
-    device_object_data->firmware_version = strdup("N/A");
-    device_object_data->hardware_version = strdup("N/A");
-    device_object_data->software_version = strdup("N/A");
-    device_object_data->device_type = strdup(SAMPLE_DEVICE_ENDPOINT_TYPE);
-    device_object_data->reboot_callback = &DeviceShadow::rebootDeviceCB;
-    device_object_data->factory_reset_callback = NULL;
-    device_object_data->reset_error_code_callback = NULL;
+  if (this->m_pt_device.isNull() == false) {
+    // our shadow contains the LWM2M resources of the device's schema (by
+    // default a Counter resource and a Switch resource)
+    for (int i = 0; i < this->m_config.num_resources; ++i) {
+      this->createLWM2MResource(&this->m_config.resources[i]);
+    }
 
-    // now initialize the device
-    ptdo_initialize_device_object(this->m_pt_device, device_object_data);
+    // our device object references our (shared) profile's strings... only
+    // the serial number is our own, and that is interned too (see
+    // releasePTDevice())
+    const device_profile_t *profile =
+        (this->m_config.profile != NULL)
+            ? this->m_config.profile
+            : DeviceProfileTable::shared()->getDefault();
+    ptdo_device_object_data_t device_object_data;
+    device_object_data.manufacturer = (char *)profile->manufacturer;
+    device_object_data.model_number = (char *)profile->model_number;
+    device_object_data.serial_number =
+        (this->m_config.serial_number != NULL)
+            ? (char *)this->m_config.serial_number
+            : (char *)this->m_endpoint_id;
+    device_object_data.firmware_version = (char *)profile->firmware_version;
+    device_object_data.hardware_version = (char *)profile->hardware_version;
+    device_object_data.software_version = (char *)profile->software_version;
+    device_object_data.device_type = (char *)profile->device_type;
+    device_object_data.reboot_callback = &DeviceShadow::rebootDeviceCB;
+    device_object_data.factory_reset_callback = NULL;
+    device_object_data.reset_error_code_callback = NULL;
 
-    // clean up
-    free(device_object_data);
+    // now initialize the device
+    ptdo_initialize_device_object(this->m_pt_device.get(), &device_object_data);
+    if (checkPTDeviceObject(this->m_pt_device.get(), profile,
+                            device_object_data.serial_number) == false) {
+      // our shared strings could be freed by PT... do not use this device
+      printf("DeviceShadow: ERROR. PT device object of %s does not keep its "
+             "(shared) strings read-only\n",
+             this->m_endpoint_id);
+      this->m_pt_device.reset(NULL);
+      return false;
+    }
 
     // return our status
     return true;
@@ -292,11 +529,13 @@ bool DeviceShadow::createShadowWithPT() {
   return false;
 }
 
-// registration success
+// registration success (PT thread)... our shard applies it
 void DeviceShadow::registrationSuccess(const char *device_id) {
   printf("DeviceShadow: Shadow device: %s successfully registered\n",
          device_id);
-  this->m_is_registered = true;
+  Orchestrator *orchestrator = (Orchestrator *)this->m_orchestrator;
+  orchestrator->registrationCompleted(this, true);
+  this->ptCallCompleted();
 }
 
 // STATIC registration success CB
@@ -307,10 +546,12 @@ void DeviceShadow::registrationSuccessCB(const char *device_id, void *ctx) {
   }
 }
 
-// registration failure
+// registration failure (PT thread)... our shard applies it
 void DeviceShadow::registrationFailure(const char *device_id) {
   printf("DeviceShadow: Shadow device: %s registration FAILED\n", device_id);
-  this->m_is_registered = false;
+  Orchestrator *orchestrator = (Orchestrator *)this->m_orchestrator;
+  orchestrator->registrationCompleted(this, false);
+  this->ptCallCompleted();
 }
 
 // STATIC registration failure CB
@@ -321,14 +562,96 @@ void DeviceShadow::registrationFailureCB(const char *device_id, void *ctx) {
   }
 }
 
-// register shadow with PT
+// apply the outcome of our (re)registration or renewal (owning shard)
+bool DeviceShadow::applyRegistration(bool success) {
+  Orchestrator *orchestrator = (Orchestrator *)this->m_orchestrator;
+  if (this->m_is_renewing == true) {
+    // a failed renewal: our registration stands until its lifetime runs
+    // out... retried
+    this->m_is_renewing = false;
+    this->m_num_renewal_failures =
+        (success == true) ? 0 : (this->m_num_renewal_failures + 1);
+    orchestrator->shadowRenewed(this, success);
+    return true;
+  }
+  this->m_num_renewal_failures = 0;
+  __atomic_store_n(&this->m_is_registered, success, __ATOMIC_RELEASE);
+  orchestrator->shadowRegistered(this, success);
+  return false;
+}
+
+// register shadow with PT (made on our PT connection's thread, see
+// registerWithPT())
 bool DeviceShadow::registerShadowWithPT() {
   // DEBUG
   printf("ShadowDevice: Registering shadow device with mbed Cloud via PT...\n");
-  Orchestrator *orchestrator = (Orchestrator *)this->m_orchestrator;
-  pt_register_device(orchestrator->getConnection(), this->m_pt_device,
-                     &DeviceShadow::registrationSuccessCB,
-                     &DeviceShadow::registrationFailureCB, (void *)this);
+  return this->postPTCall(&DeviceShadow::registerWithPTCB);
+}
+
+// pt_register_device() our PT device with its current values (PT thread)
+void DeviceShadow::registerWithPT(struct connection *connection) {
+  pt_status_t status = PT_STATUS_NOT_CONNECTED;
+  if (connection != NULL) {
+    this->syncPTValues();
+    status = pt_register_device(connection, this->m_pt_device.get(),
+                                &DeviceShadow::registrationSuccessCB,
+                                &DeviceShadow::registrationFailureCB,
+                                (void *)this);
+  }
+  if (status != PT_STATUS_SUCCESS) {
+    printf("DeviceShadow: pt_register_device() failed with error: %d\n",
+           status);
+    this->registrationFailure(this->m_endpoint_id);
+  }
+}
+
+// STATIC: make our registration call (PT thread)
+void DeviceShadow::registerWithPTCB(struct connection *connection,
+                                    void *ctx) {
+  DeviceShadow *instance = (DeviceShadow *)ctx;
+  if (instance != NULL) {
+    instance->registerWithPT(connection);
+  }
+}
+
+// hand a PT call to our PT connection's thread... pt-client is not
+// thread-safe, so our shard never calls it directly
+bool DeviceShadow::postPTCall(pt_call_fn run) {
+  PTConnection *connection = (PTConnection *)this->m_pt_connection;
+  __atomic_add_fetch(&this->m_pt_calls_pending, 1, __ATOMIC_ACQ_REL);
+  if (connection == NULL || connection->post(run, (void *)this) == false) {
+    __atomic_sub_fetch(&this->m_pt_calls_pending, 1, __ATOMIC_ACQ_REL);
+    return false;
+  }
+  return true;
+}
+
+// one of our PT calls has been acknowledged (or failed)... we must not be
+// touched after this (we may be deleted)
+void DeviceShadow::ptCallCompleted() {
+  __atomic_sub_fetch(&this->m_pt_calls_pending, 1, __ATOMIC_RELEASE);
+}
+
+// are any of our PT calls pending?
+bool DeviceShadow::hasPendingPTCalls() {
+  return (__atomic_load_n(&this->m_pt_calls_pending, __ATOMIC_ACQUIRE) > 0);
+}
+
+// copy our current values from our value cache into our PT device's resource
+// buffers (PT thread, just before they are sent... our shard never writes
+// them, it only publishes to the value cache)
+void DeviceShadow::syncPTValues() {
+  int slot = 0;
+  const value_cache_snapshot_t *snapshot = this->m_value_cache.readLock(&slot);
+  for (int i = 0; i < snapshot->num_values; ++i) {
+    const value_cache_entry_t *entry = &snapshot->values[i];
+    pt_resource_opaque_t *resource = this->getResourceInstance(
+        entry->object_id, entry->instance_id, entry->resource_id);
+    if (resource != NULL && resource->value != NULL) {
+      convert_long_value_to_network_byte_order(entry->value, resource->value);
+    }
+  }
+  this->m_value_cache.readUnlock(slot);
 }
 
 // find a specific resource instance
@@ -336,7 +659,10 @@ pt_resource_opaque_t *
 DeviceShadow::getResourceInstance(const uint16_t object_id,
                                   const uint16_t instance_id,
                                   const uint16_t resource_id) {
-  pt_device_t *device = this->m_pt_device;
+  pt_device_t *device = this->m_pt_device.get();
+  if (device == NULL) {
+    return NULL;
+  }
   pt_object_t *object = pt_device_find_object(device, object_id);
   pt_object_instance_t *instance =
       pt_object_find_object_instance(object, instance_id);
@@ -348,89 +674,230 @@ bool DeviceShadow::processWriteRequest(
     const char *device_id, const uint16_t object_id, const uint16_t instance_id,
     const uint16_t resource_id, const unsigned int operation,
     const uint8_t *value, const uint32_t value_size) {
+  device_shadow_value_t decoded;
+  if (DeviceShadow::decodeValue(value, value_size, &decoded) == false) {
+    return false;
+  }
+  return this->processWriteRequest(device_id, object_id, instance_id,
+                                   resource_id, operation, &decoded);
+}
+
+// process a (decoded) write request
+bool DeviceShadow::processWriteRequest(
+    const char *device_id, const uint16_t object_id, const uint16_t instance_id,
+    const uint16_t resource_id, const unsigned int operation,
+    const device_shadow_value_t *value) {
+  bool write_value = false;
+  if (this->applyWriteRequest(device_id, object_id, instance_id, resource_id,
+                              operation, value, &write_value) == false) {
+    return false;
+  }
+
+  // update our value within PT if we have a value...
+  if (write_value == true) {
+    this->writeValuesToPT();
+  }
+  return true;
+}
+
+// process a batch of write requests: every write is applied to the shadow
+// (and the device) first, then a single pt_write_value() pushes all of the
+// new values. Returns the number of writes applied
+int DeviceShadow::processWriteRequests(const device_shadow_write_t *writes,
+                                       int num_writes) {
+  int num_applied = 0;
+  bool write_values = false;
+  for (int i = 0; i < num_writes; ++i) {
+    device_shadow_value_t value;
+    value.type = DEVICE_SHADOW_VALUE_INTEGER;
+    value.integer = writes[i].value;
+    bool write_value = false;
+    if (this->applyWriteRequest(this->m_endpoint_id, writes[i].object_id,
+                                writes[i].instance_id, writes[i].resource_id,
+                                writes[i].operation, &value,
+                                &write_value) == true) {
+      ++num_applied;
+      write_values = write_values || write_value;
+    }
+  }
+
   // DEBUG
-  printf("DeviceShadow: processWriteRequest() URI: %s/%d/%d/%d value length: "
-         "%d bytes\n",
-         device_id, object_id, instance_id, resource_id, value_size);
+  LOG_DEBUG("DeviceShadow: %s applied %d of %d batched writes\n",
+            this->m_endpoint_id, num_applied, num_writes);
+
+  // one consolidated update for all of the new values...
+  if (write_values == true) {
+    this->writeValuesToPT();
+  }
+  return num_applied;
+}
+
+// find a resource in our schema
+const fleet_resource_config_t *
+DeviceShadow::getResourceConfig(const uint16_t object_id,
+                                const uint16_t instance_id,
+                                const uint16_t resource_id) {
+  for (int i = 0; i < this->m_config.num_resources; ++i) {
+    const fleet_resource_config_t *config = &this->m_config.resources[i];
+    if (config->object_id == object_id &&
+        config->instance_id == instance_id &&
+        config->resource_id == resource_id) {
+      return config;
+    }
+  }
+  return NULL;
+}
+
+// apply a write request to the shadow resource and our device. The decoded
+// value is stored in the shadow (re-encoded only into the PT resource, which
+// is the copy that goes out to mbed Cloud) and handed to the device setter as
+// is... nothing decodes it again. "write_value" is set if the new value must
+// be pushed through PT
+bool DeviceShadow::applyWriteRequest(
+    const char *device_id, const uint16_t object_id, const uint16_t instance_id,
+    const uint16_t resource_id, const unsigned int operation,
+    const device_shadow_value_t *value, bool *write_value) {
+  // format the URI once (on the stack) for all of our logging
+  LwM2MPath uri(device_id, object_id, instance_id, resource_id);
 
-  // get the approriate resource requested
+  // DEBUG
+  LOG_DEBUG("DeviceShadow: processWriteRequest() URI: %s has value: %s\n",
+            uri.c_str(),
+            (value->type != DEVICE_SHADOW_VALUE_NONE) ? "yes" : "no");
+
+  // get the approriate resource requested (building our PT device if it was
+  // dropped while we were idle)
+  this->touch();
+  this->materialize();
   pt_resource_opaque_t *resource =
       this->getResourceInstance(object_id, instance_id, resource_id);
   if (resource == NULL) {
-    printf(
-        "DeviceShadow: No match for device URI: %s/%d/%d/%d on write action.\n",
-        device_id, object_id, instance_id, resource_id);
+    printf("DeviceShadow: No match for device URI: %s on write action.\n",
+           uri.c_str());
     return false;
   }
 
   /* Check if resource supports operation */
   if (!(resource->operations & operation)) {
-    printf("DeviceShadow: Operation %d tried on resource URI: %s/%d/%d/%d "
-           "which does not support it\n",
-           operation, device_id, object_id, instance_id, resource_id);
+    printf("DeviceShadow: Operation %d tried on resource URI: %s which does "
+           "not support it\n",
+           operation, uri.c_str());
     return false;
   }
 
-  // for write and execute we typically have a callback... we may also update a
-  // value
+  // for write and execute we may update a value and our device
   if (operation & OPERATION_WRITE || operation & OPERATION_EXECUTE) {
-    // update the value in our resource (all of our resources are integers...)
-    long new_value = 0;
-    convert_value_to_host_order_long((const uint8_t *)value, &new_value);
-    convert_long_value_to_network_byte_order(new_value, resource->value);
-
-    // get the orchestrator
-    Orchestrator *orchestrator = (Orchestrator *)this->m_orchestrator;
-
-    // DEBUG
-    if (operation & OPERATION_WRITE) {
-      printf("DeviceShadow: Writing new value URI: %s/%d/%d/%d value: %ld...\n",
-             device_id, object_id, instance_id, resource_id, new_value);
-    }
-    if (operation & OPERATION_EXECUTE) {
-      printf(
-          "DeviceShadow: Executing new value URI: %s/%d/%d/%d value: %ld...\n",
-          device_id, object_id, instance_id, resource_id, new_value);
+    if (value->type == DEVICE_SHADOW_VALUE_INTEGER) {
+      // update the value in our shadow (all of our resources are
+      // integers... the PT thread copies it into our resource)
+      this->m_value_cache.publish(object_id, instance_id, resource_id,
+                                  value->integer);
+      this->recordHistory(object_id, instance_id, resource_id,
+                          value->integer);
+      this->notifySubscribers(object_id, instance_id, resource_id,
+                              value->integer);
+
+      // DEBUG
+      if (operation & OPERATION_WRITE) {
+        LOG_DEBUG("DeviceShadow: Writing new value URI: %s value: %ld...\n",
+                  uri.c_str(), value->integer);
+      }
+      if (operation & OPERATION_EXECUTE) {
+        LOG_DEBUG("DeviceShadow: Executing new value URI: %s value: %ld...\n",
+                  uri.c_str(), value->integer);
+      }
     }
 
-    // execute a callback if we have one...
-    if (resource->callback != NULL) {
-      printf("DeviceShadow: Calling registered callback to write new resource "
-             "value into mbed Cloud...\n");
-      resource->callback(resource, value, value_size, this);
+    // hand the decoded value to whatever the resource drives on our device
+    const fleet_resource_config_t *config =
+        this->getResourceConfig(object_id, instance_id, resource_id);
+    if (config != NULL) {
+      this->setDeviceValue(config->binding, value);
     }
 
-    // update our value within PT if we have a value...
-    if (value != NULL && value_size > 0) {
-      printf("DeviceShadow: Calling pt_write_value() to write new resource "
-             "value into mbed Cloud...(thread id: %08x)\n",
-             (unsigned int)pthread_self());
-      pt_status_t status = pt_write_value(
-          orchestrator->getConnection(), this->m_pt_device,
-          this->m_pt_device->objects, &DeviceShadow::writeSuccessCB,
-          &DeviceShadow::writeFailureCB, this);
-      if (status == PT_STATUS_SUCCESS) {
-        // success
-        printf("DeviceShadow: pt_write_value() succeeded!\n");
-      } else {
-        // failure
-        printf("DeviceShadow: pt_write_value() failed with error: %d\n",
-               status);
-      }
-    }
+    // we have a value to push into mbed Cloud
+    *write_value = (value->type != DEVICE_SHADOW_VALUE_NONE);
   }
   return true;
 }
 
+// push our current resource values into mbed Cloud via PT
+void DeviceShadow::writeValuesToPT() {
+  if (this->materialize() == false) {
+    return;
+  }
+  LOG_DEBUG("DeviceShadow: Calling pt_write_value() to write new resource "
+            "value into mbed Cloud...(thread id: %08x)\n",
+            (unsigned int)pthread_self());
+  this->issuePTWrite();
+}
+
+// queue a pt_write_value() of our PT device for our PT connection's thread
+// (acknowledged in writeSuccess() or writeFailure()). If one is already
+// queued, it picks up our new values when it is made
+void DeviceShadow::issuePTWrite() {
+  if (__atomic_exchange_n(&this->m_pt_write_queued, true, __ATOMIC_ACQ_REL) ==
+      true) {
+    LOG_DEBUG("DeviceShadow: pt_write_value() already queued (OK)...\n");
+    return;
+  }
+  Orchestrator *orchestrator = (Orchestrator *)this->m_orchestrator;
+  orchestrator->writeIssued();
+  Tracer::shared()->begin(TRACE_SPAN_ACK, this->m_endpoint_handle);
+  if (this->postPTCall(&DeviceShadow::writeToPTCB) == false) {
+    printf("DeviceShadow: pt_write_value() failed: PT not connected\n");
+    __atomic_store_n(&this->m_pt_write_queued, false, __ATOMIC_RELEASE);
+    Tracer::shared()->end(TRACE_SPAN_ACK, this->m_endpoint_handle);
+    orchestrator->writeCompleted();
+  }
+}
+
+// pt_write_value() our PT device with its current values (PT thread)... a
+// change published from here on needs a write of its own
+void DeviceShadow::writeToPT(struct connection *connection) {
+  __atomic_store_n(&this->m_pt_write_queued, false, __ATOMIC_RELEASE);
+  pt_status_t status = PT_STATUS_NOT_CONNECTED;
+  if (connection != NULL) {
+    TraceScope trace(TRACE_SPAN_PT_WRITE_VALUE, this->m_endpoint_handle);
+    this->syncPTValues();
+    status = pt_write_value(connection, this->m_pt_device.get(),
+                            this->m_pt_device->objects,
+                            &DeviceShadow::writeSuccessCB,
+                            &DeviceShadow::writeFailureCB, this);
+  }
+  if (status == PT_STATUS_SUCCESS) {
+    // success
+    LOG_DEBUG("DeviceShadow: pt_write_value() succeeded!\n");
+  } else {
+    // failure
+    printf("DeviceShadow: pt_write_value() failed with error: %d\n", status);
+    this->writeFailure(this->m_endpoint_id);
+  }
+}
+
+// STATIC: make our write call (PT thread)
+void DeviceShadow::writeToPTCB(struct connection *connection, void *ctx) {
+  DeviceShadow *instance = (DeviceShadow *)ctx;
+  if (instance != NULL) {
+    instance->writeToPT(connection);
+  }
+}
+
 // update the counter resource value via PT
 void DeviceShadow::updateCounterResourceValue(int value) {
   // DEBUG
-  printf("DeviceShadow:: updating device shadow counter resource to: %d "
-         "(thread id: %08x)...\n",
-         value, (unsigned int)pthread_self());
-  pt_resource_opaque_t *resource =
-      this->getResourceInstance(COUNTER_OBJECT_ID, 0, COUNTER_RESOURCE_ID);
-  Orchestrator *orchestrator = (Orchestrator *)this->m_orchestrator;
+  LOG_DEBUG("DeviceShadow:: updating device shadow counter resource to: %d "
+            "(thread id: %08x)...\n",
+            value, (unsigned int)pthread_self());
+  pt_resource_opaque_t *resource = NULL;
+  this->touch();
+  this->materialize();
+  if (this->m_counter_resource != NULL) {
+    resource = this->getResourceInstance(
+        this->m_counter_resource->object_id,
+        this->m_counter_resource->instance_id,
+        this->m_counter_resource->resource_id);
+  }
 
   // make sure we have a resource...
   if (resource == NULL) {
@@ -441,39 +908,41 @@ void DeviceShadow::updateCounterResourceValue(int value) {
 
   // get the current resource value
   long current = -1;
-  convert_value_to_host_order_long(resource->value, &current);
+  this->m_value_cache.read(this->m_counter_resource->object_id,
+                           this->m_counter_resource->instance_id,
+                           this->m_counter_resource->resource_id, &current);
 
   // If value changed update it
   if (current != (long)value) {
     current = (long)value; // current value is now the counter value incremented...
-    printf("DeviceShadow: Updating counter value in mbed Cloud: %d\n", value);
-    convert_long_value_to_network_byte_order(current, resource->value);
-    if (resource->callback != NULL) {
-      resource->callback(resource, resource->value, resource->value_size, this);
-    }
+    LOG_DEBUG("DeviceShadow: Updating counter value in mbed Cloud: %d\n",
+              value);
+    this->m_value_cache.publish(this->m_counter_resource->object_id,
+                                this->m_counter_resource->instance_id,
+                                this->m_counter_resource->resource_id, current);
+    this->notifySubscribers(this->m_counter_resource->object_id,
+                            this->m_counter_resource->instance_id,
+                            this->m_counter_resource->resource_id, current);
+    device_shadow_value_t decoded;
+    decoded.type = DEVICE_SHADOW_VALUE_INTEGER;
+    decoded.integer = current;
+    this->setDeviceValue(this->m_counter_resource->binding, &decoded);
 
     // DEBUG
-    printf("DeviceShadow: Calling pt_write_value() to update counter resource "
-           "in mbed Cloud: %d\n",
-           value);
+    LOG_DEBUG("DeviceShadow: Calling pt_write_value() to update counter "
+              "resource in mbed Cloud: %d\n",
+              value);
 
     // update the counter value...
-    pt_status_t status = pt_write_value(
-        orchestrator->getConnection(), this->m_pt_device,
-        this->m_pt_device->objects, &DeviceShadow::writeSuccessCB,
-        &DeviceShadow::writeFailureCB, this);
-    if (status == PT_STATUS_SUCCESS) {
-      // success
-      printf("DeviceShadow: pt_write_value() succeeded!\n");
-    } else {
-      // failure
-      printf("DeviceShadow: pt_write_value() failed with error: %d\n", status);
-    }
+    this->issuePTWrite();
   }
 }
 
-// get our actual underlying device
+// get our actual underlying device (our own, else the orchestrator's)
 void *DeviceShadow::getDevice() {
+  if (this->m_device != NULL) {
+    return this->m_device;
+  }
   Orchestrator *orchestrator = (Orchestrator *)this->m_orchestrator;
   if (orchestrator != NULL) {
     return orchestrator->getDevice();
@@ -481,12 +950,13 @@ void *DeviceShadow::getDevice() {
   return NULL;
 }
 
-// unregistration success
+// unregistration success (PT thread)... our shard applies it
 void DeviceShadow::unregisterSuccess(const char *device_id) {
   printf("DeviceShadow: Shadow device: %s successfully deregistered\n",
          device_id);
   Orchestrator *orchestrator = (Orchestrator *)this->m_orchestrator;
-  orchestrator->completeShutdown();
+  orchestrator->deregistrationCompleted(this, true);
+  this->ptCallCompleted();
 }
 
 // STATIC unregistration success CB
@@ -497,12 +967,12 @@ void DeviceShadow::unregisterSuccessCB(const char *device_id, void *ctx) {
   }
 }
 
-// unregistration failure
+// unregistration failure (PT thread)... our shard applies it
 void DeviceShadow::unregisterFailure(const char *device_id) {
   printf("DeviceShadow: Shadow device: %s deregistration FAILED\n", device_id);
-  pt_device_free(this->m_pt_device);
   Orchestrator *orchestrator = (Orchestrator *)this->m_orchestrator;
-  orchestrator->completeShutdown();
+  orchestrator->deregistrationCompleted(this, false);
+  this->ptCallCompleted();
 }
 
 // STATIC unregistration failure CB
@@ -513,50 +983,493 @@ void DeviceShadow::unregisterFailureCB(const char *device_id, void *ctx) {
   }
 }
 
+// apply the outcome of our deregistration (owning shard)
+void DeviceShadow::applyDeregistration(bool success) {
+  __atomic_store_n(&this->m_is_registered, false, __ATOMIC_RELEASE);
+  if (this->m_reregister_pending == true) {
+    // our schema has changed... re-create and re-register
+    this->recreate();
+  } else {
+    Orchestrator *orchestrator = (Orchestrator *)this->m_orchestrator;
+    orchestrator->shadowDeregistered(this, success);
+  }
+}
+
 // deregister our shadow
-void DeviceShadow::deregister() {
+bool DeviceShadow::deregister() {
   printf(
       "DeviceShadow: Unregistering device shadow from mbed Cloud via PT...\n");
-  if (this->m_is_registered == true) {
-    Orchestrator *orchestrator = (Orchestrator *)this->m_orchestrator;
-    pt_status_t status =
-        pt_unregister_device(orchestrator->getConnection(), this->m_pt_device,
-                             &DeviceShadow::unregisterSuccessCB,
-                             &DeviceShadow::unregisterFailureCB, this);
-    if (PT_STATUS_SUCCESS != status) {
-      pt_device_free(this->m_pt_device);
+  if (this->isRegistered() == true && this->materialize() == true) {
+    return this->postPTCall(&DeviceShadow::unregisterFromPTCB);
+  }
+  return false;
+}
+
+// pt_unregister_device() our PT device (PT thread)
+void DeviceShadow::unregisterFromPT(struct connection *connection) {
+  pt_status_t status = PT_STATUS_NOT_CONNECTED;
+  if (connection != NULL) {
+    status = pt_unregister_device(connection, this->m_pt_device.get(),
+                                  &DeviceShadow::unregisterSuccessCB,
+                                  &DeviceShadow::unregisterFailureCB, this);
+  }
+  if (status != PT_STATUS_SUCCESS) {
+    printf("DeviceShadow: pt_unregister_device() failed with error: %d\n",
+           status);
+    this->unregisterFailure(this->m_endpoint_id);
+  }
+}
+
+// STATIC: make our deregistration call (PT thread)
+void DeviceShadow::unregisterFromPTCB(struct connection *connection,
+                                      void *ctx) {
+  DeviceShadow *instance = (DeviceShadow *)ctx;
+  if (instance != NULL) {
+    instance->unregisterFromPT(connection);
+  }
+}
+
+// retire the shadow (it has been removed from the fleet): deregister it from
+// PT. True if a deregistration was issued... our shard waits for it
+bool DeviceShadow::retire() {
+  this->m_is_retired = true;
+  this->detachSubscriptions();
+  return this->deregister();
+}
+
+// have we been removed from the fleet?
+bool DeviceShadow::isRetired() { return this->m_is_retired; }
+
+// apply a new configuration (owning shard thread). Polling and filter changes
+// apply in place... a new schema or lifetime means our PT device has to be
+// re-created and re-registered
+void DeviceShadow::reconfigure(const fleet_device_config_t *config) {
+  bool same_schema = FleetConfig::isSameSchema(&this->m_config, config);
+  this->m_config = *config;
+  this->m_counter_resource = NULL;
+  for (int i = 0; i < this->m_config.num_resources; ++i) {
+    if (this->m_config.resources[i].binding == FLEET_BINDING_COUNTER) {
+      this->m_counter_resource = &this->m_config.resources[i];
+    }
+  }
+  this->resetWindows();
+  if (same_schema == true) {
+    return;
+  }
+  this->resetValueCache();
+  this->resetHistory();
+  this->m_restore_values = false;
+  if (this->m_pt_device.isNull() == true && this->isRegistered() == false) {
+    return;
+  }
+
+  // DEBUG
+  printf("DeviceShadow: %s schema changed... re-creating the shadow\n",
+         this->m_endpoint_id);
+  if (this->isRegistered() == true) {
+    this->m_reregister_pending = true;
+    if (this->deregister() == true) {
+      // continued in unregisterSuccess()/unregisterFailure()
+      return;
+    }
+    this->m_reregister_pending = false;
+  }
+  this->recreate();
+}
+
+// re-create our PT device from our (new) schema and register it (if PT is
+// not connected, that happens once it is)
+void DeviceShadow::recreate() {
+  this->m_reregister_pending = false;
+  __atomic_store_n(&this->m_is_registered, false, __ATOMIC_RELEASE);
+  this->m_restore_values = false;
+  this->m_pt_device.reset(NULL);
+  Orchestrator *orchestrator = (Orchestrator *)this->m_orchestrator;
+  if (orchestrator->isConnected(this) == true) {
+    this->createAndRegister();
+  }
+}
+
+// add a local subscriber
+void DeviceShadow::subscribe(Subscription *subscription) {
+  subscription->setAttached(true);
+  this->m_subscriptions.push_back(subscription);
+}
+
+// remove a local subscriber (its owner may delete it from here on)
+void DeviceShadow::unsubscribe(Subscription *subscription) {
+  for (size_t i = 0; i < this->m_subscriptions.size(); ++i) {
+    if (this->m_subscriptions[i] == subscription) {
+      this->m_subscriptions.erase(this->m_subscriptions.begin() + i);
+      break;
+    }
+  }
+  subscription->setAttached(false);
+}
+
+// let go of all of our subscribers
+void DeviceShadow::detachSubscriptions() {
+  for (size_t i = 0; i < this->m_subscriptions.size(); ++i) {
+    this->m_subscriptions[i]->setAttached(false);
+  }
+  this->m_subscriptions.clear();
+}
+
+// get the number of local subscribers
+size_t DeviceShadow::getNumSubscriptions() {
+  return this->m_subscriptions.size();
+}
+
+// fan a resource change out to our local subscribers (never blocks... a
+// subscriber whose queue is full misses the change)
+void DeviceShadow::notifySubscribers(const uint16_t object_id,
+                                     const uint16_t instance_id,
+                                     const uint16_t resource_id, long value) {
+  if (this->m_subscriptions.empty() == true) {
+    return;
+  }
+  resource_notification_t notification;
+  notification.endpoint = this->m_endpoint_handle;
+  notification.object_id = object_id;
+  notification.instance_id = instance_id;
+  notification.resource_id = resource_id;
+  notification.value = value;
+  notification.version = this->m_value_cache.getVersion();
+  for (size_t i = 0; i < this->m_subscriptions.size(); ++i) {
+    if (this->m_subscriptions[i]->matches(object_id, instance_id,
+                                          resource_id) == true) {
+      this->m_subscriptions[i]->notify(&notification);
     }
   }
 }
 
+// get our fleet configuration
+const fleet_device_config_t *DeviceShadow::getConfig() {
+  return &this->m_config;
+}
+
+// are we registered with PT?
+bool DeviceShadow::isRegistered() {
+  return __atomic_load_n(&this->m_is_registered, __ATOMIC_ACQUIRE);
+}
+
+// get the pending counter value (if any)
+bool DeviceShadow::getPendingCounterValue(int *value) {
+  if (this->m_counter_value_changed == true) {
+    *value = this->m_new_counter_value;
+    return true;
+  }
+  return false;
+}
+
+// read a resource value from our value cache
+bool DeviceShadow::getResourceValue(const uint16_t object_id,
+                                    const uint16_t instance_id,
+                                    const uint16_t resource_id, long *value) {
+  return this->m_value_cache.read(object_id, instance_id, resource_id, value);
+}
+
+// get our value cache
+ValueCache *DeviceShadow::getValueCache() { return &this->m_value_cache; }
+
+// query a resource's history
+int DeviceShadow::queryHistory(const uint16_t object_id,
+                               const uint16_t instance_id,
+                               const uint16_t resource_id, int64_t from_ms,
+                               int64_t to_ms, time_series_sample_t *samples,
+                               int max_samples) {
+  for (int i = 0; i < FLEET_CONFIG_MAX_RESOURCES; ++i) {
+    int num_samples =
+        this->m_history[i].query(object_id, instance_id, resource_id, from_ms,
+                                 to_ms, samples, max_samples);
+    if (num_samples >= 0) {
+      return num_samples;
+    }
+  }
+  return -1;
+}
+
+// aggregate a resource's history
+bool DeviceShadow::aggregateHistory(const uint16_t object_id,
+                                    const uint16_t instance_id,
+                                    const uint16_t resource_id,
+                                    int64_t from_ms, int64_t to_ms,
+                                    time_series_aggregate_t *aggregate) {
+  for (int i = 0; i < FLEET_CONFIG_MAX_RESOURCES; ++i) {
+    if (this->m_history[i].aggregate(object_id, instance_id, resource_id,
+                                     from_ms, to_ms, aggregate) == true) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// get our endpoint ID
+const char *DeviceShadow::getEndpointID() { return this->m_endpoint_id; }
+
+// get our interned endpoint ID handle
+endpoint_handle_t DeviceShadow::getEndpointHandle() {
+  return this->m_endpoint_handle;
+}
+
+// set the shard that owns us
+void DeviceShadow::setShard(void *shard) { this->m_shard = shard; }
+
+// get the shard that owns us
+void *DeviceShadow::getShard() { return this->m_shard; }
+
+// set the PT connection we are on
+void DeviceShadow::setPTConnection(void *connection) {
+  this->m_pt_connection = connection;
+}
+
+// get the PT connection we are on
+void *DeviceShadow::getPTConnection() { return this->m_pt_connection; }
+
+// apply the counter resource's filter policy to a new value. Returns false if
+// the value must be held for now; a value dropped by the delta policy clears
+// the pending change
+bool DeviceShadow::filterCounterValue(int value) {
+  if (this->m_counter_resource == NULL || this->m_has_forwarded == false) {
+    this->recordForwardedValue(value);
+    return true;
+  }
+
+  // ignore changes smaller than "delta"
+  long change = (long)value - this->m_last_forwarded_value;
+  if (this->m_counter_resource->delta > 0 &&
+      labs(change) < this->m_counter_resource->delta) {
+    LOG_DEBUG("DeviceShadow: %s change of %ld is below delta %ld... dropped\n",
+              this->m_endpoint_id, change, this->m_counter_resource->delta);
+    Tracer::shared()->end(TRACE_SPAN_COALESCE, this->m_endpoint_handle);
+    this->m_counter_value_changed = false;
+    return true;
+  }
+
+  // forward at most once per "min_interval_ms"
+  if (this->m_counter_resource->min_interval_ms > 0) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long elapsed_ms =
+        (now.tv_sec - this->m_last_forwarded_at.tv_sec) * 1000L +
+        (now.tv_nsec - this->m_last_forwarded_at.tv_nsec) / 1000000L;
+    if (elapsed_ms < this->m_counter_resource->min_interval_ms) {
+      LOG_DEBUG("DeviceShadow: %s forwarded %ld ms ago... holding\n",
+                this->m_endpoint_id, elapsed_ms);
+      return false;
+    }
+  }
+  this->recordForwardedValue(value);
+  return true;
+}
+
+// remember what (and when) we last forwarded
+void DeviceShadow::recordForwardedValue(int value) {
+  this->m_last_forwarded_value = (long)value;
+  this->m_has_forwarded = true;
+  clock_gettime(CLOCK_MONOTONIC, &this->m_last_forwarded_at);
+}
+
+// (re)configure a window per aggregate resource... any window state is
+// discarded
+void DeviceShadow::resetWindows() {
+  this->m_num_windows = 0;
+  this->m_aggregates_changed = false;
+  bool has_aggregates = false;
+  for (int i = 0; i < this->m_config.num_resources; ++i) {
+    has_aggregates = has_aggregates ||
+                     this->m_config.resources[i].binding >= FLEET_BINDING_COUNT;
+  }
+  delete[] this->m_windows;
+  this->m_windows = NULL;
+  if (has_aggregates == false) {
+    return;
+  }
+  this->m_windows = new AggregationWindow[FLEET_CONFIG_MAX_RESOURCES];
+  int poll_interval_ms = this->m_config.poll_interval_ms;
+  for (int i = 0; i < this->m_config.num_resources; ++i) {
+    const fleet_resource_config_t *config = &this->m_config.resources[i];
+    if (config->binding < FLEET_BINDING_COUNT) {
+      continue;
+    }
+    AGGREGATION_FUNCTION function = AGGREGATE_COUNT;
+    switch (config->binding) {
+    case FLEET_BINDING_SUM:
+      function = AGGREGATE_SUM;
+      break;
+    case FLEET_BINDING_MIN:
+      function = AGGREGATE_MIN;
+      break;
+    case FLEET_BINDING_MAX:
+      function = AGGREGATE_MAX;
+      break;
+    case FLEET_BINDING_MEAN:
+      function = AGGREGATE_MEAN;
+      break;
+    default:
+      break;
+    }
+    if (this->m_windows[i].configure(function, config->window_ms,
+                                     config->slide_ms,
+                                     poll_interval_ms) == true) {
+      ++this->m_num_windows;
+    }
+  }
+}
+
+// feed a counter sample to our windows... each window that closes with a new
+// value updates its resource (forwarded by processEvents())
+void DeviceShadow::aggregateCounterValue(int value) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  int64_t now_ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+  for (int i = 0; i < this->m_config.num_resources; ++i) {
+    long result = 0;
+    if (this->m_windows[i].add(now_ms, (long)value, &result) == true) {
+      const fleet_resource_config_t *config = &this->m_config.resources[i];
+      this->recordHistory(config->object_id, config->instance_id,
+                          config->resource_id, result);
+      if (this->setResourceValue(config, result) == true) {
+        this->m_aggregates_changed = true;
+      }
+    }
+  }
+}
+
+// set a resource's value in our shadow (not forwarded)... true if it changed
+bool DeviceShadow::setResourceValue(const fleet_resource_config_t *config,
+                                    long value) {
+  long current = 0;
+  if (this->m_value_cache.read(config->object_id, config->instance_id,
+                               config->resource_id, &current) == true &&
+      current == value) {
+    return false;
+  }
+  this->m_value_cache.publish(config->object_id, config->instance_id,
+                              config->resource_id, value);
+  this->notifySubscribers(config->object_id, config->instance_id,
+                          config->resource_id, value);
+  return true;
+}
+
+// forward the aggregates of the windows that closed, along with the latest
+// counter value, in a single pt_write_value()
+void DeviceShadow::forwardAggregates() {
+  if (this->m_aggregates_changed == false) {
+    LOG_DEBUG("DeviceShadow: No aggregates to forward (OK)...\n");
+    return;
+  }
+  this->touch();
+  this->materialize();
+  if (this->m_counter_value_changed == true) {
+    Tracer::shared()->end(TRACE_SPAN_COALESCE, this->m_endpoint_handle);
+  }
+  if (this->m_counter_value_changed == true &&
+      this->m_counter_resource != NULL) {
+    this->setResourceValue(this->m_counter_resource,
+                           (long)this->m_new_counter_value);
+    this->recordForwardedValue(this->m_new_counter_value);
+  }
+  this->m_counter_value_changed = false;
+  this->m_aggregates_changed = false;
+  this->writeValuesToPT();
+}
+
+// poll our own device (shard thread)... true if there is a new value
+bool DeviceShadow::poll() {
+  if (this->m_device == NULL || this->m_counter_resource == NULL) {
+    return false;
+  }
+  NonMbedDevice *device = (NonMbedDevice *)this->m_device;
+  this->notifyCounterValueHasChanged(device->poll());
+  return true;
+}
+
+// get our poll interval (0 if we are not polled)
+int DeviceShadow::getPollIntervalMs() {
+  if (this->m_device == NULL || this->m_counter_resource == NULL) {
+    return 0;
+  }
+  return this->m_config.poll_interval_ms;
+}
+
 // notify that the counter value has changed
 void DeviceShadow::notifyCounterValueHasChanged(int new_value) {
+  // a buffered value replayed after this one is older... it is dropped
+  if (this->m_pt_connection != NULL) {
+    this->m_live_epoch =
+        ((PTConnection *)this->m_pt_connection)->getNumConnects();
+  }
+
+  // every sample goes into the history (filtered or not)
+  if (this->m_counter_resource != NULL) {
+    this->recordHistory(this->m_counter_resource->object_id,
+                        this->m_counter_resource->instance_id,
+                        this->m_counter_resource->resource_id, new_value);
+  }
   this->m_new_counter_value = new_value;
+  if (this->m_counter_value_changed == false) {
+    Tracer::shared()->begin(TRACE_SPAN_COALESCE, this->m_endpoint_handle);
+  }
   this->m_counter_value_changed = true;
+  if (this->m_num_windows > 0) {
+    this->aggregateCounterValue(new_value);
+  }
+}
+
+// a buffered counter value is replayed (shard thread)
+bool DeviceShadow::notifyBufferedCounterValue(int value, int epoch) {
+  int live_epoch = this->m_live_epoch;
+  if (live_epoch >= epoch) {
+    return false;
+  }
+  this->notifyCounterValueHasChanged(value);
+  this->m_live_epoch = live_epoch; // a replayed value is not a live one
+  return true;
 }
 
 // process events
 void DeviceShadow::processEvents() {
   // DEBUG
-  printf("DeviceShadow: Checking to see if we have any events to process "
-         "(thread id: %08x)...\n",
-         (unsigned int)pthread_self());
+  LOG_DEBUG("DeviceShadow: Checking to see if we have any events to process "
+            "(thread id: %08x)...\n",
+            (unsigned int)pthread_self());
+
+  // we cannot push anything into mbed Cloud until our shadow is registered...
+  // any pending change is held until then
+  if (this->isRegistered() == false) {
+    LOG_DEBUG("DeviceShadow: Shadow not registered yet... holding events...\n");
+    return;
+  }
+
+  // with aggregates we only forward as windows close
+  if (this->m_num_windows > 0) {
+    this->forwardAggregates();
+    return;
+  }
 
   // has the ticker processor thread indicated that we have a new counter value?
   if (this->m_counter_value_changed == true) {
     // counter value has changed... so lets update mbed Cloud...
-    printf("DeviceShadow: Counter has changed in the non-mbed device... "
-           "updating the mapped resource in PT...\n");
-    this->updateCounterResourceValue(this->m_new_counter_value);
+    LOG_DEBUG("DeviceShadow: Counter has changed in the non-mbed device... "
+              "updating the mapped resource in PT...\n");
+    if (this->filterCounterValue(this->m_new_counter_value) == false) {
+      // held back by the min_interval_ms policy... forwarded on a later pass
+      return;
+    }
+    if (this->m_counter_value_changed == true) {
+      Tracer::shared()->end(TRACE_SPAN_COALESCE, this->m_endpoint_handle);
+      this->updateCounterResourceValue(this->m_new_counter_value);
 
-    // we are done with the update... so reset back to "unchanged" as the
-    // default state...
-    this->m_counter_value_changed = false;
+      // we are done with the update... so reset back to "unchanged" as the
+      // default state...
+      this->m_counter_value_changed = false;
 
-    // DEBUG
-    printf("DeviceShadow: Counter value updated in resource via PT.\n");
+      // DEBUG
+      LOG_DEBUG("DeviceShadow: Counter value updated in resource via PT.\n");
+    }
   } else {
     // nothing to do - i.e. counter has not been updated...
-    printf("DeviceShadow: No events to process (OK)...\n");
+    LOG_DEBUG("DeviceShadow: No events to process (OK)...\n");
   }
 }
@@ -28,6 +28,7 @@
 #include <pthread.h>
 #include <signal.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 // mbed-edge PT includes
@@ -41,6 +42,7 @@
                   // per our "actual" device class underneath
 #define SAMPLE_DEVICE_ENDPOINT_TYPE                                            \
   "mbed-endpoint" // defaulted EPT (currently not implemented by PT)
+#define SHADOW_IDLE_TIMEOUT_MS 60000 // an idle shadow drops its PT structures
 
 // IPSO Object ID's used by our device shadow
 enum IPSO_OBJECTS {
@@ -64,27 +66,129 @@ extern "C" {
 };
 #endif
 
+// device schemas/filter policies
+#include "FleetConfig.h"
+
+// versioned resource values (read from any thread)
+#include "ValueCache.h"
+
+// PT device/buffer ownership
+#include "PTResource.h"
+
+// PT calls are made on our PT connection's thread
+#include "PTConnection.h"
+
+// interned endpoint IDs
+#include "EndpointTable.h"
+
+// local resource subscriptions
+#include "Subscription.h"
+#include <vector>
+
+// per-resource value history
+#include "TimeSeries.h"
+
+// edge-side aggregation of the counter
+#include "AggregationWindow.h"
+
+// a resource value decoded (once) from a write request... small enough to be
+// passed around inline. All of our resources are LwM2M integers; an execute
+// may carry no value at all
+enum DEVICE_SHADOW_VALUE_TYPE {
+  DEVICE_SHADOW_VALUE_NONE = 0,
+  DEVICE_SHADOW_VALUE_INTEGER
+};
+
+typedef struct device_shadow_value {
+  DEVICE_SHADOW_VALUE_TYPE type;
+  long integer; // host byte order
+} device_shadow_value_t;
+
+// a single resource write (all of our resources are integers)
+typedef struct device_shadow_write {
+  uint16_t object_id;
+  uint16_t instance_id;
+  uint16_t resource_id;
+  unsigned int operation;
+  long value; // host byte order
+} device_shadow_write_t;
+
 class DeviceShadow {
 public:
   DeviceShadow(void *orchestrator);
   DeviceShadow(void *orchestrator, char *device_id, char *suffix);
+  DeviceShadow(void *orchestrator, void *device,
+               const fleet_device_config_t *config, const char *suffix);
   virtual ~DeviceShadow();
 
   // notify that the counter value has changed
   void notifyCounterValueHasChanged(int new_value);
 
+  // a counter value buffered while PT was down, replayed once our connection
+  // is up again ("epoch": its connect count)... false (dropped) if a live
+  // value has arrived since
+  bool notifyBufferedCounterValue(int value, int epoch);
+
   // process events
   void processEvents();
 
-  // create and register the shadow device
+  // poll our own device for a new counter value (called by our shard)
+  bool poll();
+  int getPollIntervalMs();
+
+  // create (if needed) and register the shadow device
   bool createAndRegister();
 
-  // process a write request to the shadow device...
+  // our PT device (object/instance/resource tree and device object) is only
+  // built when it is needed: to register, renew, deregister, take a write or
+  // forward a change. A shadow idle for "idle_ms" drops it again and keeps
+  // just its compact state (schema, value cache, history)... the tree is
+  // rebuilt from the value cache. Owning shard only
+  bool materialize();
+  bool dematerializeIfIdle(uint64_t now_ms, uint64_t idle_ms);
+  bool isMaterialized();
+
+  // the PT connection has been lost (we are no longer registered)
+  void connectionLost();
+
+  // apply the outcome of our (re)registration, renewal or deregistration
+  // (owning shard... PT only reports them, see registrationSuccess()). True if
+  // the registration outcome was that of a renewal
+  bool applyRegistration(bool success);
+  void applyDeregistration(bool success);
+
+  // renew our registration before its lifetime runs out (owning shard)
+  bool renewRegistration();
+  int getLifetime();
+
+  // when our next renewal is due (CLOCK_MONOTONIC ms, owning shard only... a
+  // renewal scheduled for any other time is stale)
+  void setRenewalDueMs(uint64_t due_ms);
+  uint64_t getRenewalDueMs();
+
+  // renewals that have failed in a row (owning shard... the retries back off)
+  int getNumRenewalFailures();
+
+  // process a write request to the shadow device... the value is decoded
+  // once and that decoded value goes to both the device and the shadow
   bool processWriteRequest(const char *device_id, const uint16_t object_id,
                            const uint16_t instance_id,
                            const uint16_t resource_id,
                            const unsigned int operation, const uint8_t *value,
                            const uint32_t value_size);
+  bool processWriteRequest(const char *device_id, const uint16_t object_id,
+                           const uint16_t instance_id,
+                           const uint16_t resource_id,
+                           const unsigned int operation,
+                           const device_shadow_value_t *value);
+
+  // decode a (network byte order) write request value... false if it is not
+  // a value we can hold
+  static bool decodeValue(const uint8_t *value, const uint32_t value_size,
+                          device_shadow_value_t *decoded);
+
+  // process a batch of write requests (one pt_write_value() for all of them)
+  int processWriteRequests(const device_shadow_write_t *writes, int num_writes);
 
   // write success
   void writeSuccess(const char *device_id);
@@ -134,34 +238,174 @@ public:
   void unregisterFailure(const char *device_id);
   static void unregisterFailureCB(const char *device_id, void *ctx);
 
-  // deregister our device shadow from PT
-  void deregister();
+  // deregister our device shadow from PT (true if a deregistration was issued)
+  bool deregister();
 
-private:
-  DeviceShadow(const DeviceShadow &device);
-  void initialize(void *orchestrator, char *device_id, char *suffix);
-  pt_device_t *createPTDevice();
+  // we have been removed from the fleet: deregister (true if we did... our
+  // shard hands us to the orchestrator for deletion once nothing refers to
+  // us any more)
+  bool retire();
+  bool isRetired();
+
+  // apply a new fleet configuration (re-registers only if the schema changed)
+  void reconfigure(const fleet_device_config_t *config);
+  const fleet_device_config_t *getConfig();
+
+  // are we registered with PT?
+  bool isRegistered();
+
+  // get the pending (not yet forwarded) counter value, if any
+  bool getPendingCounterValue(int *value);
+
+  // get our endpoint ID (interned... stable for the life of the process)
+  const char *getEndpointID();
+  endpoint_handle_t getEndpointHandle();
+
+  // read a resource value from our value cache (safe from any thread... does
+  // not touch the PT resource buffers that our shard mutates)
+  bool getResourceValue(const uint16_t object_id, const uint16_t instance_id,
+                        const uint16_t resource_id, long *value);
+  ValueCache *getValueCache();
+
+  // query a resource's recent history (safe from any thread... never blocks
+  // our shard). -1/false if the resource is not in our schema
+  int queryHistory(const uint16_t object_id, const uint16_t instance_id,
+                   const uint16_t resource_id, int64_t from_ms, int64_t to_ms,
+                   time_series_sample_t *samples, int max_samples);
+  bool aggregateHistory(const uint16_t object_id, const uint16_t instance_id,
+                        const uint16_t resource_id, int64_t from_ms,
+                        int64_t to_ms, time_series_aggregate_t *aggregate);
+
+  // are any of our PT calls still to be made or acknowledged? (any thread...
+  // our PT device cannot be freed, nor we deleted, until there are none)
+  bool hasPendingPTCalls();
+
+  // find a specific resource instance in our shadow
   pt_resource_opaque_t *getResourceInstance(const uint16_t object_id,
                                             const uint16_t instance_id,
                                             const uint16_t resource_id);
+
+  // local subscriptions to our resource changes (owning shard thread only)
+  void subscribe(Subscription *subscription);
+  void unsubscribe(Subscription *subscription);
+  void detachSubscriptions();
+  size_t getNumSubscriptions();
+
+  // our actual underlying device (our own, else the orchestrator's)
+  void *getDevice();
+
+  // the orchestrator shard that owns this shadow
+  void setShard(void *shard);
+  void *getShard();
+
+  // the PT connection this shadow is registered through
+  void setPTConnection(void *connection);
+  void *getPTConnection();
+
+private:
+  DeviceShadow(const DeviceShadow &device);
+  void initialize(void *orchestrator, void *device,
+                  const fleet_device_config_t *config, const char *suffix);
+  PTDevicePtr createPTDevice();
   bool createShadowWithPT();
   bool registerShadowWithPT();
-  void createCounterLWM2MResource();
-  void createSwitchLWM2MResource();
-  void *getDevice();
+  void touch();
+  void createLWM2MResource(const fleet_resource_config_t *config);
+  bool filterCounterValue(int value);
+  void recordForwardedValue(int value);
+  void recreate();
+  void resetValueCache();
+  void resetHistory();
+  void resetWindows();
+  void aggregateCounterValue(int value);
+  bool setResourceValue(const fleet_resource_config_t *config, long value);
+  void forwardAggregates();
+  void recordHistory(const uint16_t object_id, const uint16_t instance_id,
+                     const uint16_t resource_id, long value);
+  bool applyWriteRequest(const char *device_id, const uint16_t object_id,
+                         const uint16_t instance_id, const uint16_t resource_id,
+                         const unsigned int operation,
+                         const device_shadow_value_t *value, bool *write_value);
+  const fleet_resource_config_t *getResourceConfig(const uint16_t object_id,
+                                                   const uint16_t instance_id,
+                                                   const uint16_t resource_id);
+  void setDeviceValue(FLEET_RESOURCE_BINDING binding,
+                      const device_shadow_value_t *value);
+  void writeValuesToPT();
+  void issuePTWrite();
+  bool postPTCall(pt_call_fn run);
+  void ptCallCompleted();
+  void syncPTValues();
+  void registerWithPT(struct connection *connection);
+  static void registerWithPTCB(struct connection *connection, void *ctx);
+  void writeToPT(struct connection *connection);
+  static void writeToPTCB(struct connection *connection, void *ctx);
+  void unregisterFromPT(struct connection *connection);
+  static void unregisterFromPTCB(struct connection *connection, void *ctx);
+  void notifySubscribers(const uint16_t object_id, const uint16_t instance_id,
+                         const uint16_t resource_id, long value);
 
 private:
   void *m_orchestrator;
-  bool m_is_registered;
-  pt_device_t *m_pt_device;
-  char *m_device_id;
-  char *m_suffix;
-  char *m_endpoint_id;
+  void *m_device; // our own device (NULL: the orchestrator's device)
+  void *m_shard;
+  void *m_pt_connection;
+  bool m_is_registered; // atomic: also read (and cleared) off our shard
+  PTDevicePtr m_pt_device;
+  endpoint_handle_t m_endpoint_handle;
+  const char *m_endpoint_id; // owned by the endpoint table
+
+  // our schema and the resource bound to the device counter
+  fleet_device_config_t m_config;
+  const fleet_resource_config_t *m_counter_resource;
+
+  // the latest value of each resource (published by our shard)
+  ValueCache m_value_cache;
+
+  // the recent history of each resource (appended by our shard... slot "n"
+  // follows resource "n" of our schema)
+  TimeSeries m_history[FLEET_CONFIG_MAX_RESOURCES];
+
+  // windows over the counter's samples, one per aggregate resource (slot "n"
+  // follows resource "n" of our schema)... only allocated if our schema has
+  // aggregates, most shadows do not
+  AggregationWindow *m_windows;
+  int m_num_windows;
+  bool m_aggregates_changed;
+
+  // local subscribers to our resource changes (fan-out by our shard)
+  std::vector<Subscription *> m_subscriptions;
 
   int m_counter_value;
   bool m_switch_state;
   int m_new_counter_value;
   bool m_counter_value_changed;
+  int m_live_epoch; // our connection's connect count at the last live value
+
+  // last value forwarded through PT (filter policy state)
+  long m_last_forwarded_value;
+  struct timespec m_last_forwarded_at;
+  bool m_has_forwarded;
+
+  // registration renewal state
+  bool m_is_renewing;
+  uint64_t m_renewal_due_ms;
+  int m_num_renewal_failures;
+
+  // lazy PT device state: when we were last active (CLOCK_MONOTONIC ms) and
+  // whether a rebuilt PT device takes its values from our value cache
+  uint64_t m_last_active_ms;
+  bool m_restore_values;
+
+  // PT calls posted to our PT connection's thread and not yet acknowledged,
+  // and whether one of them is a write (which sends whatever our values are
+  // by the time it is made... further changes ride with it)
+  int m_pt_calls_pending;
+  bool m_pt_write_queued;
+
+  // fleet reconfiguration state
+  bool m_is_retired;
+  bool m_reregister_pending;
 };
 
 #endif // __DEVICE_SHADOW_H__
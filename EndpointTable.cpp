@@ -0,0 +1,241 @@
+/**
+ * @file    EndpointTable.cpp
+ * @brief   mbed Edge Endpoint ID Intern Table Implementation
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "EndpointTable.h"
+
+// system includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// constructor
+EndpointTable::EndpointTable() { this->initialize(); }
+
+// destructor
+EndpointTable::~EndpointTable() {
+  for (size_t i = 0; i < this->m_chunks.size(); ++i) {
+    free(this->m_chunks[i]);
+  }
+  pthread_rwlock_destroy(&this->m_lock);
+}
+
+// copy constructor
+EndpointTable::EndpointTable(const EndpointTable &table) {}
+
+// initialize
+void EndpointTable::initialize() {
+  pthread_rwlock_init(&this->m_lock, NULL);
+  this->m_buckets.assign(ENDPOINT_TABLE_MIN_BUCKETS, ENDPOINT_HANDLE_INVALID);
+  this->m_chunk_buckets.assign(ENDPOINT_TABLE_MIN_CHUNK_BUCKETS, 0);
+  this->m_chunk_used = ENDPOINT_TABLE_CHUNK_BYTES; // first intern allocates
+  this->m_num_bytes = 0;
+}
+
+// STATIC: the table shared by all of our shadows
+EndpointTable *EndpointTable::shared() {
+  static EndpointTable table;
+  return &table;
+}
+
+// STATIC: FNV-1a hash of an endpoint ID
+uint32_t EndpointTable::hash(const char *endpoint_id) {
+  uint32_t hash = 2166136261u;
+  for (const char *p = endpoint_id; *p != '\0'; ++p) {
+    hash = (hash ^ (uint8_t)*p) * 16777619u;
+  }
+  return hash;
+}
+
+// find an endpoint ID (lock held)
+endpoint_handle_t EndpointTable::findLocked(const char *endpoint_id,
+                                            uint32_t hash) {
+  size_t mask = this->m_buckets.size() - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    endpoint_handle_t handle = this->m_buckets[i];
+    if (handle == ENDPOINT_HANDLE_INVALID) {
+      return ENDPOINT_HANDLE_INVALID;
+    }
+    if (this->m_hashes[handle - 1] == hash &&
+        strcmp(this->m_endpoint_ids[handle - 1], endpoint_id) == 0) {
+      return handle;
+    }
+  }
+}
+
+// hash of a chunk address (its low bits are always 0)
+static size_t chunkHash(uintptr_t chunk) {
+  return (size_t)((chunk / ENDPOINT_TABLE_CHUNK_BYTES) * 2654435761u);
+}
+
+// allocate a chunk aligned to ENDPOINT_TABLE_CHUNK_BYTES and add it to our
+// chunk hash set (write lock held)
+char *EndpointTable::allocateChunkLocked(size_t size) {
+  void *chunk = NULL;
+  if (posix_memalign(&chunk, ENDPOINT_TABLE_CHUNK_BYTES, size) != 0) {
+    printf("EndpointTable: ERROR. Unable to allocate a %lu byte chunk\n",
+           (unsigned long)size);
+    abort();
+  }
+  this->m_chunks.push_back((char *)chunk);
+  if (2 * this->m_chunks.size() > this->m_chunk_buckets.size()) {
+    this->growChunkBucketsLocked();
+  } else {
+    size_t mask = this->m_chunk_buckets.size() - 1;
+    size_t i = chunkHash((uintptr_t)chunk) & mask;
+    while (this->m_chunk_buckets[i] != 0) {
+      i = (i + 1) & mask;
+    }
+    this->m_chunk_buckets[i] = (uintptr_t)chunk;
+  }
+  return (char *)chunk;
+}
+
+// copy an endpoint ID into our chunks (write lock held)
+const char *EndpointTable::copyLocked(const char *endpoint_id, size_t length) {
+  if (length + 1 > ENDPOINT_TABLE_CHUNK_BYTES) {
+    // oversized... gets a chunk of its own
+    char *chunk = this->allocateChunkLocked(length + 1);
+    memcpy(chunk, endpoint_id, length + 1);
+    return chunk;
+  }
+  if (this->m_chunk_used + length + 1 > ENDPOINT_TABLE_CHUNK_BYTES) {
+    this->allocateChunkLocked(ENDPOINT_TABLE_CHUNK_BYTES);
+    this->m_chunk_used = 0;
+  }
+  char *copy = this->m_chunks.back() + this->m_chunk_used;
+  memcpy(copy, endpoint_id, length + 1);
+  this->m_chunk_used += length + 1;
+  return copy;
+}
+
+// double the hash table once it is half full (write lock held)
+void EndpointTable::growLocked() {
+  std::vector<endpoint_handle_t> buckets(this->m_buckets.size() * 2,
+                                         ENDPOINT_HANDLE_INVALID);
+  size_t mask = buckets.size() - 1;
+  for (size_t handle = 1; handle <= this->m_endpoint_ids.size(); ++handle) {
+    size_t i = this->m_hashes[handle - 1] & mask;
+    while (buckets[i] != ENDPOINT_HANDLE_INVALID) {
+      i = (i + 1) & mask;
+    }
+    buckets[i] = (endpoint_handle_t)handle;
+  }
+  this->m_buckets.swap(buckets);
+}
+
+// double the chunk hash set once it is half full (write lock held)
+void EndpointTable::growChunkBucketsLocked() {
+  std::vector<uintptr_t> buckets(this->m_chunk_buckets.size() * 2, 0);
+  size_t mask = buckets.size() - 1;
+  for (size_t c = 0; c < this->m_chunks.size(); ++c) {
+    uintptr_t chunk = (uintptr_t)this->m_chunks[c];
+    size_t i = chunkHash(chunk) & mask;
+    while (buckets[i] != 0) {
+      i = (i + 1) & mask;
+    }
+    buckets[i] = chunk;
+  }
+  this->m_chunk_buckets.swap(buckets);
+}
+
+// intern an endpoint ID
+endpoint_handle_t EndpointTable::intern(const char *endpoint_id) {
+  uint32_t hash = EndpointTable::hash(endpoint_id);
+  pthread_rwlock_wrlock(&this->m_lock);
+  endpoint_handle_t handle = this->findLocked(endpoint_id, hash);
+  if (handle == ENDPOINT_HANDLE_INVALID) {
+    size_t length = strlen(endpoint_id);
+    this->m_endpoint_ids.push_back(this->copyLocked(endpoint_id, length));
+    this->m_hashes.push_back(hash);
+    this->m_num_bytes += length + 1;
+    handle = (endpoint_handle_t)this->m_endpoint_ids.size();
+    if (2 * this->m_endpoint_ids.size() > this->m_buckets.size()) {
+      this->growLocked();
+    } else {
+      size_t mask = this->m_buckets.size() - 1;
+      size_t i = hash & mask;
+      while (this->m_buckets[i] != ENDPOINT_HANDLE_INVALID) {
+        i = (i + 1) & mask;
+      }
+      this->m_buckets[i] = handle;
+    }
+  }
+  pthread_rwlock_unlock(&this->m_lock);
+  return handle;
+}
+
+// find an endpoint ID's handle
+endpoint_handle_t EndpointTable::find(const char *endpoint_id) {
+  uint32_t hash = EndpointTable::hash(endpoint_id);
+  pthread_rwlock_rdlock(&this->m_lock);
+  endpoint_handle_t handle = this->findLocked(endpoint_id, hash);
+  pthread_rwlock_unlock(&this->m_lock);
+  return handle;
+}
+
+// get the interned endpoint ID for a handle
+const char *EndpointTable::lookup(endpoint_handle_t handle) {
+  const char *endpoint_id = NULL;
+  pthread_rwlock_rdlock(&this->m_lock);
+  if (handle != ENDPOINT_HANDLE_INVALID &&
+      handle <= this->m_endpoint_ids.size()) {
+    endpoint_id = this->m_endpoint_ids[handle - 1];
+  }
+  pthread_rwlock_unlock(&this->m_lock);
+  return endpoint_id;
+}
+
+// does "ptr" point into one of our interned copies? Chunks are aligned to
+// their size, so rounding "ptr" down gives the only chunk that can hold it
+// (an oversized copy has a chunk of its own: only its first
+// ENDPOINT_TABLE_CHUNK_BYTES are found, which covers the pointer we hand out)
+bool EndpointTable::isInterned(const void *ptr) {
+  uintptr_t chunk =
+      (uintptr_t)ptr & ~(uintptr_t)(ENDPOINT_TABLE_CHUNK_BYTES - 1);
+  bool interned = false;
+  pthread_rwlock_rdlock(&this->m_lock);
+  size_t mask = this->m_chunk_buckets.size() - 1;
+  for (size_t i = chunkHash(chunk) & mask;; i = (i + 1) & mask) {
+    if (this->m_chunk_buckets[i] == 0 || this->m_chunk_buckets[i] == chunk) {
+      interned = (chunk != 0 && this->m_chunk_buckets[i] == chunk);
+      break;
+    }
+  }
+  pthread_rwlock_unlock(&this->m_lock);
+  return interned;
+}
+
+// get the number of interned endpoint IDs
+size_t EndpointTable::getNumEndpoints() {
+  pthread_rwlock_rdlock(&this->m_lock);
+  size_t num_endpoints = this->m_endpoint_ids.size();
+  pthread_rwlock_unlock(&this->m_lock);
+  return num_endpoints;
+}
+
+// get the number of bytes used by the interned endpoint IDs
+size_t EndpointTable::getNumBytes() {
+  pthread_rwlock_rdlock(&this->m_lock);
+  size_t num_bytes = this->m_num_bytes;
+  pthread_rwlock_unlock(&this->m_lock);
+  return num_bytes;
+}
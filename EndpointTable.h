@@ -0,0 +1,104 @@
+/**
+ * @file    EndpointTable.h
+ * @brief   mbed Edge Endpoint ID Intern Table
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __ENDPOINT_TABLE_H__
+#define __ENDPOINT_TABLE_H__
+
+// system includes
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// handles and string chunks
+#include <vector>
+
+// Tunables for the endpoint table
+#define ENDPOINT_TABLE_CHUNK_BYTES (64 * 1024) // endpoint IDs are packed into
+                                               // chunks (a power of two)
+#define ENDPOINT_TABLE_MIN_BUCKETS 1024         // initial hash table size
+#define ENDPOINT_TABLE_MIN_CHUNK_BUCKETS 16     // initial chunk hash set size
+
+// an interned endpoint ID (0 is never a valid handle)
+typedef uint32_t endpoint_handle_t;
+#define ENDPOINT_HANDLE_INVALID 0
+
+// One stable, NUL-terminated copy of every endpoint ID we have seen, keyed by
+// a small integer handle. Interned IDs are never freed or moved (a removed
+// device may come back with a fleet reload), so the "const char *" returned
+// for a handle can be kept for the life of the process. Lookups do not
+// allocate.
+class EndpointTable {
+public:
+  EndpointTable();
+  virtual ~EndpointTable();
+
+  // the table shared by all of our shadows
+  static EndpointTable *shared();
+
+  // intern an endpoint ID (returns the existing handle if already interned)
+  endpoint_handle_t intern(const char *endpoint_id);
+
+  // find an endpoint ID's handle (ENDPOINT_HANDLE_INVALID if not interned)
+  endpoint_handle_t find(const char *endpoint_id);
+
+  // get the interned endpoint ID for a handle (NULL if invalid)
+  const char *lookup(endpoint_handle_t handle);
+
+  // does "ptr" point into one of our interned copies? O(1): chunks are
+  // aligned to their size, so the chunk holding "ptr" is found by hash
+  bool isInterned(const void *ptr);
+
+  // FNV-1a hash of an endpoint ID
+  static uint32_t hash(const char *endpoint_id);
+
+  // statistics
+  size_t getNumEndpoints();
+  size_t getNumBytes();
+
+private:
+  EndpointTable(const EndpointTable &table);
+  void initialize();
+  endpoint_handle_t findLocked(const char *endpoint_id, uint32_t hash);
+  const char *copyLocked(const char *endpoint_id, size_t length);
+  char *allocateChunkLocked(size_t size);
+  void growLocked();
+  void growChunkBucketsLocked();
+
+private:
+  pthread_rwlock_t m_lock;
+
+  // interned IDs (handle - 1 indexes these)
+  std::vector<const char *> m_endpoint_ids;
+  std::vector<uint32_t> m_hashes;
+
+  // open-addressed hash table of handles (power of two buckets)
+  std::vector<endpoint_handle_t> m_buckets;
+
+  // chunks the IDs are copied into (and an open-addressed hash set of their
+  // addresses, power of two buckets... 0 is an empty bucket)
+  std::vector<char *> m_chunks;
+  std::vector<uintptr_t> m_chunk_buckets;
+  size_t m_chunk_used;
+  size_t m_num_bytes;
+};
+
+#endif // __ENDPOINT_TABLE_H__
@@ -0,0 +1,646 @@
+/**
+ * @file    FleetConfig.cpp
+ * @brief   mbed Edge Orchestrator fleet configuration implementation
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FleetConfig.h"
+
+// AggregationWindow limits, DeviceShadow/NonMbedDevice defaults
+#include "AggregationWindow.h"
+#include "DeviceShadow.h"
+#include "NonMbedDevice.h"
+
+// system includes
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// skip blanks
+static const char *skipSpace(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t')) {
+    ++p;
+  }
+  return p;
+}
+
+// find the end of the token starting at "p"
+static const char *tokenEnd(const char *p, const char *end) {
+  while (p < end && *p != ' ' && *p != '\t') {
+    ++p;
+  }
+  return p;
+}
+
+// does the token [p, e) equal "word"?
+static bool tokenEquals(const char *p, const char *e, const char *word) {
+  size_t length = strlen(word);
+  return ((size_t)(e - p) == length && memcmp(p, word, length) == 0);
+}
+
+// parse a (optionally negative) decimal number spanning [p, e)... false if it
+// does not fit in a long
+static bool parseNumber(const char *p, const char *e, long *value) {
+  bool negative = (p < e && *p == '-');
+  if (negative == true) {
+    ++p;
+  }
+  if (p == e) {
+    return false;
+  }
+  long result = 0;
+  for (; p < e; ++p) {
+    if (*p < '0' || *p > '9') {
+      return false;
+    }
+    int digit = *p - '0';
+    if (result > (LONG_MAX - digit) / 10) {
+      return false; // too large for a long... and for any of our fields
+    }
+    result = result * 10 + digit;
+  }
+  *value = (negative == true) ? -result : result;
+  return true;
+}
+
+// parse "<key>=<number>" spanning [p, e)... false if the key does not match
+static bool parseOption(const char *p, const char *e, const char *key,
+                        long *value, bool *valid) {
+  size_t length = strlen(key);
+  if ((size_t)(e - p) <= length || memcmp(p, key, length) != 0 ||
+      p[length] != '=') {
+    return false;
+  }
+  *valid = parseNumber(p + length + 1, e, value);
+  return true;
+}
+
+// parse "<key>=<string>" spanning [p, e) into "value"... false if the key does
+// not match
+static bool parseStringOption(const char *p, const char *e, const char *key,
+                              char *value, size_t size, bool *valid) {
+  size_t length = strlen(key);
+  if ((size_t)(e - p) <= length || memcmp(p, key, length) != 0 ||
+      p[length] != '=') {
+    return false;
+  }
+  p += length + 1;
+  *valid = (p < e && (size_t)(e - p) < size);
+  if (*valid == true) {
+    memcpy(value, p, e - p);
+    value[e - p] = '\0';
+  }
+  return true;
+}
+
+// parse "<obj>/<inst>/<res>" spanning [p, e)
+static bool parsePath(const char *p, const char *e, uint16_t *ids) {
+  for (int i = 0; i < 3; ++i) {
+    const char *sep = p;
+    while (sep < e && *sep != '/') {
+      ++sep;
+    }
+    long id = 0;
+    if (parseNumber(p, sep, &id) == false || id < 0 || id > 65535 ||
+        (i < 2 && sep == e) || (i == 2 && sep != e)) {
+      return false;
+    }
+    ids[i] = (uint16_t)id;
+    p = sep + 1;
+  }
+  return true;
+}
+
+// constructor
+FleetConfig::FleetConfig() { this->initialize(); }
+
+// destructor
+FleetConfig::~FleetConfig() {}
+
+// copy constructor
+FleetConfig::FleetConfig(const FleetConfig &config) {}
+
+// initialize
+void FleetConfig::initialize() {
+  this->m_path = NULL;
+  this->m_line = 0;
+  this->m_num_devices = 0;
+  this->m_num_errors = 0;
+  this->m_fn = NULL;
+  this->m_ctx = NULL;
+  this->m_in_device = false;
+  this->m_device_valid = false;
+  this->m_has_default_schema = false;
+  this->m_profiles.clear();
+  FleetConfig::initializeDefaultDevice(&this->m_defaults, "");
+  memset(&this->m_device, 0, sizeof(this->m_device));
+}
+
+// the built-in device: our NonMbedDevice's counter and switch
+void FleetConfig::initializeDefaultDevice(fleet_device_config_t *device,
+                                          const char *endpoint_id) {
+  memset(device, 0, sizeof(fleet_device_config_t));
+  snprintf(device->endpoint_id, sizeof(device->endpoint_id), "%s",
+           endpoint_id);
+  device->lifetime = LIFETIME;
+  device->poll_interval_ms = TICKER_SLEEP_TIME_SEC * 1000;
+  device->profile = DeviceProfileTable::shared()->getDefault();
+  device->serial_number = NULL;
+  device->num_resources = 2;
+
+  fleet_resource_config_t *counter = &device->resources[0];
+  counter->object_id = COUNTER_OBJECT_ID;
+  counter->instance_id = 0;
+  counter->resource_id = COUNTER_RESOURCE_ID;
+  counter->operations = OPERATION_READ | OPERATION_WRITE;
+  counter->binding = FLEET_BINDING_COUNTER;
+
+  fleet_resource_config_t *sw = &device->resources[1];
+  sw->object_id = SWITCH_OBJECT_ID;
+  sw->instance_id = 0;
+  sw->resource_id = SWITCH_RESOURCE_ID;
+  sw->operations = OPERATION_READ | OPERATION_WRITE;
+  sw->binding = FLEET_BINDING_SWITCH;
+}
+
+// same PT shape?
+bool FleetConfig::isSameSchema(const fleet_device_config_t *a,
+                               const fleet_device_config_t *b) {
+  // (profiles and serial numbers are interned)
+  if (a->lifetime != b->lifetime || a->profile != b->profile ||
+      a->serial_number != b->serial_number ||
+      a->num_resources != b->num_resources) {
+    return false;
+  }
+  for (int i = 0; i < a->num_resources; ++i) {
+    const fleet_resource_config_t *ra = &a->resources[i];
+    const fleet_resource_config_t *rb = &b->resources[i];
+    if (ra->object_id != rb->object_id || ra->instance_id != rb->instance_id ||
+        ra->resource_id != rb->resource_id ||
+        ra->operations != rb->operations || ra->binding != rb->binding) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// identical configuration?
+bool FleetConfig::isSameDevice(const fleet_device_config_t *a,
+                               const fleet_device_config_t *b) {
+  if (strcmp(a->endpoint_id, b->endpoint_id) != 0 ||
+      a->poll_interval_ms != b->poll_interval_ms ||
+      FleetConfig::isSameSchema(a, b) == false) {
+    return false;
+  }
+  for (int i = 0; i < a->num_resources; ++i) {
+    if (a->resources[i].delta != b->resources[i].delta ||
+        a->resources[i].min_interval_ms != b->resources[i].min_interval_ms ||
+        a->resources[i].window_ms != b->resources[i].window_ms ||
+        a->resources[i].slide_ms != b->resources[i].slide_ms) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// parse a configuration file
+bool FleetConfig::parse(const char *path, fleet_device_fn *fn, void *ctx) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    printf("FleetConfig: ERROR. Unable to open %s: %s\n", path,
+           strerror(errno));
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    printf("FleetConfig: ERROR. Unable to stat %s: %s\n", path,
+           strerror(errno));
+    close(fd);
+    return false;
+  }
+
+  // map the whole file... we walk it once, front to back
+  const char *buffer = NULL;
+  size_t length = (size_t)st.st_size;
+  if (length > 0) {
+    buffer = (const char *)mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (buffer == (const char *)MAP_FAILED) {
+      printf("FleetConfig: ERROR. Unable to map %s: %s\n", path,
+             strerror(errno));
+      close(fd);
+      return false;
+    }
+    madvise((void *)buffer, length, MADV_SEQUENTIAL);
+  }
+  close(fd);
+
+  this->m_path = path;
+  bool parsed = this->parse(buffer, length, fn, ctx);
+  if (buffer != NULL) {
+    munmap((void *)buffer, length);
+  }
+
+  // DEBUG
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  printf("FleetConfig: parsed %d device(s) from %s in %.1f ms (%d error(s))\n",
+         this->m_num_devices, path,
+         (end.tv_sec - start.tv_sec) * 1000.0 +
+             (end.tv_nsec - start.tv_nsec) / 1000000.0,
+         this->m_num_errors);
+  return parsed;
+}
+
+// parse a configuration held in memory
+bool FleetConfig::parse(const char *buffer, size_t length, fleet_device_fn *fn,
+                        void *ctx) {
+  const char *path = (this->m_path != NULL) ? this->m_path : "<memory>";
+  this->initialize();
+  this->m_path = path;
+  this->m_fn = fn;
+  this->m_ctx = ctx;
+
+  const char *p = buffer;
+  const char *end = buffer + length;
+  while (p < end) {
+    const char *eol = (const char *)memchr(p, '\n', end - p);
+    if (eol == NULL) {
+      eol = end;
+    }
+    ++this->m_line;
+    this->parseLine(p, eol);
+    p = eol + 1;
+  }
+  this->emitDevice();
+  this->m_path = NULL;
+  return (this->m_num_errors == 0);
+}
+
+// report a parse error
+void FleetConfig::error(const char *message) {
+  printf("FleetConfig: ERROR. %s:%d: %s\n", this->m_path, this->m_line,
+         message);
+  ++this->m_num_errors;
+}
+
+// parse a single line
+void FleetConfig::parseLine(const char *line, const char *end) {
+  // strip comments and trailing CR
+  const char *comment = (const char *)memchr(line, '#', end - line);
+  if (comment != NULL) {
+    end = comment;
+  }
+  if (end > line && end[-1] == '\r') {
+    --end;
+  }
+
+  const char *p = skipSpace(line, end);
+  if (p == end) {
+    return;
+  }
+  const char *e = tokenEnd(p, end);
+  if (tokenEquals(p, e, "device") == true) {
+    this->parseDevice(e, end);
+  } else if (tokenEquals(p, e, "resource") == true) {
+    this->parseResource(e, end);
+  } else if (tokenEquals(p, e, "defaults") == true) {
+    this->parseDefaults(e, end);
+  } else if (tokenEquals(p, e, "profile") == true) {
+    this->parseProfile(e, end);
+  } else {
+    this->error("unknown directive");
+  }
+}
+
+// parse a device option (lifetime=, poll_interval_ms=, profile=, serial=)
+bool FleetConfig::parseDeviceOption(fleet_device_config_t *device,
+                                    const char *token, const char *token_end) {
+  char text[DEVICE_PROFILE_VALUE_LENGTH];
+  bool valid = false;
+  if (parseStringOption(token, token_end, "profile", text, sizeof(text),
+                        &valid) == true) {
+    std::map<std::string, const device_profile_t *>::iterator it =
+        this->m_profiles.find(text);
+    if (valid == false || it == this->m_profiles.end()) {
+      this->error("unknown device profile");
+      return false;
+    }
+    device->profile = it->second;
+    return true;
+  }
+  if (parseStringOption(token, token_end, "serial", text, sizeof(text),
+                        &valid) == true) {
+    if (valid == false || device == &this->m_defaults) {
+      this->error("invalid serial number (one per device)");
+      return false;
+    }
+    device->serial_number = DeviceProfileTable::shared()->internString(text);
+    return true;
+  }
+
+  long value = 0;
+  if (parseOption(token, token_end, "lifetime", &value, &valid) == true) {
+    device->lifetime = (int)value;
+  } else if (parseOption(token, token_end, "poll_interval_ms", &value,
+                         &valid) == true) {
+    device->poll_interval_ms = (int)value;
+  } else {
+    this->error("unknown device option");
+    return false;
+  }
+  if (valid == false || value < 0 || value > INT_MAX) {
+    this->error("invalid device option value");
+    return false;
+  }
+  return true;
+}
+
+// defaults [lifetime=<sec>] [poll_interval_ms=<ms>] [profile=<name>]
+void FleetConfig::parseDefaults(const char *p, const char *end) {
+  if (this->m_in_device == true || this->m_num_devices > 0) {
+    this->error("defaults must come before the first device");
+    return;
+  }
+  for (p = skipSpace(p, end); p < end; p = skipSpace(p, end)) {
+    const char *e = tokenEnd(p, end);
+    this->parseDeviceOption(&this->m_defaults, p, e);
+    p = e;
+  }
+}
+
+// profile <name> [manufacturer=<s>] [model=<s>] [firmware=<s>] [hardware=<s>]
+//                [software=<s>] [type=<s>]
+void FleetConfig::parseProfile(const char *p, const char *end) {
+  p = skipSpace(p, end);
+  const char *e = tokenEnd(p, end);
+  if (p == e) {
+    this->error("missing profile name");
+    return;
+  }
+  std::string name(p, e - p);
+
+  // fields left out come from the built-in profile
+  const char *keys[] = {"manufacturer", "model",    "firmware",
+                        "hardware",     "software", "type"};
+  char values[6][DEVICE_PROFILE_VALUE_LENGTH];
+  bool given[6] = {false, false, false, false, false, false};
+  for (p = skipSpace(e, end); p < end; p = skipSpace(p, end)) {
+    e = tokenEnd(p, end);
+    bool matched = false;
+    for (int i = 0; i < 6 && matched == false; ++i) {
+      bool valid = false;
+      matched = parseStringOption(p, e, keys[i], values[i],
+                                  sizeof(values[i]), &valid);
+      if (matched == true && valid == false) {
+        this->error("invalid profile value");
+        return;
+      }
+      given[i] = (given[i] == true || matched == true);
+    }
+    if (matched == false) {
+      this->error("unknown profile option");
+      return;
+    }
+    p = e;
+  }
+  device_profile_t profile;
+  profile.manufacturer = (given[0] == true) ? values[0] : NULL;
+  profile.model_number = (given[1] == true) ? values[1] : NULL;
+  profile.firmware_version = (given[2] == true) ? values[2] : NULL;
+  profile.hardware_version = (given[3] == true) ? values[3] : NULL;
+  profile.software_version = (given[4] == true) ? values[4] : NULL;
+  profile.device_type = (given[5] == true) ? values[5] : NULL;
+  this->m_profiles[name] = DeviceProfileTable::shared()->intern(&profile);
+}
+
+// device <endpoint name> [lifetime=<sec>] [poll_interval_ms=<ms>] [...]
+void FleetConfig::parseDevice(const char *p, const char *end) {
+  // the previous device is complete...
+  this->emitDevice();
+
+  // start from the defaults (less the default schema)
+  this->m_device = this->m_defaults;
+  this->m_device.num_resources = 0;
+  this->m_in_device = true;
+
+  p = skipSpace(p, end);
+  const char *e = tokenEnd(p, end);
+  if (p == e || (size_t)(e - p) >= FLEET_CONFIG_ENDPOINT_ID_LENGTH) {
+    // its resource lines are still parsed (and checked)... just not emitted
+    this->error("missing or too long device endpoint name");
+    this->m_device_valid = false;
+    return;
+  }
+  memcpy(this->m_device.endpoint_id, p, e - p);
+  this->m_device.endpoint_id[e - p] = '\0';
+  this->m_device_valid = true;
+  for (p = skipSpace(e, end); p < end; p = skipSpace(p, end)) {
+    e = tokenEnd(p, end);
+    this->parseDeviceOption(&this->m_device, p, e);
+    p = e;
+  }
+}
+
+// resource <obj>/<inst>/<res> <r|w|x...> <counter|switch|none> [options]
+void FleetConfig::parseResource(const char *p, const char *end) {
+  // before the first device, resources make up the default schema (which
+  // replaces the built-in one)
+  fleet_device_config_t *device = &this->m_device;
+  if (this->m_in_device == false) {
+    device = &this->m_defaults;
+    if (this->m_has_default_schema == false) {
+      device->num_resources = 0;
+      this->m_has_default_schema = true;
+    }
+  }
+  if (device->num_resources == FLEET_CONFIG_MAX_RESOURCES) {
+    this->error("too many resources");
+    return;
+  }
+  fleet_resource_config_t resource;
+  memset(&resource, 0, sizeof(resource));
+
+  // path
+  uint16_t ids[3];
+  p = skipSpace(p, end);
+  const char *e = tokenEnd(p, end);
+  if (parsePath(p, e, ids) == false) {
+    this->error("invalid resource path (expected <obj>/<inst>/<res>)");
+    return;
+  }
+  resource.object_id = ids[0];
+  resource.instance_id = ids[1];
+  resource.resource_id = ids[2];
+
+  // operations
+  p = skipSpace(e, end);
+  e = tokenEnd(p, end);
+  for (const char *c = p; c < e; ++c) {
+    if (*c == 'r') {
+      resource.operations |= OPERATION_READ;
+    } else if (*c == 'w') {
+      resource.operations |= OPERATION_WRITE;
+    } else if (*c == 'x') {
+      resource.operations |= OPERATION_EXECUTE;
+    } else {
+      resource.operations = 0;
+      break;
+    }
+  }
+  if (resource.operations == 0) {
+    this->error("invalid resource operations (expected r, w and/or x)");
+    return;
+  }
+
+  // binding
+  p = skipSpace(e, end);
+  e = tokenEnd(p, end);
+  if (tokenEquals(p, e, "counter") == true) {
+    resource.binding = FLEET_BINDING_COUNTER;
+  } else if (tokenEquals(p, e, "switch") == true) {
+    resource.binding = FLEET_BINDING_SWITCH;
+  } else if (tokenEquals(p, e, "none") == true) {
+    resource.binding = FLEET_BINDING_NONE;
+  } else if (tokenEquals(p, e, "count") == true) {
+    resource.binding = FLEET_BINDING_COUNT;
+  } else if (tokenEquals(p, e, "sum") == true) {
+    resource.binding = FLEET_BINDING_SUM;
+  } else if (tokenEquals(p, e, "min") == true) {
+    resource.binding = FLEET_BINDING_MIN;
+  } else if (tokenEquals(p, e, "max") == true) {
+    resource.binding = FLEET_BINDING_MAX;
+  } else if (tokenEquals(p, e, "mean") == true) {
+    resource.binding = FLEET_BINDING_MEAN;
+  } else {
+    this->error("invalid resource binding (expected counter, switch, none, "
+                "count, sum, min, max or mean)");
+    return;
+  }
+
+  // filter policy
+  for (p = skipSpace(e, end); p < end; p = skipSpace(p, end)) {
+    e = tokenEnd(p, end);
+    long value = 0;
+    long max_value = INT_MAX; // all but the delta are ints
+    bool valid = false;
+    if (parseOption(p, e, "delta", &value, &valid) == true) {
+      resource.delta = value;
+      max_value = LONG_MAX;
+    } else if (parseOption(p, e, "min_interval_ms", &value, &valid) == true) {
+      resource.min_interval_ms = (int)value;
+    } else if (parseOption(p, e, "window_ms", &value, &valid) == true) {
+      resource.window_ms = (int)value;
+    } else if (parseOption(p, e, "slide_ms", &value, &valid) == true) {
+      resource.slide_ms = (int)value;
+    } else {
+      this->error("unknown resource option");
+      return;
+    }
+    if (valid == false || value < 0 || value > max_value) {
+      this->error("invalid resource option value");
+      return;
+    }
+    p = e;
+  }
+
+  // aggregates need a window (and only they have one)
+  bool aggregate = (resource.binding >= FLEET_BINDING_COUNT);
+  if (aggregate == true && resource.window_ms == 0) {
+    this->error("aggregate resources need a window_ms");
+    return;
+  }
+  if (aggregate == false && (resource.window_ms > 0 || resource.slide_ms > 0)) {
+    this->error("window_ms/slide_ms only apply to aggregate resources");
+    return;
+  }
+  if (resource.slide_ms > resource.window_ms) {
+    this->error("slide_ms cannot be longer than window_ms");
+    return;
+  }
+
+  // no duplicates... and only one resource can carry the counter
+  for (int i = 0; i < device->num_resources; ++i) {
+    fleet_resource_config_t *other = &device->resources[i];
+    if (other->object_id == resource.object_id &&
+        other->instance_id == resource.instance_id &&
+        other->resource_id == resource.resource_id) {
+      this->error("duplicate resource");
+      return;
+    }
+    if (other->binding == FLEET_BINDING_COUNTER &&
+        resource.binding == FLEET_BINDING_COUNTER) {
+      this->error("only one resource can be bound to the counter");
+      return;
+    }
+  }
+  device->resources[device->num_resources++] = resource;
+}
+
+// hand the device we have been parsing to our callback
+void FleetConfig::emitDevice() {
+  if (this->m_in_device == false) {
+    return;
+  }
+  this->m_in_device = false;
+  if (this->m_device_valid == false) {
+    return;
+  }
+
+  // devices without their own resources get the default schema
+  if (this->m_device.num_resources == 0) {
+    this->m_device.num_resources = this->m_defaults.num_resources;
+    memcpy(this->m_device.resources, this->m_defaults.resources,
+           sizeof(this->m_device.resources));
+  }
+
+  // a sliding window keeps every sample of window_ms: refuse those that would
+  // outgrow its ring at this poll interval (they would drop samples early)
+  for (int i = 0; i < this->m_device.num_resources; ++i) {
+    const fleet_resource_config_t *resource = &this->m_device.resources[i];
+    if (resource->slide_ms > 0 && resource->slide_ms < resource->window_ms &&
+        AggregationWindow::samplesNeeded(resource->window_ms,
+                                         this->m_device.poll_interval_ms) >
+            AGGREGATION_WINDOW_MAX_SAMPLES) {
+      char message[FLEET_CONFIG_ENDPOINT_ID_LENGTH + 80];
+      snprintf(message, sizeof(message),
+               "%s: window_ms holds too many samples at poll_interval_ms",
+               this->m_device.endpoint_id);
+      this->error(message);
+      return;
+    }
+  }
+  ++this->m_num_devices;
+  if (this->m_fn != NULL) {
+    (this->m_fn)(&this->m_device, this->m_ctx);
+  }
+}
+
+// get the number of devices parsed
+int FleetConfig::getNumDevices() { return this->m_num_devices; }
+
+// get the number of errors found
+int FleetConfig::getNumErrors() { return this->m_num_errors; }
@@ -0,0 +1,166 @@
+/**
+ * @file    FleetConfig.h
+ * @brief   mbed Edge Orchestrator fleet configuration (streaming parser)
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __FLEET_CONFIG_H__
+#define __FLEET_CONFIG_H__
+
+// system includes
+#include <stddef.h>
+#include <stdint.h>
+
+// mbed-edge PT includes (LWM2M operations)
+#include "common/constants.h"
+
+// shared device profiles
+#include "DeviceProfile.h"
+
+// named profiles (per parse)
+#include <map>
+#include <string>
+
+// Tunables for the fleet configuration
+#define FLEET_CONFIG_ENDPOINT_ID_LENGTH 64 // max endpoint name length
+#define FLEET_CONFIG_MAX_RESOURCES 16      // max resources per device schema
+
+// what drives a resource's value on the device side
+enum FLEET_RESOURCE_BINDING {
+  FLEET_BINDING_NONE = 0, // value only lives in the shadow
+  FLEET_BINDING_COUNTER,  // the device's (polled) counter
+  FLEET_BINDING_SWITCH,   // the device's I/O switch
+  FLEET_BINDING_COUNT,    // aggregates of the counter over a window...
+  FLEET_BINDING_SUM,
+  FLEET_BINDING_MIN,
+  FLEET_BINDING_MAX,
+  FLEET_BINDING_MEAN
+};
+
+// a resource in a device's schema (and its forwarding filter policy)
+typedef struct fleet_resource_config {
+  uint16_t object_id;
+  uint16_t instance_id;
+  uint16_t resource_id;
+  uint8_t operations; // OPERATION_READ | OPERATION_WRITE | OPERATION_EXECUTE
+  FLEET_RESOURCE_BINDING binding;
+  long delta;          // only forward changes of at least this much (0: all)
+  int min_interval_ms; // forward at most once per interval (0: no limit)
+  int window_ms;       // aggregates: window length
+  int slide_ms;        // aggregates: publish interval (0: tumbling)
+} fleet_resource_config_t;
+
+// a device in the fleet
+typedef struct fleet_device_config {
+  char endpoint_id[FLEET_CONFIG_ENDPOINT_ID_LENGTH];
+  int lifetime;         // registration lifetime (seconds)
+  int poll_interval_ms; // device poll interval (0: not polled)
+  const device_profile_t *profile; // device object metadata (shared)
+  const char *serial_number; // interned (NULL: the endpoint name)
+  int num_resources;
+  fleet_resource_config_t resources[FLEET_CONFIG_MAX_RESOURCES];
+} fleet_device_config_t;
+
+// called once per device as the configuration is parsed
+typedef void(fleet_device_fn)(const fleet_device_config_t *device, void *ctx);
+
+// The configuration is line oriented ('#' starts a comment):
+//
+//   profile <name> [manufacturer=<s>] [model=<s>] [firmware=<s>]
+//           [hardware=<s>] [software=<s>] [type=<s>]
+//   defaults [lifetime=<sec>] [poll_interval_ms=<ms>] [profile=<name>]
+//   resource <obj>/<inst>/<res> <r|w|x...> <counter|switch|none>
+//            [delta=<n>] [min_interval_ms=<ms>]
+//   resource <obj>/<inst>/<res> <r|w|x...> <count|sum|min|max|mean>
+//            window_ms=<ms> [slide_ms=<ms>]
+//   device <endpoint name> [lifetime=<sec>] [poll_interval_ms=<ms>]
+//          [profile=<name>] [serial=<s>]
+//
+// "resource" lines add to the schema of the device above them. Resources
+// given before the first device make up the default schema used by every
+// device that does not list its own. The file is mmap()'ed and parsed in a
+// single pass... each device is handed to the callback as soon as it is
+// complete, so the caller can build its registry while we parse.
+//
+// A profile holds the device object metadata shared by a class of devices
+// (fields it leaves out come from the built-in profile). Profiles are
+// interned (see "DeviceProfile"): every device using one references a single
+// copy of it, and only the serial number is kept per device.
+//
+// Aggregate resources publish a function of the counter's samples over a
+// window (tumbling, or sliding by slide_ms); a device with any of them
+// forwards its counter along with the aggregates as each window closes.
+class FleetConfig {
+public:
+  FleetConfig();
+  virtual ~FleetConfig();
+
+  // parse a configuration file (false if it cannot be read or is invalid)
+  bool parse(const char *path, fleet_device_fn *fn, void *ctx);
+
+  // parse a configuration held in memory (not NUL terminated)
+  bool parse(const char *buffer, size_t length, fleet_device_fn *fn,
+             void *ctx);
+
+  // results of the last parse
+  int getNumDevices();
+  int getNumErrors();
+
+  // the built-in device (the counter/switch schema of our NonMbedDevice)
+  static void initializeDefaultDevice(fleet_device_config_t *device,
+                                      const char *endpoint_id);
+
+  // do two devices have the same PT shape (lifetime, device object and
+  // resources)?
+  static bool isSameSchema(const fleet_device_config_t *a,
+                           const fleet_device_config_t *b);
+
+  // are two devices configured identically (schema, polling and filters)?
+  static bool isSameDevice(const fleet_device_config_t *a,
+                           const fleet_device_config_t *b);
+
+private:
+  FleetConfig(const FleetConfig &config);
+  void initialize();
+  void parseLine(const char *line, const char *end);
+  void parseDefaults(const char *p, const char *end);
+  void parseProfile(const char *p, const char *end);
+  void parseDevice(const char *p, const char *end);
+  void parseResource(const char *p, const char *end);
+  bool parseDeviceOption(fleet_device_config_t *device, const char *token,
+                         const char *token_end);
+  void emitDevice();
+  void error(const char *message);
+
+private:
+  const char *m_path;
+  int m_line;
+  int m_num_devices;
+  int m_num_errors;
+  fleet_device_fn *m_fn;
+  void *m_ctx;
+  fleet_device_config_t m_defaults; // defaults and default schema
+  fleet_device_config_t m_device;   // device being parsed
+  bool m_in_device;          // parsing a device's lines
+  bool m_device_valid;       // ... and it can be emitted
+  bool m_has_default_schema; // the file replaced the built-in schema
+  std::map<std::string, const device_profile_t *> m_profiles; // by name
+};
+
+#endif // __FLEET_CONFIG_H__
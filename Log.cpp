@@ -0,0 +1,65 @@
+/**
+ * @file    Log.cpp
+ * @brief   mbed Edge Orchestrator Log Levels Implementation
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "Log.h"
+
+// system includes
+#include <string.h>
+
+// level names
+static const char *level_names[LOG_NUM_LEVELS] = {"warning", "info", "debug"};
+
+// the process-wide level
+static int log_level = LOG_LEVEL_DEBUG;
+
+// STATIC: is "level" enabled?
+bool Log::isEnabled(LOG_LEVEL level) {
+  return ((int)level <= __atomic_load_n(&log_level, __ATOMIC_RELAXED));
+}
+
+// STATIC: get the level
+LOG_LEVEL Log::getLevel() {
+  return (LOG_LEVEL)__atomic_load_n(&log_level, __ATOMIC_RELAXED);
+}
+
+// STATIC: set the level
+void Log::setLevel(LOG_LEVEL level) {
+  __atomic_store_n(&log_level, (int)level, __ATOMIC_RELAXED);
+}
+
+// STATIC: level names
+const char *Log::levelName(LOG_LEVEL level) {
+  return (level >= 0 && level < LOG_NUM_LEVELS) ? level_names[level]
+                                                : "unknown";
+}
+
+// STATIC: parse a level name
+bool Log::parseLevel(const char *name, LOG_LEVEL *level) {
+  for (int i = 0; i < LOG_NUM_LEVELS; ++i) {
+    if (strcmp(name, level_names[i]) == 0) {
+      *level = (LOG_LEVEL)i;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,69 @@
+/**
+ * @file    Log.h
+ * @brief   mbed Edge Orchestrator Log Levels
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __LOG_H__
+#define __LOG_H__
+
+// system includes
+#include <stdio.h>
+
+// log levels: errors and warnings are always printed... "info" adds our
+// lifecycle and status messages, "debug" adds a line per device event (the
+// default, as we have always printed them)
+enum LOG_LEVEL {
+  LOG_LEVEL_WARNING = 0,
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_DEBUG,
+  LOG_NUM_LEVELS
+};
+
+// print if the level is enabled (the arguments are not evaluated otherwise)
+#define LOG_INFO(...)                                                          \
+  do {                                                                         \
+    if (Log::isEnabled(LOG_LEVEL_INFO) == true) {                              \
+      printf(__VA_ARGS__);                                                     \
+    }                                                                          \
+  } while (0)
+#define LOG_DEBUG(...)                                                         \
+  do {                                                                         \
+    if (Log::isEnabled(LOG_LEVEL_DEBUG) == true) {                             \
+      printf(__VA_ARGS__);                                                     \
+    }                                                                          \
+  } while (0)
+
+// the process-wide log level (changed at runtime from the control socket)
+class Log {
+public:
+  // is "level" enabled? (any thread)
+  static bool isEnabled(LOG_LEVEL level);
+
+  // get/set the level
+  static LOG_LEVEL getLevel();
+  static void setLevel(LOG_LEVEL level);
+
+  // level names ("warning", "info", "debug")... false if "name" is not one
+  static const char *levelName(LOG_LEVEL level);
+  static bool parseLevel(const char *name, LOG_LEVEL *level);
+};
+
+#endif // __LOG_H__
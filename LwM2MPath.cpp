@@ -0,0 +1,61 @@
+/**
+ * @file    LwM2MPath.cpp
+ * @brief   mbed Edge LwM2M Path Formatter Implementation
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "LwM2MPath.h"
+
+// constructor
+LwM2MPath::LwM2MPath(const char *endpoint_id, const uint16_t object_id,
+                     const uint16_t instance_id, const uint16_t resource_id) {
+  this->m_length = 0;
+  this->m_path[0] = '\0';
+  if (endpoint_id != NULL) {
+    this->append(endpoint_id);
+  }
+  this->append("/");
+  this->append(object_id);
+  this->append("/");
+  this->append(instance_id);
+  this->append("/");
+  this->append(resource_id);
+}
+
+// append a string (truncated at the end of our buffer)
+void LwM2MPath::append(const char *string) {
+  while (*string != '\0' && this->m_length < LWM2M_PATH_MAX_LENGTH - 1) {
+    this->m_path[this->m_length++] = *string++;
+  }
+  this->m_path[this->m_length] = '\0';
+}
+
+// append an ID in decimal
+void LwM2MPath::append(uint16_t value) {
+  char digits[8];
+  int num_digits = 0;
+  do {
+    digits[num_digits++] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value > 0);
+  while (num_digits > 0 && this->m_length < LWM2M_PATH_MAX_LENGTH - 1) {
+    this->m_path[this->m_length++] = digits[--num_digits];
+  }
+  this->m_path[this->m_length] = '\0';
+}
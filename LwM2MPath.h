@@ -0,0 +1,54 @@
+/**
+ * @file    LwM2MPath.h
+ * @brief   mbed Edge LwM2M Path Formatter (stack buffer, no allocation)
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __LWM2M_PATH_H__
+#define __LWM2M_PATH_H__
+
+// system includes
+#include <stddef.h>
+#include <stdint.h>
+
+// Tunables for the path formatter
+#define LWM2M_PATH_MAX_LENGTH 128 // longer endpoint IDs are truncated
+
+// An LwM2M path ("<endpoint>/<object>/<instance>/<resource>") formatted into
+// a buffer that lives wherever the LwM2MPath does... on the stack in our hot
+// paths, so logging/looking up a URI never touches the heap (or printf)
+class LwM2MPath {
+public:
+  LwM2MPath(const char *endpoint_id, const uint16_t object_id,
+            const uint16_t instance_id, const uint16_t resource_id);
+
+  // the formatted path
+  const char *c_str() const { return this->m_path; }
+  size_t length() const { return this->m_length; }
+
+private:
+  void append(const char *string);
+  void append(uint16_t value);
+
+private:
+  char m_path[LWM2M_PATH_MAX_LENGTH];
+  size_t m_length;
+};
+
+#endif // __LWM2M_PATH_H__
@@ -21,13 +21,22 @@
  */
 
 #include "NonMbedDevice.h"
+#include "Log.h"
+#include "Profiler.h"
+#include "Threads.h"
+#include <errno.h>
+#include <time.h>
 #include <unistd.h>
 
 // constructor
 NonMbedDevice::NonMbedDevice() { this->initialize(); }
 
 // destructor
-NonMbedDevice::~NonMbedDevice() {}
+NonMbedDevice::~NonMbedDevice() {
+  this->stop();
+  pthread_cond_destroy(&this->m_cond);
+  pthread_mutex_destroy(&this->m_mutex);
+}
 
 // copy constructor
 NonMbedDevice::NonMbedDevice(const NonMbedDevice &device) {}
@@ -39,6 +48,9 @@ void NonMbedDevice::initialize() {
   this->m_counter = 0;
   this->m_ctx = NULL;
   this->m_is_running = true;
+  this->m_is_started = false;
+  pthread_mutex_init(&this->m_mutex, NULL);
+  pthread_cond_init(&this->m_cond, NULL);
 }
 
 // set the event callback handler
@@ -65,10 +77,24 @@ void NonMbedDevice::deviceRunLoop() {
   printf(
       "NonMbedDevice: non mbed device loop starting...(thread id: %08x)...\n",
       (unsigned int)pthread_self());
+  Profiler::shared()->registerThread("ticker");
+  pthread_mutex_lock(&this->m_mutex);
   while (this->m_is_running == true) {
+    pthread_mutex_unlock(&this->m_mutex);
     this->tick();
-    sleep(TICKER_SLEEP_TIME_SEC);
+    pthread_mutex_lock(&this->m_mutex);
+
+    // sleep until our next tick (or until we are stopped)
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += TICKER_SLEEP_TIME_SEC;
+    while (this->m_is_running == true &&
+           pthread_cond_timedwait(&this->m_cond, &this->m_mutex, &deadline) !=
+               ETIMEDOUT) {
+    }
   }
+  pthread_mutex_unlock(&this->m_mutex);
+  Profiler::shared()->unregisterThread();
 }
 
 // start the device event loop
@@ -77,15 +103,24 @@ void NonMbedDevice::start() {
   printf("NonMbedDevice::starting the device event loop...\n");
 
   // create a simple thread to start a monotonic counter...
-  pthread_create(&this->m_ticker_thread, NULL, &NonMbedDevice::tickerProcessor,
-                 (void *)this);
+  this->m_is_started = Threads::create(
+      &this->m_ticker_thread, &NonMbedDevice::tickerProcessor, (void *)this);
 }
 
 // stop the device event loop
 void NonMbedDevice::stop() {
   // DEBUG
   printf("NonMbedDevice: Stopping device event loop...\n");
+  pthread_mutex_lock(&this->m_mutex);
   this->m_is_running = false;
+  pthread_cond_broadcast(&this->m_cond);
+  pthread_mutex_unlock(&this->m_mutex);
+
+  // wait for the ticker thread to finish its current tick and exit
+  if (this->m_is_started == true) {
+    pthread_join(this->m_ticker_thread, NULL);
+    this->m_is_started = false;
+  }
 }
 
 // set the switch state
@@ -93,8 +128,8 @@ void NonMbedDevice::setSwitchState(bool switch_state) {
   this->m_switch_state = switch_state;
 
   // DEBUG
-  printf("NonMbedDevice: Switch State set: %s\n",
-         this->m_switch_state ? "on" : "off");
+  LOG_DEBUG("NonMbedDevice: Switch State set: %s\n",
+            this->m_switch_state ? "on" : "off");
 }
 
 // get the switch state
@@ -109,7 +144,7 @@ void NonMbedDevice::tick() {
   ++this->m_counter;
 
   // DEBUG
-  printf("NonMbedDevice: TICK(%d)...\n", this->m_counter);
+  LOG_DEBUG("NonMbedDevice: TICK(%d)...\n", this->m_counter);
 
   // call handler if we have one
   if (this->m_event_fn != NULL) {
@@ -117,10 +152,13 @@ void NonMbedDevice::tick() {
   }
 }
 
+// poll (no handler is called... the poller picks up the value)
+int NonMbedDevice::poll() { return ++this->m_counter; }
+
 // (re)set our counter value
 void NonMbedDevice::setCounterValue(int counter_value) {
   this->m_counter = counter_value;
 
   // DEBUG
-  printf("NonMbedDevice: Counter value set to: %d\n", this->m_counter);
+  LOG_DEBUG("NonMbedDevice: Counter value set to: %d\n", this->m_counter);
 }
@@ -43,11 +43,15 @@ public:
   // static "tick" processor
   static void *tickerProcessor(void *ctx);
 
-  // main loop for the simulated device (pthread)
+  // main loop for the simulated device (pthread)... stop() joins the loop
   void start();
   void stop();
   void deviceRunLoop();
 
+  // advance the device by one tick without the ticker thread (for devices
+  // polled by their orchestrator shard)... returns the new counter value
+  int poll();
+
   // the simulated device "ticks" a counter value every "n" seconds... so we can
   // get/set its value...
   void setCounterValue(int counter_value);
@@ -69,7 +73,10 @@ private:
   ticker_event_fn *m_event_fn;
   void *m_ctx;
   bool m_is_running;
+  bool m_is_started;
   pthread_t m_ticker_thread;
+  pthread_mutex_t m_mutex;
+  pthread_cond_t m_cond; // wakes the ticker loop early on stop()
 };
 
 #endif // __NON_MBED_DEVICE_H__
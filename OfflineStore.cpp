@@ -0,0 +1,351 @@
+/**
+ * @file    OfflineStore.cpp
+ * @brief   mbed Edge Offline Store-and-Forward Segment Log Implementation
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "OfflineStore.h"
+
+// system includes
+#include <dirent.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// compaction support
+#include <set>
+#include <string>
+
+// constructor
+OfflineStore::OfflineStore(const char *directory) {
+  this->initialize(directory);
+}
+
+// destructor
+OfflineStore::~OfflineStore() {
+  this->closeSegment();
+  if (this->m_directory != NULL) {
+    free(this->m_directory);
+  }
+  pthread_mutex_destroy(&this->m_replay_mutex);
+  pthread_mutex_destroy(&this->m_mutex);
+}
+
+// copy constructor
+OfflineStore::OfflineStore(const OfflineStore &store) {}
+
+// initialize
+void OfflineStore::initialize(const char *directory) {
+  pthread_mutex_init(&this->m_mutex, NULL);
+  pthread_mutex_init(&this->m_replay_mutex, NULL);
+  this->m_directory = strdup(directory);
+  this->m_segment = NULL;
+  this->m_segment_bytes = 0;
+  this->m_first_segment = 0;
+  this->m_last_segment = 0;
+  this->m_sequence = 0;
+  this->m_num_records = 0;
+  this->m_num_dropped = 0;
+}
+
+// build the path to a given segment
+void OfflineStore::segmentPath(char *buffer, size_t length, uint32_t segment) {
+  snprintf(buffer, length, "%s/segment-%08u.log", this->m_directory, segment);
+}
+
+// open the store
+bool OfflineStore::open() {
+  if (mkdir(this->m_directory, 0755) != 0 && errno != EEXIST) {
+    printf("OfflineStore: ERROR. Unable to create store directory %s: %s\n",
+           this->m_directory, strerror(errno));
+    return false;
+  }
+
+  // find any segments left over from a previous run...
+  DIR *dir = opendir(this->m_directory);
+  if (dir == NULL) {
+    printf("OfflineStore: ERROR. Unable to open store directory %s: %s\n",
+           this->m_directory, strerror(errno));
+    return false;
+  }
+  bool found = false;
+  struct dirent *entry = NULL;
+  while ((entry = readdir(dir)) != NULL) {
+    unsigned int segment = 0;
+    if (sscanf(entry->d_name, "segment-%08u.log", &segment) == 1) {
+      if (found == false || segment < this->m_first_segment) {
+        this->m_first_segment = segment;
+      }
+      if (found == false || segment > this->m_last_segment) {
+        this->m_last_segment = segment;
+      }
+      found = true;
+    }
+  }
+  closedir(dir);
+
+  // continue appending to the newest segment
+  pthread_mutex_lock(&this->m_mutex);
+  bool opened = this->openSegment(this->m_last_segment);
+  pthread_mutex_unlock(&this->m_mutex);
+
+  // DEBUG
+  if (found == true) {
+    printf("OfflineStore: found buffered segments %u..%u in %s\n",
+           this->m_first_segment, this->m_last_segment, this->m_directory);
+  }
+  return opened;
+}
+
+// open a segment for appending (lock held)
+bool OfflineStore::openSegment(uint32_t segment) {
+  char path[256];
+  this->segmentPath(path, sizeof(path), segment);
+  this->m_segment = fopen(path, "ab");
+  if (this->m_segment == NULL) {
+    printf("OfflineStore: ERROR. Unable to open segment %s: %s\n", path,
+           strerror(errno));
+    return false;
+  }
+  this->m_segment_bytes = ftell(this->m_segment);
+
+  // cut off a record torn by a crash... otherwise everything we append would
+  // land out of step with the record boundaries and be skipped on replay
+  long torn = this->m_segment_bytes % (long)sizeof(offline_store_record_t);
+  if (torn != 0) {
+    this->m_segment_bytes -= torn;
+    if (ftruncate(fileno(this->m_segment), this->m_segment_bytes) != 0) {
+      printf("OfflineStore: ERROR. Unable to truncate segment %s: %s\n", path,
+             strerror(errno));
+      this->closeSegment();
+      return false;
+    }
+
+    // DEBUG
+    printf("OfflineStore: dropped a torn record (%ld bytes) at the end of %s\n",
+           torn, path);
+  }
+  return true;
+}
+
+// close the current segment (lock held)
+void OfflineStore::closeSegment() {
+  if (this->m_segment != NULL) {
+    fclose(this->m_segment);
+    this->m_segment = NULL;
+  }
+  this->m_segment_bytes = 0;
+}
+
+// drop the oldest segment to keep our disk usage bounded (lock held)
+void OfflineStore::dropOldestSegment() {
+  char path[256];
+  struct stat st;
+  this->segmentPath(path, sizeof(path), this->m_first_segment);
+  if (stat(path, &st) == 0) {
+    this->m_num_dropped += st.st_size / sizeof(offline_store_record_t);
+  }
+  unlink(path);
+  ++this->m_first_segment;
+
+  // DEBUG
+  printf("OfflineStore: disk bound reached. Dropped oldest segment (%llu "
+         "records dropped so far)\n",
+         (unsigned long long)this->m_num_dropped);
+}
+
+// simple record checksum (detects torn writes at the tail of a segment)
+uint32_t OfflineStore::checksum(const offline_store_record_t *record) {
+  const uint8_t *bytes = (const uint8_t *)record;
+  uint32_t sum = 2166136261u;
+  for (size_t i = 0; i < offsetof(offline_store_record_t, checksum); ++i) {
+    sum = (sum ^ bytes[i]) * 16777619u;
+  }
+  return sum;
+}
+
+// append a shadow update
+bool OfflineStore::append(const char *endpoint_id, const uint16_t object_id,
+                          const uint16_t instance_id,
+                          const uint16_t resource_id, long value) {
+  offline_store_record_t record;
+  memset(&record, 0, sizeof(record));
+  record.magic = OFFLINE_STORE_RECORD_MAGIC;
+  record.object_id = object_id;
+  record.instance_id = instance_id;
+  record.resource_id = resource_id;
+  record.value = (int64_t)value;
+  strncpy(record.endpoint_id, endpoint_id, sizeof(record.endpoint_id) - 1);
+
+  pthread_mutex_lock(&this->m_mutex);
+
+  // roll to a new segment if the current one is full...
+  if (this->m_segment != NULL &&
+      this->m_segment_bytes + (long)sizeof(record) >
+          OFFLINE_STORE_SEGMENT_MAX_BYTES) {
+    this->closeSegment();
+    ++this->m_last_segment;
+    if (this->m_last_segment - this->m_first_segment + 1 >
+        OFFLINE_STORE_MAX_SEGMENTS) {
+      this->dropOldestSegment();
+    }
+  }
+  if (this->m_segment == NULL &&
+      this->openSegment(this->m_last_segment) == false) {
+    pthread_mutex_unlock(&this->m_mutex);
+    return false;
+  }
+
+  // append and flush so that a crash/restart does not lose the record
+  record.sequence = this->m_sequence++;
+  record.checksum = OfflineStore::checksum(&record);
+  bool written = (fwrite(&record, sizeof(record), 1, this->m_segment) == 1 &&
+                  fflush(this->m_segment) == 0);
+  if (written == true) {
+    this->m_segment_bytes += sizeof(record);
+    ++this->m_num_records;
+  } else {
+    // a short write (e.g. disk full) is torn too: reopen (and so truncate)
+    // the segment before the next append
+    this->closeSegment();
+  }
+  pthread_mutex_unlock(&this->m_mutex);
+  return written;
+}
+
+// read all of the valid records in a segment (lock held)
+int OfflineStore::readSegment(uint32_t segment,
+                              offline_store_record_t **records,
+                              int *num_records, int *capacity) {
+  char path[256];
+  this->segmentPath(path, sizeof(path), segment);
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) {
+    return 0;
+  }
+  int count = 0;
+  offline_store_record_t record;
+  while (fread(&record, sizeof(record), 1, fp) == 1) {
+    if (record.magic != OFFLINE_STORE_RECORD_MAGIC ||
+        record.checksum != OfflineStore::checksum(&record)) {
+      printf("OfflineStore: skipping corrupt record in %s\n", path);
+      continue;
+    }
+    if (*num_records == *capacity) {
+      *capacity = (*capacity == 0) ? 1024 : (*capacity * 2);
+      *records = (offline_store_record_t *)realloc(
+          *records, *capacity * sizeof(offline_store_record_t));
+    }
+    (*records)[(*num_records)++] = record;
+    ++count;
+  }
+  fclose(fp);
+  return count;
+}
+
+// replay the compacted log and truncate it
+int OfflineStore::replay(offline_store_replay_fn *fn, void *ctx) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  offline_store_record_t *records = NULL;
+  int num_records = 0;
+  int capacity = 0;
+
+  // one replay at a time (each PT connection replays once it is registered)
+  pthread_mutex_lock(&this->m_replay_mutex);
+
+  // read every segment, oldest first... appends meanwhile go to a new
+  // segment, which this replay leaves alone
+  pthread_mutex_lock(&this->m_mutex);
+  this->closeSegment();
+  uint32_t first_segment = this->m_first_segment;
+  uint32_t last_segment = this->m_last_segment;
+  for (uint32_t segment = first_segment; segment <= last_segment; ++segment) {
+    this->readSegment(segment, &records, &num_records, &capacity);
+  }
+  ++this->m_last_segment;
+  pthread_mutex_unlock(&this->m_mutex);
+
+  // compact: walking backwards, keep only the latest record per resource...
+  std::set<std::string> seen;
+  int num_compacted = 0;
+  for (int i = num_records - 1; i >= 0; --i) {
+    char key[OFFLINE_STORE_ENDPOINT_ID_LENGTH + 32];
+    snprintf(key, sizeof(key), "%.*s/%d/%d/%d",
+             OFFLINE_STORE_ENDPOINT_ID_LENGTH, records[i].endpoint_id,
+             records[i].object_id, records[i].instance_id,
+             records[i].resource_id);
+    if (seen.insert(key).second == false) {
+      records[i].magic = 0; // superseded by a later update
+    } else {
+      ++num_compacted;
+    }
+  }
+
+  // ... and replay the survivors in their original order
+  for (int i = 0; i < num_records; ++i) {
+    if (records[i].magic == OFFLINE_STORE_RECORD_MAGIC && fn != NULL) {
+      (fn)(&records[i], ctx);
+    }
+  }
+  free(records);
+
+  // only now truncate what we read: every value has been handed off (a crash
+  // before this point replays them again on the next run)
+  pthread_mutex_lock(&this->m_mutex);
+  for (uint32_t segment = first_segment; segment <= last_segment; ++segment) {
+    char path[256];
+    this->segmentPath(path, sizeof(path), segment);
+    unlink(path);
+  }
+  if (this->m_first_segment <= last_segment) {
+    this->m_first_segment = last_segment + 1;
+  }
+  this->m_num_records = (this->m_num_records > (uint64_t)num_records)
+                            ? (this->m_num_records - num_records)
+                            : 0;
+  pthread_mutex_unlock(&this->m_mutex);
+  pthread_mutex_unlock(&this->m_replay_mutex);
+
+  // DEBUG
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double elapsed = (end.tv_sec - start.tv_sec) +
+                   (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+  if (num_records > 0) {
+    printf("OfflineStore: replayed %d buffered updates (%d after compaction) "
+           "in %.3f ms (%.0f records/sec)\n",
+           num_records, num_compacted, elapsed * 1000.0,
+           (elapsed > 0) ? (num_records / elapsed) : 0.0);
+  }
+  return num_compacted;
+}
+
+// do we have anything buffered?
+bool OfflineStore::isEmpty() {
+  pthread_mutex_lock(&this->m_mutex);
+  bool empty = (this->m_first_segment == this->m_last_segment &&
+                this->m_segment_bytes == 0);
+  pthread_mutex_unlock(&this->m_mutex);
+  return empty;
+}
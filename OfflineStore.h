@@ -0,0 +1,100 @@
+/**
+ * @file    OfflineStore.h
+ * @brief   mbed Edge Offline Store-and-Forward Segment Log
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __OFFLINE_STORE_H__
+#define __OFFLINE_STORE_H__
+
+// system includes
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Tunables for the offline store
+#define OFFLINE_STORE_DIR "./offline-store" // where our segments live
+#define OFFLINE_STORE_SEGMENT_MAX_BYTES                                        \
+  (256 * 1024) // roll to a new segment once this size is reached
+#define OFFLINE_STORE_MAX_SEGMENTS                                             \
+  16 // oldest segment is dropped beyond this (bounds disk usage to ~4MB)
+#define OFFLINE_STORE_ENDPOINT_ID_LENGTH 64 // max endpoint ID length stored
+#define OFFLINE_STORE_RECORD_MAGIC 0x4f53 // "OS"
+
+// a single buffered shadow resource update (fixed size on disk)
+typedef struct offline_store_record {
+  uint16_t magic;
+  uint16_t object_id;
+  uint16_t instance_id;
+  uint16_t resource_id;
+  int64_t value;
+  uint64_t sequence;
+  char endpoint_id[OFFLINE_STORE_ENDPOINT_ID_LENGTH];
+  uint32_t checksum;
+} offline_store_record_t;
+
+// replay callback (invoked once per compacted record, in order)
+typedef void(offline_store_replay_fn)(const offline_store_record_t *record,
+                                      void *ctx);
+
+class OfflineStore {
+public:
+  OfflineStore(const char *directory);
+  virtual ~OfflineStore();
+
+  // open the store (picks up segments left over from a previous run)
+  bool open();
+
+  // append a shadow resource update to the log
+  bool append(const char *endpoint_id, const uint16_t object_id,
+              const uint16_t instance_id, const uint16_t resource_id,
+              long value);
+
+  // replay the compacted log (latest value per resource) and then truncate
+  // what was replayed (once every callback has returned)
+  int replay(offline_store_replay_fn *fn, void *ctx);
+
+  // do we have anything buffered?
+  bool isEmpty();
+
+private:
+  OfflineStore(const OfflineStore &store);
+  void initialize(const char *directory);
+  void segmentPath(char *buffer, size_t length, uint32_t segment);
+  bool openSegment(uint32_t segment);
+  void closeSegment();
+  void dropOldestSegment();
+  int readSegment(uint32_t segment, offline_store_record_t **records,
+                  int *num_records, int *capacity);
+  static uint32_t checksum(const offline_store_record_t *record);
+
+private:
+  pthread_mutex_t m_mutex;
+  pthread_mutex_t m_replay_mutex; // serializes replay()
+  char *m_directory;
+  FILE *m_segment;        // segment currently being appended to
+  long m_segment_bytes;   // bytes written into the current segment
+  uint32_t m_first_segment; // oldest segment still on disk
+  uint32_t m_last_segment;  // segment currently being appended to
+  uint64_t m_sequence;
+  uint64_t m_num_records;
+  uint64_t m_num_dropped;
+};
+
+#endif // __OFFLINE_STORE_H__
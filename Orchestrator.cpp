@@ -25,26 +25,112 @@
 // simulated device
 #include "NonMbedDevice.h"
 
+// local rules
+#include "RulesEngine.h"
+
+// per-device spans
+#include "Tracer.h"
+
+// CPU profiling
+#include "Profiler.h"
+
+// log levels
+#include "Log.h"
+
+// local admin control socket
+#include "ControlSocket.h"
+
+// PT client connections
+#include "PTConnection.h"
+
 // Docooptargs support
 #include "docoptargs.h"
 
-// program ender
-extern "C" void end_program();
+// time support
+#include <time.h>
+
+// registry diffs
+#include <algorithm>
+#include <set>
+
+// elapsed milliseconds between two CLOCK_MONOTONIC timestamps
+static double elapsedMs(const struct timespec *from,
+                        const struct timespec *to) {
+  return (to->tv_sec - from->tv_sec) * 1000.0 +
+         (to->tv_nsec - from->tv_nsec) / 1000000.0;
+}
+
+// hash ring position of a key: FNV-1a (as for the shards) with a final mix,
+// so that similar endpoint IDs and point names land all over the ring
+static uint32_t ringHash(const char *key) {
+  uint32_t hash = EndpointTable::hash(key);
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bU;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35U;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+// hash ring order
+static bool ringPointIsLess(const pt_ring_point_t &a,
+                            const pt_ring_point_t &b) {
+  return a.hash < b.hash;
+}
+
+// absolute CLOCK_REALTIME deadline "ms" milliseconds from now
+static void deadlineAfterMs(struct timespec *deadline, int ms) {
+  clock_gettime(CLOCK_REALTIME, deadline);
+  deadline->tv_sec += ms / 1000;
+  deadline->tv_nsec += (ms % 1000) * 1000000L;
+  if (deadline->tv_nsec >= 1000000000L) {
+    deadline->tv_sec += 1;
+    deadline->tv_nsec -= 1000000000L;
+  }
+}
 
 // default constructor
 Orchestrator::Orchestrator(void *device) { this->initialize(device); }
 
 // destructor
 Orchestrator::~Orchestrator() {
-  if (this->m_connection != NULL) {
-    free(this->m_connection);
+  if (this->m_control_socket != NULL) {
+    delete this->m_control_socket;
+  }
+  this->stopRulesEngine();
+  this->stopShards();
+  for (size_t i = 0; i < this->m_shards.size(); ++i) {
+    delete this->m_shards[i];
+  }
+  for (size_t i = 0; i < this->m_device_shadows.size(); ++i) {
+    delete this->m_device_shadows[i];
   }
-  if (this->m_device_shadow != NULL) {
-    delete this->m_device_shadow;
+  this->deleteRetiredShadows();
+  for (size_t i = 0; i < this->m_fleet_devices.size(); ++i) {
+    delete this->m_fleet_devices[i];
   }
+  for (size_t i = 0; i < this->m_pt_connections.size(); ++i) {
+    delete this->m_pt_connections[i];
+  }
+  free(this->m_rules_path);
+  free(this->m_trace_path);
+  free(this->m_profile_prefix);
+  free(this->m_control_path);
+  free(this->m_config_path);
+  free(this->m_fleet_endpoint_postfix);
   if (this->m_pt_ctx != NULL) {
+    free(this->m_pt_ctx->name);
+    free((char *)this->m_pt_ctx->hostname);
     free(this->m_pt_ctx);
   }
+  if (this->m_offline_store != NULL) {
+    delete this->m_offline_store;
+  }
+  sem_destroy(&this->m_event_sem);
+  pthread_rwlock_destroy(&this->m_registry_lock);
+  pthread_mutex_destroy(&this->m_fleet_mutex);
+  pthread_cond_destroy(&this->m_cond);
+  pthread_mutex_destroy(&this->m_mutex);
 }
 
 // copy constructor
@@ -54,17 +140,51 @@ Orchestrator::Orchestrator(const Orchestrator &orchestrator) {}
 void Orchestrator::initialize(void *device) {
   // bind to the actual underlying device and init...
   this->m_device = device;
-  this->m_connection = NULL;
-  this->m_pt_connected = false;
+  this->m_pt_ctx = NULL;
+  this->m_shutting_down = false;
 
-  // create our device shadow (only one for the one actual device we have
-  // underneath...)
-  this->m_device_shadow = new DeviceShadow((void *)this);
-}
+  // shutdown state
+  this->m_state = ORCHESTRATOR_RUNNING;
+  this->m_shutdown_requested = 0;
+  this->m_shutdown_signal = 0;
+  sem_init(&this->m_event_sem, 0, 0);
+  this->m_num_writes_in_flight = 0;
+  this->m_max_writes_in_flight = 0;
+  this->m_pressure = ORCHESTRATOR_PRESSURE_NONE;
+  this->m_num_pending_deregistrations = 0;
+  this->m_pt_threads_stuck = false;
+  this->m_num_shards = 0;
+  this->m_fleet_endpoint_postfix = NULL;
+  this->m_fleet_has_duplicates = false;
+  this->m_config_path = NULL;
+  this->m_reload_requested = 0;
+  this->m_trace_export_requested = 0;
+  this->m_trace_path = NULL;
+  this->m_profile_toggle_requested = 0;
+  this->m_profile_prefix = strdup(PROFILER_DEFAULT_PREFIX);
+  this->m_profile_hz = PROFILER_DEFAULT_HZ;
+  this->m_control_path = NULL;
+  this->m_control_socket = NULL;
+  this->m_poll_scale_percent = 100;
+  this->m_coalesce_interval_ms = SHARD_COALESCE_INTERVAL_MS;
+  pthread_mutex_init(&this->m_fleet_mutex, NULL);
+  this->m_rules_path = NULL;
+  this->m_rules_engine = NULL;
+  this->m_num_device_shadows = 0;
+  pthread_rwlock_init(&this->m_registry_lock, NULL);
 
-// get the connection
-struct connection *Orchestrator::getConnection() {
-  return this->m_connection;
+  // reconnection state
+  pthread_mutex_init(&this->m_mutex, NULL);
+  pthread_cond_init(&this->m_cond, NULL);
+
+  // open our offline store-and-forward log (buffers updates while PT is down)
+  this->m_offline_store = new OfflineStore(OFFLINE_STORE_DIR);
+  if (this->m_offline_store->open() == false) {
+    printf("Orchestrator: WARNING. Offline store unavailable... updates made "
+           "while PT is disconnected will be dropped\n");
+    delete this->m_offline_store;
+    this->m_offline_store = NULL;
+  }
 }
 
 // initialize PT
@@ -77,8 +197,8 @@ bool Orchestrator::initializePT(int argc, char **argv) {
     DocoptArgs args = docopt(argc, argv, /* help */ 1, /* version */ "0.1");
 
     // allocate and configure the protocol translator
-    this->m_pt_ctx = (protocol_translator_api_ctx_t *)malloc(
-        sizeof(protocol_translator_api_ctx_t));
+    this->m_pt_ctx = (protocol_translator_api_ctx_t *)calloc(
+        1, sizeof(protocol_translator_api_ctx_t));
     if (!args.protocol_translator_name) {
       printf("Missing required options: --protocol-translator-name parameter "
              "is mandatory\n");
@@ -91,25 +211,485 @@ bool Orchestrator::initializePT(int argc, char **argv) {
     }
     this->m_pt_ctx->port = atoi(args.port);
     this->m_pt_ctx->hostname = strdup(args.host);
+
+    // one PT connection unless told otherwise
+    int num_connections =
+        (args.pt_connections != NULL) ? atoi(args.pt_connections) : 1;
+    if (this->createPTConnections(this->m_pt_ctx->name, num_connections) ==
+        false) {
+      return false;
+    }
+
+    // one shard per core unless told otherwise
+    this->m_num_shards = (args.shards != NULL)
+                             ? atoi(args.shards)
+                             : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (this->m_num_shards < 1) {
+      this->m_num_shards = 1;
+    }
+    if (this->m_num_shards > ORCHESTRATOR_MAX_SHARDS) {
+      this->m_num_shards = ORCHESTRATOR_MAX_SHARDS;
+    }
+
+    // create our device shadows
+    if (this->createDeviceShadows(args.config, args.endpoint_postfix) ==
+        false) {
+      return false;
+    }
+
+    // local rules (started once the shards are)
+    if (args.rules != NULL) {
+      this->m_rules_path = strdup(args.rules);
+    }
+
+    // per-device tracing (a sample of the fleet)
+    if (args.trace != NULL) {
+      this->m_trace_path = strdup(args.trace);
+      int sample_every = (args.trace_sample != NULL)
+                             ? atoi(args.trace_sample)
+                             : TRACE_DEFAULT_SAMPLE_EVERY;
+      Tracer::shared()->setSampling((sample_every > 0) ? sample_every : 1);
+    }
+
+    // CPU profiling: toggled with SIGUSR2 or, with "--profile", running from
+    // the start
+    if (args.profile_hz != NULL) {
+      this->m_profile_hz = atoi(args.profile_hz);
+    }
+    if (args.profile != NULL) {
+      free(this->m_profile_prefix);
+      this->m_profile_prefix = strdup(args.profile);
+      Profiler::shared()->start(this->m_profile_hz);
+    }
+
+    // local admin control socket (started once the shards are)
+    if (args.control != NULL) {
+      this->m_control_path = strdup(args.control);
+    }
+    if (args.log_level != NULL) {
+      LOG_LEVEL level;
+      if (Log::parseLevel(args.log_level, &level) == false) {
+        printf("Orchestrator: ERROR. Unknown log level: %s\n",
+               args.log_level);
+        return false;
+      }
+      Log::setLevel(level);
+    }
+  }
+  return true;
+}
+
+// create our device shadows: one per device in the fleet configuration or,
+// without one, a single shadow for the one actual device we have underneath
+bool Orchestrator::createDeviceShadows(const char *config,
+                                       const char *endpoint_postfix) {
+  if (config != NULL) {
+    return this->loadFleetConfig(config, endpoint_postfix);
+  }
+  if (this->m_device_shadows.empty() == true) {
+    fleet_device_config_t device;
+    FleetConfig::initializeDefaultDevice(&device, SAMPLE_DEVICE_PREFIX);
+    this->addDeviceShadow(
+        new DeviceShadow((void *)this, NULL, &device,
+                         (endpoint_postfix != NULL) ? endpoint_postfix : "-0"));
   }
   return true;
 }
 
-// complete shutdown
-void Orchestrator::completeShutdown() {
-  // close our connection to PT...
-  if (this->m_connection != NULL) {
-    pt_client_shutdown(this->m_connection);
+// load a fleet configuration... the shadow registry is built as it is parsed
+bool Orchestrator::loadFleetConfig(const char *path,
+                                   const char *endpoint_postfix) {
+  // remember where it came from (for reloads)
+  free(this->m_config_path);
+  free(this->m_fleet_endpoint_postfix);
+  this->m_config_path = strdup(path);
+  this->m_fleet_endpoint_postfix =
+      (endpoint_postfix != NULL) ? strdup(endpoint_postfix) : NULL;
+
+  FleetConfig config;
+  this->m_fleet_has_duplicates = false;
+  bool parsed =
+      config.parse(path, &Orchestrator::addFleetDeviceCB, (void *)this);
+  if (parsed == false || this->m_fleet_has_duplicates == true) {
+    printf("Orchestrator: ERROR. Invalid fleet configuration: %s\n", path);
+    return false;
+  }
+  if (config.getNumDevices() == 0) {
+    printf("Orchestrator: ERROR. No devices in fleet configuration: %s\n",
+           path);
+    return false;
+  }
+
+  // the fleet's devices are polled by the shards... our built-in device (and
+  // its ticker) is not used
+  if (this->m_device != NULL) {
+    ((NonMbedDevice *)this->m_device)->stop();
   }
+  return true;
+}
 
-  // end our program
-  end_program();
+// full endpoint ID of a configured device
+void Orchestrator::fleetEndpointID(char *buffer, size_t length,
+                                   const fleet_device_config_t *config) {
+  snprintf(buffer, length, "%s%s", config->endpoint_id,
+           (this->m_fleet_endpoint_postfix != NULL)
+               ? this->m_fleet_endpoint_postfix
+               : "");
+}
+
+// add a shadow (and its simulated device) for a configured device
+void Orchestrator::addFleetDevice(const fleet_device_config_t *config) {
+  NonMbedDevice *device = new NonMbedDevice();
+  DeviceShadow *shadow = new DeviceShadow((void *)this, (void *)device, config,
+                                          this->m_fleet_endpoint_postfix);
+  if (this->addDeviceShadow(shadow) == false) {
+    this->m_fleet_has_duplicates = true;
+    delete shadow;
+    delete device;
+    return;
+  }
+  this->m_fleet_devices.push_back(device);
+  this->m_fleet_configs[shadow->getEndpointHandle()] = *config;
 }
 
-// shutdown
+// STATIC: add a configured device
+void Orchestrator::addFleetDeviceCB(const fleet_device_config_t *config,
+                                    void *ctx) {
+  Orchestrator *instance = (Orchestrator *)ctx;
+  if (instance != NULL) {
+    instance->addFleetDevice(config);
+  }
+}
+
+// STATIC: collect a configured device (reload)
+void Orchestrator::collectFleetDeviceCB(const fleet_device_config_t *config,
+                                        void *ctx) {
+  std::vector<fleet_device_config_t> *devices =
+      (std::vector<fleet_device_config_t> *)ctx;
+  devices->push_back(*config);
+}
+
+// reload the fleet configuration and apply the difference to the live
+// registry: unchanged shadows keep their registration and values
+bool Orchestrator::reloadFleetConfig() {
+  if (this->m_config_path == NULL) {
+    printf("Orchestrator: No fleet configuration to reload\n");
+    return false;
+  }
+  if (__atomic_load_n(&this->m_state, __ATOMIC_ACQUIRE) !=
+      ORCHESTRATOR_RUNNING) {
+    return false;
+  }
+  struct timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // parse the new configuration... if it is invalid we keep the current one
+  FleetConfig config;
+  std::vector<fleet_device_config_t> devices;
+  if (config.parse(this->m_config_path, &Orchestrator::collectFleetDeviceCB,
+                   (void *)&devices) == false ||
+      devices.empty() == true) {
+    printf("Orchestrator: ERROR. Invalid fleet configuration: %s... keeping "
+           "the current one\n",
+           this->m_config_path);
+    return false;
+  }
+
+  // diff it against the live registry (the control socket may change a
+  // configuration meanwhile... it waits for us). Devices we already have are
+  // matched by their interned endpoint handle: only the IDs of new ones are
+  // copied
+  pthread_mutex_lock(&this->m_fleet_mutex);
+  std::vector<bool> wanted(this->m_device_shadow_index.size(), false);
+  std::set<std::string> new_endpoint_ids;
+  std::vector<std::pair<DeviceShadow *, const fleet_device_config_t *> >
+      changed;
+  std::vector<const fleet_device_config_t *> added;
+  size_t num_unchanged = 0;
+  for (size_t i = 0; i < devices.size(); ++i) {
+    char endpoint_id[FLEET_CONFIG_ENDPOINT_ID_LENGTH + 64];
+    this->fleetEndpointID(endpoint_id, sizeof(endpoint_id), &devices[i]);
+    DeviceShadow *shadow = this->getDeviceShadow(endpoint_id);
+    bool duplicate = false;
+    if (shadow == NULL) {
+      duplicate = (new_endpoint_ids.insert(endpoint_id).second == false);
+      added.push_back(&devices[i]);
+    } else {
+      endpoint_handle_t handle = shadow->getEndpointHandle();
+      duplicate = wanted[handle];
+      wanted[handle] = true;
+      std::map<endpoint_handle_t, fleet_device_config_t>::iterator current =
+          this->m_fleet_configs.find(handle);
+      if (current == this->m_fleet_configs.end() ||
+          FleetConfig::isSameDevice(&current->second, &devices[i]) == false) {
+        changed.push_back(std::make_pair(shadow, &devices[i]));
+      } else {
+        ++num_unchanged;
+      }
+    }
+    if (duplicate == true) {
+      printf("Orchestrator: ERROR. Duplicate endpoint ID: %s... keeping the "
+             "current configuration\n",
+             endpoint_id);
+      pthread_mutex_unlock(&this->m_fleet_mutex);
+      return false;
+    }
+  }
+
+  // update the registry (one pass over our shadows)... once a shadow is out
+  // of the index, nothing new can be queued for it
+  std::vector<DeviceShadow *> removed;
+  std::vector<DeviceShadow *> new_shadows;
+  pthread_rwlock_wrlock(&this->m_registry_lock);
+  size_t num_kept = 0;
+  for (size_t i = 0; i < this->m_device_shadows.size(); ++i) {
+    DeviceShadow *shadow = this->m_device_shadows[i];
+    endpoint_handle_t handle = shadow->getEndpointHandle();
+    if (wanted[handle] == true) {
+      this->m_device_shadows[num_kept++] = shadow;
+      continue;
+    }
+    this->m_device_shadow_index[handle] = NULL;
+    this->m_fleet_configs.erase(handle);
+    if (shadow->getPTConnection() != NULL) {
+      ((PTConnection *)shadow->getPTConnection())->removeDeviceShadow();
+    }
+    removed.push_back(shadow);
+  }
+  this->m_device_shadows.resize(num_kept);
+  for (size_t i = 0; i < added.size(); ++i) {
+    NonMbedDevice *device = new NonMbedDevice();
+    DeviceShadow *shadow =
+        new DeviceShadow((void *)this, (void *)device, added[i],
+                         this->m_fleet_endpoint_postfix);
+    this->indexDeviceShadow(shadow);
+    this->m_fleet_configs[shadow->getEndpointHandle()] = *added[i];
+    this->m_device_shadows.push_back(shadow);
+    this->m_fleet_devices.push_back(device);
+    new_shadows.push_back(shadow);
+  }
+  for (size_t i = 0; i < changed.size(); ++i) {
+    this->m_fleet_configs[changed[i].first->getEndpointHandle()] =
+        *changed[i].second;
+  }
+  __atomic_store_n(&this->m_num_device_shadows, this->m_device_shadows.size(),
+                   __ATOMIC_RELEASE);
+  pthread_rwlock_unlock(&this->m_registry_lock);
+
+  // ... and hand the work to the shards that own the shadows
+  for (size_t i = 0; i < removed.size(); ++i) {
+    this->getShard(removed[i])->enqueueRemove(removed[i]);
+  }
+  for (size_t i = 0; i < changed.size(); ++i) {
+    this->getShard(changed[i].first)
+        ->enqueueReconfigure(changed[i].first, changed[i].second);
+  }
+  for (size_t i = 0; i < new_shadows.size(); ++i) {
+    OrchestratorShard *shard =
+        this->m_shards[EndpointTable::hash(new_shadows[i]->getEndpointID()) %
+                       this->m_shards.size()];
+    new_shadows[i]->setShard((void *)shard);
+    this->assignPTConnection(new_shadows[i]);
+    shard->enqueueAdd(new_shadows[i]);
+  }
+  pthread_mutex_unlock(&this->m_fleet_mutex);
+
+  // DEBUG
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  printf("Orchestrator: Reloaded %s in %.1f ms: %zu added, %zu removed, %zu "
+         "changed, %zu unchanged\n",
+         this->m_config_path, elapsedMs(&start, &now), added.size(),
+         removed.size(), changed.size(), num_unchanged);
+  return true;
+}
+
+// create the shards, hand each its shadows and start them
+bool Orchestrator::startShards() {
+  int num_cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  for (int i = 0; i < this->m_num_shards; ++i) {
+    this->m_shards.push_back(new OrchestratorShard(
+        (void *)this, i, (num_cpus > 0) ? (i % num_cpus) : -1));
+  }
+  for (size_t i = 0; i < this->m_device_shadows.size(); ++i) {
+    DeviceShadow *shadow = this->m_device_shadows[i];
+    OrchestratorShard *shard =
+        this->m_shards[EndpointTable::hash(shadow->getEndpointID()) %
+                       this->m_shards.size()];
+    shard->addDeviceShadow(shadow);
+    shadow->setShard((void *)shard);
+    this->assignPTConnection(shadow);
+  }
+  for (size_t i = 0; i < this->m_shards.size(); ++i) {
+    if (this->m_shards[i]->start() == false) {
+      return false;
+    }
+  }
+
+  // DEBUG
+  printf("Orchestrator: %zu shadow(s) spread across %zu shard(s) and %zu PT "
+         "connection(s)\n",
+         this->m_device_shadows.size(), this->m_shards.size(),
+         this->m_pt_connections.size());
+  return true;
+}
+
+// create our PT connections: with more than one, each gets a protocol
+// translator name of its own ("<name>-<index>") and its points on the hash
+// ring that spreads the shadows across them
+bool Orchestrator::createPTConnections(const char *name,
+                                       int num_connections) {
+  if (num_connections < 1) {
+    num_connections = 1;
+  }
+  if (num_connections > PT_MAX_CONNECTIONS) {
+    num_connections = PT_MAX_CONNECTIONS;
+  }
+  for (int i = 0; i < num_connections; ++i) {
+    char connection_name[PT_CONNECTION_NAME_LENGTH];
+    if (num_connections > 1) {
+      snprintf(connection_name, sizeof(connection_name), "%s-%d", name, i);
+    } else {
+      snprintf(connection_name, sizeof(connection_name), "%s", name);
+    }
+    this->m_pt_connections.push_back(
+        new PTConnection((void *)this, i, connection_name,
+                         this->m_pt_ctx->hostname, this->m_pt_ctx->port));
+    for (int point = 0; point < PT_CONNECTION_RING_POINTS; ++point) {
+      char key[PT_CONNECTION_NAME_LENGTH + 16];
+      snprintf(key, sizeof(key), "%s#%d", connection_name, point);
+      pt_ring_point_t ring_point;
+      ring_point.hash = ringHash(key);
+      ring_point.connection = i;
+      this->m_pt_ring.push_back(ring_point);
+    }
+  }
+  std::sort(this->m_pt_ring.begin(), this->m_pt_ring.end(), ringPointIsLess);
+  return true;
+}
+
+// put a shadow on its PT connection
+void Orchestrator::assignPTConnection(DeviceShadow *shadow) {
+  PTConnection *connection = this->getPTConnection(shadow->getEndpointID());
+  if (connection != NULL) {
+    connection->addDeviceShadow();
+  }
+  shadow->setPTConnection((void *)connection);
+}
+
+// get the PT connection an endpoint is on: the first ring point at or after
+// the endpoint's hash (wrapping around)
+PTConnection *Orchestrator::getPTConnection(const char *endpoint_id) {
+  if (this->m_pt_ring.empty() == true) {
+    return NULL;
+  }
+  pt_ring_point_t key;
+  key.hash = ringHash(endpoint_id);
+  key.connection = 0;
+  std::vector<pt_ring_point_t>::iterator point = std::lower_bound(
+      this->m_pt_ring.begin(), this->m_pt_ring.end(), key, ringPointIsLess);
+  if (point == this->m_pt_ring.end()) {
+    point = this->m_pt_ring.begin();
+  }
+  return this->m_pt_connections[point->connection];
+}
+
+// get the number of PT connections
+size_t Orchestrator::getNumPTConnections() {
+  return this->m_pt_connections.size();
+}
+
+// get a PT connection
+PTConnection *Orchestrator::getPTConnectionAt(size_t index) {
+  return (index < this->m_pt_connections.size()) ? this->m_pt_connections[index]
+                                                 : NULL;
+}
+
+// (re)load the local rules
+bool Orchestrator::reloadRules() {
+  RulesEngine *engine =
+      new RulesEngine(this, (this->m_config_path != NULL)
+                                ? this->m_fleet_endpoint_postfix
+                                : NULL);
+  if (engine->parse(this->m_rules_path) == false) {
+    printf("Orchestrator: ERROR. Invalid rules file: %s%s\n",
+           this->m_rules_path,
+           (this->m_rules_engine != NULL) ? " (keeping the running rules)"
+                                          : "");
+    delete engine;
+    return false;
+  }
+  this->stopRulesEngine();
+  this->m_rules_engine = engine;
+  return this->m_rules_engine->start();
+}
+
+// stop (and discard) the rules engine
+void Orchestrator::stopRulesEngine() {
+  if (this->m_rules_engine != NULL) {
+    this->m_rules_engine->stop();
+    delete this->m_rules_engine;
+    this->m_rules_engine = NULL;
+  }
+}
+
+// stop the shards (each drains its queue first)
+void Orchestrator::stopShards() {
+  for (size_t i = 0; i < this->m_shards.size(); ++i) {
+    this->m_shards[i]->stop();
+  }
+}
+
+// get the shard that owns a shadow
+OrchestratorShard *Orchestrator::getShard(DeviceShadow *shadow) {
+  return (OrchestratorShard *)shadow->getShard();
+}
+
+// request a shutdown... this is called from signal context so it may only
+// do async-signal-safe work: the event loop performs the actual shutdown
+void Orchestrator::requestShutdown(int signum) {
+  this->m_shutdown_signal = signum;
+  this->m_shutdown_requested = 1;
+  sem_post(&this->m_event_sem);
+}
+
+// request a fleet configuration reload (signal context, as above)
+void Orchestrator::requestReload(int signum) {
+  this->m_reload_requested = 1;
+  sem_post(&this->m_event_sem);
+}
+
+// request a trace export (signal context)
+void Orchestrator::requestTraceExport(int signum) {
+  this->m_trace_export_requested = 1;
+  sem_post(&this->m_event_sem);
+}
+
+// request a CPU profile start/stop (signal context)
+void Orchestrator::requestProfileToggle(int signum) {
+  this->m_profile_toggle_requested = 1;
+  sem_post(&this->m_event_sem);
+}
+
+// shutdown: stop intake, drain in-flight writes, deregister every shadow,
+// then close PT and join its thread... each phase is bounded in time
 void Orchestrator::shutdown() {
+  if (__atomic_load_n(&this->m_state, __ATOMIC_ACQUIRE) !=
+      ORCHESTRATOR_RUNNING) {
+    return;
+  }
+
   // DEBUG
-  printf("Orchestrator: Shutting down...\n");
+  printf("Orchestrator: Shutting down (signal: %d)...\n",
+         (int)this->m_shutdown_signal);
+  struct timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // DRAINING: no more reconnection attempts or new device events...
+  pthread_mutex_lock(&this->m_mutex);
+  __atomic_store_n(&this->m_shutting_down, true, __ATOMIC_RELEASE);
+  __atomic_store_n(&this->m_state, ORCHESTRATOR_DRAINING, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&this->m_cond);
+  pthread_mutex_unlock(&this->m_mutex);
 
   // stop our NonMbedDevice event loop
   if (this->m_device != NULL) {
@@ -117,62 +697,329 @@ void Orchestrator::shutdown() {
     d->stop();
   }
 
-  // deregister all shadows
-  if (this->m_device_shadow != NULL) {
-    this->m_device_shadow->deregister();
+  // stop the rules engine (no more local writes) and our control socket
+  this->stopRulesEngine();
+  if (this->m_control_socket != NULL) {
+    this->m_control_socket->stop();
+  }
+
+  // stop the shards... they process whatever is already queued. From here on
+  // the shadows are only touched by this thread
+  this->stopShards();
+
+  // flush anything still pending in the shadows and wait (bounded) for the
+  // resulting pt_write_value() calls to be acknowledged
+  this->drainPendingUpdates();
+  if (this->waitForZero(&this->m_num_writes_in_flight,
+                        SHUTDOWN_DRAIN_TIMEOUT_MS) == false) {
+    printf("Orchestrator: WARNING. %zu write(s) still in flight after %d ms\n",
+           this->m_num_writes_in_flight, SHUTDOWN_DRAIN_TIMEOUT_MS);
+  }
+
+  // DEREGISTERING: issue every deregistration at once and wait (bounded) for
+  // them to complete
+  pthread_mutex_lock(&this->m_mutex);
+  __atomic_store_n(&this->m_state, ORCHESTRATOR_DEREGISTERING,
+                   __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&this->m_mutex);
+  for (size_t i = 0; i < this->m_device_shadows.size(); ++i) {
+    pthread_mutex_lock(&this->m_mutex);
+    ++this->m_num_pending_deregistrations;
+    pthread_mutex_unlock(&this->m_mutex);
+    if (this->m_device_shadows[i]->deregister() == false) {
+      this->shadowDeregistered(this->m_device_shadows[i], false);
+    }
+  }
+  if (this->waitForZero(&this->m_num_pending_deregistrations,
+                        SHUTDOWN_DEREGISTER_TIMEOUT_MS) == false) {
+    printf("Orchestrator: WARNING. %zu deregistration(s) still pending after "
+           "%d ms\n",
+           this->m_num_pending_deregistrations,
+           SHUTDOWN_DEREGISTER_TIMEOUT_MS);
+  }
+
+  // STOPPING: close our connection to PT and join the PT thread
+  pthread_mutex_lock(&this->m_mutex);
+  __atomic_store_n(&this->m_state, ORCHESTRATOR_STOPPING, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&this->m_mutex);
+  for (size_t i = 0; i < this->m_pt_connections.size(); ++i) {
+    this->m_pt_connections[i]->shutdown();
+  }
+  struct timespec deadline;
+  deadlineAfterMs(&deadline, SHUTDOWN_JOIN_TIMEOUT_MS);
+  for (size_t i = 0; i < this->m_pt_connections.size(); ++i) {
+    if (this->m_pt_connections[i]->join(&deadline) == false) {
+      printf("Orchestrator: WARNING. PT thread %zu did not exit within %d "
+             "ms... leaving its state to the process exit\n",
+             i, SHUTDOWN_JOIN_TIMEOUT_MS);
+      this->m_pt_threads_stuck = true;
+    }
+  }
+
+  // the traced spans (the drain and deregistrations included)
+  if (this->m_trace_path != NULL) {
+    Tracer::shared()->exportTo(this->m_trace_path);
+  }
+
+  // ... and a running CPU profile
+  if (Profiler::shared()->isRunning() == true) {
+    Profiler::shared()->stop(this->m_profile_prefix);
+  }
+
+  // STOPPED
+  __atomic_store_n(&this->m_state, ORCHESTRATOR_STOPPED, __ATOMIC_RELEASE);
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  printf("Orchestrator: Shutdown complete. %zu shadow(s) torn down in %.1f "
+         "ms\n",
+         this->m_device_shadows.size(), elapsedMs(&start, &now));
+}
+
+// flush pending shadow updates (or buffer them if PT is not connected)
+void Orchestrator::drainPendingUpdates() {
+  for (size_t i = 0; i < this->m_device_shadows.size(); ++i) {
+    DeviceShadow *shadow = this->m_device_shadows[i];
+    int value = 0;
+    if (this->isConnected(shadow) == true && shadow->isRegistered() == true) {
+      shadow->processEvents();
+    } else if (shadow->getPendingCounterValue(&value) == true &&
+               this->m_offline_store != NULL) {
+      // keep it for the next run... it will be replayed once we reconnect
+      this->m_offline_store->append(shadow->getEndpointID(), COUNTER_OBJECT_ID,
+                                    0, COUNTER_RESOURCE_ID, (long)value);
+    }
   }
 }
 
-// STATIC shutdown
-void Orchestrator::shutdownCB(void *ctx) {
-  Orchestrator *instance = (Orchestrator *)ctx;
-  if (instance != NULL) {
-    instance->shutdown();
+// wait (bounded) for a counter guarded by our mutex to reach zero
+bool Orchestrator::waitForZero(size_t *counter, int timeout_ms) {
+  struct timespec deadline;
+  deadlineAfterMs(&deadline, timeout_ms);
+  pthread_mutex_lock(&this->m_mutex);
+  while (*counter > 0) {
+    if (pthread_cond_timedwait(&this->m_cond, &this->m_mutex, &deadline) ==
+        ETIMEDOUT) {
+      break;
+    }
   }
+  bool drained = (*counter == 0);
+  pthread_mutex_unlock(&this->m_mutex);
+  return drained;
 }
 
-// PT Registration Failure
-void Orchestrator::ptRegisterFailure() { this->shutdown(); }
+// a pt_write_value() has been issued
+void Orchestrator::writeIssued() {
+  pthread_mutex_lock(&this->m_mutex);
+  ++this->m_num_writes_in_flight;
+  if (this->m_num_writes_in_flight > this->m_max_writes_in_flight) {
+    this->m_max_writes_in_flight = this->m_num_writes_in_flight;
+  }
+  this->updatePressure();
+  pthread_mutex_unlock(&this->m_mutex);
+}
 
-// STATIC: PT Registration failure
-void Orchestrator::ptRegisterFailureCB(void *ctx) {
-  Orchestrator *instance = (Orchestrator *)ctx;
-  if (instance != NULL) {
-    instance->ptRegisterFailure();
+// a pt_write_value() has completed (or failed)
+void Orchestrator::writeCompleted() {
+  pthread_mutex_lock(&this->m_mutex);
+  if (this->m_num_writes_in_flight > 0) {
+    --this->m_num_writes_in_flight;
   }
+  this->updatePressure();
+  pthread_cond_broadcast(&this->m_cond);
+  pthread_mutex_unlock(&this->m_mutex);
 }
 
-// PT Registration success
-void Orchestrator::ptRegisterSuccess() {
-  // DEBUG
-  printf("Orchestrator: PT connected and registered. Ready for device shadow "
-         "creation...\n");
+// move our backpressure up (or down) a level as edge-core falls behind (or
+// catches up) with our writes (lock held). Dropping back only below half of
+// a level's threshold keeps us from flapping around it
+void Orchestrator::updatePressure() {
+  static const size_t thresholds[] = {0, PT_PRESSURE_ELEVATED_WRITES,
+                                      PT_PRESSURE_HIGH_WRITES,
+                                      PT_PRESSURE_CRITICAL_WRITES};
+  int pressure = (int)this->m_pressure;
+  while (pressure < ORCHESTRATOR_PRESSURE_CRITICAL &&
+         this->m_num_writes_in_flight >= thresholds[pressure + 1]) {
+    ++pressure;
+  }
+  while (pressure > ORCHESTRATOR_PRESSURE_NONE &&
+         this->m_num_writes_in_flight < thresholds[pressure] / 2) {
+    --pressure;
+  }
+  if (pressure != (int)this->m_pressure) {
+    // DEBUG
+    printf("Orchestrator: backpressure %s -> %s (%zu write(s) in flight)\n",
+           pressureName(this->m_pressure),
+           pressureName((ORCHESTRATOR_PRESSURE)pressure),
+           this->m_num_writes_in_flight);
+    __atomic_store_n(&this->m_pressure, (ORCHESTRATOR_PRESSURE)pressure,
+                     __ATOMIC_RELAXED);
+  }
+}
 
-  // we now have a connected and registered PT!
-  this->m_pt_connected = true;
+// get our current backpressure
+ORCHESTRATOR_PRESSURE Orchestrator::getPressure() {
+  return __atomic_load_n(&this->m_pressure, __ATOMIC_RELAXED);
+}
 
-  // so, next wecreate the "shadow" of our device through PT...
-  this->createDeviceShadow();
+// STATIC: backpressure level names
+const char *Orchestrator::pressureName(ORCHESTRATOR_PRESSURE pressure) {
+  static const char *names[] = {"NONE", "ELEVATED", "HIGH", "CRITICAL"};
+  return (pressure >= ORCHESTRATOR_PRESSURE_NONE &&
+          pressure <= ORCHESTRATOR_PRESSURE_CRITICAL)
+             ? names[pressure]
+             : "UNKNOWN";
 }
 
-// STATIC: PT Registration success
-void Orchestrator::ptRegisterSuccessCB(void *ctx) {
-  Orchestrator *instance = (Orchestrator *)ctx;
-  if (instance != NULL) {
-    instance->ptRegisterSuccess();
+// set the poll scale (percent of each configured poll interval)
+void Orchestrator::setPollScalePercent(int percent) {
+  __atomic_store_n(&this->m_poll_scale_percent, (percent > 0) ? percent : 1,
+                   __ATOMIC_RELAXED);
+}
+
+// get the poll scale
+int Orchestrator::getPollScalePercent() {
+  return __atomic_load_n(&this->m_poll_scale_percent, __ATOMIC_RELAXED);
+}
+
+// set the coalescing window at ELEVATED backpressure
+void Orchestrator::setCoalesceIntervalMs(int interval_ms) {
+  __atomic_store_n(&this->m_coalesce_interval_ms,
+                   (interval_ms > 0) ? interval_ms : 1, __ATOMIC_RELAXED);
+}
+
+// get the coalescing window
+int Orchestrator::getCoalesceIntervalMs() {
+  return __atomic_load_n(&this->m_coalesce_interval_ms, __ATOMIC_RELAXED);
+}
+
+// change a configured device's poll interval: the shard that owns the shadow
+// applies it like a fleet reload would
+bool Orchestrator::setPollInterval(const char *endpoint_id, int interval_ms) {
+  bool changed = false;
+  pthread_mutex_lock(&this->m_fleet_mutex);
+  std::map<endpoint_handle_t, fleet_device_config_t>::iterator current =
+      this->m_fleet_configs.find(EndpointTable::shared()->find(endpoint_id));
+  if (current != this->m_fleet_configs.end()) {
+    current->second.poll_interval_ms = (interval_ms > 0) ? interval_ms : 0;
+    pthread_rwlock_rdlock(&this->m_registry_lock);
+    DeviceShadow *shadow = this->getDeviceShadow(endpoint_id);
+    if (shadow != NULL && this->getShard(shadow) != NULL) {
+      changed = this->getShard(shadow)->enqueueReconfigure(shadow,
+                                                           &current->second);
+    }
+    pthread_rwlock_unlock(&this->m_registry_lock);
   }
+  pthread_mutex_unlock(&this->m_fleet_mutex);
+  return changed;
+}
+
+// get the number of writes in flight
+size_t Orchestrator::getNumWritesInFlight() {
+  pthread_mutex_lock(&this->m_mutex);
+  size_t num_writes = this->m_num_writes_in_flight;
+  pthread_mutex_unlock(&this->m_mutex);
+  return num_writes;
 }
 
-// PT Connection is Ready
-void Orchestrator::ptIsReady(struct connection *connection) {
-  pt_status_t status = pt_register_protocol_translator(
-      connection, &Orchestrator::ptRegisterSuccessCB,
-      &Orchestrator::ptRegisterFailureCB, (void *)this);
-  if (status != PT_STATUS_SUCCESS) {
-    this->shutdown();
+// get the most writes there have been in flight
+size_t Orchestrator::getMaxWritesInFlight() {
+  pthread_mutex_lock(&this->m_mutex);
+  size_t max_writes = this->m_max_writes_in_flight;
+  pthread_mutex_unlock(&this->m_mutex);
+  return max_writes;
+}
+
+// a shadow removed from the fleet has been retired: its shard no longer
+// refers to it, and nothing queued does either
+void Orchestrator::shadowRetired(DeviceShadow *shadow) {
+  pthread_mutex_lock(&this->m_mutex);
+  this->m_retired_shadows.push_back(shadow);
+  pthread_mutex_unlock(&this->m_mutex);
+  sem_post(&this->m_event_sem);
+}
+
+// delete retired shadows (and their devices)
+void Orchestrator::deleteRetiredShadows() {
+  std::vector<DeviceShadow *> retired;
+  pthread_mutex_lock(&this->m_mutex);
+  retired.swap(this->m_retired_shadows);
+  pthread_mutex_unlock(&this->m_mutex);
+  for (size_t i = 0; i < retired.size(); ++i) {
+    NonMbedDevice *device = (NonMbedDevice *)retired[i]->getDevice();
+    if (device != this->m_device) {
+      std::vector<NonMbedDevice *>::iterator it = std::find(
+          this->m_fleet_devices.begin(), this->m_fleet_devices.end(), device);
+      if (it != this->m_fleet_devices.end()) {
+        this->m_fleet_devices.erase(it);
+        delete device;
+      }
+    }
+
+    // DEBUG
+    printf("Orchestrator: Shadow %s retired\n", retired[i]->getEndpointID());
+    delete retired[i];
   }
 }
 
+// register a shadow added to the fleet (owning shard thread)
+void Orchestrator::registerDeviceShadow(DeviceShadow *shadow) {
+  if (this->isConnected(shadow) == true) {
+    shadow->createAndRegister();
+  }
+}
+
+// is the PT connection a shadow is on connected and registered?
+bool Orchestrator::isConnected(DeviceShadow *shadow) {
+  PTConnection *connection = (PTConnection *)shadow->getPTConnection();
+  return (connection != NULL && connection->isConnected() == true);
+}
+
+// are we shutting down?
+bool Orchestrator::isShuttingDown() {
+  return __atomic_load_n(&this->m_shutting_down, __ATOMIC_ACQUIRE);
+}
+
+// can we be deleted? (every PT thread has been joined)
+bool Orchestrator::isSafeToDelete() {
+  return (this->m_pt_threads_stuck == false);
+}
+
+// a device shadow has finished deregistering
+void Orchestrator::shadowDeregistered(DeviceShadow *shadow, bool success) {
+  pthread_mutex_lock(&this->m_mutex);
+  if (this->m_num_pending_deregistrations > 0) {
+    --this->m_num_pending_deregistrations;
+  }
+  pthread_cond_broadcast(&this->m_cond);
+  pthread_mutex_unlock(&this->m_mutex);
+}
+
+// a PT connection to mbed-edge has shut down (its PT thread)
+void Orchestrator::connectionShutdown(PTConnection *connection) {
+  // edge-core has gone away... the shadows on the connection are no longer
+  // registered. We keep their in-memory state so that we can quickly re-sync
+  // them once it is reconnected (updates in the meantime go to the offline
+  // store)
+  pthread_rwlock_rdlock(&this->m_registry_lock);
+  for (size_t i = 0; i < this->m_device_shadows.size(); ++i) {
+    if (this->m_device_shadows[i]->getPTConnection() == (void *)connection) {
+      this->m_device_shadows[i]->connectionLost();
+    }
+  }
+  pthread_rwlock_unlock(&this->m_registry_lock);
+}
+
+// a PT connection is connected and registered (its PT thread)
+void Orchestrator::ptRegisterSuccess(PTConnection *connection) {
+  // so, next we create the "shadows" of our devices on it through PT...
+  // (after a reconnect, this re-registers them from their in-memory state)
+  this->createDeviceShadow(connection);
+
+  // finally, forward anything we buffered while PT was not connected... (an
+  // update for a shadow on a connection that is still down is buffered
+  // again)
+  this->replayOfflineStore();
+}
+
 // STATIC: process a write request
 void Orchestrator::processWriteRequestCB(
     struct connection *c, const char *device_id, const uint16_t object_id,
@@ -181,14 +1028,27 @@ void Orchestrator::processWriteRequestCB(
     const uint32_t value_size, void *ctx) {
   Orchestrator *instance = (Orchestrator *)ctx;
   if (instance != NULL) {
-    // we simply have one shadow in our orchestrator.. so snag it and call its
-    // processWriteRequest() method...
-    bool success = instance->getDeviceShadow()->processWriteRequest(
-        device_id, object_id, instance_id, resource_id, operation, value,
-        value_size);
+    // hand the write to the shard that owns the shadow... it is processed on
+    // that shard's thread
+    uint64_t received_ns =
+        (Tracer::shared()->isEnabled() == true) ? Tracer::now() : 0;
+    pthread_rwlock_rdlock(&instance->m_registry_lock);
+    DeviceShadow *shadow = instance->getDeviceShadow(device_id);
+    bool success = false;
+    if (shadow != NULL && instance->getShard(shadow) != NULL) {
+      success = instance->getShard(shadow)->enqueueWrite(
+          shadow, object_id, instance_id, resource_id, operation, value,
+          value_size);
+    }
+    if (shadow != NULL && received_ns != 0) {
+      Tracer::shared()->complete(TRACE_SPAN_WRITE_RECEIVED,
+                                 shadow->getEndpointHandle(), received_ns,
+                                 Tracer::now());
+    }
+    pthread_rwlock_unlock(&instance->m_registry_lock);
     if (success == true) {
-      // write succees
-      printf("Orchestrator: write SUCCESS\n");
+      // write queued
+      LOG_DEBUG("Orchestrator: write QUEUED\n");
     } else {
       // write failure
       printf("Orchestrator: write FAILURE\n");
@@ -196,57 +1056,306 @@ void Orchestrator::processWriteRequestCB(
   }
 }
 
+// write a batch of resource updates (any thread)
+int Orchestrator::writeResources(const orchestrator_write_t *writes,
+                                 int num_writes) {
+  // group the writes per shadow (in order)...
+  std::map<DeviceShadow *, std::vector<device_shadow_write_t> > batches;
+  std::vector<DeviceShadow *> order;
+  int num_queued = 0;
+  pthread_rwlock_rdlock(&this->m_registry_lock);
+  for (int i = 0; i < num_writes; ++i) {
+    DeviceShadow *shadow = this->getDeviceShadow(writes[i].endpoint_id);
+    if (shadow == NULL) {
+      printf("Orchestrator: write to unknown endpoint %s... skipped\n",
+             writes[i].endpoint_id);
+      continue;
+    }
+    std::vector<device_shadow_write_t> &batch = batches[shadow];
+    if (batch.empty() == true) {
+      order.push_back(shadow);
+    }
+    batch.push_back(writes[i].write);
+  }
+
+  // ... and hand each group to the shard that owns the shadow
+  for (size_t i = 0; i < order.size(); ++i) {
+    std::vector<device_shadow_write_t> &batch = batches[order[i]];
+    OrchestratorShard *shard = this->getShard(order[i]);
+    if (shard != NULL &&
+        shard->enqueueWriteBatch(order[i], &batch[0], (int)batch.size()) ==
+            true) {
+      num_queued += (int)batch.size();
+    }
+  }
+  pthread_rwlock_unlock(&this->m_registry_lock);
+
+  // DEBUG
+  LOG_DEBUG("Orchestrator: queued %d of %d batched writes for %zu shadow(s)\n",
+            num_queued, num_writes, order.size());
+  return num_queued;
+}
+
 // get the device shadow
-DeviceShadow *Orchestrator::getDeviceShadow() { return this->m_device_shadow; }
+DeviceShadow *Orchestrator::getDeviceShadow() {
+  return this->m_device_shadows.empty() ? NULL : this->m_device_shadows[0];
+}
 
-// get the underlying device
-void *Orchestrator::getDevice() { return this->m_device; }
+// get the device shadow for a given endpoint ID (other threads must hold the
+// registry lock for as long as they use the shadow)
+DeviceShadow *Orchestrator::getDeviceShadow(const char *endpoint_id) {
+  // interned endpoint IDs index the registry directly (no allocation)
+  endpoint_handle_t handle = EndpointTable::shared()->find(endpoint_id);
+  if (handle == ENDPOINT_HANDLE_INVALID ||
+      handle >= this->m_device_shadow_index.size()) {
+    return NULL;
+  }
+  return this->m_device_shadow_index[handle];
+}
 
-// STATIC: PT Connection is Ready CB
-void Orchestrator::ptIsReadyCB(struct connection *connection, void *ctx) {
-  Orchestrator *instance = (Orchestrator *)ctx;
-  if (instance != NULL) {
-    instance->ptIsReady(connection);
+// add a shadow to the registry index (registry write lock held)
+void Orchestrator::indexDeviceShadow(DeviceShadow *shadow) {
+  endpoint_handle_t handle = shadow->getEndpointHandle();
+  if (handle >= this->m_device_shadow_index.size()) {
+    this->m_device_shadow_index.resize(handle + 1, NULL);
   }
+  this->m_device_shadow_index[handle] = shadow;
 }
 
-// Run PT
-void Orchestrator::runPT() {
-  // DEBUG
-  printf(
-      "Orchestrator: starting up the protocol translator (ThreadID: %08x)...\n",
-      (unsigned int)pthread_self());
-
-  // create and run the protocol translator (PT) - configure the callbacks for
-  // it...
-  protocol_translator_callbacks_t pt_cbs;
-  pt_cbs.connection_ready_cb =
-      (pt_connection_ready_cb)&Orchestrator::ptIsReadyCB;
-  pt_cbs.received_write_cb =
-      (pt_received_write_handler)&Orchestrator::processWriteRequestCB;
-  pt_cbs.connection_shutdown_cb =
-      (pt_connection_shutdown_cb)&Orchestrator::shutdownCB;
-
-  // start the PT...
-  pt_client_start(this->m_pt_ctx->hostname, this->m_pt_ctx->port,
-                  this->m_pt_ctx->name, &pt_cbs, (void *)this,
-                  &this->m_connection);
-}
-
-// STATIC: Run PT
-void *Orchestrator::runPT(void *ctx) {
-  Orchestrator *instance = (Orchestrator *)ctx;
-  if (instance != NULL) {
-    instance->runPT();
+// subscribe a local consumer to a shadow's resource changes
+bool Orchestrator::subscribe(Subscription *subscription) {
+  bool subscribed = false;
+  pthread_rwlock_rdlock(&this->m_registry_lock);
+  endpoint_handle_t handle = subscription->getEndpoint();
+  DeviceShadow *shadow = (handle < this->m_device_shadow_index.size())
+                             ? this->m_device_shadow_index[handle]
+                             : NULL;
+  if (shadow != NULL && this->getShard(shadow) != NULL) {
+    // the shard owns it from here until it lets go
+    subscription->setAttached(true);
+    subscribed =
+        this->getShard(shadow)->enqueueSubscribe(shadow, subscription);
+    if (subscribed == false) {
+      subscription->setAttached(false);
+    }
+  }
+  pthread_rwlock_unlock(&this->m_registry_lock);
+  return subscribed;
+}
+
+// unsubscribe a local consumer
+void Orchestrator::unsubscribe(Subscription *subscription) {
+  pthread_rwlock_rdlock(&this->m_registry_lock);
+  endpoint_handle_t handle = subscription->getEndpoint();
+  DeviceShadow *shadow = (handle < this->m_device_shadow_index.size())
+                             ? this->m_device_shadow_index[handle]
+                             : NULL;
+  // (a shadow no longer in the registry has already let go of it... see
+  // DeviceShadow::retire())
+  if (shadow != NULL && this->getShard(shadow) != NULL &&
+      subscription->isAttached() == true) {
+    if (this->getShard(shadow)->enqueueUnsubscribe(shadow, subscription) ==
+        false) {
+      // the shards have stopped (shutdown)... let go of it ourselves
+      shadow->unsubscribe(subscription);
+    }
+  }
+  pthread_rwlock_unlock(&this->m_registry_lock);
+}
+
+// read a resource value from a shadow's value cache
+bool Orchestrator::readResourceValue(const char *endpoint_id,
+                                     const uint16_t object_id,
+                                     const uint16_t instance_id,
+                                     const uint16_t resource_id, long *value) {
+  bool found = false;
+  pthread_rwlock_rdlock(&this->m_registry_lock);
+  DeviceShadow *shadow = this->getDeviceShadow(endpoint_id);
+  if (shadow != NULL) {
+    found = shadow->getResourceValue(object_id, instance_id, resource_id, value);
+  }
+  pthread_rwlock_unlock(&this->m_registry_lock);
+  return found;
+}
+
+// query a shadow resource's history
+int Orchestrator::queryResourceHistory(
+    const char *endpoint_id, const uint16_t object_id,
+    const uint16_t instance_id, const uint16_t resource_id, int64_t from_ms,
+    int64_t to_ms, time_series_sample_t *samples, int max_samples) {
+  int num_samples = -1;
+  pthread_rwlock_rdlock(&this->m_registry_lock);
+  DeviceShadow *shadow = this->getDeviceShadow(endpoint_id);
+  if (shadow != NULL) {
+    num_samples = shadow->queryHistory(object_id, instance_id, resource_id,
+                                       from_ms, to_ms, samples, max_samples);
+  }
+  pthread_rwlock_unlock(&this->m_registry_lock);
+  return num_samples;
+}
+
+// aggregate a shadow resource's history
+bool Orchestrator::aggregateResourceHistory(
+    const char *endpoint_id, const uint16_t object_id,
+    const uint16_t instance_id, const uint16_t resource_id, int64_t from_ms,
+    int64_t to_ms, time_series_aggregate_t *aggregate) {
+  bool found = false;
+  pthread_rwlock_rdlock(&this->m_registry_lock);
+  DeviceShadow *shadow = this->getDeviceShadow(endpoint_id);
+  if (shadow != NULL) {
+    found = shadow->aggregateHistory(object_id, instance_id, resource_id,
+                                     from_ms, to_ms, aggregate);
+  }
+  pthread_rwlock_unlock(&this->m_registry_lock);
+  return found;
+}
+
+// add a device shadow (endpoint IDs must be unique)
+bool Orchestrator::addDeviceShadow(DeviceShadow *shadow) {
+  if (this->getDeviceShadow(shadow->getEndpointID()) != NULL) {
+    printf("Orchestrator: ERROR. Duplicate endpoint ID: %s\n",
+           shadow->getEndpointID());
+    return false;
+  }
+  this->indexDeviceShadow(shadow);
+  this->m_device_shadows.push_back(shadow);
+  __atomic_store_n(&this->m_num_device_shadows, this->m_device_shadows.size(),
+                   __ATOMIC_RELEASE);
+  return true;
+}
+
+// get the number of device shadows
+size_t Orchestrator::getNumDeviceShadows() {
+  return __atomic_load_n(&this->m_num_device_shadows, __ATOMIC_ACQUIRE);
+}
+
+// get the number of registered device shadows
+size_t Orchestrator::getNumRegisteredDeviceShadows() {
+  size_t num_registered = 0;
+  pthread_rwlock_rdlock(&this->m_registry_lock);
+  for (size_t i = 0; i < this->m_device_shadows.size(); ++i) {
+    if (this->m_device_shadows[i]->isRegistered() == true) {
+      ++num_registered;
+    }
+  }
+  pthread_rwlock_unlock(&this->m_registry_lock);
+  return num_registered;
+}
+
+// get the number of events processed by all of our shards
+uint64_t Orchestrator::getNumEventsProcessed() {
+  uint64_t num_events = 0;
+  for (size_t i = 0; i < this->m_shards.size(); ++i) {
+    num_events += this->m_shards[i]->getNumEventsProcessed();
+  }
+  return num_events;
+}
+
+// get the number of registration renewals issued by all of our shards
+uint64_t Orchestrator::getNumRenewals() {
+  uint64_t num_renewals = 0;
+  for (size_t i = 0; i < this->m_shards.size(); ++i) {
+    num_renewals += this->m_shards[i]->getNumRenewals();
+  }
+  return num_renewals;
+}
+
+// get the number of forwards coalesced by all of our shards under
+// backpressure
+uint64_t Orchestrator::getNumCoalesced() {
+  uint64_t num_coalesced = 0;
+  for (size_t i = 0; i < this->m_shards.size(); ++i) {
+    num_coalesced += this->m_shards[i]->getNumCoalesced();
   }
-  return NULL;
+  return num_coalesced;
+}
+
+// get the number of telemetry events dropped by all of our shards under
+// backpressure
+uint64_t Orchestrator::getNumDropped() {
+  uint64_t num_dropped = 0;
+  for (size_t i = 0; i < this->m_shards.size(); ++i) {
+    num_dropped += this->m_shards[i]->getNumDropped();
+  }
+  return num_dropped;
+}
+
+// get the number of events shed by all of our shards from a full overflow
+uint64_t Orchestrator::getNumShed() {
+  uint64_t num_shed = 0;
+  for (size_t i = 0; i < this->m_shards.size(); ++i) {
+    num_shed += this->m_shards[i]->getNumShed();
+  }
+  return num_shed;
+}
+
+// get a lane's latency percentile across all of our shards
+double Orchestrator::getLaneLatencyUs(SHARD_LANE lane, double percentile) {
+  uint64_t buckets[SHARD_LATENCY_BUCKETS];
+  memset(buckets, 0, sizeof(buckets));
+  for (size_t i = 0; i < this->m_shards.size(); ++i) {
+    this->m_shards[i]->getLaneLatency(lane, buckets);
+  }
+  return OrchestratorShard::latencyPercentileUs(buckets, percentile);
+}
+
+// get the number of shards
+size_t Orchestrator::getNumShards() { return this->m_shards.size(); }
+
+// get a shard
+OrchestratorShard *Orchestrator::getShardAt(size_t index) {
+  return (index < this->m_shards.size()) ? this->m_shards[index] : NULL;
+}
+
+// visit a slice of the registry: the read lock is only held for up to
+// "max_shadows" shadows at a time, so a fleet reload waits for one slice at
+// most
+bool Orchestrator::visitDeviceShadows(size_t *from, size_t max_shadows,
+                                      orchestrator_shadow_fn *fn, void *ctx) {
+  size_t num_visited = 0;
+  pthread_rwlock_rdlock(&this->m_registry_lock);
+  size_t handle = *from;
+  for (; handle < this->m_device_shadow_index.size() &&
+         num_visited < max_shadows;
+       ++handle) {
+    if (this->m_device_shadow_index[handle] != NULL) {
+      fn(this->m_device_shadow_index[handle], ctx);
+      ++num_visited;
+    }
+  }
+  bool more = (handle < this->m_device_shadow_index.size());
+  pthread_rwlock_unlock(&this->m_registry_lock);
+  *from = handle;
+  return more;
+}
+
+// get the underlying device
+void *Orchestrator::getDevice() { return this->m_device; }
+
+// wait before reconnecting (returns early if we start shutting down)
+void Orchestrator::waitForReconnect(int delay_ms) {
+  struct timespec deadline;
+  deadlineAfterMs(&deadline, delay_ms);
+  pthread_mutex_lock(&this->m_mutex);
+  while (this->m_shutting_down == false) {
+    if (pthread_cond_timedwait(&this->m_cond, &this->m_mutex, &deadline) ==
+        ETIMEDOUT) {
+      break;
+    }
+  }
+  pthread_mutex_unlock(&this->m_mutex);
 }
 
 // Start PT
 bool Orchestrator::startPT() {
-  // create a thread to create PT, register it, create and register the device
-  // shadow...
-  pthread_create(&this->m_pt_thread, NULL, &Orchestrator::runPT, (void *)this);
+  // a thread per connection to create PT, register it, create and register
+  // the device shadows on it...
+  for (size_t i = 0; i < this->m_pt_connections.size(); ++i) {
+    if (this->m_pt_connections[i]->start() == false) {
+      return false;
+    }
+  }
+  return true;
 }
 
 // connect to mbed edge via PT
@@ -256,6 +1365,25 @@ bool Orchestrator::connectToMbedEdgePT(int argc, char **argv) {
 
   // initialize PT
   if (this->initializePT(argc, argv) == true) {
+    // start the shards that process our shadows' events
+    if (this->startShards() == false) {
+      return false;
+    }
+
+    // ... and the rules between them
+    if (this->m_rules_path != NULL && this->reloadRules() == false) {
+      return false;
+    }
+
+    // ... and our control socket
+    if (this->m_control_path != NULL) {
+      this->m_control_socket =
+          new ControlSocket((void *)this, this->m_control_path);
+      if (this->m_control_socket->start() == false) {
+        return false;
+      }
+    }
+
     // start PT
     this->startPT();
 
@@ -271,41 +1399,246 @@ bool Orchestrator::connectToMbedEdgePT(int argc, char **argv) {
 void Orchestrator::processEvents() {
   // the orchestrator can do other things in an actual implementation.. here we
   // can just sleep as our NonMbedDevice has an event loop and will drive
-  // eventing via "ticks"
-  while (true) {
-    // process any events in the device shadow
-    this->m_device_shadow->processEvents();
-
+  // eventing via "ticks" (processed by the shards that own the shadows)
+  Profiler::shared()->registerThread("orchestrator");
+  while (this->m_shutdown_requested == 0) {
     // DEBUG
-    printf("Orchestrator: Device shadow done processing events... sleeping for "
-           "a bit...\n");
+    for (size_t i = 0; i < this->m_shards.size(); ++i) {
+      LOG_INFO("Orchestrator: shard %d: %zu shadow(s), %llu event(s) "
+               "processed, %llu renewal(s), %llu idle shadow(s) compacted\n",
+               this->m_shards[i]->getIndex(),
+               this->m_shards[i]->getNumDeviceShadows(),
+               (unsigned long long)this->m_shards[i]->getNumEventsProcessed(),
+               (unsigned long long)this->m_shards[i]->getNumRenewals(),
+               (unsigned long long)this->m_shards[i]->getNumDematerialized());
+    }
+    LOG_INFO("Orchestrator: p99 latency (usec): control %.0f, state %.0f, "
+             "telemetry %.0f\n",
+             this->getLaneLatencyUs(SHARD_LANE_CONTROL, 99.0),
+             this->getLaneLatencyUs(SHARD_LANE_STATE, 99.0),
+             this->getLaneLatencyUs(SHARD_LANE_TELEMETRY, 99.0));
+    LOG_INFO("Orchestrator: %zu write(s) in flight (peak %zu), %llu "
+             "forward(s) coalesced, %llu tick(s) dropped, %llu event(s) "
+             "shed\n",
+             this->getNumWritesInFlight(), this->getMaxWritesInFlight(),
+             (unsigned long long)this->getNumCoalesced(),
+             (unsigned long long)this->getNumDropped(),
+             (unsigned long long)this->getNumShed());
+
+    // wait a bit (a shutdown request wakes us up early)
+    struct timespec deadline;
+    deadlineAfterMs(&deadline, 5000);
+    while (sem_timedwait(&this->m_event_sem, &deadline) != 0 &&
+           errno == EINTR) {
+    }
+
+    // reload our fleet configuration if asked to (SIGHUP)
+    if (this->m_reload_requested != 0 && this->m_shutdown_requested == 0) {
+      this->m_reload_requested = 0;
+      this->reloadFleetConfig();
+      if (this->m_rules_path != NULL) {
+        this->reloadRules();
+      }
+    }
+
+    // export the traced spans if asked to (SIGUSR1)
+    if (this->m_trace_export_requested != 0) {
+      this->m_trace_export_requested = 0;
+      if (this->m_trace_path != NULL) {
+        Tracer::shared()->exportTo(this->m_trace_path);
+      }
+    }
+
+    // start or stop (and write) the CPU profile if asked to (SIGUSR2)
+    if (this->m_profile_toggle_requested != 0) {
+      this->m_profile_toggle_requested = 0;
+      Profiler::shared()->toggle(this->m_profile_prefix, this->m_profile_hz);
+    }
 
-    // wait a bit
-    sleep(5);
-  };
+    // clean up shadows that have been removed from the fleet
+    this->deleteRetiredShadows();
+  }
+
+  // we have been asked to shut down... do so from here (not signal context)
+  this->shutdown();
+  Profiler::shared()->unregisterThread();
 }
 
 // create our device shadow
-void Orchestrator::createDeviceShadow() {
+void Orchestrator::createDeviceShadow(PTConnection *connection) {
   // make sure that PT is connected and ready...
-  if (this->m_pt_connected == true) {
-    // have the device shadow create and register itself via PT
-    this->m_device_shadow->createAndRegister();
+  if (connection->isConnected() == true) {
+    // have the device shadows on the connection create (if needed) and
+    // register themselves via PT... each on the shard that owns it (which
+    // also builds and drops its PT device). One event per shard: the shards
+    // work through their own shadows, so we neither hold the registry nor
+    // wait on a lane here. We collect the results as they complete
+    for (size_t i = 0; i < this->m_shards.size(); ++i) {
+      this->m_shards[i]->enqueueRegisterAll((void *)connection);
+    }
+  }
+}
+
+// PT has acknowledged a shadow's (re)registration or renewal (PT thread)...
+// its shard applies it, so the shadow's registration state only ever
+// changes there. A stopped shard means we are shutting down: nothing is
+// registered from here on
+void Orchestrator::registrationCompleted(DeviceShadow *shadow, bool success) {
+  if (this->getShard(shadow) != NULL) {
+    this->getShard(shadow)->enqueueRegistered(shadow, success);
+  }
+}
+
+// PT has acknowledged a shadow's deregistration (PT thread)... its shard
+// applies it (and releases a retired shadow). Once the shards have stopped
+// (shutdown), this thread only counts it
+void Orchestrator::deregistrationCompleted(DeviceShadow *shadow,
+                                           bool success) {
+  if ((this->getShard(shadow) == NULL ||
+       this->getShard(shadow)->enqueueDeregistered(shadow, success) ==
+           false) &&
+      shadow->isRetired() == false) {
+    this->shadowDeregistered(shadow, success);
+  }
+}
+
+// a device shadow has finished (re)registering with PT (owning shard... it
+// forwards anything the shadow held while it was not registered, and
+// schedules its renewal)
+void Orchestrator::shadowRegistered(DeviceShadow *shadow, bool success) {
+  if (success == false) {
+    printf("Orchestrator: Shadow %s failed to (re)register\n",
+           shadow->getEndpointID());
+  }
+
+  // report how long it took to re-sync the shadows on its connection after
+  // a reconnect
+  PTConnection *connection = (PTConnection *)shadow->getPTConnection();
+  double synced_ms = 0.0;
+  double outage_ms = 0.0;
+  if (connection != NULL &&
+      connection->shadowSynced(&synced_ms, &outage_ms) == true) {
+    if (outage_ms >= 0.0) {
+      printf("Orchestrator: %s reconnected after %.1f ms outage. %zu "
+             "shadow(s) re-synced in %.1f ms\n",
+             connection->getName(), outage_ms,
+             connection->getNumDeviceShadows(), synced_ms);
+    } else {
+      printf("Orchestrator: %zu shadow(s) registered through %s in %.1f ms\n",
+             connection->getNumDeviceShadows(), connection->getName(),
+             synced_ms);
+    }
+  }
+}
+
+// a device shadow has finished renewing its registration (owning shard...
+// it schedules the next renewal, or a retry)
+void Orchestrator::shadowRenewed(DeviceShadow *shadow, bool success) {
+  if (success == false) {
+    printf("Orchestrator: Shadow %s failed to renew its registration\n",
+           shadow->getEndpointID());
+  }
+}
+
+// replay anything buffered while PT was not connected
+void Orchestrator::replayOfflineStore() {
+  if (this->m_offline_store != NULL &&
+      this->m_offline_store->isEmpty() == false) {
+    // DEBUG
+    printf("Orchestrator: replaying updates buffered while PT was "
+           "disconnected...\n");
+    this->m_offline_store->replay(&Orchestrator::replayOfflineUpdateCB,
+                                  (void *)this);
+  }
+}
+
+// replay a buffered shadow update
+void Orchestrator::replayOfflineUpdate(const offline_store_record_t *record) {
+  // find the shadow the update is for
+  char endpoint_id[OFFLINE_STORE_ENDPOINT_ID_LENGTH + 1];
+  snprintf(endpoint_id, sizeof(endpoint_id), "%.*s",
+           OFFLINE_STORE_ENDPOINT_ID_LENGTH, record->endpoint_id);
+  pthread_rwlock_rdlock(&this->m_registry_lock);
+  DeviceShadow *shadow = this->getDeviceShadow(endpoint_id);
+  if (shadow == NULL) {
+    printf("Orchestrator: No shadow for buffered update to %s... dropping\n",
+           endpoint_id);
+  } else if (record->object_id == COUNTER_OBJECT_ID &&
+             record->resource_id == COUNTER_RESOURCE_ID) {
+    // the counter is the only resource we push from the device side... the
+    // shadow will forward it once it has (re)registered, unless a live value
+    // has reached it first (this one is older). A shadow whose connection is
+    // still down keeps it buffered
+    PTConnection *connection = (PTConnection *)shadow->getPTConnection();
+    OrchestratorShard *shard = this->getShard(shadow);
+    if (this->isConnected(shadow) == false || shard == NULL ||
+        __atomic_load_n(&this->m_state, __ATOMIC_ACQUIRE) !=
+            ORCHESTRATOR_RUNNING) {
+      this->m_offline_store->append(shadow->getEndpointID(), COUNTER_OBJECT_ID,
+                                    0, COUNTER_RESOURCE_ID, record->value);
+    } else if (shard->enqueueReplay(shadow, (int)record->value,
+                                    connection->getNumConnects()) == false) {
+      printf("Orchestrator: shard unavailable... dropping buffered update to "
+             "%s\n",
+             endpoint_id);
+    }
+  }
+  pthread_rwlock_unlock(&this->m_registry_lock);
+}
+
+// STATIC: replay a buffered shadow update
+void Orchestrator::replayOfflineUpdateCB(const offline_store_record_t *record,
+                                         void *ctx) {
+  Orchestrator *instance = (Orchestrator *)ctx;
+  if (instance != NULL) {
+    instance->replayOfflineUpdate(record);
   }
 }
 
 // device shadow: tick processor (ORCHESTRATE!)
 void Orchestrator::processTick(int value) {
-  // make sure that PT is connected and ready...
-  if (this->m_pt_connected == true) {
-    // DEBUG
-    printf("Orchestrator: notifying device shadow that the counter value has "
-           "changed. new_value=%d...\n",
-           value);
+  // our one "actual" device is shadowed by our default shadow
+  pthread_rwlock_rdlock(&this->m_registry_lock);
+  DeviceShadow *shadow = this->getDeviceShadow();
+  if (shadow != NULL) {
+    this->processTick(shadow, value);
+  }
+  pthread_rwlock_unlock(&this->m_registry_lock);
+}
+
+// device shadow: tick processor for a specific shadow
+void Orchestrator::processTick(DeviceShadow *shadow, int value) {
+  TraceScope trace(TRACE_SPAN_TICK, shadow->getEndpointHandle());
 
-    // tell the device shadow that the counter value has changed... its running
-    // in a separate thread and will hand this in its loop...
-    this->m_device_shadow->notifyCounterValueHasChanged(value);
+  // if PT is not connected (or we are shutting down), buffer the update until
+  // we are (re)connected...
+  if (this->isConnected(shadow) == false ||
+      __atomic_load_n(&this->m_state, __ATOMIC_ACQUIRE) !=
+          ORCHESTRATOR_RUNNING) {
+    if (this->m_offline_store != NULL) {
+      // DEBUG
+      LOG_DEBUG("Orchestrator: PT not connected. Buffering counter value "
+                "%d...\n",
+                value);
+      this->m_offline_store->append(shadow->getEndpointID(), COUNTER_OBJECT_ID,
+                                    0, COUNTER_RESOURCE_ID, (long)value);
+    }
+    return;
+  }
+
+  // DEBUG
+  LOG_DEBUG("Orchestrator: notifying device shadow that the counter value has "
+            "changed. new_value=%d...\n",
+            value);
+
+  // tell the device shadow that the counter value has changed... it is owned
+  // by a shard running in a separate thread which will handle this in its
+  // loop...
+  OrchestratorShard *shard = this->getShard(shadow);
+  if (shard == NULL || shard->enqueueTick(shadow, value) == false) {
+    printf("Orchestrator: shard unavailable (or shedding telemetry)... "
+           "dropping tick(%d)\n",
+           value);
   }
 }
 
@@ -26,6 +26,7 @@
 // system includes
 #include <errno.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <signal.h>
 #include <string.h>
 #include <unistd.h>
@@ -47,6 +48,67 @@ extern "C" {
 // DeviceShadow
 #include "DeviceShadow.h"
 
+// Offline store-and-forward log
+#include "OfflineStore.h"
+
+// per-core shards
+#include "OrchestratorShard.h"
+
+// fleet configuration
+#include "FleetConfig.h"
+
+// shadow registry
+#include <map>
+#include <string>
+#include <vector>
+
+// Tunables for PT reconnection
+#define PT_RECONNECT_BASE_DELAY_MS 500 // first reconnect attempt delay
+#define PT_RECONNECT_MAX_DELAY_MS 30000 // backoff is capped at this delay
+
+// Tunables for shutdown
+#define SHUTDOWN_DRAIN_TIMEOUT_MS 5000 // max wait for in-flight writes
+#define SHUTDOWN_DEREGISTER_TIMEOUT_MS 5000 // max wait for deregistrations
+#define SHUTDOWN_JOIN_TIMEOUT_MS 2000 // max wait for the PT threads to exit
+
+// Tunables for backpressure: the pt_write_value() calls in flight (issued but
+// not yet acknowledged by edge-core... each one sits in the connection's
+// outbound buffer until then) at which we enter each pressure level. We only
+// drop back a level once they fall below half of its threshold
+#define PT_PRESSURE_ELEVATED_WRITES 128
+#define PT_PRESSURE_HIGH_WRITES 512
+#define PT_PRESSURE_CRITICAL_WRITES 2048
+
+// Orchestrator lifecycle (shutdown state machine)
+enum ORCHESTRATOR_STATE {
+  ORCHESTRATOR_RUNNING = 0,   // normal processing
+  ORCHESTRATOR_DRAINING,      // intake stopped, flushing in-flight writes
+  ORCHESTRATOR_DEREGISTERING, // deregistering all shadows
+  ORCHESTRATOR_STOPPING,      // closing PT and joining its thread
+  ORCHESTRATOR_STOPPED        // done
+};
+
+// backpressure from PT (see OrchestratorShard: each level stretches the poll
+// intervals and the coalescing window further)
+enum ORCHESTRATOR_PRESSURE {
+  ORCHESTRATOR_PRESSURE_NONE = 0, // edge-core is keeping up
+  ORCHESTRATOR_PRESSURE_ELEVATED, // polls stretched, forwards coalesced
+  ORCHESTRATOR_PRESSURE_HIGH,     // ... more so
+  ORCHESTRATOR_PRESSURE_CRITICAL  // telemetry is held and shed
+};
+
+// simulated devices
+class NonMbedDevice;
+
+// local rules
+class RulesEngine;
+
+// local admin control socket
+class ControlSocket;
+
+// PT client connections
+class PTConnection;
+
 // PT context
 typedef struct protocol_translator_api_ctx {
   const char *hostname;
@@ -54,6 +116,21 @@ typedef struct protocol_translator_api_ctx {
   char *name;
 } protocol_translator_api_ctx_t;
 
+// a resource write addressed to a shadow (see Orchestrator::writeResources())
+typedef struct orchestrator_write {
+  const char *endpoint_id;
+  device_shadow_write_t write;
+} orchestrator_write_t;
+
+// a point of the PT connection hash ring (see Orchestrator::getPTConnection())
+typedef struct pt_ring_point {
+  uint32_t hash;
+  int connection;
+} pt_ring_point_t;
+
+// visits a shadow in the registry (see Orchestrator::visitDeviceShadows())
+typedef void(orchestrator_shadow_fn)(DeviceShadow *shadow, void *ctx);
+
 // PT Orchestrator
 class Orchestrator {
 public:
@@ -65,25 +142,92 @@ public:
 
   // process a "tick" event
   void processTick(int value);
+  void processTick(DeviceShadow *shadow, int value);
 
-  // main loop for Orchestrator (trivial sleep...)
+  // main loop for Orchestrator (waits for shutdown... the shards do the work)
   void processEvents();
 
   // connect the Orchestrator to mbed edge PT
   bool connectToMbedEdgePT(int argc, char **argv);
 
-  // Run mbed edge's PT
-  void runPT(void);
-  static void *runPT(void *ctx);
+  // request a shutdown (async-signal-safe: only posts to the event loop)
+  void requestShutdown(int signum);
+
+  // request a fleet configuration reload (async-signal-safe, as above)
+  void requestReload(int signum);
+
+  // request an export of the traced spans to the "--trace" file
+  // (async-signal-safe, as above)
+  void requestTraceExport(int signum);
+
+  // request a CPU profile start or stop (async-signal-safe, as above)
+  void requestProfileToggle(int signum);
 
-  // PT Shutdown
-  void completeShutdown();
+  // reload the fleet configuration: only added, removed or changed shadows
+  // are created, torn down or reconfigured (orchestrator thread)
+  bool reloadFleetConfig();
+
+  // (re)load the local rules file: the running rules are only replaced if
+  // the new file compiles (orchestrator thread)
+  bool reloadRules();
+
+  // PT Shutdown (runs the shutdown state machine to completion)
   void shutdown();
-  static void shutdownCB(void *ctx);
 
-  // PT is Ready for processing!
-  void ptIsReady(struct connection *connection);
-  static void ptIsReadyCB(struct connection *connection, void *ctx);
+  // can we be deleted? (false if a PT thread did not exit by the shutdown
+  // deadline: it may still call back into us and our shadows, so we are left
+  // to the process exit)
+  bool isSafeToDelete();
+
+  // a PT connection to mbed-edge has gone away: the shadows on it are no
+  // longer registered (it reconnects unless we are shutting down)
+  void connectionShutdown(PTConnection *connection);
+
+  // a PT connection is up and registered: (re)register the shadows on it
+  // and replay what was buffered meanwhile
+  void ptRegisterSuccess(PTConnection *connection);
+
+  // are we shutting down? (PT threads stop reconnecting)
+  bool isShuttingDown();
+
+  // wait before reconnecting (returns early if we start shutting down)
+  void waitForReconnect(int delay_ms);
+
+  // PT has acknowledged a shadow's (re)registration, renewal or
+  // deregistration (PT thread): the shadow's shard applies the outcome
+  void registrationCompleted(DeviceShadow *shadow, bool success);
+  void deregistrationCompleted(DeviceShadow *shadow, bool success);
+
+  // a device shadow has finished (re)registering with PT (owning shard)
+  void shadowRegistered(DeviceShadow *shadow, bool success);
+
+  // a device shadow has finished renewing its registration (owning shard)
+  void shadowRenewed(DeviceShadow *shadow, bool success);
+
+  // a device shadow has finished deregistering with PT
+  void shadowDeregistered(DeviceShadow *shadow, bool success);
+
+  // a shadow removed from the fleet has been retired and released by its
+  // shard (it is deleted by our event loop)
+  void shadowRetired(DeviceShadow *shadow);
+
+  // register a shadow added to the fleet (if PT is connected)
+  void registerDeviceShadow(DeviceShadow *shadow);
+
+  // is the PT connection a shadow is on connected and registered?
+  bool isConnected(DeviceShadow *shadow);
+
+  // in-flight pt_write_value() accounting (used to drain on shutdown and to
+  // derive our backpressure)
+  void writeIssued();
+  void writeCompleted();
+
+  // Get our current backpressure (any thread... never blocks)
+  ORCHESTRATOR_PRESSURE getPressure();
+
+  // Get the number of writes in flight (and the most there have been)
+  size_t getNumWritesInFlight();
+  size_t getMaxWritesInFlight();
 
   // Process device shadow write request
   static void processWriteRequestCB(struct connection *c, const char *device_id,
@@ -98,39 +242,214 @@ public:
   // example Orchestrator...)
   DeviceShadow *getDeviceShadow();
 
+  // Get the device shadow for a given endpoint ID
+  DeviceShadow *getDeviceShadow(const char *endpoint_id);
+
+  // Write a batch of resource updates for one or many shadows: the writes
+  // are grouped per shadow and each shadow's shard applies its group and
+  // issues a single pt_write_value(). Returns the number of writes queued
+  int writeResources(const orchestrator_write_t *writes, int num_writes);
+
+  // Subscribe a local consumer to a shadow's resource changes (the
+  // subscription names the shadow). Notifications are queued by the owning
+  // shard; the consumer drains them with Subscription::poll()
+  bool subscribe(Subscription *subscription);
+
+  // Unsubscribe... the subscription may be deleted once it is no longer
+  // attached (Subscription::isAttached())
+  void unsubscribe(Subscription *subscription);
+
+  // Query a shadow resource's recent history/aggregates (any thread... never
+  // waits on the shards). -1/false if the shadow or resource is unknown
+  int queryResourceHistory(const char *endpoint_id, const uint16_t object_id,
+                           const uint16_t instance_id,
+                           const uint16_t resource_id, int64_t from_ms,
+                           int64_t to_ms, time_series_sample_t *samples,
+                           int max_samples);
+  bool aggregateResourceHistory(const char *endpoint_id,
+                                const uint16_t object_id,
+                                const uint16_t instance_id,
+                                const uint16_t resource_id, int64_t from_ms,
+                                int64_t to_ms,
+                                time_series_aggregate_t *aggregate);
+
+  // Read a shadow's resource value from its value cache (any thread... never
+  // waits on the shards)
+  bool readResourceValue(const char *endpoint_id, const uint16_t object_id,
+                         const uint16_t instance_id, const uint16_t resource_id,
+                         long *value);
+
+  // Add a device shadow (before connecting to mbed edge)... we take ownership
+  bool addDeviceShadow(DeviceShadow *shadow);
+
+  // Load a fleet configuration (before connecting to mbed edge): one shadow
+  // (and simulated device) per configured device
+  bool loadFleetConfig(const char *path, const char *endpoint_postfix);
+  void addFleetDevice(const fleet_device_config_t *config);
+  static void addFleetDeviceCB(const fleet_device_config_t *config, void *ctx);
+  static void collectFleetDeviceCB(const fleet_device_config_t *config,
+                                   void *ctx);
+
+  // Get the number of device shadows (and how many are registered)
+  size_t getNumDeviceShadows();
+  size_t getNumRegisteredDeviceShadows();
+
+  // Get the number of events processed by all of our shards
+  uint64_t getNumEventsProcessed();
+
+  // Get the number of registration renewals issued by all of our shards
+  uint64_t getNumRenewals();
+
+  // Get the telemetry our shards have coalesced or dropped under backpressure
+  uint64_t getNumCoalesced();
+  uint64_t getNumDropped();
+
+  // Get the events our shards have shed from a full lane overflow
+  uint64_t getNumShed();
+
+  // Get a latency percentile (usec, enqueue to processed) of a shard lane
+  // across all of our shards
+  double getLaneLatencyUs(SHARD_LANE lane, double percentile);
+
+  // Get our shards (for statistics... any thread)
+  size_t getNumShards();
+  OrchestratorShard *getShardAt(size_t index);
+
+  // Visit up to "max_shadows" shadows of the registry, from handle "*from"
+  // on, under the registry read lock ("fn" must not block). Returns false
+  // once there are no more... else "*from" is where to continue
+  bool visitDeviceShadows(size_t *from, size_t max_shadows,
+                          orchestrator_shadow_fn *fn, void *ctx);
+
+  // Runtime tuning (any thread... the shards pick new values up as they go):
+  // every poll interval is scaled by a percentage, and the coalescing window
+  // at ELEVATED backpressure (it doubles per level above) can be changed
+  void setPollScalePercent(int percent);
+  int getPollScalePercent();
+  void setCoalesceIntervalMs(int interval_ms);
+  int getCoalesceIntervalMs();
+
+  // Change a configured device's poll interval (until the fleet
+  // configuration is next reloaded)... false if it is not in the fleet
+  bool setPollInterval(const char *endpoint_id, int interval_ms);
+
+  // Backpressure level names
+  static const char *pressureName(ORCHESTRATOR_PRESSURE pressure);
+
   // Get our actual underlying device
   void *getDevice();
 
-  // Get our connection
-  struct connection *getConnection();
+  // Get our PT connections (any thread, once connected to mbed edge PT)
+  size_t getNumPTConnections();
+  PTConnection *getPTConnectionAt(size_t index);
 
-  // PT Registation Success
-  void ptRegisterSuccess();
-  static void ptRegisterSuccessCB(void *ctx);
+  // Get the PT connection an endpoint is on: shadows are spread across the
+  // connections by consistent hashing, so changing their number only moves
+  // the shadows that land on the added (or removed) connections
+  PTConnection *getPTConnection(const char *endpoint_id);
 
-  // PT Registration Failure
-  void ptRegisterFailure();
-  static void ptRegisterFailureCB(void *ctx);
+  // replay a buffered (offline) shadow update
+  void replayOfflineUpdate(const offline_store_record_t *record);
+  static void replayOfflineUpdateCB(const offline_store_record_t *record,
+                                    void *ctx);
 
 private:
   Orchestrator(const Orchestrator &orchestrator);
   void initialize(void *device);
   bool initializePT(int argc, char **argv);
+  bool createDeviceShadows(const char *config, const char *endpoint_postfix);
   bool startPT();
-  void createDeviceShadow(void);
+  bool startShards();
+  void stopShards();
+  void stopRulesEngine();
+  OrchestratorShard *getShard(DeviceShadow *shadow);
+  bool waitForZero(size_t *counter, int timeout_ms);
+  void updatePressure();
+  void drainPendingUpdates();
+  void createDeviceShadow(PTConnection *connection);
+  bool createPTConnections(const char *name, int num_connections);
+  void assignPTConnection(DeviceShadow *shadow);
+  void fleetEndpointID(char *buffer, size_t length,
+                       const fleet_device_config_t *config);
+  void deleteRetiredShadows();
+  void indexDeviceShadow(DeviceShadow *shadow);
+  void replayOfflineStore(void);
 
 private:
-  // PT essentials
-  bool m_pt_connected;
-  struct connection *m_connection;
+  // PT essentials: one or more connections (each with its own thread) and
+  // the hash ring that spreads the shadows across them
   protocol_translator_api_ctx_t *m_pt_ctx;
-  pthread_t m_pt_thread;
+  std::vector<PTConnection *> m_pt_connections;
+  std::vector<pt_ring_point_t> m_pt_ring; // sorted by hash
+  bool m_shutting_down;
+
+  // shutdown state (written by shutdown(), read from any thread: atomic)
+  ORCHESTRATOR_STATE m_state;
+  volatile sig_atomic_t m_shutdown_requested;
+  volatile sig_atomic_t m_shutdown_signal;
+  volatile sig_atomic_t m_reload_requested;
+  volatile sig_atomic_t m_trace_export_requested;
+  volatile sig_atomic_t m_profile_toggle_requested;
+  sem_t m_event_sem; // wakes our event loop (posted from signal context)
+  size_t m_num_writes_in_flight;
+  size_t m_max_writes_in_flight;
+  ORCHESTRATOR_PRESSURE m_pressure; // written under m_mutex, read atomically
+  size_t m_num_pending_deregistrations;
+  bool m_pt_threads_stuck; // a PT thread outlived shutdown()
+
+  // PT reconnection state
+  pthread_mutex_t m_mutex;
+  pthread_cond_t m_cond;
 
   // device essentials - in our sample, we have ONE "actual" device and ONE
   // shadow representing it in mbed Cloud...
-  void *m_device;                // the "actual" underlying device
-  DeviceShadow *m_device_shadow; // the shadow of the "actual" device within
-                                 // mbed Cloud (via PT)
+  void *m_device; // the "actual" underlying device
+  std::vector<DeviceShadow *>
+      m_device_shadows; // the shadows of the "actual" devices within mbed
+                        // Cloud (via PT)
+  std::vector<DeviceShadow *>
+      m_device_shadow_index; // shadows by (interned) endpoint handle
+  size_t m_num_device_shadows;
+  pthread_rwlock_t m_registry_lock; // held (read) across lookup + enqueue
+                                    // by other threads, (write) to change
+                                    // the registry
+  std::vector<DeviceShadow *> m_retired_shadows; // guarded by m_mutex
+
+  // simulated devices created from the fleet configuration (each is polled by
+  // the shard owning its shadow)
+  std::vector<NonMbedDevice *> m_fleet_devices;
+  char *m_fleet_endpoint_postfix;
+  bool m_fleet_has_duplicates;
+  char *m_config_path; // reloaded on SIGHUP
+  std::map<endpoint_handle_t, fleet_device_config_t>
+      m_fleet_configs; // the configuration of each live shadow (by handle)
+
+  // local rules between the fleet's devices (see RulesEngine)
+  char *m_rules_path; // reloaded on SIGHUP
+  RulesEngine *m_rules_engine;
+
+  // sampled per-device spans are exported here (see Tracer) on SIGUSR1 and
+  // at shutdown
+  char *m_trace_path;
+
+  // CPU profiles (see Profiler) are written as "<prefix>.<thread>.folded"
+  char *m_profile_prefix;
+  int m_profile_hz;
+
+  // local admin control socket (see ControlSocket) and the runtime tuning it
+  // can change
+  char *m_control_path;
+  ControlSocket *m_control_socket;
+  int m_poll_scale_percent;
+  int m_coalesce_interval_ms;
+  pthread_mutex_t m_fleet_mutex; // m_fleet_configs: reloads vs. the socket
+
+  // updates generated while PT is not connected are buffered here
+  OfflineStore *m_offline_store;
+
+  // shadows are hashed (by endpoint ID) onto per-core shards
+  int m_num_shards;
+  std::vector<OrchestratorShard *> m_shards;
 };
 
 #endif // __ORCHESTRATOR_H__
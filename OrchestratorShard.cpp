@@ -0,0 +1,1244 @@
+/**
+ * @file    OrchestratorShard.cpp
+ * @brief   mbed Edge Orchestrator Shard Implementation
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "OrchestratorShard.h"
+
+// Orchestrator
+#include "Orchestrator.h"
+
+// per-device spans
+#include "Tracer.h"
+
+// CPU profiling
+#include "Profiler.h"
+
+// worker threads (process signals blocked)
+#include "Threads.h"
+
+// log levels
+#include "Log.h"
+
+// system includes
+#include <malloc.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// batch de-duplication, poll/renewal heaps
+#include <algorithm>
+
+// current CLOCK_MONOTONIC time in milliseconds
+static uint64_t monotonicMs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// current CLOCK_MONOTONIC time in nanoseconds
+static uint64_t monotonicNs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// poll heap ordering (earliest due time on top)
+static bool pollIsLater(const shard_poll_t &a, const shard_poll_t &b) {
+  return a.due_ms > b.due_ms;
+}
+
+// renewal heap ordering (earliest due time on top)
+static bool renewalIsLater(const shard_renewal_t &a, const shard_renewal_t &b) {
+  return a.due_ms > b.due_ms;
+}
+
+// the shard whose loop the calling thread runs (if any)
+static __thread OrchestratorShard *current_shard = NULL;
+
+// does the calling thread never wait on a full lane? (see
+// setNonBlockingThread())
+static __thread bool nonblocking_thread = false;
+
+// constructor
+OrchestratorShard::OrchestratorShard(void *orchestrator, int index, int cpu) {
+  this->initialize(orchestrator, index, cpu);
+}
+
+// destructor
+OrchestratorShard::~OrchestratorShard() {
+  this->stop();
+  for (int i = 0; i < SHARD_NUM_LANES; ++i) {
+    free(this->m_lanes[i].events);
+  }
+  free(this->m_batch);
+  free(this->m_control_batch);
+  pthread_cond_destroy(&this->m_not_full);
+  pthread_cond_destroy(&this->m_not_empty);
+  pthread_mutex_destroy(&this->m_mutex);
+}
+
+// copy constructor
+OrchestratorShard::OrchestratorShard(const OrchestratorShard &shard) {}
+
+// initialize
+void OrchestratorShard::initialize(void *orchestrator, int index, int cpu) {
+  this->m_orchestrator = orchestrator;
+  this->m_index = index;
+  this->m_cpu = cpu;
+  this->m_is_running = false;
+  this->m_is_started = false;
+  pthread_mutex_init(&this->m_mutex, NULL);
+
+  // our loop also wakes up for polls... those are timed on CLOCK_MONOTONIC
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&this->m_not_empty, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_cond_init(&this->m_not_full, NULL);
+  memset(this->m_lanes, 0, sizeof(this->m_lanes));
+  for (int i = 0; i < SHARD_NUM_LANES; ++i) {
+    this->m_lanes[i].capacity = (i == SHARD_LANE_TELEMETRY)
+                                    ? SHARD_QUEUE_CAPACITY
+                                    : SHARD_LANE_CAPACITY;
+    this->m_lanes[i].events = (shard_event_t *)calloc(
+        this->m_lanes[i].capacity, sizeof(shard_event_t));
+  }
+  this->m_batch =
+      (shard_event_t *)calloc(SHARD_BATCH_BUDGET, sizeof(shard_event_t));
+  this->m_control_batch =
+      (shard_event_t *)calloc(SHARD_LANE_MIN_SHARE, sizeof(shard_event_t));
+  this->m_num_events_processed = 0;
+  this->m_next_forward_ms = 0;
+  this->m_num_coalesced = 0;
+  this->m_num_dropped = 0;
+  this->m_num_shed = 0;
+  this->m_poll_seed = (unsigned int)index;
+  this->m_renewal_seed = (unsigned int)index ^ (unsigned int)monotonicMs();
+  this->m_next_renewal_batch_ms = 0;
+  this->m_num_renewals = 0;
+  this->m_next_idle_sweep_ms = 0;
+  this->m_idle_sweep_cursor = 0;
+  this->m_num_dematerialized = 0;
+  this->m_num_untrimmed = 0;
+}
+
+// STATIC: pthread invocation function
+void *OrchestratorShard::shardProcessor(void *ctx) {
+  OrchestratorShard *instance = (OrchestratorShard *)ctx;
+  if (instance != NULL) {
+    instance->shardRunLoop();
+  }
+  return NULL;
+}
+
+// start the shard event loop
+bool OrchestratorShard::start() {
+  this->m_is_running = true;
+  if (Threads::create(&this->m_thread, &OrchestratorShard::shardProcessor,
+                      (void *)this) == false) {
+    printf("OrchestratorShard(%d): ERROR. Unable to start shard thread\n",
+           this->m_index);
+    this->m_is_running = false;
+    return false;
+  }
+  this->m_is_started = true;
+
+  // pin the shard to its core... its shadows' state stays in that core's cache
+  if (this->m_cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(this->m_cpu, &cpus);
+    if (pthread_setaffinity_np(this->m_thread, sizeof(cpus), &cpus) != 0) {
+      printf("OrchestratorShard(%d): WARNING. Unable to pin shard to CPU %d\n",
+             this->m_index, this->m_cpu);
+    }
+  }
+  return true;
+}
+
+// stop the shard event loop (anything already queued is processed first)
+void OrchestratorShard::stop() {
+  pthread_mutex_lock(&this->m_mutex);
+  this->m_is_running = false;
+  pthread_cond_broadcast(&this->m_not_empty);
+  pthread_cond_broadcast(&this->m_not_full);
+  pthread_mutex_unlock(&this->m_mutex);
+  if (this->m_is_started == true) {
+    pthread_join(this->m_thread, NULL);
+    this->m_is_started = false;
+  }
+
+  // whatever is still retiring is deleted by our orchestrator once PT has
+  // been shut down
+  for (size_t i = 0; i < this->m_retirees.size(); ++i) {
+    ((Orchestrator *)this->m_orchestrator)
+        ->shadowRetired(this->m_retirees[i].shadow);
+  }
+  this->m_retirees.clear();
+}
+
+// add a shadow to this shard (before start(), else shard thread only)
+void OrchestratorShard::addDeviceShadow(DeviceShadow *shadow) {
+  this->m_device_shadows.push_back(shadow);
+  this->schedulePoll(shadow);
+}
+
+// is a shadow one of the (sorted) removed ones?
+static bool isRemoved(const std::vector<DeviceShadow *> *removed,
+                      DeviceShadow *shadow) {
+  return std::binary_search(removed->begin(), removed->end(), shadow);
+}
+
+// drop shadows from this shard (shard thread only)... one pass over each of
+// our containers, however many there are
+void OrchestratorShard::removeDeviceShadows(
+    std::vector<DeviceShadow *> *removed) {
+  std::sort(removed->begin(), removed->end());
+  size_t kept = 0;
+  for (size_t i = 0; i < this->m_device_shadows.size(); ++i) {
+    if (isRemoved(removed, this->m_device_shadows[i]) == false) {
+      this->m_device_shadows[kept++] = this->m_device_shadows[i];
+    }
+  }
+  this->m_device_shadows.resize(kept);
+  kept = 0;
+  for (size_t i = 0; i < this->m_dirty_shadows.size(); ++i) {
+    if (isRemoved(removed, this->m_dirty_shadows[i]) == false) {
+      this->m_dirty_shadows[kept++] = this->m_dirty_shadows[i];
+    }
+  }
+  this->m_dirty_shadows.resize(kept);
+  kept = 0;
+  for (size_t i = 0; i < this->m_held_shadows.size(); ++i) {
+    if (isRemoved(removed, this->m_held_shadows[i]) == false) {
+      this->m_held_shadows[kept++] = this->m_held_shadows[i];
+    }
+  }
+  this->m_held_shadows.resize(kept);
+  kept = 0;
+  for (size_t i = 0; i < this->m_pending_registrations.size(); ++i) {
+    if (isRemoved(removed, this->m_pending_registrations[i]) == false) {
+      this->m_pending_registrations[kept++] = this->m_pending_registrations[i];
+    }
+  }
+  this->m_pending_registrations.resize(kept);
+  kept = 0;
+  for (size_t i = 0; i < this->m_polls.size(); ++i) {
+    if (isRemoved(removed, this->m_polls[i].shadow) == false) {
+      this->m_polls[kept++] = this->m_polls[i];
+    }
+  }
+  if (kept != this->m_polls.size()) {
+    this->m_polls.resize(kept);
+    std::make_heap(this->m_polls.begin(), this->m_polls.end(), pollIsLater);
+  }
+  kept = 0;
+  for (size_t i = 0; i < this->m_renewals.size(); ++i) {
+    if (isRemoved(removed, this->m_renewals[i].shadow) == false) {
+      this->m_renewals[kept++] = this->m_renewals[i];
+    }
+  }
+  if (kept != this->m_renewals.size()) {
+    this->m_renewals.resize(kept);
+    std::make_heap(this->m_renewals.begin(), this->m_renewals.end(),
+                   renewalIsLater);
+  }
+}
+
+// schedule a shadow's polls... the first one is spread across the poll
+// interval so a large fleet does not poll in lock step
+void OrchestratorShard::schedulePoll(DeviceShadow *shadow) {
+  uint64_t interval_ms = this->getPollIntervalMs(shadow);
+  if (interval_ms > 0) {
+    shard_poll_t poll;
+    poll.due_ms = monotonicMs() + rand_r(&this->m_poll_seed) % interval_ms;
+    poll.shadow = shadow;
+    this->m_polls.push_back(poll);
+    std::push_heap(this->m_polls.begin(), this->m_polls.end(), pollIsLater);
+  }
+}
+
+// stop polling a shadow
+void OrchestratorShard::unschedulePoll(DeviceShadow *shadow) {
+  size_t num_polls = this->m_polls.size();
+  for (size_t i = 0; i < this->m_polls.size();) {
+    if (this->m_polls[i].shadow == shadow) {
+      this->m_polls[i] = this->m_polls.back();
+      this->m_polls.pop_back();
+    } else {
+      ++i;
+    }
+  }
+  if (this->m_polls.size() != num_polls) {
+    std::make_heap(this->m_polls.begin(), this->m_polls.end(), pollIsLater);
+  }
+}
+
+// the lane an event is queued in
+SHARD_LANE OrchestratorShard::getLane(SHARD_EVENT_TYPE type) {
+  switch (type) {
+  case SHARD_EVENT_WRITE:
+  case SHARD_EVENT_WRITE_BATCH:
+  case SHARD_EVENT_SUBSCRIBE:
+  case SHARD_EVENT_UNSUBSCRIBE:
+    return SHARD_LANE_CONTROL;
+  case SHARD_EVENT_REGISTERED:
+  case SHARD_EVENT_REGISTER_ALL:
+  case SHARD_EVENT_DEREGISTERED:
+  case SHARD_EVENT_FLUSH:
+    return SHARD_LANE_STATE;
+  default:
+    return SHARD_LANE_TELEMETRY;
+  }
+}
+
+// number of events queued across our lanes (lock held)
+size_t OrchestratorShard::getQueueCount() {
+  size_t count = 0;
+  for (int i = 0; i < SHARD_NUM_LANES; ++i) {
+    count += this->m_lanes[i].count;
+  }
+  return count;
+}
+
+// our orchestrator's current backpressure
+int OrchestratorShard::getPressure() {
+  return (int)((Orchestrator *)this->m_orchestrator)->getPressure();
+}
+
+// a shadow's poll interval, scaled by our orchestrator's poll scale (0: the
+// shadow is not polled)
+uint64_t OrchestratorShard::getPollIntervalMs(DeviceShadow *shadow) {
+  int interval_ms = shadow->getPollIntervalMs();
+  if (interval_ms <= 0) {
+    return 0;
+  }
+  uint64_t scaled_ms =
+      (uint64_t)interval_ms *
+      ((Orchestrator *)this->m_orchestrator)->getPollScalePercent() / 100;
+  return (scaled_ms > 0) ? scaled_ms : 1;
+}
+
+// mark the calling thread as one that never waits on a full lane
+void OrchestratorShard::setNonBlockingThread() { nonblocking_thread = true; }
+
+// enqueue an event (blocks while its lane is full... a telemetry flood never
+// holds up a cloud write). Under critical backpressure a tick that finds its
+// lane full is dropped instead: it is the lowest priority telemetry we have.
+// A non-blocking thread's event goes to the lane's overflow instead of
+// waiting... blocking producers wait for the overflow to drain too, so the
+// events in a lane keep their order. The overflow is bounded (see
+// makeOverflowRoom())
+bool OrchestratorShard::enqueue(const shard_event_t *event) {
+  if (current_shard == this) {
+    // queued by our own loop: waiting for room would wait on ourselves
+    this->m_self_events.push_back(*event);
+    this->m_self_events.back().enqueued_ns = monotonicNs();
+    return true;
+  }
+  SHARD_LANE lane_index = this->getLane(event->type);
+  shard_lane_t *lane = &this->m_lanes[lane_index];
+  std::deque<shard_event_t> *overflow = &this->m_overflow[lane_index];
+  pthread_mutex_lock(&this->m_mutex);
+  if (event->type == SHARD_EVENT_TICK && lane->count == lane->capacity &&
+      this->getPressure() == ORCHESTRATOR_PRESSURE_CRITICAL) {
+    ++this->m_num_dropped;
+    pthread_mutex_unlock(&this->m_mutex);
+    return false;
+  }
+  while ((lane->count == lane->capacity || overflow->empty() == false) &&
+         nonblocking_thread == false && this->m_is_running == true) {
+    pthread_cond_wait(&this->m_not_full, &this->m_mutex);
+  }
+  if (this->m_is_running == false) {
+    pthread_mutex_unlock(&this->m_mutex);
+    return false;
+  }
+  if (lane->count == lane->capacity || overflow->empty() == false) {
+    if (overflow->size() >= SHARD_OVERFLOW_CAPACITY &&
+        this->makeOverflowRoom(lane_index, event) == false) {
+      ++this->m_num_shed;
+      pthread_mutex_unlock(&this->m_mutex);
+      return false;
+    }
+    ++lane->num_queued;
+    overflow->push_back(*event);
+    overflow->back().enqueued_ns = monotonicNs();
+    pthread_cond_signal(&this->m_not_empty);
+    pthread_mutex_unlock(&this->m_mutex);
+    return true;
+  }
+  ++lane->num_queued;
+  shard_event_t *queued =
+      &lane->events[(lane->head + lane->count) % lane->capacity];
+  *queued = *event;
+  queued->enqueued_ns = monotonicNs();
+  ++lane->count;
+  pthread_cond_signal(&this->m_not_empty);
+  pthread_mutex_unlock(&this->m_mutex);
+  return true;
+}
+
+// make room for "event" in a lane's full overflow (lock held)... false if it
+// is shed instead. Telemetry goes first: an incoming tick or replayed value
+// is dropped, anything else in the telemetry lane takes the place of the
+// oldest tick (or replayed value) waiting there. A cloud write that finds no
+// room is refused (PT reports the failure). Registration outcomes and fleet
+// changes are never shed: there are only ever a few per shadow
+bool OrchestratorShard::makeOverflowRoom(SHARD_LANE lane_index,
+                                         const shard_event_t *event) {
+  if (event->type == SHARD_EVENT_TICK || event->type == SHARD_EVENT_REPLAY) {
+    return false;
+  }
+  if (lane_index == SHARD_LANE_TELEMETRY) {
+    std::deque<shard_event_t> *overflow = &this->m_overflow[lane_index];
+    for (std::deque<shard_event_t>::iterator it = overflow->begin();
+         it != overflow->end(); ++it) {
+      if (it->type == SHARD_EVENT_TICK || it->type == SHARD_EVENT_REPLAY) {
+        overflow->erase(it);
+        ++this->m_lanes[lane_index].num_taken; // (never to be taken)
+        ++this->m_num_shed;
+        return true;
+      }
+    }
+  }
+  return (event->type != SHARD_EVENT_WRITE &&
+          event->type != SHARD_EVENT_WRITE_BATCH);
+}
+
+// enqueue a counter change
+bool OrchestratorShard::enqueueTick(DeviceShadow *shadow, int value) {
+  shard_event_t event;
+  event.type = SHARD_EVENT_TICK;
+  event.shadow = shadow;
+  event.value = value;
+  return this->enqueue(&event);
+}
+
+// enqueue a buffered counter value
+bool OrchestratorShard::enqueueReplay(DeviceShadow *shadow, int value,
+                                      int epoch) {
+  shard_event_t event;
+  event.type = SHARD_EVENT_REPLAY;
+  event.shadow = shadow;
+  event.value = value;
+  event.epoch = epoch;
+  return this->enqueue(&event);
+}
+
+// enqueue a (re)registration or renewal outcome
+bool OrchestratorShard::enqueueRegistered(DeviceShadow *shadow, bool success) {
+  shard_event_t event;
+  event.type = SHARD_EVENT_REGISTERED;
+  event.shadow = shadow;
+  event.value = (success == true) ? 1 : 0;
+  return this->enqueue(&event);
+}
+
+// enqueue a deregistration outcome
+bool OrchestratorShard::enqueueDeregistered(DeviceShadow *shadow,
+                                            bool success) {
+  shard_event_t event;
+  event.type = SHARD_EVENT_DEREGISTERED;
+  event.shadow = shadow;
+  event.value = (success == true) ? 1 : 0;
+  return this->enqueue(&event);
+}
+
+// enqueue a (re)registration of our shadows on a PT connection
+bool OrchestratorShard::enqueueRegisterAll(void *connection) {
+  shard_event_t event;
+  event.type = SHARD_EVENT_REGISTER_ALL;
+  event.shadow = NULL;
+  event.connection = connection;
+  return this->enqueue(&event);
+}
+
+// enqueue a cloud write request (the value belongs to PT... it is decoded
+// into the event, once, on the way in)
+bool OrchestratorShard::enqueueWrite(
+    DeviceShadow *shadow, const uint16_t object_id, const uint16_t instance_id,
+    const uint16_t resource_id, const unsigned int operation,
+    const uint8_t *value, const uint32_t value_size) {
+  shard_event_t event;
+  if (DeviceShadow::decodeValue(value, value_size, &event.write_value) ==
+      false) {
+    return false;
+  }
+  event.type = SHARD_EVENT_WRITE;
+  event.shadow = shadow;
+  event.object_id = object_id;
+  event.instance_id = instance_id;
+  event.resource_id = resource_id;
+  event.operation = operation;
+  return this->enqueue(&event);
+}
+
+// enqueue a batch of writes to a shadow (copied)
+bool OrchestratorShard::enqueueWriteBatch(DeviceShadow *shadow,
+                                          const device_shadow_write_t *writes,
+                                          int num_writes) {
+  shard_event_t event;
+  event.type = SHARD_EVENT_WRITE_BATCH;
+  event.shadow = shadow;
+  event.num_writes = num_writes;
+  event.writes = (device_shadow_write_t *)malloc(num_writes *
+                                                 sizeof(device_shadow_write_t));
+  memcpy(event.writes, writes, num_writes * sizeof(device_shadow_write_t));
+  if (this->enqueue(&event) == false) {
+    free(event.writes);
+    return false;
+  }
+  return true;
+}
+
+// enqueue a flush of whatever the shadow is holding
+bool OrchestratorShard::enqueueFlush(DeviceShadow *shadow) {
+  shard_event_t event;
+  event.type = SHARD_EVENT_FLUSH;
+  event.shadow = shadow;
+  return this->enqueue(&event);
+}
+
+// enqueue the attachment of a local subscriber
+bool OrchestratorShard::enqueueSubscribe(DeviceShadow *shadow,
+                                         Subscription *subscription) {
+  shard_event_t event;
+  event.type = SHARD_EVENT_SUBSCRIBE;
+  event.shadow = shadow;
+  event.subscription = subscription;
+  return this->enqueue(&event);
+}
+
+// enqueue the detachment of a local subscriber
+bool OrchestratorShard::enqueueUnsubscribe(DeviceShadow *shadow,
+                                           Subscription *subscription) {
+  shard_event_t event;
+  event.type = SHARD_EVENT_UNSUBSCRIBE;
+  event.shadow = shadow;
+  event.subscription = subscription;
+  return this->enqueue(&event);
+}
+
+// enqueue the adoption of a new shadow
+bool OrchestratorShard::enqueueAdd(DeviceShadow *shadow) {
+  shard_event_t event;
+  event.type = SHARD_EVENT_ADD;
+  event.shadow = shadow;
+  return this->enqueue(&event);
+}
+
+// enqueue the removal of a shadow
+bool OrchestratorShard::enqueueRemove(DeviceShadow *shadow) {
+  shard_event_t event;
+  event.type = SHARD_EVENT_REMOVE;
+  event.shadow = shadow;
+  return this->enqueue(&event);
+}
+
+// enqueue a shadow's new configuration (copied)
+bool OrchestratorShard::enqueueReconfigure(
+    DeviceShadow *shadow, const fleet_device_config_t *config) {
+  shard_event_t event;
+  event.type = SHARD_EVENT_RECONFIGURE;
+  event.shadow = shadow;
+  event.config =
+      (fleet_device_config_t *)malloc(sizeof(fleet_device_config_t));
+  *event.config = *config;
+  if (this->enqueue(&event) == false) {
+    free(event.config);
+    return false;
+  }
+  return true;
+}
+
+// take the next batch off our lanes (lock held). Every waiting lane gets its
+// minimum share of the budget first, so telemetry keeps moving under a flood
+// of writes... the rest goes in priority order
+size_t OrchestratorShard::takeBatch() {
+  size_t take[SHARD_NUM_LANES];
+  size_t budget = SHARD_BATCH_BUDGET;
+  for (int i = 0; i < SHARD_NUM_LANES; ++i) {
+    take[i] = std::min(this->m_lanes[i].count, (size_t)SHARD_LANE_MIN_SHARE);
+    budget -= take[i];
+  }
+  for (int i = 0; i < SHARD_NUM_LANES; ++i) {
+    size_t extra = std::min(this->m_lanes[i].count - take[i], budget);
+    take[i] += extra;
+    budget -= extra;
+  }
+  size_t num_events = 0;
+  for (int i = 0; i < SHARD_NUM_LANES; ++i) {
+    num_events += this->takeFromLane(i, take[i], &this->m_batch[num_events]);
+  }
+  return num_events;
+}
+
+// take (up to) "count" events off the head of a lane (lock held)
+size_t OrchestratorShard::takeFromLane(int index, size_t count,
+                                       shard_event_t *events) {
+  shard_lane_t *lane = &this->m_lanes[index];
+  count = std::min(count, lane->count);
+  for (size_t j = 0; j < count; ++j) {
+    events[j] = lane->events[(lane->head + j) % lane->capacity];
+  }
+  lane->head = (lane->head + count) % lane->capacity;
+  lane->count -= count;
+  lane->num_taken += count;
+
+  // ... and move whatever overflowed into the room we just made
+  std::deque<shard_event_t> *overflow = &this->m_overflow[index];
+  while (overflow->empty() == false && lane->count < lane->capacity) {
+    lane->events[(lane->head + lane->count) % lane->capacity] =
+        overflow->front();
+    overflow->pop_front();
+    ++lane->count;
+  }
+  return count;
+}
+
+// process the control events (writes, (un)subscribes) queued since we took
+// our batch, ahead of the rest of its telemetry (shard thread only). A cloud
+// write then never waits behind a whole batch of ticks
+size_t OrchestratorShard::processControlEvents() {
+  pthread_mutex_lock(&this->m_mutex);
+  size_t num_events = this->takeFromLane(
+      SHARD_LANE_CONTROL, SHARD_LANE_MIN_SHARE, this->m_control_batch);
+  if (num_events > 0) {
+    pthread_cond_broadcast(&this->m_not_full);
+  }
+  pthread_mutex_unlock(&this->m_mutex);
+  for (size_t i = 0; i < num_events; ++i) {
+    this->processEvent(&this->m_control_batch[i]);
+    this->recordLatency(&this->m_control_batch[i]);
+  }
+  return num_events;
+}
+
+// account for the time an event spent between being queued and processed
+void OrchestratorShard::recordLatency(const shard_event_t *event) {
+  shard_lane_t *lane = &this->m_lanes[this->getLane(event->type)];
+  uint64_t latency_us = (monotonicNs() - event->enqueued_ns) / 1000;
+  int bucket = (latency_us == 0) ? 0 : 64 - __builtin_clzll(latency_us);
+  if (bucket >= SHARD_LATENCY_BUCKETS) {
+    bucket = SHARD_LATENCY_BUCKETS - 1;
+  }
+  __atomic_add_fetch(&lane->latency[bucket], 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&lane->num_events, 1, __ATOMIC_RELAXED);
+}
+
+// process a single event (shard thread only)
+void OrchestratorShard::processEvent(const shard_event_t *event) {
+  DeviceShadow *shadow = event->shadow;
+
+  // a retired shadow only waits for its deregistration... anything else
+  // still queued for it is dropped
+  if (shadow != NULL && shadow->isRetired() == true &&
+      event->type != SHARD_EVENT_DEREGISTERED) {
+    this->discardEvent(event);
+    return;
+  }
+
+  // the time ticks and writes of traced devices spent in our lanes
+  if ((event->type == SHARD_EVENT_TICK || event->type == SHARD_EVENT_WRITE ||
+       event->type == SHARD_EVENT_WRITE_BATCH) &&
+      Tracer::shared()->isSampled(shadow->getEndpointHandle()) == true) {
+    Tracer::shared()->complete(TRACE_SPAN_ENQUEUE, shadow->getEndpointHandle(),
+                               event->enqueued_ns, Tracer::now());
+  }
+  switch (event->type) {
+  case SHARD_EVENT_TICK:
+    shadow->notifyCounterValueHasChanged(event->value);
+    this->m_dirty_shadows.push_back(shadow);
+    break;
+  case SHARD_EVENT_REPLAY:
+    if (shadow->notifyBufferedCounterValue(event->value, event->epoch) ==
+        true) {
+      this->m_dirty_shadows.push_back(shadow);
+    }
+    break;
+  case SHARD_EVENT_WRITE: {
+    bool success = shadow->processWriteRequest(
+        shadow->getEndpointID(), event->object_id, event->instance_id,
+        event->resource_id, event->operation, &event->write_value);
+    LOG_DEBUG("OrchestratorShard(%d): write %s\n", this->m_index,
+              (success == true) ? "SUCCESS" : "FAILURE");
+    break;
+  }
+  case SHARD_EVENT_WRITE_BATCH:
+    shadow->processWriteRequests(event->writes, event->num_writes);
+    free(event->writes);
+    break;
+  case SHARD_EVENT_SUBSCRIBE:
+    shadow->subscribe(event->subscription);
+    break;
+  case SHARD_EVENT_UNSUBSCRIBE:
+    shadow->unsubscribe(event->subscription);
+    break;
+  case SHARD_EVENT_FLUSH:
+    this->m_dirty_shadows.push_back(shadow);
+    break;
+  case SHARD_EVENT_REGISTERED:
+  {
+    bool renewed = shadow->applyRegistration(event->value != 0);
+    if (event->value != 0) {
+      this->m_dirty_shadows.push_back(shadow);
+    }
+    this->scheduleRenewal(shadow, event->value != 0, renewed);
+    break;
+  }
+  case SHARD_EVENT_DEREGISTERED:
+    if (shadow->isRetired() == true) {
+      this->retireShadow(shadow);
+    } else {
+      shadow->applyDeregistration(event->value != 0);
+    }
+    break;
+  case SHARD_EVENT_REGISTER_ALL:
+    // registered a batch at a time (see registerPendingShadows())
+    for (size_t i = 0; i < this->m_device_shadows.size(); ++i) {
+      if (this->m_device_shadows[i]->getPTConnection() == event->connection) {
+        this->m_pending_registrations.push_back(this->m_device_shadows[i]);
+      }
+    }
+    break;
+  case SHARD_EVENT_ADD:
+    this->addDeviceShadow(shadow);
+    ((Orchestrator *)this->m_orchestrator)->registerDeviceShadow(shadow);
+    break;
+  case SHARD_EVENT_REMOVE:
+    // nothing new is queued for the shadow from here on (see
+    // Orchestrator::reloadFleetConfig())... it is released for deletion once
+    // it has deregistered and what is already queued has gone through
+    if (shadow->retire() == false) {
+      this->retireShadow(shadow);
+    }
+    break;
+  case SHARD_EVENT_RECONFIGURE: {
+    int poll_interval_ms = shadow->getConfig()->poll_interval_ms;
+    shadow->reconfigure(event->config);
+    if (shadow->getConfig()->poll_interval_ms != poll_interval_ms) {
+      this->unschedulePoll(shadow);
+      this->schedulePoll(shadow);
+    }
+    free(event->config);
+    break;
+  }
+  }
+}
+
+// drop an event without processing it (frees what it owns, and lets go of
+// a subscriber... its owner may be waiting on it)
+void OrchestratorShard::discardEvent(const shard_event_t *event) {
+  switch (event->type) {
+  case SHARD_EVENT_WRITE_BATCH:
+    free(event->writes);
+    break;
+  case SHARD_EVENT_RECONFIGURE:
+    free(event->config);
+    break;
+  case SHARD_EVENT_SUBSCRIBE:
+  case SHARD_EVENT_UNSUBSCRIBE:
+    event->subscription->setAttached(false);
+    break;
+  default:
+    break;
+  }
+}
+
+// a shadow removed from the fleet is done with PT (shard thread only)... it
+// is released once nothing can refer to it any more. A shadow that was
+// deregistering already when it was removed may report twice
+void OrchestratorShard::retireShadow(DeviceShadow *shadow) {
+  for (size_t i = 0; i < this->m_retirees.size(); ++i) {
+    if (this->m_retirees[i].shadow == shadow) {
+      return;
+    }
+  }
+  shard_retiree_t retiree;
+  memset(&retiree, 0, sizeof(retiree));
+  retiree.shadow = shadow;
+  this->m_retirees.push_back(retiree);
+}
+
+// hand the retired shadows nothing refers to any more to our orchestrator,
+// which deletes them (shard thread only). Once a shadow's PT calls have
+// completed nothing new is queued for it, so it only waits for what each
+// lane held at that point to be taken... our loop has processed those
+void OrchestratorShard::releaseRetiredShadows() {
+  if (this->m_retirees.empty() == true) {
+    return;
+  }
+  pthread_mutex_lock(&this->m_mutex);
+  for (size_t i = 0; i < this->m_retirees.size();) {
+    shard_retiree_t *retiree = &this->m_retirees[i];
+    if (retiree->has_barrier == false &&
+        retiree->shadow->hasPendingPTCalls() == false) {
+      for (int j = 0; j < SHARD_NUM_LANES; ++j) {
+        retiree->barrier[j] = this->m_lanes[j].num_queued;
+      }
+      retiree->has_barrier = true;
+    }
+    bool released = retiree->has_barrier;
+    for (int j = 0; j < SHARD_NUM_LANES && released == true; ++j) {
+      released = (this->m_lanes[j].num_taken >= retiree->barrier[j]);
+    }
+    if (released == true) {
+      this->m_released.push_back(retiree->shadow);
+      this->m_retirees[i] = this->m_retirees.back();
+      this->m_retirees.pop_back();
+    } else {
+      ++i;
+    }
+  }
+  pthread_mutex_unlock(&this->m_mutex);
+  if (this->m_released.empty() == true) {
+    return;
+  }
+  this->removeDeviceShadows(&this->m_released);
+  for (size_t i = 0; i < this->m_released.size(); ++i) {
+    ((Orchestrator *)this->m_orchestrator)->shadowRetired(this->m_released[i]);
+  }
+  this->m_released.clear();
+}
+
+// schedule a shadow's next registration renewal (shard thread only). It is
+// due at a random point late in its lifetime... so renewals do not go out
+// together. The first one after a (re)registration is drawn so that a fleet
+// that registered at once renews at its steady rate straight away: over the
+// first SHARD_RENEWAL_MIN_PERCENT of the lifetime, or over the renewal window
+// with fewer towards its end (the delay left until the next renewal of a
+// fleet already renewing at random). A failed renewal is retried with
+// exponential backoff and equal jitter (see PTConnection::reconnectDelayMs())
+void OrchestratorShard::scheduleRenewal(DeviceShadow *shadow, bool success,
+                                        bool renewed) {
+  uint64_t lifetime_ms = (uint64_t)shadow->getLifetime() * 1000;
+  if (lifetime_ms == 0 || shadow->isRegistered() == false ||
+      shadow->isRetired() == true) {
+    shadow->setRenewalDueMs(0);
+    return;
+  }
+  uint64_t min_ms = lifetime_ms * SHARD_RENEWAL_MIN_PERCENT / 100;
+  uint64_t span_ms =
+      lifetime_ms * (SHARD_RENEWAL_MAX_PERCENT - SHARD_RENEWAL_MIN_PERCENT) /
+      100;
+  uint64_t delay_ms = min_ms;
+  if (success == false) {
+    uint64_t ceiling = SHARD_RENEWAL_RETRY_MS;
+    for (int i = 1; i < shadow->getNumRenewalFailures() &&
+                    ceiling < SHARD_RENEWAL_RETRY_MAX_MS;
+         ++i) {
+      ceiling *= 2;
+    }
+    if (ceiling > SHARD_RENEWAL_RETRY_MAX_MS) {
+      ceiling = SHARD_RENEWAL_RETRY_MAX_MS;
+    }
+    delay_ms = ceiling / 2 + rand_r(&this->m_renewal_seed) % (ceiling / 2 + 1);
+  } else if (renewed == true || min_ms + span_ms == 0) {
+    delay_ms += (span_ms > 0) ? rand_r(&this->m_renewal_seed) % span_ms : 0;
+  } else if ((uint64_t)rand_r(&this->m_renewal_seed) % (2 * min_ms + span_ms) <
+             2 * min_ms) {
+    // (weighted by the time each part spends ahead of a renewal)
+    delay_ms = (min_ms > 0) ? rand_r(&this->m_renewal_seed) % min_ms : 0;
+  } else if (span_ms > 0) {
+    // the lesser of two draws: less and less likely towards the end
+    delay_ms += std::min(rand_r(&this->m_renewal_seed) % span_ms,
+                         rand_r(&this->m_renewal_seed) % span_ms);
+  }
+  shard_renewal_t renewal;
+  renewal.due_ms = monotonicMs() + delay_ms;
+  renewal.shadow = shadow;
+  shadow->setRenewalDueMs(renewal.due_ms);
+  this->m_renewals.push_back(renewal);
+  std::push_heap(this->m_renewals.begin(), this->m_renewals.end(),
+                 renewalIsLater);
+}
+
+// renew the registrations that are due, a batch at a time (shard thread
+// only)... the next renewal of each is scheduled once it completes
+void OrchestratorShard::renewDueShadows() {
+  uint64_t now = monotonicMs();
+  if (now < this->m_next_renewal_batch_ms) {
+    return;
+  }
+  int num_renewed = 0;
+  while (this->m_renewals.empty() == false &&
+         this->m_renewals.front().due_ms <= now &&
+         num_renewed < SHARD_RENEWAL_BATCH_SIZE) {
+    std::pop_heap(this->m_renewals.begin(), this->m_renewals.end(),
+                  renewalIsLater);
+    shard_renewal_t renewal = this->m_renewals.back();
+    this->m_renewals.pop_back();
+    if (renewal.shadow->getRenewalDueMs() != renewal.due_ms) {
+      // stale: re-registered (and re-scheduled) since
+      continue;
+    }
+    renewal.shadow->setRenewalDueMs(0);
+    if (renewal.shadow->isRetired() == false &&
+        renewal.shadow->renewRegistration() == true) {
+      ++num_renewed;
+    }
+  }
+  if (num_renewed > 0) {
+    this->m_next_renewal_batch_ms = now + SHARD_RENEWAL_BATCH_INTERVAL_MS;
+    __atomic_add_fetch(&this->m_num_renewals, num_renewed, __ATOMIC_RELEASE);
+  }
+}
+
+// drop the PT structures of the shadows that have been idle for a while
+// (shard thread only)... a slice of our shadows per sweep, so a large fleet
+// never holds up the loop
+void OrchestratorShard::sweepIdleShadows() {
+  uint64_t now = monotonicMs();
+  if (now < this->m_next_idle_sweep_ms) {
+    return;
+  }
+  this->m_next_idle_sweep_ms = now + SHARD_IDLE_SWEEP_INTERVAL_MS;
+  size_t num_shadows = this->m_device_shadows.size();
+  size_t num_swept = std::min(num_shadows, (size_t)SHARD_IDLE_SWEEP_BATCH);
+  uint64_t num_dematerialized = 0;
+  for (size_t i = 0; i < num_swept; ++i) {
+    if (this->m_idle_sweep_cursor >= num_shadows) {
+      this->m_idle_sweep_cursor = 0;
+    }
+    DeviceShadow *shadow = this->m_device_shadows[this->m_idle_sweep_cursor++];
+    if (shadow->dematerializeIfIdle(now, SHADOW_IDLE_TIMEOUT_MS) == true) {
+      ++num_dematerialized;
+    }
+  }
+  if (num_dematerialized > 0) {
+    __atomic_add_fetch(&this->m_num_dematerialized, num_dematerialized,
+                       __ATOMIC_RELAXED);
+  }
+
+  // the dropped trees are scattered through the heap... return the pages
+  // they leave free
+  this->m_num_untrimmed += num_dematerialized;
+  if (this->m_num_untrimmed >= SHARD_IDLE_TRIM_THRESHOLD) {
+    this->m_num_untrimmed = 0;
+    malloc_trim(0);
+  }
+}
+
+// (re)register the next batch of shadows waiting on their PT connection...
+// a reconnect of a large fleet does not hold up our lanes
+void OrchestratorShard::registerPendingShadows() {
+  for (int i = 0; i < SHARD_REGISTER_BATCH_SIZE &&
+                  this->m_pending_registrations.empty() == false;
+       ++i) {
+    DeviceShadow *shadow = this->m_pending_registrations.front();
+    this->m_pending_registrations.pop_front();
+    if (shadow->isRetired() == false && shadow->createAndRegister() == false) {
+      printf("OrchestratorShard(%d): unable to register %s\n", this->m_index,
+             shadow->getEndpointID());
+    }
+  }
+}
+
+// when do we next have to wake up for a poll, a renewal batch, an idle sweep,
+// a registration batch, a retired shadow or to forward the shadows we are
+// holding?
+bool OrchestratorShard::getNextDueMs(uint64_t *due_ms) {
+  if (this->m_pending_registrations.empty() == false) {
+    *due_ms = monotonicMs();
+    return true;
+  }
+  bool found = false;
+  if (this->m_retirees.empty() == false) {
+    *due_ms = monotonicMs() + SHARD_RETIRE_RECHECK_MS;
+    found = true;
+  }
+  if (this->m_polls.empty() == false) {
+    if (found == false || this->m_polls.front().due_ms < *due_ms) {
+      *due_ms = this->m_polls.front().due_ms;
+    }
+    found = true;
+  }
+  if (this->m_held_shadows.empty() == false) {
+    if (found == false || this->m_next_forward_ms < *due_ms) {
+      *due_ms = this->m_next_forward_ms;
+    }
+    found = true;
+  }
+  if (this->m_device_shadows.empty() == false) {
+    if (found == false || this->m_next_idle_sweep_ms < *due_ms) {
+      *due_ms = this->m_next_idle_sweep_ms;
+    }
+    found = true;
+  }
+  if (this->m_renewals.empty() == false) {
+    uint64_t renewal_ms = std::max(this->m_renewals.front().due_ms,
+                                   this->m_next_renewal_batch_ms);
+    if (found == false || renewal_ms < *due_ms) {
+      *due_ms = renewal_ms;
+    }
+    found = true;
+  }
+  return found;
+}
+
+// poll every shadow that is due (shard thread only)... under backpressure the
+// next polls are stretched out, so our devices produce less for edge-core to
+// catch up with
+void OrchestratorShard::pollDueShadows() {
+  uint64_t now = monotonicMs();
+  int pressure = this->getPressure();
+  while (this->m_polls.empty() == false &&
+         this->m_polls.front().due_ms <= now) {
+    std::pop_heap(this->m_polls.begin(), this->m_polls.end(), pollIsLater);
+    shard_poll_t &poll = this->m_polls.back();
+    if (poll.shadow->isRetired() == true) {
+      // removed from the fleet: no more polls
+      this->m_polls.pop_back();
+      continue;
+    }
+    if (poll.shadow->poll() == true) {
+      this->m_dirty_shadows.push_back(poll.shadow);
+    }
+
+    // next poll (if we fell behind, skip the missed ones)
+    uint64_t interval_ms = this->getPollIntervalMs(poll.shadow) << pressure;
+    poll.due_ms += interval_ms;
+    if (poll.due_ms <= now) {
+      poll.due_ms = now + interval_ms;
+    }
+    std::push_heap(this->m_polls.begin(), this->m_polls.end(), pollIsLater);
+  }
+}
+
+// forward each touched shadow once (multiple ticks in a batch coalesce).
+// Under backpressure they are held instead and forwarded together once per
+// coalescing window, each with just its latest value... and under critical
+// backpressure nothing more is forwarded until edge-core catches up (the
+// held values are superseded by newer ones in the meantime)
+void OrchestratorShard::forwardDirtyShadows() {
+  this->m_held_shadows.insert(this->m_held_shadows.end(),
+                              this->m_dirty_shadows.begin(),
+                              this->m_dirty_shadows.end());
+  this->m_dirty_shadows.clear();
+  if (this->m_held_shadows.empty() == true) {
+    return;
+  }
+  uint64_t now = monotonicMs();
+  int pressure = this->getPressure();
+  if (pressure != ORCHESTRATOR_PRESSURE_NONE &&
+      now < this->m_next_forward_ms) {
+    return;
+  }
+  size_t num_held = this->m_held_shadows.size();
+  std::sort(this->m_held_shadows.begin(), this->m_held_shadows.end());
+  this->m_held_shadows.erase(std::unique(this->m_held_shadows.begin(),
+                                         this->m_held_shadows.end()),
+                             this->m_held_shadows.end());
+  if (pressure != ORCHESTRATOR_PRESSURE_NONE) {
+    __atomic_add_fetch(&this->m_num_coalesced,
+                       num_held - this->m_held_shadows.size(),
+                       __ATOMIC_RELAXED);
+  }
+  size_t num_forwarded = 0;
+  while (num_forwarded < this->m_held_shadows.size() &&
+         this->getPressure() != ORCHESTRATOR_PRESSURE_CRITICAL) {
+    DeviceShadow *shadow = this->m_held_shadows[num_forwarded++];
+    if (shadow->isRetired() == false) {
+      shadow->processEvents();
+    }
+  }
+  this->m_held_shadows.erase(this->m_held_shadows.begin(),
+                             this->m_held_shadows.begin() + num_forwarded);
+
+  // next window (we may have pushed ourselves into a higher level)
+  pressure = this->getPressure();
+  this->m_next_forward_ms =
+      now + ((pressure == ORCHESTRATOR_PRESSURE_NONE)
+                 ? 0
+                 : ((uint64_t)((Orchestrator *)this->m_orchestrator)
+                        ->getCoalesceIntervalMs()
+                    << (pressure - 1)));
+}
+
+// shard run loop: drain the queue in batches... only this thread touches the
+// state of the shard's shadows, so no locks are needed to process them
+void OrchestratorShard::shardRunLoop() {
+  // DEBUG
+  printf("OrchestratorShard(%d): shard loop starting on CPU %d (%zu shadows, "
+         "thread id: %08x)...\n",
+         this->m_index, this->m_cpu, this->m_device_shadows.size(),
+         (unsigned int)pthread_self());
+  current_shard = this;
+  char thread_name[TRACE_THREAD_NAME_LENGTH];
+  snprintf(thread_name, sizeof(thread_name), "shard-%d", this->m_index);
+  Tracer::setThreadName(thread_name);
+  Profiler::shared()->registerThread(thread_name);
+
+  pthread_mutex_lock(&this->m_mutex);
+  while (this->m_is_running == true || this->getQueueCount() > 0) {
+    // wait for events (or for our next poll/renewal to become due)
+    while (this->getQueueCount() == 0 && this->m_is_running == true) {
+      uint64_t due_ms = 0;
+      if (this->getNextDueMs(&due_ms) == false) {
+        pthread_cond_wait(&this->m_not_empty, &this->m_mutex);
+        continue;
+      }
+      if (due_ms <= monotonicMs()) {
+        break;
+      }
+      struct timespec deadline;
+      deadline.tv_sec = due_ms / 1000;
+      deadline.tv_nsec = (due_ms % 1000) * 1000000L;
+      pthread_cond_timedwait(&this->m_not_empty, &this->m_mutex, &deadline);
+    }
+
+    // take a batch, highest priority lane first...
+    size_t num_events = this->takeBatch();
+    pthread_cond_broadcast(&this->m_not_full);
+    pthread_mutex_unlock(&this->m_mutex);
+
+    // ... process it outside of the lock, letting new control events cut in
+    // every so often
+    size_t num_taken = num_events;
+    for (size_t i = 0; i < num_taken; ++i) {
+      this->processEvent(&this->m_batch[i]);
+      this->recordLatency(&this->m_batch[i]);
+      if ((i + 1) % SHARD_CONTROL_CHECK_EVERY == 0) {
+        num_events += this->processControlEvents();
+      }
+    }
+    this->pollDueShadows();
+    this->renewDueShadows();
+    this->registerPendingShadows();
+    this->sweepIdleShadows();
+
+    // ... along with anything that queued for us
+    while (this->m_self_events.empty() == false) {
+      this->m_self_batch.swap(this->m_self_events);
+      for (size_t i = 0; i < this->m_self_batch.size(); ++i) {
+        this->processEvent(&this->m_self_batch[i]);
+        this->recordLatency(&this->m_self_batch[i]);
+      }
+      num_events += this->m_self_batch.size();
+      this->m_self_batch.clear();
+    }
+
+    // forward the shadows touched (or held back)... and let go of the
+    // retired ones nothing refers to any more
+    this->forwardDirtyShadows();
+    this->releaseRetiredShadows();
+    __atomic_add_fetch(&this->m_num_events_processed, num_events,
+                       __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&this->m_mutex);
+  }
+  pthread_mutex_unlock(&this->m_mutex);
+  current_shard = NULL;
+  Profiler::shared()->unregisterThread();
+
+  // DEBUG
+  printf("OrchestratorShard(%d): shard loop stopped (%llu events "
+         "processed)\n",
+         this->m_index, (unsigned long long)this->m_num_events_processed);
+}
+
+// get our shard index
+int OrchestratorShard::getIndex() { return this->m_index; }
+
+// get the number of shadows owned by this shard
+size_t OrchestratorShard::getNumDeviceShadows() {
+  return this->m_device_shadows.size();
+}
+
+// get the number of events waiting in a lane
+size_t OrchestratorShard::getLaneQueueDepth(SHARD_LANE lane) {
+  return __atomic_load_n(&this->m_lanes[lane].count, __ATOMIC_RELAXED);
+}
+
+// get the number of events processed through a lane
+uint64_t OrchestratorShard::getLaneNumEvents(SHARD_LANE lane) {
+  return __atomic_load_n(&this->m_lanes[lane].num_events, __ATOMIC_RELAXED);
+}
+
+// add a lane's latency histogram into "buckets"
+void OrchestratorShard::getLaneLatency(SHARD_LANE lane, uint64_t *buckets) {
+  for (int i = 0; i < SHARD_LATENCY_BUCKETS; ++i) {
+    buckets[i] +=
+        __atomic_load_n(&this->m_lanes[lane].latency[i], __ATOMIC_RELAXED);
+  }
+}
+
+// STATIC: a latency percentile (0..100) from a histogram... the upper bound of
+// the bucket it falls in
+double OrchestratorShard::latencyPercentileUs(const uint64_t *buckets,
+                                              double percentile) {
+  uint64_t total = 0;
+  for (int i = 0; i < SHARD_LATENCY_BUCKETS; ++i) {
+    total += buckets[i];
+  }
+  if (total == 0) {
+    return 0.0;
+  }
+  uint64_t rank = (uint64_t)(total * percentile / 100.0);
+  uint64_t seen = 0;
+  for (int i = 0; i < SHARD_LATENCY_BUCKETS; ++i) {
+    seen += buckets[i];
+    if (seen > rank || seen == total) {
+      return (double)(1ULL << i);
+    }
+  }
+  return (double)(1ULL << (SHARD_LATENCY_BUCKETS - 1));
+}
+
+// get the number of registration renewals issued so far
+uint64_t OrchestratorShard::getNumRenewals() {
+  return __atomic_load_n(&this->m_num_renewals, __ATOMIC_ACQUIRE);
+}
+
+// get the number of forwards coalesced under backpressure
+uint64_t OrchestratorShard::getNumCoalesced() {
+  return __atomic_load_n(&this->m_num_coalesced, __ATOMIC_RELAXED);
+}
+
+// get the number of ticks dropped under backpressure
+uint64_t OrchestratorShard::getNumDropped() {
+  pthread_mutex_lock(&this->m_mutex);
+  uint64_t num_dropped = this->m_num_dropped;
+  pthread_mutex_unlock(&this->m_mutex);
+  return num_dropped;
+}
+
+// get the number of events shed from a full overflow
+uint64_t OrchestratorShard::getNumShed() {
+  pthread_mutex_lock(&this->m_mutex);
+  uint64_t num_shed = this->m_num_shed;
+  pthread_mutex_unlock(&this->m_mutex);
+  return num_shed;
+}
+
+// get the number of idle shadows whose PT structures were dropped
+uint64_t OrchestratorShard::getNumDematerialized() {
+  return __atomic_load_n(&this->m_num_dematerialized, __ATOMIC_RELAXED);
+}
+
+// get the number of events processed so far
+uint64_t OrchestratorShard::getNumEventsProcessed() {
+  return __atomic_load_n(&this->m_num_events_processed, __ATOMIC_ACQUIRE);
+}
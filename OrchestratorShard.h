@@ -0,0 +1,324 @@
+/**
+ * @file    OrchestratorShard.h
+ * @brief   mbed Edge Orchestrator Shard (per-core event loop)
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __ORCHESTRATOR_SHARD_H__
+#define __ORCHESTRATOR_SHARD_H__
+
+// system includes
+#include <pthread.h>
+#include <stdint.h>
+
+// shadows owned by this shard, lane overflow
+#include <deque>
+#include <vector>
+
+// DeviceShadow
+#include "DeviceShadow.h"
+
+// Tunables for the shards
+#define ORCHESTRATOR_MAX_SHARDS 64 // upper bound on --shards
+#define SHARD_QUEUE_CAPACITY 4096  // telemetry events buffered per shard
+#define SHARD_LANE_CAPACITY 1024   // control/state events buffered per shard
+#define SHARD_OVERFLOW_CAPACITY 4096 // overflow per lane before shedding
+#define SHARD_BATCH_BUDGET 512     // events taken per pass of the loop...
+#define SHARD_LANE_MIN_SHARE 32    // ... of which every waiting lane gets this
+#define SHARD_CONTROL_CHECK_EVERY 16 // telemetry events between looks at the
+                                     // control lane (writes cut in)
+#define SHARD_LATENCY_BUCKETS 32   // log2(usec) latency histogram buckets
+
+// Tunables for registration renewals: each is due at a random point between
+// these percentages of the shadow's lifetime, and they go out in batches
+#define SHARD_RENEWAL_MIN_PERCENT 50
+#define SHARD_RENEWAL_MAX_PERCENT 85
+#define SHARD_RENEWAL_BATCH_SIZE 256        // renewals per batch...
+#define SHARD_RENEWAL_BATCH_INTERVAL_MS 100 // ... and at most one batch per
+#define SHARD_RENEWAL_RETRY_MS 5000     // a failed renewal is retried, backing
+#define SHARD_RENEWAL_RETRY_MAX_MS 300000 // off up to this delay
+
+// Tunables for (re)registration after a PT connection comes up: the shard
+// registers the shadows on it a batch per pass of its loop (no more than a
+// batch of events... a cloud write waits one batch at most)
+#define SHARD_REGISTER_BATCH_SIZE SHARD_BATCH_BUDGET
+
+// Tunables for backpressure (see Orchestrator::getPressure()): every level
+// doubles the poll intervals, and above none the touched shadows are held and
+// forwarded together once per coalescing window (doubling per level... the
+// window can be changed at runtime, see Orchestrator::setCoalesceIntervalMs())
+#define SHARD_COALESCE_INTERVAL_MS 50 // coalescing window at ELEVATED pressure
+
+// Tunables for idle shadows (see DeviceShadow::materialize()): the shard
+// looks for shadows to drop the PT structures of this often... this many at a
+// time
+#define SHARD_IDLE_SWEEP_INTERVAL_MS 1000
+#define SHARD_IDLE_SWEEP_BATCH 4096
+
+// the freed PT structures are handed back to the system (malloc_trim()) once
+// this many shadows have dropped theirs... free() alone keeps the pages
+#define SHARD_IDLE_TRIM_THRESHOLD 1024
+
+// a shadow removed from the fleet is only handed back for deletion once its
+// PT calls have completed and every event queued until then has been
+// processed... while it waits on PT it is checked this often
+#define SHARD_RETIRE_RECHECK_MS 10
+
+// events handed to a shard from other threads
+enum SHARD_EVENT_TYPE {
+  SHARD_EVENT_TICK = 0, // the device counter has changed
+  SHARD_EVENT_WRITE,    // cloud-initiated write request
+  SHARD_EVENT_FLUSH,    // forward anything the shadow is holding
+  SHARD_EVENT_ADD,      // fleet reload: adopt (and register) a new shadow
+  SHARD_EVENT_REMOVE,   // fleet reload: drop (and retire) a shadow
+  SHARD_EVENT_RECONFIGURE, // fleet reload: apply a shadow's new configuration
+  SHARD_EVENT_WRITE_BATCH, // several writes, pushed with one pt_write_value()
+  SHARD_EVENT_SUBSCRIBE,   // attach a local subscriber to the shadow
+  SHARD_EVENT_UNSUBSCRIBE, // detach a local subscriber from the shadow
+  SHARD_EVENT_REGISTERED,  // (re)registered or renewed: flush, schedule renewal
+  SHARD_EVENT_REGISTER_ALL, // (re)register the shadows on a PT connection
+  SHARD_EVENT_DEREGISTERED, // deregistered: re-create if the schema changed
+  SHARD_EVENT_REPLAY        // a counter value buffered while PT was down
+};
+
+// priority lanes, drained in this order: writes (actuation) first, then
+// registration state changes, then device telemetry. Events only keep their
+// order within a lane, so (un)subscribes ride with the writes (a subscriber
+// sees every write issued after it subscribed) and fleet reloads
+// (add/remove/reconfigure) ride with the ticks... the other lanes only ever
+// move an event ahead of those
+enum SHARD_LANE {
+  SHARD_LANE_CONTROL = 0,
+  SHARD_LANE_STATE,
+  SHARD_LANE_TELEMETRY,
+  SHARD_NUM_LANES
+};
+
+typedef struct shard_event {
+  SHARD_EVENT_TYPE type;
+  uint64_t enqueued_ns; // CLOCK_MONOTONIC (lane latency)
+  DeviceShadow *shadow;
+  int value; // SHARD_EVENT_TICK/REPLAY (SHARD_EVENT_(DE)REGISTERED: success)
+  int epoch; // SHARD_EVENT_REPLAY: the PT connection's connect count
+  // SHARD_EVENT_WRITE
+  uint16_t object_id;
+  uint16_t instance_id;
+  uint16_t resource_id;
+  unsigned int operation;
+  device_shadow_value_t write_value; // decoded as it is queued
+  fleet_device_config_t *config; // SHARD_EVENT_RECONFIGURE (shard frees it)
+  device_shadow_write_t *writes; // SHARD_EVENT_WRITE_BATCH (shard frees it)
+  int num_writes;
+  Subscription *subscription; // SHARD_EVENT_(UN)SUBSCRIBE
+  void *connection; // SHARD_EVENT_REGISTER_ALL (a PTConnection)
+} shard_event_t;
+
+// a bounded event ring (and the latency of the events that went through it)
+typedef struct shard_lane {
+  shard_event_t *events;
+  size_t capacity;
+  size_t head;
+  size_t count;
+  uint64_t num_events;
+  uint64_t num_queued; // ever queued, overflow included (under the mutex)
+  uint64_t num_taken;  // ever taken by the loop (under the mutex)
+  uint64_t latency[SHARD_LATENCY_BUCKETS]; // enqueue -> processed
+} shard_lane_t;
+
+// a shadow whose device is polled by the shard
+typedef struct shard_poll {
+  uint64_t due_ms; // CLOCK_MONOTONIC
+  DeviceShadow *shadow;
+} shard_poll_t;
+
+// a shadow whose registration is renewed by the shard
+typedef struct shard_renewal {
+  uint64_t due_ms; // CLOCK_MONOTONIC
+  DeviceShadow *shadow;
+} shard_renewal_t;
+
+// a retired shadow waiting to be released: once its PT calls have completed,
+// "barrier" records how many events each lane had queued. It is released
+// when our loop has taken (and processed) all of those
+typedef struct shard_retiree {
+  DeviceShadow *shadow;
+  bool has_barrier;
+  uint64_t barrier[SHARD_NUM_LANES];
+} shard_retiree_t;
+
+class OrchestratorShard {
+public:
+  OrchestratorShard(void *orchestrator, int index, int cpu);
+  virtual ~OrchestratorShard();
+
+  // start/stop the shard event loop (stop() drains the queue first)
+  bool start();
+  void stop();
+
+  // hand a shadow to this shard... from here on only the shard thread
+  // touches its state
+  void addDeviceShadow(DeviceShadow *shadow);
+
+  // cross-thread entry points (enqueue only). A replayed counter value
+  // (buffered while PT was down) is dropped if a live one got there first
+  bool enqueueTick(DeviceShadow *shadow, int value);
+  bool enqueueReplay(DeviceShadow *shadow, int value, int epoch);
+  bool enqueueWrite(DeviceShadow *shadow, const uint16_t object_id,
+                    const uint16_t instance_id, const uint16_t resource_id,
+                    const unsigned int operation, const uint8_t *value,
+                    const uint32_t value_size);
+  bool enqueueWriteBatch(DeviceShadow *shadow,
+                         const device_shadow_write_t *writes, int num_writes);
+  bool enqueueFlush(DeviceShadow *shadow);
+  bool enqueueRegistered(DeviceShadow *shadow, bool success);
+  bool enqueueDeregistered(DeviceShadow *shadow, bool success);
+  bool enqueueRegisterAll(void *connection);
+  bool enqueueSubscribe(DeviceShadow *shadow, Subscription *subscription);
+  bool enqueueUnsubscribe(DeviceShadow *shadow, Subscription *subscription);
+  bool enqueueAdd(DeviceShadow *shadow);
+  bool enqueueRemove(DeviceShadow *shadow);
+  bool enqueueReconfigure(DeviceShadow *shadow,
+                          const fleet_device_config_t *config);
+
+  // the calling thread never waits for room in a lane: whatever does not fit
+  // is kept in the lane's overflow until it does (PT event threads... a
+  // blocked PT thread would hold up the completions the shard waits on)
+  static void setNonBlockingThread();
+
+  // statistics
+  int getIndex();
+  size_t getNumDeviceShadows();
+  uint64_t getNumEventsProcessed();
+  uint64_t getNumRenewals();
+  uint64_t getNumCoalesced();
+  uint64_t getNumDropped();
+  uint64_t getNumShed();
+  uint64_t getNumDematerialized();
+
+  // events waiting in a lane (a racy snapshot... for display only)
+  size_t getLaneQueueDepth(SHARD_LANE lane);
+
+  // per-lane statistics: events processed and their latency histogram
+  // (bucket "b" counts latencies below 2^b usec... added into "buckets")
+  uint64_t getLaneNumEvents(SHARD_LANE lane);
+  void getLaneLatency(SHARD_LANE lane, uint64_t *buckets);
+  static double latencyPercentileUs(const uint64_t *buckets,
+                                    double percentile);
+
+  // shard event loop (pthread)
+  static void *shardProcessor(void *ctx);
+  void shardRunLoop();
+
+private:
+  OrchestratorShard(const OrchestratorShard &shard);
+  void initialize(void *orchestrator, int index, int cpu);
+  bool enqueue(const shard_event_t *event);
+  SHARD_LANE getLane(SHARD_EVENT_TYPE type);
+  size_t getQueueCount();
+  bool makeOverflowRoom(SHARD_LANE lane_index, const shard_event_t *event);
+  size_t takeBatch();
+  size_t takeFromLane(int lane, size_t count, shard_event_t *events);
+  size_t processControlEvents();
+  void recordLatency(const shard_event_t *event);
+  void processEvent(const shard_event_t *event);
+  void pollDueShadows();
+  void schedulePoll(DeviceShadow *shadow);
+  void unschedulePoll(DeviceShadow *shadow);
+  void scheduleRenewal(DeviceShadow *shadow, bool success, bool renewed);
+  void renewDueShadows();
+  void sweepIdleShadows();
+  void registerPendingShadows();
+  bool getNextDueMs(uint64_t *due_ms);
+  int getPressure();
+  uint64_t getPollIntervalMs(DeviceShadow *shadow);
+  void forwardDirtyShadows();
+  void discardEvent(const shard_event_t *event);
+  void retireShadow(DeviceShadow *shadow);
+  void releaseRetiredShadows();
+  void removeDeviceShadows(std::vector<DeviceShadow *> *removed);
+
+private:
+  void *m_orchestrator;
+  int m_index;
+  int m_cpu;
+  bool m_is_running;
+  bool m_is_started;
+  pthread_t m_thread;
+
+  // shadows owned by this shard
+  std::vector<DeviceShadow *> m_device_shadows;
+
+  // inbound event queues (a bounded ring per lane)
+  pthread_mutex_t m_mutex;
+  pthread_cond_t m_not_empty;
+  pthread_cond_t m_not_full;
+  shard_lane_t m_lanes[SHARD_NUM_LANES];
+
+  // events from non-blocking threads that found their lane full (moved into
+  // the lane, in order, as it drains... a lane only has overflow while full)
+  std::deque<shard_event_t> m_overflow[SHARD_NUM_LANES];
+
+  // events the shard thread queues for itself (e.g. a registration that
+  // completed inline)... they never wait on our own lanes, and are processed
+  // in the same pass (shard thread only)
+  std::vector<shard_event_t> m_self_events;
+  std::vector<shard_event_t> m_self_batch;
+
+  // events being processed and the shadows they touched (each touched
+  // shadow is flushed once per batch)
+  shard_event_t *m_batch;
+  shard_event_t *m_control_batch; // control events that cut into a batch
+  std::vector<DeviceShadow *> m_dirty_shadows;
+  uint64_t m_num_events_processed;
+
+  // shadows held back under backpressure (forwarded together once per
+  // coalescing window... only their latest values go out)
+  std::vector<DeviceShadow *> m_held_shadows;
+  uint64_t m_next_forward_ms;
+  uint64_t m_num_coalesced;
+  uint64_t m_num_dropped;
+  uint64_t m_num_shed; // events shed from a full overflow (under the mutex)
+
+  // shadows polled by this shard (min-heap on due time)
+  std::vector<shard_poll_t> m_polls;
+  unsigned int m_poll_seed;
+
+  // registrations renewed by this shard (min-heap on due time... entries
+  // that no longer match their shadow's due time are stale and skipped)
+  std::vector<shard_renewal_t> m_renewals;
+  unsigned int m_renewal_seed;
+  uint64_t m_next_renewal_batch_ms;
+  uint64_t m_num_renewals;
+
+  // shadows waiting to (re)register after their PT connection came up
+  std::deque<DeviceShadow *> m_pending_registrations;
+
+  // idle shadows are swept a slice at a time (from "cursor" on)
+  uint64_t m_next_idle_sweep_ms;
+  size_t m_idle_sweep_cursor;
+  uint64_t m_num_dematerialized;
+  size_t m_num_untrimmed; // dropped since our last malloc_trim()
+
+  // shadows removed from the fleet, waiting until nothing refers to them
+  // (they stay in our containers, skipped, until they are released)
+  std::vector<shard_retiree_t> m_retirees;
+  std::vector<DeviceShadow *> m_released;
+};
+
+#endif // __ORCHESTRATOR_SHARD_H__
@@ -0,0 +1,415 @@
+/**
+ * @file    PTConnection.cpp
+ * @brief   mbed Edge Orchestrator PT client connection
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PTConnection.h"
+
+// Orchestrator
+#include "Orchestrator.h"
+
+// CPU profiling
+#include "Profiler.h"
+
+// worker threads (process signals blocked)
+#include "Threads.h"
+
+// system includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// elapsed milliseconds between two CLOCK_MONOTONIC timestamps
+static double elapsedMs(const struct timespec *from,
+                        const struct timespec *to) {
+  return (to->tv_sec - from->tv_sec) * 1000.0 +
+         (to->tv_nsec - from->tv_nsec) / 1000000.0;
+}
+
+// default constructor
+PTConnection::PTConnection(void *orchestrator, int index, const char *name,
+                           const char *hostname, int port) {
+  this->initialize(orchestrator, index, name, hostname, port);
+}
+
+// destructor
+PTConnection::~PTConnection() {
+  pthread_mutex_destroy(&this->m_calls_mutex);
+  free(this->m_name);
+  free(this->m_hostname);
+}
+
+// copy constructor
+PTConnection::PTConnection(const PTConnection &connection) {}
+
+// initialize
+void PTConnection::initialize(void *orchestrator, int index, const char *name,
+                              const char *hostname, int port) {
+  this->m_orchestrator = orchestrator;
+  this->m_index = index;
+  this->m_name = strdup(name);
+  this->m_hostname = strdup(hostname);
+  this->m_port = port;
+  this->m_connection = NULL;
+  this->m_connected = false;
+  this->m_thread_started = false;
+  pthread_mutex_init(&this->m_calls_mutex, NULL);
+  this->m_accepting_calls = false;
+  this->m_drain_scheduled = false;
+  this->m_reconnect_seed =
+      (unsigned int)time(NULL) ^ (unsigned int)getpid() ^ (index * 2654435761U);
+  this->m_reconnect_attempt = 0;
+  this->m_num_connects = 0;
+  this->m_was_connected = false;
+  memset(&this->m_disconnected_at, 0, sizeof(this->m_disconnected_at));
+  memset(&this->m_connected_at, 0, sizeof(this->m_connected_at));
+  this->m_num_device_shadows = 0;
+  this->m_num_shadows_synced = 0;
+}
+
+// start the PT thread
+bool PTConnection::start() {
+  this->m_thread_started = Threads::create(
+      &this->m_thread, &PTConnection::ptProcessor, (void *)this);
+  return this->m_thread_started;
+}
+
+// close the connection
+void PTConnection::shutdown() {
+  struct connection *connection =
+      __atomic_load_n(&this->m_connection, __ATOMIC_ACQUIRE);
+  if (connection != NULL) {
+    pt_client_shutdown(connection);
+  }
+}
+
+// join the PT thread (detached if it does not exit in time)
+bool PTConnection::join(const struct timespec *deadline) {
+  if (this->m_thread_started == false) {
+    return true;
+  }
+  this->m_thread_started = false;
+  if (pthread_timedjoin_np(this->m_thread, NULL, deadline) != 0) {
+    pthread_detach(this->m_thread);
+    return false;
+  }
+  return true;
+}
+
+// get the connection
+struct connection *PTConnection::getConnection() {
+  return __atomic_load_n(&this->m_connection, __ATOMIC_ACQUIRE);
+}
+
+// hand a PT call to the PT thread: the first call posted since the last drain
+// schedules another one on the PT event loop. A call posted while the
+// connection goes down is made (with a NULL connection) once its event loop
+// has exited
+bool PTConnection::post(pt_call_fn run, void *ctx) {
+  pt_call_t call;
+  call.run = run;
+  call.ctx = ctx;
+  pthread_mutex_lock(&this->m_calls_mutex);
+  if (this->m_accepting_calls == false) {
+    pthread_mutex_unlock(&this->m_calls_mutex);
+    return false;
+  }
+  this->m_calls.push_back(call);
+  if (this->m_drain_scheduled == false) {
+    this->m_drain_scheduled = true;
+    pt_status_t status =
+        pt_api_send_to_event_loop(this->getConnection(), (void *)this,
+                                  &PTConnection::drainCallsCB);
+    if (status != PT_STATUS_SUCCESS) {
+      printf("PTConnection(%d): ERROR. Unable to schedule PT calls (%d)\n",
+             this->m_index, status);
+    }
+  }
+  pthread_mutex_unlock(&this->m_calls_mutex);
+  return true;
+}
+
+// make the PT calls posted so far (PT thread)
+void PTConnection::drainCalls(struct connection *connection) {
+  pthread_mutex_lock(&this->m_calls_mutex);
+  this->m_draining.swap(this->m_calls);
+  this->m_drain_scheduled = false;
+  pthread_mutex_unlock(&this->m_calls_mutex);
+  for (size_t i = 0; i < this->m_draining.size(); ++i) {
+    this->m_draining[i].run(connection, this->m_draining[i].ctx);
+  }
+  this->m_draining.clear();
+}
+
+// is PT connected and registered?
+bool PTConnection::isConnected() {
+  return __atomic_load_n(&this->m_connected, __ATOMIC_ACQUIRE);
+}
+
+// get our index
+int PTConnection::getIndex() { return this->m_index; }
+
+// get our protocol translator name
+const char *PTConnection::getName() { return this->m_name; }
+
+// a shadow has been put on this connection
+void PTConnection::addDeviceShadow() {
+  __atomic_add_fetch(&this->m_num_device_shadows, 1, __ATOMIC_RELAXED);
+}
+
+// a shadow has been taken off this connection
+void PTConnection::removeDeviceShadow() {
+  __atomic_sub_fetch(&this->m_num_device_shadows, 1, __ATOMIC_RELAXED);
+}
+
+// get the number of shadows on this connection
+size_t PTConnection::getNumDeviceShadows() {
+  return __atomic_load_n(&this->m_num_device_shadows, __ATOMIC_RELAXED);
+}
+
+// a shadow on this connection has (re)registered... registrations complete
+// on the PT thread or the shards, hence the atomic count
+bool PTConnection::shadowSynced(double *synced_ms, double *outage_ms) {
+  size_t num_synced =
+      __atomic_add_fetch(&this->m_num_shadows_synced, 1, __ATOMIC_ACQ_REL);
+  if (num_synced != this->getNumDeviceShadows()) {
+    return false;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  *synced_ms = elapsedMs(&this->m_connected_at, &now);
+  *outage_ms = (this->m_was_connected == true)
+                   ? elapsedMs(&this->m_disconnected_at, &this->m_connected_at)
+                   : -1.0;
+  this->m_was_connected = true;
+  return true;
+}
+
+// get the number of times we have connected (and registered)
+int PTConnection::getNumConnects() {
+  return __atomic_load_n(&this->m_num_connects, __ATOMIC_RELAXED);
+}
+
+// PT connection is ready: register our protocol translator
+void PTConnection::connectionReady(struct connection *connection) {
+  pthread_mutex_lock(&this->m_calls_mutex);
+  this->m_accepting_calls = true;
+  pthread_mutex_unlock(&this->m_calls_mutex);
+  pt_status_t status = pt_register_protocol_translator(
+      connection, &PTConnection::registerSuccessCB,
+      &PTConnection::registerFailureCB, (void *)this);
+  if (status != PT_STATUS_SUCCESS) {
+    printf("PTConnection(%d): Unable to register the protocol translator "
+           "(%d)... retrying...\n",
+           this->m_index, status);
+    pt_client_shutdown(connection);
+  }
+}
+
+// PT Registration success
+void PTConnection::registerSuccess() {
+  // DEBUG
+  printf("PTConnection(%d): PT %s connected and registered. %zu shadow(s) "
+         "on it...\n",
+         this->m_index, this->m_name, this->getNumDeviceShadows());
+
+  // we now have a connected and registered PT!
+  this->m_reconnect_attempt = 0;
+  __atomic_store_n(&this->m_num_shadows_synced, 0, __ATOMIC_RELEASE);
+  clock_gettime(CLOCK_MONOTONIC, &this->m_connected_at);
+  __atomic_add_fetch(&this->m_num_connects, 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&this->m_connected, true, __ATOMIC_RELEASE);
+
+  // (re)register the shadows on this connection...
+  ((Orchestrator *)this->m_orchestrator)->ptRegisterSuccess(this);
+}
+
+// PT Registration Failure
+void PTConnection::registerFailure() {
+  // DEBUG
+  printf("PTConnection(%d): PT registration FAILED. Closing the connection "
+         "and retrying...\n",
+         this->m_index);
+
+  // close the connection... our PT run loop will back off and reconnect
+  this->shutdown();
+}
+
+// PT connection to mbed-edge has shut down
+void PTConnection::connectionShutdown() {
+  // DEBUG
+  printf("PTConnection(%d): PT connection to mbed-edge has shut down...\n",
+         this->m_index);
+
+  __atomic_store_n(&this->m_connected, false, __ATOMIC_RELEASE);
+  pthread_mutex_lock(&this->m_calls_mutex);
+  this->m_accepting_calls = false;
+  pthread_mutex_unlock(&this->m_calls_mutex);
+  Orchestrator *orchestrator = (Orchestrator *)this->m_orchestrator;
+  if (orchestrator->isShuttingDown() == true) {
+    // we asked for this...
+    return;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &this->m_disconnected_at);
+  orchestrator->connectionShutdown(this);
+}
+
+// STATIC: PT connection is ready
+void PTConnection::connectionReadyCB(struct connection *connection,
+                                     void *ctx) {
+  PTConnection *instance = (PTConnection *)ctx;
+  if (instance != NULL) {
+    instance->connectionReady(connection);
+  }
+}
+
+// STATIC: PT Registration success
+void PTConnection::registerSuccessCB(void *ctx) {
+  PTConnection *instance = (PTConnection *)ctx;
+  if (instance != NULL) {
+    instance->registerSuccess();
+  }
+}
+
+// STATIC: PT Registration failure
+void PTConnection::registerFailureCB(void *ctx) {
+  PTConnection *instance = (PTConnection *)ctx;
+  if (instance != NULL) {
+    instance->registerFailure();
+  }
+}
+
+// STATIC: PT connection shutdown
+void PTConnection::connectionShutdownCB(struct connection **connection,
+                                        void *ctx) {
+  PTConnection *instance = (PTConnection *)ctx;
+  if (instance != NULL) {
+    instance->connectionShutdown();
+  }
+}
+
+// STATIC: make the posted PT calls (PT event loop)
+void PTConnection::drainCallsCB(void *ctx) {
+  PTConnection *instance = (PTConnection *)ctx;
+  if (instance != NULL) {
+    instance->drainCalls(instance->getConnection());
+  }
+}
+
+// STATIC: a cloud write for a device on this connection
+void PTConnection::receivedWriteCB(
+    struct connection *connection, const char *device_id,
+    const uint16_t object_id, const uint16_t instance_id,
+    const uint16_t resource_id, const unsigned int operation,
+    const uint8_t *value, const uint32_t value_size, void *ctx) {
+  PTConnection *instance = (PTConnection *)ctx;
+  if (instance != NULL) {
+    Orchestrator::processWriteRequestCB(connection, device_id, object_id,
+                                        instance_id, resource_id, operation,
+                                        value, value_size,
+                                        instance->m_orchestrator);
+  }
+}
+
+// exponential backoff with "equal jitter" so a fleet of gateways (and our own
+// connections) does not reconnect to a restarted edge-core in lock step: the
+// delay is random over the upper half of the ceiling. Keeping the lower half
+// as a floor means an edge-core that refuses us at once is never retried at
+// once (full jitter can draw a delay of ~0 at every attempt)
+int PTConnection::reconnectDelayMs(int attempt) {
+  long ceiling = PT_RECONNECT_BASE_DELAY_MS;
+  for (int i = 1; i < attempt && ceiling < PT_RECONNECT_MAX_DELAY_MS; ++i) {
+    ceiling *= 2;
+  }
+  if (ceiling > PT_RECONNECT_MAX_DELAY_MS) {
+    ceiling = PT_RECONNECT_MAX_DELAY_MS;
+  }
+  return (int)(ceiling / 2 +
+               rand_r(&this->m_reconnect_seed) % (ceiling / 2 + 1));
+}
+
+// STATIC: PT thread
+void *PTConnection::ptProcessor(void *ctx) {
+  PTConnection *instance = (PTConnection *)ctx;
+  if (instance != NULL) {
+    instance->runPT();
+  }
+  return NULL;
+}
+
+// Run PT
+void PTConnection::runPT() {
+  Orchestrator *orchestrator = (Orchestrator *)this->m_orchestrator;
+
+  // DEBUG
+  printf("PTConnection(%d): starting up the protocol translator %s (ThreadID: "
+         "%08x)...\n",
+         this->m_index, this->m_name, (unsigned int)pthread_self());
+  char thread_name[PROFILER_THREAD_NAME_LENGTH];
+  if (orchestrator->getNumPTConnections() > 1) {
+    snprintf(thread_name, sizeof(thread_name), "pt-%d", this->m_index);
+  } else {
+    snprintf(thread_name, sizeof(thread_name), "pt");
+  }
+  Profiler::shared()->registerThread(thread_name);
+
+  // our callbacks queue work to the shards: they must never wait on a full
+  // lane (the shards may be waiting on us)
+  OrchestratorShard::setNonBlockingThread();
+
+  // create and run the protocol translator (PT) - configure the callbacks for
+  // it...
+  protocol_translator_callbacks_t pt_cbs;
+  pt_cbs.connection_ready_cb =
+      (pt_connection_ready_cb)&PTConnection::connectionReadyCB;
+  pt_cbs.received_write_cb =
+      (pt_received_write_handler)&PTConnection::receivedWriteCB;
+  pt_cbs.connection_shutdown_cb = &PTConnection::connectionShutdownCB;
+
+  // start the PT... pt_client_start() runs until the connection goes away, at
+  // which point we back off and reconnect (unless we are shutting down)
+  while (orchestrator->isShuttingDown() == false) {
+    pt_client_start(this->m_hostname, this->m_port, this->m_name, &pt_cbs,
+                    (void *)this, &this->m_connection);
+    __atomic_store_n(&this->m_connection, (struct connection *)NULL,
+                     __ATOMIC_RELEASE);
+    __atomic_store_n(&this->m_connected, false, __ATOMIC_RELEASE);
+
+    // the calls that did not make it before the connection went away (their
+    // callers see them fail)
+    pthread_mutex_lock(&this->m_calls_mutex);
+    this->m_accepting_calls = false;
+    pthread_mutex_unlock(&this->m_calls_mutex);
+    this->drainCalls(NULL);
+    if (orchestrator->isShuttingDown() == true) {
+      break;
+    }
+
+    // back off before we try again...
+    int delay_ms = this->reconnectDelayMs(++this->m_reconnect_attempt);
+    printf("PTConnection(%d): PT disconnected. Reconnect attempt %d in %d "
+           "ms...\n",
+           this->m_index, this->m_reconnect_attempt, delay_ms);
+    orchestrator->waitForReconnect(delay_ms);
+  }
+  Profiler::shared()->unregisterThread();
+}
@@ -0,0 +1,165 @@
+/**
+ * @file    PTConnection.h
+ * @brief   mbed Edge Orchestrator PT client connection
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PT_CONNECTION_H__
+#define __PT_CONNECTION_H__
+
+// system includes
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// PT calls queued for the PT thread
+#include <vector>
+
+// PT client connection (pt-client/pt_api.h)
+struct connection;
+
+// a PT call handed to a connection's PT thread (see PTConnection::post()).
+// "run" is called on that thread with the connection... or with NULL if the
+// connection went away before the call could be made
+typedef void (*pt_call_fn)(struct connection *connection, void *ctx);
+typedef struct pt_call {
+  pt_call_fn run;
+  void *ctx;
+} pt_call_t;
+
+// Tunables for the PT connections
+#define PT_MAX_CONNECTIONS 16         // upper bound on --pt-connections
+#define PT_CONNECTION_RING_POINTS 128 // hash ring points per connection
+#define PT_CONNECTION_NAME_LENGTH 128
+
+// One PT client connection to edge-core: its own protocol translator name,
+// its own thread running pt_client_start() (and so its own libevent base and
+// websocket) and its own reconnection backoff. The Orchestrator spreads the
+// shadows across its connections (see Orchestrator::getPTConnection()) and
+// every PT call for a shadow goes through the connection it is on, so
+// JSON-RPC serialization and socket I/O are spread across the PT threads.
+// Losing one connection only takes the shadows on it offline. pt-client (and
+// its libevent base) is not thread-safe: the shards post their PT calls here
+// and the PT thread makes them from its event loop.
+class PTConnection {
+public:
+  PTConnection(void *orchestrator, int index, const char *name,
+               const char *hostname, int port);
+  virtual ~PTConnection();
+
+  // start the PT thread: it connects, registers the protocol translator and
+  // reconnects (with backoff) until the orchestrator shuts down
+  bool start();
+
+  // close the connection (the PT thread reconnects unless shutting down)
+  void shutdown();
+
+  // join the PT thread (false if it did not exit by "deadline", REALTIME)
+  bool join(const struct timespec *deadline);
+
+  // the connection (NULL while not connected)
+  struct connection *getConnection();
+
+  // hand a PT call to the PT thread (any thread)... false if the connection
+  // is not up, in which case the call is not made
+  bool post(pt_call_fn run, void *ctx);
+
+  // is the connection up and the protocol translator registered?
+  bool isConnected();
+
+  // identity
+  int getIndex();
+  const char *getName();
+
+  // shadows on this connection (see Orchestrator::assignPTConnection())
+  void addDeviceShadow();
+  void removeDeviceShadow();
+  size_t getNumDeviceShadows();
+
+  // re-sync accounting: a registration completed... true once every shadow
+  // on the connection has (re)registered since it came up. "synced_ms" and
+  // "outage_ms" (-1 on the first connection) are then filled in
+  bool shadowSynced(double *synced_ms, double *outage_ms);
+
+  // statistics
+  int getNumConnects();
+
+  // PT callbacks (ctx: the PTConnection)
+  static void connectionReadyCB(struct connection *connection, void *ctx);
+  static void registerSuccessCB(void *ctx);
+  static void registerFailureCB(void *ctx);
+  static void connectionShutdownCB(struct connection **connection, void *ctx);
+  static void receivedWriteCB(struct connection *connection,
+                              const char *device_id, const uint16_t object_id,
+                              const uint16_t instance_id,
+                              const uint16_t resource_id,
+                              const unsigned int operation,
+                              const uint8_t *value, const uint32_t value_size,
+                              void *ctx);
+  static void drainCallsCB(void *ctx);
+
+  // PT thread (pthread)
+  static void *ptProcessor(void *ctx);
+  void runPT();
+
+private:
+  PTConnection(const PTConnection &connection);
+  void initialize(void *orchestrator, int index, const char *name,
+                  const char *hostname, int port);
+  void connectionReady(struct connection *connection);
+  void registerSuccess();
+  void registerFailure();
+  void connectionShutdown();
+  void drainCalls(struct connection *connection);
+  int reconnectDelayMs(int attempt);
+
+private:
+  void *m_orchestrator;
+  int m_index;
+  char *m_name;
+  char *m_hostname;
+  int m_port;
+  struct connection *m_connection;
+  bool m_connected;
+  pthread_t m_thread;
+  bool m_thread_started;
+
+  // PT calls posted by the shards (a drain is scheduled on the PT event loop
+  // for the first call posted after the last drain)
+  pthread_mutex_t m_calls_mutex;
+  std::vector<pt_call_t> m_calls;    // guarded by m_calls_mutex
+  std::vector<pt_call_t> m_draining; // PT thread
+  bool m_accepting_calls;            // guarded by m_calls_mutex
+  bool m_drain_scheduled;            // guarded by m_calls_mutex
+
+  // reconnection state (PT thread)
+  unsigned int m_reconnect_seed;
+  int m_reconnect_attempt;
+  int m_num_connects;
+  bool m_was_connected;
+  struct timespec m_disconnected_at; // when we lost edge-core
+  struct timespec m_connected_at;    // when PT (re)registered
+
+  // shadows on this connection, and how many have re-synced since it came up
+  size_t m_num_device_shadows;
+  size_t m_num_shadows_synced;
+};
+
+#endif // __PT_CONNECTION_H__
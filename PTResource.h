@@ -0,0 +1,102 @@
+/**
+ * @file    PTResource.h
+ * @brief   mbed Edge PT Resource Ownership (move-only RAII wrappers)
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PT_RESOURCE_H__
+#define __PT_RESOURCE_H__
+
+// system includes
+#include <stdint.h>
+#include <stdlib.h>
+
+// we have to wrap in "externs" since the headers dont have them already...
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include "pt-client/pt_api.h"
+#ifdef __cplusplus
+};
+#endif
+
+// Single owner of a C allocation: released exactly once (by "release_fn") when
+// the owner goes away or is reset. Ownership can be moved (the source is left
+// empty) but never copied... so a shadow's PT device and buffers cannot be
+// freed twice or leaked when the shadow is torn down or re-created.
+//
+// PT objects, object instances and resources are owned by their device (see
+// pt_device_free()): pointers to them are borrowed and never outlive it.
+template <typename T, void (*release_fn)(T *)> class PTOwned {
+public:
+  PTOwned() : m_ptr(NULL) {}
+  explicit PTOwned(T *ptr) : m_ptr(ptr) {}
+  PTOwned(PTOwned &&owned) : m_ptr(owned.m_ptr) { owned.m_ptr = NULL; }
+  ~PTOwned() { this->reset(NULL); }
+
+  // take over another owner's allocation (ours is released)
+  PTOwned &operator=(PTOwned &&owned) {
+    if (this != &owned) {
+      this->reset(owned.m_ptr);
+      owned.m_ptr = NULL;
+    }
+    return *this;
+  }
+
+  // the allocation (still owned by us)
+  T *get() const { return this->m_ptr; }
+  T *operator->() const { return this->m_ptr; }
+  bool isNull() const { return (this->m_ptr == NULL); }
+
+  // give up ownership (e.g. once PT has taken over a value buffer)
+  T *release() {
+    T *ptr = this->m_ptr;
+    this->m_ptr = NULL;
+    return ptr;
+  }
+
+  // release our allocation and own "ptr" instead
+  void reset(T *ptr) {
+    if (this->m_ptr != NULL && this->m_ptr != ptr) {
+      (release_fn)(this->m_ptr);
+    }
+    this->m_ptr = ptr;
+  }
+
+private:
+  PTOwned(const PTOwned &owned);
+  PTOwned &operator=(const PTOwned &owned);
+
+private:
+  T *m_ptr;
+};
+
+// release functions (a device's values shared with other devices, e.g. its
+// device profile's strings, are handed back before pt_device_free() frees the
+// rest... see "DeviceProfile.cpp")
+void releasePTDevice(pt_device_t *device);
+inline void releasePTValue(uint8_t *value) { free(value); }
+
+// a PT device (and, through it, all of its objects/instances/resources)
+typedef PTOwned<pt_device_t, releasePTDevice> PTDevicePtr;
+
+// a resource value buffer... PT owns it once the resource has been added
+typedef PTOwned<uint8_t, releasePTValue> PTValueBuffer;
+
+#endif // __PT_RESOURCE_H__
@@ -0,0 +1,518 @@
+/**
+ * @file    Profiler.cpp
+ * @brief   mbed Edge Orchestrator Sampling CPU Profiler Implementation
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "Profiler.h"
+
+// system includes
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+// folded stacks
+#include <map>
+#include <string>
+
+// older glibc only has the union member
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// the calling thread's registration (read by the SIGPROF handler)
+static __thread profiler_thread_t *current_thread = NULL;
+
+// constructor
+Profiler::Profiler() { this->initialize(); }
+
+// destructor
+Profiler::~Profiler() {
+  for (int i = 0; i < this->m_num_threads; ++i) {
+    if (this->m_threads[i]->has_timer == true) {
+      timer_delete(this->m_threads[i]->timer);
+    }
+    free(this->m_threads[i]->stacks);
+    free(this->m_threads[i]);
+  }
+  pthread_mutex_destroy(&this->m_mutex);
+}
+
+// copy constructor
+Profiler::Profiler(const Profiler &profiler) {}
+
+// initialize
+void Profiler::initialize() {
+  pthread_mutex_init(&this->m_mutex, NULL);
+  memset(this->m_threads, 0, sizeof(this->m_threads));
+  this->m_num_threads = 0;
+  this->m_handler_installed = false;
+  this->m_hz = PROFILER_DEFAULT_HZ;
+  this->m_running = 0;
+  memset(&this->m_started, 0, sizeof(this->m_started));
+}
+
+// STATIC: the profiler shared by all of our threads
+Profiler *Profiler::shared() {
+  static Profiler profiler;
+  return &profiler;
+}
+
+// install our SIGPROF handler (lock held)
+bool Profiler::installHandler() {
+  if (this->m_handler_installed == false) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = &Profiler::sampleHandler;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, NULL) != 0) {
+      printf("Profiler: ERROR. Unable to install the SIGPROF handler: %s\n",
+             strerror(errno));
+      return false;
+    }
+    this->m_handler_installed = true;
+  }
+  return true;
+}
+
+// register the calling thread: a SIGPROF timer on its own CPU time
+void Profiler::registerThread(const char *name) {
+  if (current_thread != NULL) {
+    return;
+  }
+  profiler_thread_t *thread =
+      (profiler_thread_t *)calloc(1, sizeof(profiler_thread_t));
+  if (thread == NULL) {
+    return;
+  }
+  snprintf(thread->name, sizeof(thread->name), "%s", name);
+  thread->tid = (long)syscall(SYS_gettid);
+
+  // our stack bounds (the frame pointer walk never leaves them)
+  pthread_attr_t attr;
+  if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+    void *stack_addr = NULL;
+    size_t stack_size = 0;
+    if (pthread_attr_getstack(&attr, &stack_addr, &stack_size) == 0) {
+      thread->stack_low = (uintptr_t)stack_addr;
+      thread->stack_high = (uintptr_t)stack_addr + stack_size;
+    }
+    pthread_attr_destroy(&attr);
+  }
+
+  // the timer counts this thread's CPU time and signals this thread only
+  struct sigevent sev;
+  memset(&sev, 0, sizeof(sev));
+  sev.sigev_notify = SIGEV_THREAD_ID;
+  sev.sigev_signo = SIGPROF;
+  sev.sigev_notify_thread_id = (pid_t)thread->tid;
+  if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &thread->timer) != 0) {
+    printf("Profiler: ERROR. Unable to create a CPU timer for thread %s: %s\n",
+           thread->name, strerror(errno));
+    free(thread);
+    return;
+  }
+  thread->has_timer = true;
+
+  pthread_mutex_lock(&this->m_mutex);
+  if (this->m_num_threads == PROFILER_MAX_THREADS ||
+      this->installHandler() == false) {
+    pthread_mutex_unlock(&this->m_mutex);
+    printf("Profiler: ERROR. Unable to register thread %s\n", thread->name);
+    timer_delete(thread->timer);
+    free(thread);
+    return;
+  }
+  this->m_threads[this->m_num_threads++] = thread;
+  current_thread = thread;
+
+  // profiling is already running... sample this thread too
+  if (__atomic_load_n(&this->m_running, __ATOMIC_SEQ_CST) != 0) {
+    thread->stacks = (profiler_stack_t *)calloc(PROFILER_STACKS_PER_THREAD,
+                                                sizeof(profiler_stack_t));
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_interval.tv_nsec = 1000000000L / this->m_hz;
+    its.it_value = its.it_interval;
+    timer_settime(thread->timer, 0, &its, NULL);
+  }
+  pthread_mutex_unlock(&this->m_mutex);
+}
+
+// unregister the calling thread (while profiling, its samples are kept until
+// they have been written)
+void Profiler::unregisterThread() {
+  profiler_thread_t *thread = current_thread;
+  if (thread == NULL) {
+    return;
+  }
+
+  // a SIGPROF still pending for us finds no registration and is ignored
+  current_thread = NULL;
+  pthread_mutex_lock(&this->m_mutex);
+  if (thread->has_timer == true) {
+    timer_delete(thread->timer);
+    thread->has_timer = false;
+  }
+  thread->exited = true;
+  if (this->m_running == 0) {
+    for (int i = 0; i < this->m_num_threads; ++i) {
+      if (this->m_threads[i] == thread) {
+        this->removeThread(i);
+        break;
+      }
+    }
+  }
+  pthread_mutex_unlock(&this->m_mutex);
+}
+
+// free the slot of a thread that has gone away (lock held)
+void Profiler::removeThread(int index) {
+  free(this->m_threads[index]->stacks);
+  free(this->m_threads[index]);
+  this->m_threads[index] = this->m_threads[--this->m_num_threads];
+  this->m_threads[this->m_num_threads] = NULL;
+}
+
+// arm (hz > 0) or disarm (hz == 0) every registered thread's timer (lock
+// held)
+bool Profiler::armTimers(int hz) {
+  struct itimerspec its;
+  memset(&its, 0, sizeof(its));
+  if (hz > 0) {
+    its.it_interval.tv_nsec = 1000000000L / hz;
+    its.it_value = its.it_interval;
+  }
+  bool armed = true;
+  for (int i = 0; i < this->m_num_threads; ++i) {
+    if (this->m_threads[i]->has_timer == true &&
+        timer_settime(this->m_threads[i]->timer, 0, &its, NULL) != 0) {
+      printf("Profiler: ERROR. Unable to set the CPU timer of thread %s: %s\n",
+             this->m_threads[i]->name, strerror(errno));
+      armed = false;
+    }
+  }
+  return armed;
+}
+
+// start sampling every registered thread at "hz"
+bool Profiler::start(int hz) {
+  pthread_mutex_lock(&this->m_mutex);
+  if (this->m_running != 0) {
+    pthread_mutex_unlock(&this->m_mutex);
+    return false;
+  }
+  this->m_hz = (hz < 1) ? 1 : ((hz > PROFILER_MAX_HZ) ? PROFILER_MAX_HZ : hz);
+
+  // a fresh profile: allocate (or clear) each thread's stack table
+  for (int i = 0; i < this->m_num_threads; ++i) {
+    profiler_thread_t *thread = this->m_threads[i];
+    if (thread->stacks == NULL) {
+      thread->stacks = (profiler_stack_t *)calloc(PROFILER_STACKS_PER_THREAD,
+                                                  sizeof(profiler_stack_t));
+    } else if (thread->num_samples > 0) {
+      memset(thread->stacks, 0,
+             PROFILER_STACKS_PER_THREAD * sizeof(profiler_stack_t));
+    }
+    thread->num_samples = 0;
+    thread->num_dropped = 0;
+  }
+  __atomic_store_n(&this->m_running, 1, __ATOMIC_SEQ_CST);
+  clock_gettime(CLOCK_MONOTONIC, &this->m_started);
+  bool armed = this->armTimers(this->m_hz);
+  int num_threads = this->m_num_threads;
+  pthread_mutex_unlock(&this->m_mutex);
+
+  // DEBUG
+  printf("Profiler: sampling at %d Hz of CPU time (%d thread(s) so far)\n",
+         this->m_hz, num_threads);
+  return armed;
+}
+
+// stop sampling and write the folded stacks
+bool Profiler::stop(const char *prefix) {
+  pthread_mutex_lock(&this->m_mutex);
+  if (this->m_running == 0) {
+    pthread_mutex_unlock(&this->m_mutex);
+    return false;
+  }
+  __atomic_store_n(&this->m_running, 0, __ATOMIC_SEQ_CST);
+  this->armTimers(0);
+
+  // wait out any sample that was already being taken
+  for (int i = 0; i < this->m_num_threads; ++i) {
+    while (__atomic_load_n(&this->m_threads[i]->in_handler,
+                           __ATOMIC_SEQ_CST) != 0) {
+      sched_yield();
+    }
+  }
+  bool written = this->writeFolded(prefix);
+
+  // threads that went away while we were profiling are written... let them go
+  for (int i = this->m_num_threads - 1; i >= 0; --i) {
+    if (this->m_threads[i]->exited == true) {
+      this->removeThread(i);
+    }
+  }
+  pthread_mutex_unlock(&this->m_mutex);
+  return written;
+}
+
+// start if stopped, stop (and write) if started
+bool Profiler::toggle(const char *prefix, int hz) {
+  if (this->isRunning() == true) {
+    return this->stop(prefix);
+  }
+  return this->start(hz);
+}
+
+// are we sampling?
+bool Profiler::isRunning() {
+  return (__atomic_load_n(&this->m_running, __ATOMIC_SEQ_CST) != 0);
+}
+
+// get the number of samples taken (this profile)
+uint64_t Profiler::getNumSamples() {
+  uint64_t num_samples = 0;
+  pthread_mutex_lock(&this->m_mutex);
+  for (int i = 0; i < this->m_num_threads; ++i) {
+    num_samples +=
+        __atomic_load_n(&this->m_threads[i]->num_samples, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&this->m_mutex);
+  return num_samples;
+}
+
+// get the number of samples dropped (stack table full)
+uint64_t Profiler::getNumDropped() {
+  uint64_t num_dropped = 0;
+  pthread_mutex_lock(&this->m_mutex);
+  for (int i = 0; i < this->m_num_threads; ++i) {
+    num_dropped +=
+        __atomic_load_n(&this->m_threads[i]->num_dropped, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&this->m_mutex);
+  return num_dropped;
+}
+
+// STATIC: SIGPROF handler (signal context: no locks, no allocations)
+void Profiler::sampleHandler(int signum, siginfo_t *info, void *ucontext) {
+  int saved_errno = errno;
+  profiler_thread_t *thread = current_thread;
+  if (thread != NULL && thread->stacks != NULL) {
+    __atomic_store_n(&thread->in_handler, 1, __ATOMIC_SEQ_CST);
+    if (Profiler::shared()->isRunning() == true) {
+      Profiler::shared()->sample(thread, ucontext);
+    }
+    __atomic_store_n(&thread->in_handler, 0, __ATOMIC_SEQ_CST);
+  }
+  errno = saved_errno;
+}
+
+// walk the frame pointers of the interrupted context (signal context)
+void Profiler::sample(profiler_thread_t *thread, void *ucontext) {
+  ucontext_t *uc = (ucontext_t *)ucontext;
+  uintptr_t pcs[PROFILER_MAX_DEPTH];
+  uint32_t depth = 0;
+  uintptr_t fp = 0;
+#if defined(__x86_64__)
+  pcs[depth++] = (uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+  fp = (uintptr_t)uc->uc_mcontext.gregs[REG_RBP];
+#elif defined(__aarch64__)
+  pcs[depth++] = (uintptr_t)uc->uc_mcontext.pc;
+  fp = (uintptr_t)uc->uc_mcontext.regs[29];
+#else
+  // we do not know where this architecture keeps the interrupted PC
+  return;
+#endif
+
+  // each frame holds the caller's frame pointer and our return address...
+  // stop at anything outside of our stack, misaligned or not moving up
+  while (depth < PROFILER_MAX_DEPTH && fp != 0 && (fp & 0x7) == 0 &&
+         fp >= thread->stack_low && fp + 2 * sizeof(uintptr_t) <=
+                                        thread->stack_high) {
+    uintptr_t next_fp = ((uintptr_t *)fp)[0];
+    uintptr_t pc = ((uintptr_t *)fp)[1];
+    if (pc == 0) {
+      break;
+    }
+    pcs[depth++] = pc - 1; // inside the call, not after it
+    if (next_fp <= fp) {
+      break;
+    }
+    fp = next_fp;
+  }
+  this->countStack(thread, pcs, depth);
+}
+
+// count a stack in the thread's table (signal context)
+void Profiler::countStack(profiler_thread_t *thread, const uintptr_t *pcs,
+                          uint32_t depth) {
+  uint32_t hash = 2166136261u;
+  for (uint32_t i = 0; i < depth; ++i) {
+    hash = (hash ^ (uint32_t)(pcs[i] ^ (pcs[i] >> 32))) * 16777619u;
+  }
+  ++thread->num_samples;
+  for (uint32_t probe = 0; probe < PROFILER_MAX_PROBES; ++probe) {
+    profiler_stack_t *stack =
+        &thread->stacks[(hash + probe) & (PROFILER_STACKS_PER_THREAD - 1)];
+    if (stack->depth == 0) {
+      stack->hash = hash;
+      memcpy(stack->pcs, pcs, depth * sizeof(uintptr_t));
+      stack->count = 1;
+      stack->depth = depth;
+      return;
+    }
+    if (stack->hash == hash && stack->depth == depth &&
+        memcmp(stack->pcs, pcs, depth * sizeof(uintptr_t)) == 0) {
+      ++stack->count;
+      return;
+    }
+  }
+  ++thread->num_dropped;
+}
+
+// name a frame: the (demangled) symbol if we can find one, else its module
+// and offset (for addr2line)
+static std::string frameName(uintptr_t pc) {
+  Dl_info info;
+  char buffer[256];
+  if (dladdr((void *)pc, &info) != 0) {
+    if (info.dli_sname != NULL) {
+      int status = 0;
+      char *demangled =
+          abi::__cxa_demangle(info.dli_sname, NULL, NULL, &status);
+      std::string name((status == 0 && demangled != NULL) ? demangled
+                                                          : info.dli_sname);
+      free(demangled);
+      return name;
+    }
+    if (info.dli_fname != NULL) {
+      const char *module = strrchr(info.dli_fname, '/');
+      snprintf(buffer, sizeof(buffer), "%s+0x%lx",
+               (module != NULL) ? module + 1 : info.dli_fname,
+               (unsigned long)(pc - (uintptr_t)info.dli_fbase));
+      return std::string(buffer);
+    }
+  }
+  snprintf(buffer, sizeof(buffer), "0x%lx", (unsigned long)pc);
+  return std::string(buffer);
+}
+
+// write the folded stacks, one file per thread name (lock held)
+bool Profiler::writeFolded(const char *prefix) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double elapsed = (now.tv_sec - this->m_started.tv_sec) +
+                   (now.tv_nsec - this->m_started.tv_nsec) / 1000000000.0;
+
+  // fold every thread's stacks (root first) under its name
+  std::map<uintptr_t, std::string> symbols;
+  std::map<std::string, std::map<std::string, uint64_t> > folded;
+  std::map<std::string, uint64_t> num_samples;
+  uint64_t total_samples = 0, total_dropped = 0;
+  for (int i = 0; i < this->m_num_threads; ++i) {
+    profiler_thread_t *thread = this->m_threads[i];
+    total_samples += thread->num_samples;
+    total_dropped += thread->num_dropped;
+    if (thread->stacks == NULL || thread->num_samples == 0) {
+      continue;
+    }
+    std::map<std::string, uint64_t> &stacks = folded[thread->name];
+    for (int j = 0; j < PROFILER_STACKS_PER_THREAD; ++j) {
+      const profiler_stack_t *stack = &thread->stacks[j];
+      if (stack->depth == 0) {
+        continue;
+      }
+      std::string line;
+      for (int k = (int)stack->depth - 1; k >= 0; --k) {
+        std::map<uintptr_t, std::string>::iterator symbol =
+            symbols.find(stack->pcs[k]);
+        if (symbol == symbols.end()) {
+          symbol = symbols
+                       .insert(std::make_pair(stack->pcs[k],
+                                              frameName(stack->pcs[k])))
+                       .first;
+        }
+        if (line.empty() == false) {
+          line += ';';
+        }
+        line += symbol->second;
+      }
+      stacks[line] += stack->count;
+      num_samples[thread->name] += stack->count;
+    }
+  }
+
+  // DEBUG
+  printf("Profiler: stopped after %.1f s: %llu sample(s) from %d thread(s), "
+         "%llu dropped\n",
+         elapsed, (unsigned long long)total_samples, this->m_num_threads,
+         (unsigned long long)total_dropped);
+
+  // "<prefix>.<thread name>.folded" (written in place via a temporary file)
+  bool written = true;
+  std::map<std::string, std::map<std::string, uint64_t> >::iterator it;
+  for (it = folded.begin(); it != folded.end(); ++it) {
+    std::string name(it->first);
+    for (size_t i = 0; i < name.size(); ++i) {
+      if (name[i] == '/' || name[i] == ' ') {
+        name[i] = '_';
+      }
+    }
+    std::string path = std::string(prefix) + "." + name + ".folded";
+    std::string tmp_path = path + ".tmp";
+    FILE *fp = fopen(tmp_path.c_str(), "w");
+    if (fp == NULL) {
+      printf("Profiler: ERROR. Unable to open %s: %s\n", tmp_path.c_str(),
+             strerror(errno));
+      written = false;
+      continue;
+    }
+    std::map<std::string, uint64_t>::iterator stack;
+    for (stack = it->second.begin(); stack != it->second.end(); ++stack) {
+      fprintf(fp, "%s %llu\n", stack->first.c_str(),
+              (unsigned long long)stack->second);
+    }
+    bool ok = (ferror(fp) == 0);
+    if (fclose(fp) != 0 || ok == false ||
+        rename(tmp_path.c_str(), path.c_str()) != 0) {
+      printf("Profiler: ERROR. Unable to write %s: %s\n", path.c_str(),
+             strerror(errno));
+      unlink(tmp_path.c_str());
+      written = false;
+      continue;
+    }
+
+    // DEBUG
+    printf("Profiler: wrote %llu sample(s) (%zu stack(s)) of %s to %s\n",
+           (unsigned long long)num_samples[it->first], it->second.size(),
+           it->first.c_str(), path.c_str());
+  }
+  return written;
+}
@@ -0,0 +1,132 @@
+/**
+ * @file    Profiler.h
+ * @brief   mbed Edge Orchestrator Sampling CPU Profiler
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __PROFILER_H__
+#define __PROFILER_H__
+
+// system includes
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Tunables for profiling
+#define PROFILER_DEFAULT_HZ 99          // samples per second of thread CPU time
+#define PROFILER_MAX_HZ 1000
+#define PROFILER_MAX_THREADS 128        // profiled threads (over our lifetime)
+#define PROFILER_MAX_PROBES 64          // slots tried before a stack is dropped
+#define PROFILER_MAX_DEPTH 32           // frames kept per sample
+#define PROFILER_STACKS_PER_THREAD 2048 // distinct stacks counted per thread
+#define PROFILER_THREAD_NAME_LENGTH 32
+#define PROFILER_DEFAULT_PREFIX "orchestrator-profile"
+
+// a distinct stack of a thread (and how many samples landed on it)
+typedef struct profiler_stack {
+  uint64_t count;
+  uint32_t hash;
+  uint32_t depth; // 0: free slot
+  uintptr_t pcs[PROFILER_MAX_DEPTH]; // leaf first
+} profiler_stack_t;
+
+// a profiled thread: its CPU time timer and the stacks it has been sampled in
+typedef struct profiler_thread {
+  char name[PROFILER_THREAD_NAME_LENGTH];
+  long tid;
+  timer_t timer;
+  bool has_timer;
+  uintptr_t stack_low; // the thread's stack (frame pointers are kept inside)
+  uintptr_t stack_high;
+  profiler_stack_t *stacks; // allocated when profiling first starts
+  uint64_t num_samples;
+  uint64_t num_dropped; // no free slot left for the stack
+  int in_handler;       // a sample is being taken
+  bool exited;          // unregistered while profiling (freed once written)
+} profiler_thread_t;
+
+// Sampling CPU profiler. Each of our threads registers itself, which gives it
+// a SIGPROF timer on its own CPU time; while profiling, every tick of that
+// timer walks the thread's frame pointers from the interrupted context and
+// counts the stack in a table of its own (fixed size, so the signal handler
+// never allocates or locks). When profiling stops, the stacks are symbolized
+// and written as folded stacks ("frame;frame;...;leaf count", the input of
+// flamegraph.pl and speedscope), one file per thread name: e.g. the PT
+// thread, the ticker, each shard and the orchestrator loop separately.
+// Stacks are only as good as the frame pointers: see "make profile". The
+// kernel checks CPU timers on its scheduler tick, so a thread is sampled at
+// most CONFIG_HZ times a second whatever we ask for.
+class Profiler {
+public:
+  Profiler();
+  virtual ~Profiler();
+
+  // the profiler shared by all of our threads
+  static Profiler *shared();
+
+  // register/unregister the calling thread (names need not be unique...
+  // threads of the same name share a file)
+  void registerThread(const char *name);
+  void unregisterThread();
+
+  // start sampling every registered thread at "hz"
+  bool start(int hz);
+
+  // stop sampling and write "<prefix>.<thread name>.folded" for every thread
+  // name that was sampled
+  bool stop(const char *prefix);
+
+  // start if stopped, stop (and write) if started
+  bool toggle(const char *prefix, int hz);
+
+  // status
+  bool isRunning();
+  uint64_t getNumSamples();
+  uint64_t getNumDropped();
+
+  // SIGPROF handler
+  static void sampleHandler(int signum, siginfo_t *info, void *ucontext);
+
+private:
+  Profiler(const Profiler &profiler);
+  void initialize();
+  bool installHandler();
+  bool armTimers(int hz);
+  void sample(profiler_thread_t *thread, void *ucontext);
+  void countStack(profiler_thread_t *thread, const uintptr_t *pcs,
+                  uint32_t depth);
+  bool writeFolded(const char *prefix);
+  void removeThread(int index);
+
+private:
+  // every registered thread (a thread that goes away while we are profiling
+  // keeps its slot until its samples have been written)
+  pthread_mutex_t m_mutex;
+  profiler_thread_t *m_threads[PROFILER_MAX_THREADS];
+  int m_num_threads;
+  bool m_handler_installed;
+  int m_hz;
+  int m_running; // sampling (read by the handler)
+  struct timespec m_started;
+};
+
+#endif // __PROFILER_H__
@@ -0,0 +1,802 @@
+/**
+ * @file    RulesEngine.cpp
+ * @brief   mbed Edge Orchestrator local rules engine implementation
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "RulesEngine.h"
+
+// CPU profiling
+#include "Profiler.h"
+
+// worker threads (process signals blocked)
+#include "Threads.h"
+
+// system includes
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// binary operators by precedence level (lowest first)
+#define RULES_NUM_LEVELS 6
+typedef struct rule_operator {
+  const char *token;
+  uint8_t opcode;
+} rule_operator_t;
+static const rule_operator_t s_operators[RULES_NUM_LEVELS][5] = {
+    {{"||", RULE_OP_OR}, {NULL, 0}},
+    {{"&&", RULE_OP_AND}, {NULL, 0}},
+    {{"==", RULE_OP_EQ}, {"!=", RULE_OP_NE}, {NULL, 0}},
+    {{"<=", RULE_OP_LE},
+     {">=", RULE_OP_GE},
+     {"<", RULE_OP_LT},
+     {">", RULE_OP_GT},
+     {NULL, 0}},
+    {{"+", RULE_OP_ADD}, {"-", RULE_OP_SUB}, {NULL, 0}},
+    {{"*", RULE_OP_MUL}, {"/", RULE_OP_DIV}, {"%", RULE_OP_MOD}, {NULL, 0}}};
+
+// current CLOCK_MONOTONIC time in milliseconds
+static uint64_t monotonicMs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// skip blanks
+static const char *skipSpace(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t')) {
+    ++p;
+  }
+  return p;
+}
+
+// find the end of the token starting at "p"
+static const char *tokenEnd(const char *p, const char *end) {
+  while (p < end && *p != ' ' && *p != '\t') {
+    ++p;
+  }
+  return p;
+}
+
+// does the token [p, e) equal "word"?
+static bool tokenEquals(const char *p, const char *e, const char *word) {
+  size_t length = strlen(word);
+  return ((size_t)(e - p) == length && memcmp(p, word, length) == 0);
+}
+
+// does the text at "p" start with "prefix"?
+static bool startsWith(const char *p, const char *end, const char *prefix) {
+  size_t length = strlen(prefix);
+  return ((size_t)(end - p) >= length && memcmp(p, prefix, length) == 0);
+}
+
+// is "c" part of an endpoint name?
+static bool isNameChar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.';
+}
+
+// parse an unsigned decimal number at "*p"
+static bool parseDigits(const char **p, const char *end, long *value) {
+  const char *q = *p;
+  long result = 0;
+  while (q < end && *q >= '0' && *q <= '9') {
+    result = result * 10 + (*q - '0');
+    ++q;
+  }
+  if (q == *p) {
+    return false;
+  }
+  *p = q;
+  *value = result;
+  return true;
+}
+
+// variable registry key
+static std::pair<endpoint_handle_t, uint64_t>
+variableKey(endpoint_handle_t endpoint, const uint16_t object_id,
+            const uint16_t instance_id, const uint16_t resource_id) {
+  return std::make_pair(endpoint, ((uint64_t)object_id << 32) |
+                                      ((uint64_t)instance_id << 16) |
+                                      (uint64_t)resource_id);
+}
+
+// constructor
+RulesEngine::RulesEngine(Orchestrator *orchestrator,
+                         const char *endpoint_postfix) {
+  this->initialize(orchestrator, endpoint_postfix);
+}
+
+// destructor
+RulesEngine::~RulesEngine() {
+  this->stop();
+  for (size_t i = 0; i < this->m_variables.size(); ++i) {
+    delete this->m_variables[i].subscription;
+  }
+  free(this->m_endpoint_postfix);
+}
+
+// copy constructor
+RulesEngine::RulesEngine(const RulesEngine &engine) {}
+
+// initialize
+void RulesEngine::initialize(Orchestrator *orchestrator,
+                             const char *endpoint_postfix) {
+  this->m_orchestrator = orchestrator;
+  this->m_endpoint_postfix =
+      (endpoint_postfix != NULL) ? strdup(endpoint_postfix) : NULL;
+  this->m_path = NULL;
+  this->m_line = 0;
+  this->m_num_errors = 0;
+  this->m_num_evaluations = 0;
+  this->m_num_actions = 0;
+  this->m_is_running = false;
+  this->m_is_started = false;
+}
+
+// parse and compile a rules file
+bool RulesEngine::parse(const char *path) {
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) {
+    printf("RulesEngine: ERROR. Unable to open %s: %s\n", path,
+           strerror(errno));
+    return false;
+  }
+
+  // rules files are small... read it in one go
+  char *buffer = NULL;
+  size_t length = 0;
+  size_t capacity = 0;
+  size_t n = 0;
+  do {
+    if (length == capacity) {
+      capacity = (capacity == 0) ? 4096 : (capacity * 2);
+      buffer = (char *)realloc(buffer, capacity);
+    }
+    n = fread(buffer + length, 1, capacity - length, fp);
+    length += n;
+  } while (n > 0);
+  fclose(fp);
+
+  this->m_path = path;
+  bool parsed = this->parse(buffer, length);
+  free(buffer);
+
+  // DEBUG
+  printf("RulesEngine: compiled %zu rule(s) over %zu resource(s) from %s (%d "
+         "error(s))\n",
+         this->m_rules.size(), this->m_variables.size(), path,
+         this->m_num_errors);
+  return parsed;
+}
+
+// parse and compile rules held in memory
+bool RulesEngine::parse(const char *buffer, size_t length) {
+  if (this->m_path == NULL) {
+    this->m_path = "<memory>";
+  }
+  this->m_line = 0;
+  this->m_num_errors = 0;
+
+  const char *p = buffer;
+  const char *end = buffer + length;
+  while (p < end) {
+    const char *eol = (const char *)memchr(p, '\n', end - p);
+    if (eol == NULL) {
+      eol = end;
+    }
+    ++this->m_line;
+    this->parseLine(p, eol);
+    p = eol + 1;
+  }
+  this->m_path = NULL;
+  return (this->m_num_errors == 0);
+}
+
+// report a parse error
+void RulesEngine::error(const char *message) {
+  printf("RulesEngine: ERROR. %s:%d: %s\n", this->m_path, this->m_line,
+         message);
+  ++this->m_num_errors;
+}
+
+// parse and compile a single line
+void RulesEngine::parseLine(const char *line, const char *end) {
+  // strip comments and trailing CR
+  const char *comment = (const char *)memchr(line, '#', end - line);
+  if (comment != NULL) {
+    end = comment;
+  }
+  if (end > line && end[-1] == '\r') {
+    --end;
+  }
+
+  const char *p = skipSpace(line, end);
+  if (p == end) {
+    return;
+  }
+  const char *e = tokenEnd(p, end);
+  if (tokenEquals(p, e, "rule") == false) {
+    this->error("expected \"rule\"");
+    return;
+  }
+
+  // rule <name>
+  rule_t rule;
+  memset(&rule, 0, sizeof(rule));
+  rule.state = -1;
+  p = skipSpace(e, end);
+  e = tokenEnd(p, end);
+  if (p == e || (size_t)(e - p) >= sizeof(rule.name)) {
+    this->error("missing or too long rule name");
+    return;
+  }
+  memcpy(rule.name, p, e - p);
+
+  // the rule is only added once it has compiled... its variables are
+  // linked to it by index
+  int index = (int)this->m_rules.size();
+
+  // when <expr>
+  p = skipSpace(e, end);
+  e = tokenEnd(p, end);
+  if (tokenEquals(p, e, "when") == false) {
+    this->error("expected \"when\"");
+    return;
+  }
+  p = e;
+  if (this->compileExpression(&p, end, &rule.condition, index) == false) {
+    return;
+  }
+
+  // then <action>
+  p = skipSpace(p, end);
+  e = tokenEnd(p, end);
+  if (tokenEquals(p, e, "then") == false) {
+    this->error("expected \"then\"");
+    return;
+  }
+  p = e;
+  if (this->compileAction(&p, end, &rule.action, index) == false) {
+    return;
+  }
+
+  // [else <action>]
+  p = skipSpace(p, end);
+  if (p < end) {
+    e = tokenEnd(p, end);
+    if (tokenEquals(p, e, "else") == false) {
+      this->error("expected \"else\" or the end of the rule");
+      return;
+    }
+    p = e;
+    if (this->compileAction(&p, end, &rule.else_action, index) == false) {
+      return;
+    }
+    rule.has_else = true;
+    p = skipSpace(p, end);
+    if (p < end) {
+      this->error("unexpected text after the rule");
+      return;
+    }
+  }
+  this->m_rules.push_back(rule);
+}
+
+// compile "<endpoint>:<obj>/<inst>/<res> = <expr>"
+bool RulesEngine::compileAction(const char **p, const char *end,
+                                rule_action_t *action, int rule_index) {
+  uint16_t ids[3];
+  *p = skipSpace(*p, end);
+  if (this->compileResource(p, end, &action->endpoint_id, ids) == false) {
+    return false;
+  }
+  action->object_id = ids[0];
+  action->instance_id = ids[1];
+  action->resource_id = ids[2];
+  *p = skipSpace(*p, end);
+  if (*p == end || **p != '=' || startsWith(*p, end, "==") == true) {
+    this->error("expected \"=\"");
+    return false;
+  }
+  ++(*p);
+
+  // resources read by an action's value do not trigger the rule
+  return this->compileExpression(p, end, &action->value, -1);
+}
+
+// compile an expression (and check that it fits our evaluation stack)
+bool RulesEngine::compileExpression(const char **p, const char *end,
+                                    rule_program_t *program, int rule_index) {
+  program->length = 0;
+  if (this->compileBinary(p, end, program, rule_index, 0) == false) {
+    return false;
+  }
+  int depth = 0;
+  int max_depth = 0;
+  for (int i = 0; i < program->length; ++i) {
+    uint8_t opcode = program->code[i].opcode;
+    if (opcode == RULE_OP_PUSH || opcode == RULE_OP_LOAD) {
+      ++depth;
+    } else if (opcode != RULE_OP_NEG && opcode != RULE_OP_NOT) {
+      --depth;
+    }
+    if (depth > max_depth) {
+      max_depth = depth;
+    }
+  }
+  if (max_depth > RULES_MAX_STACK_DEPTH) {
+    this->error("expression is too deeply nested");
+    return false;
+  }
+  return true;
+}
+
+// compile the binary operators of a precedence level (and those above it)
+bool RulesEngine::compileBinary(const char **p, const char *end,
+                                rule_program_t *program, int rule_index,
+                                int level) {
+  if (level == RULES_NUM_LEVELS) {
+    return this->compileUnary(p, end, program, rule_index);
+  }
+  if (this->compileBinary(p, end, program, rule_index, level + 1) == false) {
+    return false;
+  }
+  while (true) {
+    *p = skipSpace(*p, end);
+    const rule_operator_t *op = s_operators[level];
+    while (op->token != NULL && startsWith(*p, end, op->token) == false) {
+      ++op;
+    }
+    if (op->token == NULL) {
+      return true;
+    }
+    *p += strlen(op->token);
+    if (this->compileBinary(p, end, program, rule_index, level + 1) ==
+            false ||
+        this->emit(program, op->opcode, 0, 0) == false) {
+      return false;
+    }
+  }
+}
+
+// compile a unary operator, a parenthesized expression or an operand
+bool RulesEngine::compileUnary(const char **p, const char *end,
+                               rule_program_t *program, int rule_index) {
+  *p = skipSpace(*p, end);
+  if (*p == end) {
+    this->error("unexpected end of expression");
+    return false;
+  }
+  char c = **p;
+  if (c == '-' || (c == '!' && startsWith(*p, end, "!=") == false)) {
+    ++(*p);
+    return this->compileUnary(p, end, program, rule_index) &&
+           this->emit(program, (c == '-') ? RULE_OP_NEG : RULE_OP_NOT, 0, 0);
+  }
+  if (c == '(') {
+    ++(*p);
+    if (this->compileBinary(p, end, program, rule_index, 0) == false) {
+      return false;
+    }
+    *p = skipSpace(*p, end);
+    if (*p == end || **p != ')') {
+      this->error("expected \")\"");
+      return false;
+    }
+    ++(*p);
+    return true;
+  }
+  if (c >= '0' && c <= '9') {
+    long value = 0;
+    parseDigits(p, end, &value);
+    return this->emit(program, RULE_OP_PUSH, 0, value);
+  }
+  const char *endpoint_id = NULL;
+  uint16_t ids[3];
+  if (this->compileResource(p, end, &endpoint_id, ids) == false) {
+    return false;
+  }
+  int slot = this->variableSlot(endpoint_id, ids, rule_index);
+  return this->emit(program, RULE_OP_LOAD, (uint32_t)slot, 0);
+}
+
+// compile "<endpoint>:<obj>/<inst>/<res>" (the endpoint is interned)
+bool RulesEngine::compileResource(const char **p, const char *end,
+                                  const char **endpoint_id, uint16_t *ids) {
+  const char *name = *p;
+  const char *q = name;
+  if (q == end || !((*q >= 'a' && *q <= 'z') || (*q >= 'A' && *q <= 'Z'))) {
+    this->error("expected a number or <endpoint>:<obj>/<inst>/<res>");
+    return false;
+  }
+  while (q < end && isNameChar(*q) == true) {
+    ++q;
+  }
+  char buffer[FLEET_CONFIG_ENDPOINT_ID_LENGTH + 64];
+  size_t postfix_length = (this->m_endpoint_postfix != NULL)
+                              ? strlen(this->m_endpoint_postfix)
+                              : 0;
+  if ((size_t)(q - name) + postfix_length >= sizeof(buffer)) {
+    this->error("endpoint name is too long");
+    return false;
+  }
+  if (q == end || *q != ':') {
+    this->error("expected \":\" after the endpoint name");
+    return false;
+  }
+  memcpy(buffer, name, q - name);
+  if (postfix_length > 0) {
+    memcpy(buffer + (q - name), this->m_endpoint_postfix, postfix_length);
+  }
+  buffer[(q - name) + postfix_length] = '\0';
+  ++q;
+  for (int i = 0; i < 3; ++i) {
+    long id = 0;
+    if ((i > 0 && (q == end || *q++ != '/')) ||
+        parseDigits(&q, end, &id) == false || id > 0xFFFF) {
+      this->error("invalid <obj>/<inst>/<res>");
+      return false;
+    }
+    ids[i] = (uint16_t)id;
+  }
+  *p = q;
+  EndpointTable *table = EndpointTable::shared();
+  *endpoint_id = table->lookup(table->intern(buffer));
+  return true;
+}
+
+// append an instruction
+bool RulesEngine::emit(rule_program_t *program, uint8_t opcode, uint32_t slot,
+                       long value) {
+  if (program->length == RULES_MAX_PROGRAM_LENGTH) {
+    this->error("expression is too long");
+    return false;
+  }
+  rule_instruction_t *instruction = &program->code[program->length++];
+  instruction->opcode = opcode;
+  instruction->slot = slot;
+  instruction->value = value;
+  return true;
+}
+
+// find (or add) the variable for a resource... and link it to the rule that
+// reads it (rule_index < 0: no rule is triggered by it)
+int RulesEngine::variableSlot(const char *endpoint_id, const uint16_t *ids,
+                              int rule_index) {
+  endpoint_handle_t endpoint = EndpointTable::shared()->find(endpoint_id);
+  std::pair<endpoint_handle_t, uint64_t> key =
+      variableKey(endpoint, ids[0], ids[1], ids[2]);
+  std::map<std::pair<endpoint_handle_t, uint64_t>, int>::iterator it =
+      this->m_variable_slots.find(key);
+  int slot = 0;
+  if (it != this->m_variable_slots.end()) {
+    slot = it->second;
+  } else {
+    rule_variable_t variable;
+    variable.endpoint = endpoint;
+    variable.endpoint_id = endpoint_id;
+    variable.object_id = ids[0];
+    variable.instance_id = ids[1];
+    variable.resource_id = ids[2];
+    variable.value = 0;
+    variable.known = false;
+    variable.subscription = NULL;
+    slot = (int)this->m_variables.size();
+    this->m_variables.push_back(variable);
+    this->m_variable_slots[key] = slot;
+  }
+  std::vector<int> &rules = this->m_variables[slot].rules;
+  if (rule_index >= 0 && (rules.empty() == true || rules.back() != rule_index)) {
+    rules.push_back(rule_index);
+  }
+  return slot;
+}
+
+// evaluate a compiled expression
+bool RulesEngine::evaluate(const rule_program_t *program, long *result) {
+  long stack[RULES_MAX_STACK_DEPTH];
+  int top = -1;
+  for (int i = 0; i < program->length; ++i) {
+    const rule_instruction_t *instruction = &program->code[i];
+    switch (instruction->opcode) {
+    case RULE_OP_PUSH:
+      stack[++top] = instruction->value;
+      continue;
+    case RULE_OP_LOAD: {
+      const rule_variable_t *variable = &this->m_variables[instruction->slot];
+      if (variable->known == false) {
+        return false;
+      }
+      stack[++top] = variable->value;
+      continue;
+    }
+    case RULE_OP_NEG:
+      stack[top] = -stack[top];
+      continue;
+    case RULE_OP_NOT:
+      stack[top] = !stack[top];
+      continue;
+    default:
+      break;
+    }
+
+    // binary operators
+    long b = stack[top--];
+    long a = stack[top];
+    switch (instruction->opcode) {
+    case RULE_OP_ADD:
+      stack[top] = a + b;
+      break;
+    case RULE_OP_SUB:
+      stack[top] = a - b;
+      break;
+    case RULE_OP_MUL:
+      stack[top] = a * b;
+      break;
+    case RULE_OP_DIV:
+    case RULE_OP_MOD:
+      if (b == 0) {
+        return false;
+      }
+      stack[top] = (instruction->opcode == RULE_OP_DIV) ? (a / b) : (a % b);
+      break;
+    case RULE_OP_LT:
+      stack[top] = (a < b);
+      break;
+    case RULE_OP_LE:
+      stack[top] = (a <= b);
+      break;
+    case RULE_OP_GT:
+      stack[top] = (a > b);
+      break;
+    case RULE_OP_GE:
+      stack[top] = (a >= b);
+      break;
+    case RULE_OP_EQ:
+      stack[top] = (a == b);
+      break;
+    case RULE_OP_NE:
+      stack[top] = (a != b);
+      break;
+    case RULE_OP_AND:
+      stack[top] = (a != 0 && b != 0);
+      break;
+    case RULE_OP_OR:
+      stack[top] = (a != 0 || b != 0);
+      break;
+    }
+  }
+  *result = stack[top];
+  return true;
+}
+
+// feed a resource value
+void RulesEngine::updateValue(endpoint_handle_t endpoint,
+                              const uint16_t object_id,
+                              const uint16_t instance_id,
+                              const uint16_t resource_id, long value) {
+  std::map<std::pair<endpoint_handle_t, uint64_t>, int>::iterator it =
+      this->m_variable_slots.find(
+          variableKey(endpoint, object_id, instance_id, resource_id));
+  if (it != this->m_variable_slots.end()) {
+    this->updateVariable(it->second, value);
+  }
+}
+
+// a variable has a (new) value: re-evaluate the rules that read it
+void RulesEngine::updateVariable(int slot, long value) {
+  rule_variable_t *variable = &this->m_variables[slot];
+  if (variable->known == true && variable->value == value) {
+    return;
+  }
+  variable->value = value;
+  variable->known = true;
+  for (size_t i = 0; i < variable->rules.size(); ++i) {
+    this->evaluateRule(variable->rules[i]);
+  }
+}
+
+// evaluate a rule's condition... its action is issued when it changes
+void RulesEngine::evaluateRule(int index) {
+  rule_t *rule = &this->m_rules[index];
+  ++this->m_num_evaluations;
+  long result = 0;
+  if (this->evaluate(&rule->condition, &result) == false) {
+    return;
+  }
+  int state = (result != 0) ? 1 : 0;
+  if (state == rule->state) {
+    return;
+  }
+  rule->state = state;
+  if (state == 1) {
+    this->issueAction(&rule->action);
+    ++rule->num_fired;
+  } else if (rule->has_else == true) {
+    this->issueAction(&rule->else_action);
+    ++rule->num_fired;
+  }
+}
+
+// queue an action's write (pushed by flushActions())
+void RulesEngine::issueAction(const rule_action_t *action) {
+  long value = 0;
+  if (this->evaluate(&action->value, &value) == false) {
+    return;
+  }
+  orchestrator_write_t write;
+  write.endpoint_id = action->endpoint_id;
+  write.write.object_id = action->object_id;
+  write.write.instance_id = action->instance_id;
+  write.write.resource_id = action->resource_id;
+  write.write.operation = OPERATION_WRITE;
+  write.write.value = value;
+  this->m_actions.push_back(write);
+  ++this->m_num_actions;
+}
+
+// push the queued actions with a single batch write
+int RulesEngine::flushActions() {
+  int num_actions = (int)this->m_actions.size();
+  if (num_actions > 0 && this->m_orchestrator != NULL) {
+    this->m_orchestrator->writeResources(&this->m_actions[0], num_actions);
+  }
+  this->m_actions.clear();
+  return num_actions;
+}
+
+// subscribe every variable that is not (or no longer) attached to its shadow
+// (e.g. the shadow was not yet registered, or was removed and re-added by a
+// fleet reload)
+void RulesEngine::attachVariables() {
+  int num_attached = 0;
+  for (size_t i = 0; i < this->m_variables.size(); ++i) {
+    rule_variable_t *variable = &this->m_variables[i];
+    if (variable->subscription->isAttached() == true ||
+        this->m_orchestrator->subscribe(variable->subscription) == false) {
+      continue;
+    }
+
+    // start from the shadow's current value... notifications follow
+    long value = 0;
+    if (this->m_orchestrator->readResourceValue(
+            variable->endpoint_id, variable->object_id, variable->instance_id,
+            variable->resource_id, &value) == true) {
+      this->updateVariable((int)i, value);
+    }
+    ++num_attached;
+  }
+
+  // DEBUG
+  if (num_attached > 0) {
+    printf("RulesEngine: attached to %d resource(s)\n", num_attached);
+  }
+}
+
+// start the engine thread
+bool RulesEngine::start() {
+  if (this->m_is_started == true || this->m_orchestrator == NULL) {
+    return false;
+  }
+  for (size_t i = 0; i < this->m_variables.size(); ++i) {
+    rule_variable_t *variable = &this->m_variables[i];
+    if (variable->subscription == NULL) {
+      variable->subscription = new Subscription(
+          variable->endpoint_id, variable->object_id, variable->instance_id,
+          variable->resource_id, SUBSCRIPTION_DEFAULT_CAPACITY);
+    }
+  }
+  this->m_is_running = true;
+  this->m_is_started = Threads::create(
+      &this->m_thread, &RulesEngine::rulesProcessor, (void *)this);
+  return this->m_is_started;
+}
+
+// stop the engine thread and detach our subscriptions
+void RulesEngine::stop() {
+  if (this->m_is_started == false) {
+    return;
+  }
+  this->m_is_running = false;
+  pthread_join(this->m_thread, NULL);
+  this->m_is_started = false;
+
+  // the shards let go of the subscriptions asynchronously
+  for (size_t i = 0; i < this->m_variables.size(); ++i) {
+    this->m_orchestrator->unsubscribe(this->m_variables[i].subscription);
+  }
+  uint64_t deadline = monotonicMs() + RULES_ENGINE_DETACH_TIMEOUT_MS;
+  for (size_t i = 0; i < this->m_variables.size(); ++i) {
+    Subscription *subscription = this->m_variables[i].subscription;
+    while (subscription->isAttached() == true && monotonicMs() < deadline) {
+      usleep(RULES_ENGINE_IDLE_SLEEP_US);
+    }
+    if (subscription->isAttached() == true) {
+      // still referenced by a shadow... leak it rather than free it
+      printf("RulesEngine: WARNING. Subscription still attached after %d "
+             "ms\n",
+             RULES_ENGINE_DETACH_TIMEOUT_MS);
+      this->m_variables[i].subscription = NULL;
+    }
+  }
+}
+
+// STATIC: engine thread
+void *RulesEngine::rulesProcessor(void *ctx) {
+  RulesEngine *engine = (RulesEngine *)ctx;
+  if (engine != NULL) {
+    engine->rulesRunLoop();
+  }
+  return NULL;
+}
+
+// engine loop: drain our subscriptions, re-evaluate the rules they touch and
+// push the resulting actions as one batch
+void RulesEngine::rulesRunLoop() {
+  uint64_t last_attach_ms = 0;
+  int idle_passes = 0;
+  resource_notification_t notification;
+  Profiler::shared()->registerThread("rules");
+  while (this->m_is_running == true) {
+    uint64_t now_ms = monotonicMs();
+    if (last_attach_ms == 0 ||
+        now_ms - last_attach_ms >= RULES_ENGINE_ATTACH_INTERVAL_MS) {
+      this->attachVariables();
+      last_attach_ms = now_ms;
+    }
+
+    bool received = false;
+    for (size_t i = 0; i < this->m_variables.size(); ++i) {
+      Subscription *subscription = this->m_variables[i].subscription;
+      while (subscription->poll(&notification) == true) {
+        this->updateVariable((int)i, notification.value);
+        received = true;
+      }
+    }
+    this->flushActions();
+
+    // stay responsive to bursts... sleep once we have been idle for a while
+    if (received == true) {
+      idle_passes = 0;
+    } else if (++idle_passes < RULES_ENGINE_IDLE_SPINS) {
+      sched_yield();
+    } else {
+      usleep(RULES_ENGINE_IDLE_SLEEP_US);
+    }
+  }
+  Profiler::shared()->unregisterThread();
+}
+
+// get the number of rules
+int RulesEngine::getNumRules() { return (int)this->m_rules.size(); }
+
+// get the number of resources read by the rules
+int RulesEngine::getNumVariables() { return (int)this->m_variables.size(); }
+
+// get the number of rule evaluations
+uint64_t RulesEngine::getNumEvaluations() { return this->m_num_evaluations; }
+
+// get the number of actions issued
+uint64_t RulesEngine::getNumActions() { return this->m_num_actions; }
@@ -0,0 +1,217 @@
+/**
+ * @file    RulesEngine.h
+ * @brief   mbed Edge Orchestrator local rules engine
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __RULES_ENGINE_H__
+#define __RULES_ENGINE_H__
+
+// system includes
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// rule registry
+#include <map>
+#include <vector>
+
+// Orchestrator (subscriptions and writes)
+#include "Orchestrator.h"
+
+// Tunables for the rules engine
+#define RULES_MAX_NAME_LENGTH 32   // max rule name length
+#define RULES_MAX_PROGRAM_LENGTH 32 // max instructions per expression
+#define RULES_MAX_STACK_DEPTH 16   // max evaluation stack depth
+#define RULES_ENGINE_IDLE_SPINS 256     // idle passes before the engine sleeps
+#define RULES_ENGINE_IDLE_SLEEP_US 1000 // engine thread sleep when idle
+#define RULES_ENGINE_ATTACH_INTERVAL_MS 1000 // retry detached subscriptions
+#define RULES_ENGINE_DETACH_TIMEOUT_MS 2000 // max wait for the shards on stop
+
+// rule expression opcodes (a stack machine)
+enum RULE_OPCODE {
+  RULE_OP_PUSH = 0, // push a constant
+  RULE_OP_LOAD,     // push a resource value (fails if it is not yet known)
+  RULE_OP_NEG,
+  RULE_OP_NOT,
+  RULE_OP_ADD,
+  RULE_OP_SUB,
+  RULE_OP_MUL,
+  RULE_OP_DIV, // fails on division by zero
+  RULE_OP_MOD, // ... as above
+  RULE_OP_LT,
+  RULE_OP_LE,
+  RULE_OP_GT,
+  RULE_OP_GE,
+  RULE_OP_EQ,
+  RULE_OP_NE,
+  RULE_OP_AND,
+  RULE_OP_OR
+};
+
+// a single instruction
+typedef struct rule_instruction {
+  uint8_t opcode;
+  uint32_t slot; // RULE_OP_LOAD: variable index
+  long value;    // RULE_OP_PUSH: constant
+} rule_instruction_t;
+
+// a compiled expression
+typedef struct rule_program {
+  int length;
+  rule_instruction_t code[RULES_MAX_PROGRAM_LENGTH];
+} rule_program_t;
+
+// a resource write issued by a rule
+typedef struct rule_action {
+  const char *endpoint_id; // interned (see EndpointTable)
+  uint16_t object_id;
+  uint16_t instance_id;
+  uint16_t resource_id;
+  rule_program_t value;
+} rule_action_t;
+
+// a compiled rule
+typedef struct rule {
+  char name[RULES_MAX_NAME_LENGTH];
+  rule_program_t condition;
+  rule_action_t action;      // when the condition becomes true
+  rule_action_t else_action; // when it becomes false (if has_else)
+  bool has_else;
+  int state;           // -1: not yet evaluated, else the last condition
+  uint64_t num_fired;  // actions issued
+} rule_t;
+
+// a shadow resource read by one or more rules
+typedef struct rule_variable {
+  endpoint_handle_t endpoint;
+  const char *endpoint_id; // interned
+  uint16_t object_id;
+  uint16_t instance_id;
+  uint16_t resource_id;
+  long value;
+  bool known;                // a value has been seen
+  Subscription *subscription; // feeds the value (see attach())
+  std::vector<int> rules;     // the rules that read it
+} rule_variable_t;
+
+// Local (edge-side) rules between devices. A rules file is line oriented
+// ('#' starts a comment):
+//
+//   rule <name> when <expr> then <endpoint>:<obj>/<inst>/<res> = <expr>
+//                          [else <endpoint>:<obj>/<inst>/<res> = <expr>]
+//
+// Expressions are integer arithmetic/comparisons over constants and shadow
+// resources ("<endpoint>:<obj>/<inst>/<res>", the endpoint name starting
+// with a letter) with the usual C operators and precedence (|| && == != < <=
+// > >= + - * / % ! and unary -). Each expression is compiled to a small
+// stack machine program.
+//
+// Every resource a rule reads is a variable fed by a local subscription
+// (see Subscription). When a variable changes only the rules that read it
+// are re-evaluated, and a rule's action is only issued when its condition
+// changes (becomes true... or false, with "else"). The actions of a pass
+// are pushed with a single Orchestrator::writeResources().
+class RulesEngine {
+public:
+  RulesEngine(Orchestrator *orchestrator, const char *endpoint_postfix);
+  virtual ~RulesEngine();
+
+  // parse and compile a rules file (false if it cannot be read or is invalid)
+  bool parse(const char *path);
+
+  // parse and compile rules held in memory (not NUL terminated)
+  bool parse(const char *buffer, size_t length);
+
+  // start/stop the engine thread (stop() detaches our subscriptions)
+  bool start();
+  void stop();
+
+  // feed a resource value... re-evaluates the rules that read it (engine
+  // thread, or the caller if the engine is not started)
+  void updateValue(endpoint_handle_t endpoint, const uint16_t object_id,
+                   const uint16_t instance_id, const uint16_t resource_id,
+                   long value);
+
+  // push the actions issued since the last flush (returns their number)
+  int flushActions();
+
+  // evaluate a compiled expression (false if a value is not known yet or on
+  // division by zero)
+  bool evaluate(const rule_program_t *program, long *result);
+
+  // statistics
+  int getNumRules();
+  int getNumVariables();
+  uint64_t getNumEvaluations();
+  uint64_t getNumActions();
+
+  // engine thread (pthread)
+  static void *rulesProcessor(void *ctx);
+  void rulesRunLoop();
+
+private:
+  RulesEngine(const RulesEngine &engine);
+  void initialize(Orchestrator *orchestrator, const char *endpoint_postfix);
+  void parseLine(const char *line, const char *end);
+  bool compileAction(const char **p, const char *end, rule_action_t *action,
+                     int rule_index);
+  bool compileExpression(const char **p, const char *end,
+                         rule_program_t *program, int rule_index);
+  bool compileBinary(const char **p, const char *end, rule_program_t *program,
+                     int rule_index, int level);
+  bool compileUnary(const char **p, const char *end, rule_program_t *program,
+                    int rule_index);
+  bool compileResource(const char **p, const char *end,
+                       const char **endpoint_id, uint16_t *ids);
+  bool emit(rule_program_t *program, uint8_t opcode, uint32_t slot,
+            long value);
+  int variableSlot(const char *endpoint_id, const uint16_t *ids,
+                   int rule_index);
+  void updateVariable(int slot, long value);
+  void evaluateRule(int index);
+  void issueAction(const rule_action_t *action);
+  void attachVariables();
+  void error(const char *message);
+
+private:
+  Orchestrator *m_orchestrator;
+  char *m_endpoint_postfix;
+  const char *m_path;
+  int m_line;
+  int m_num_errors;
+
+  // compiled rules and the variables they read
+  std::vector<rule_t> m_rules;
+  std::vector<rule_variable_t> m_variables;
+  std::map<std::pair<endpoint_handle_t, uint64_t>, int> m_variable_slots;
+
+  // actions waiting for the next flushActions()
+  std::vector<orchestrator_write_t> m_actions;
+  uint64_t m_num_evaluations;
+  uint64_t m_num_actions;
+
+  // engine thread
+  pthread_t m_thread;
+  volatile bool m_is_running;
+  bool m_is_started;
+};
+
+#endif // __RULES_ENGINE_H__
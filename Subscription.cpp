@@ -0,0 +1,124 @@
+/**
+ * @file    Subscription.cpp
+ * @brief   mbed Edge Shadow Resource Subscription Implementation
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Subscription.h"
+
+// system includes
+#include <stdlib.h>
+
+// constructor
+Subscription::Subscription(const char *endpoint_id, const uint16_t object_id,
+                           const uint16_t instance_id,
+                           const uint16_t resource_id, size_t capacity) {
+  this->initialize(endpoint_id, object_id, instance_id, resource_id, capacity);
+}
+
+// destructor
+Subscription::~Subscription() { free(this->m_ring); }
+
+// copy constructor
+Subscription::Subscription(const Subscription &subscription) {}
+
+// initialize
+void Subscription::initialize(const char *endpoint_id,
+                              const uint16_t object_id,
+                              const uint16_t instance_id,
+                              const uint16_t resource_id, size_t capacity) {
+  this->m_endpoint = EndpointTable::shared()->intern(endpoint_id);
+  this->m_object_id = object_id;
+  this->m_instance_id = instance_id;
+  this->m_resource_id = resource_id;
+  this->m_attached = false;
+
+  // round the capacity up to a power of two
+  size_t slots = 1;
+  while (slots < capacity) {
+    slots <<= 1;
+  }
+  this->m_ring = (resource_notification_t *)malloc(
+      slots * sizeof(resource_notification_t));
+  this->m_mask = slots - 1;
+  this->m_head = 0;
+  this->m_tail = 0;
+  this->m_num_notified = 0;
+  this->m_num_dropped = 0;
+}
+
+// does this subscription cover a resource?
+bool Subscription::matches(const uint16_t object_id,
+                           const uint16_t instance_id,
+                           const uint16_t resource_id) {
+  return (this->m_object_id == SUBSCRIPTION_ANY_ID ||
+          this->m_object_id == object_id) &&
+         (this->m_instance_id == SUBSCRIPTION_ANY_ID ||
+          this->m_instance_id == instance_id) &&
+         (this->m_resource_id == SUBSCRIPTION_ANY_ID ||
+          this->m_resource_id == resource_id);
+}
+
+// queue a notification (owning shard only)
+bool Subscription::notify(const resource_notification_t *notification) {
+  uint64_t head = __atomic_load_n(&this->m_head, __ATOMIC_ACQUIRE);
+  if (this->m_tail - head > this->m_mask) {
+    // full... drop it rather than hold up the shard
+    __atomic_add_fetch(&this->m_num_dropped, 1, __ATOMIC_RELAXED);
+    return false;
+  }
+  this->m_ring[this->m_tail & this->m_mask] = *notification;
+  __atomic_store_n(&this->m_tail, this->m_tail + 1, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&this->m_num_notified, 1, __ATOMIC_RELAXED);
+  return true;
+}
+
+// next notification (subscriber only)
+bool Subscription::poll(resource_notification_t *notification) {
+  uint64_t tail = __atomic_load_n(&this->m_tail, __ATOMIC_ACQUIRE);
+  if (this->m_head == tail) {
+    return false;
+  }
+  *notification = this->m_ring[this->m_head & this->m_mask];
+  __atomic_store_n(&this->m_head, this->m_head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+// set our attachment to the shadow (owning shard)
+void Subscription::setAttached(bool attached) {
+  __atomic_store_n(&this->m_attached, attached, __ATOMIC_RELEASE);
+}
+
+// are we attached to the shadow?
+bool Subscription::isAttached() {
+  return __atomic_load_n(&this->m_attached, __ATOMIC_ACQUIRE);
+}
+
+// get our (interned) endpoint
+endpoint_handle_t Subscription::getEndpoint() { return this->m_endpoint; }
+
+// get the number of notifications queued
+uint64_t Subscription::getNumNotified() {
+  return __atomic_load_n(&this->m_num_notified, __ATOMIC_RELAXED);
+}
+
+// get the number of notifications dropped (ring full)
+uint64_t Subscription::getNumDropped() {
+  return __atomic_load_n(&this->m_num_dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,105 @@
+/**
+ * @file    Subscription.h
+ * @brief   mbed Edge Shadow Resource Subscription (bounded notification queue)
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SUBSCRIPTION_H__
+#define __SUBSCRIPTION_H__
+
+// system includes
+#include <stddef.h>
+#include <stdint.h>
+
+// interned endpoint IDs
+#include "EndpointTable.h"
+
+// Tunables for subscriptions
+#define SUBSCRIPTION_DEFAULT_CAPACITY 256 // notifications queued per subscriber
+#define SUBSCRIPTION_ANY_ID 0xFFFF        // wildcard object/instance/resource ID
+
+// a resource value change
+typedef struct resource_notification {
+  endpoint_handle_t endpoint; // see EndpointTable::lookup()
+  uint16_t object_id;
+  uint16_t instance_id;
+  uint16_t resource_id;
+  long value;
+  uint64_t version; // the shadow's value cache version
+} resource_notification_t;
+
+// A local consumer's interest in one (or, with SUBSCRIPTION_ANY_ID, several)
+// of a shadow's resources. The owning shard is the only producer and the
+// subscriber the only consumer of its notification ring, so neither side
+// takes a lock. A full ring drops the new notification (and counts it)...
+// a slow consumer never holds up the shard or the cloud path.
+//
+// The subscriber owns the Subscription, but hands it to the shadow's shard
+// while subscribed (see Orchestrator::subscribe()/unsubscribe()): isAttached()
+// is true from subscribe() until the shard has let go of it (unsubscribed, or
+// the shadow was removed from the fleet)... only then may it be deleted.
+class Subscription {
+public:
+  Subscription(const char *endpoint_id, const uint16_t object_id,
+               const uint16_t instance_id, const uint16_t resource_id,
+               size_t capacity);
+  virtual ~Subscription();
+
+  // consumer: next notification (false if there is none)
+  bool poll(resource_notification_t *notification);
+
+  // does this subscription cover a resource?
+  bool matches(const uint16_t object_id, const uint16_t instance_id,
+               const uint16_t resource_id);
+
+  // producer (owning shard): queue a notification (false if it was dropped)
+  bool notify(const resource_notification_t *notification);
+
+  // attachment to the shadow (owning shard)
+  void setAttached(bool attached);
+  bool isAttached();
+
+  // accessors/statistics
+  endpoint_handle_t getEndpoint();
+  uint64_t getNumNotified();
+  uint64_t getNumDropped();
+
+private:
+  Subscription(const Subscription &subscription);
+  void initialize(const char *endpoint_id, const uint16_t object_id,
+                  const uint16_t instance_id, const uint16_t resource_id,
+                  size_t capacity);
+
+private:
+  endpoint_handle_t m_endpoint;
+  uint16_t m_object_id;
+  uint16_t m_instance_id;
+  uint16_t m_resource_id;
+  bool m_attached;
+
+  // single producer/single consumer ring (power of two slots)
+  resource_notification_t *m_ring;
+  size_t m_mask;
+  uint64_t m_head; // consumer
+  uint64_t m_tail; // producer
+  uint64_t m_num_notified;
+  uint64_t m_num_dropped;
+};
+
+#endif // __SUBSCRIPTION_H__
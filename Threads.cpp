@@ -0,0 +1,43 @@
+/**
+ * @file    Threads.cpp
+ * @brief   mbed Edge Orchestrator Thread Creation
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Class support
+#include "Threads.h"
+
+// system includes
+#include <signal.h>
+
+// create a thread with the process signals blocked... the creating thread's
+// mask is restored right after
+bool Threads::create(pthread_t *thread, void *(*run)(void *), void *ctx) {
+  sigset_t blocked, previous;
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGINT);
+  sigaddset(&blocked, SIGTERM);
+  sigaddset(&blocked, SIGHUP);
+  sigaddset(&blocked, SIGUSR1);
+  sigaddset(&blocked, SIGUSR2);
+  pthread_sigmask(SIG_BLOCK, &blocked, &previous);
+  bool created = (pthread_create(thread, NULL, run, ctx) == 0);
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+  return created;
+}
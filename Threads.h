@@ -0,0 +1,42 @@
+/**
+ * @file    Threads.h
+ * @brief   mbed Edge Orchestrator Thread Creation
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __THREADS_H__
+#define __THREADS_H__
+
+// pthreads
+#include <pthread.h>
+
+// Our worker threads (shards, PT connections, rules, control socket, device
+// ticker) never take the process signals: SIGINT/SIGTERM/SIGHUP/SIGUSR1/
+// SIGUSR2 are delivered to the main thread only, so their handlers never run
+// on a thread that holds one of our locks
+class Threads {
+public:
+  // create a thread with the process signals blocked (it inherits the mask)
+  static bool create(pthread_t *thread, void *(*run)(void *), void *ctx);
+
+private:
+  Threads();
+};
+
+#endif // __THREADS_H__
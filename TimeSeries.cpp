@@ -0,0 +1,538 @@
+/**
+ * @file    TimeSeries.cpp
+ * @brief   mbed Edge Orchestrator compressed per-resource time series implementation
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "TimeSeries.h"
+
+// system includes
+#include <sched.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// worst case encoded sizes of a sample (see append())
+#define TIME_SERIES_MAX_TIMESTAMP_BITS (4 + 64)
+#define TIME_SERIES_MAX_VALUE_BITS (2 + 6 + 6 + 64)
+
+// resource key (0: no resource)
+static uint64_t seriesKey(const uint16_t object_id, const uint16_t instance_id,
+                          const uint16_t resource_id) {
+  return (1ULL << 48) | ((uint64_t)object_id << 32) |
+         ((uint64_t)instance_id << 16) | (uint64_t)resource_id;
+}
+
+// append "num_bits" bits of "value" (MSB first) to a column
+static void writeBits(uint8_t *column, uint32_t *position, uint64_t value,
+                      int num_bits) {
+  while (num_bits > 0) {
+    int offset = (int)(*position & 7);
+    int take = 8 - offset;
+    if (take > num_bits) {
+      take = num_bits;
+    }
+    uint8_t chunk =
+        (uint8_t)((value >> (num_bits - take)) & ((1U << take) - 1));
+    column[*position >> 3] |= (uint8_t)(chunk << (8 - offset - take));
+    *position += take;
+    num_bits -= take;
+  }
+}
+
+// read "num_bits" bits (MSB first) from a column
+static uint64_t readBits(const uint8_t *column, uint32_t *position,
+                         int num_bits) {
+  uint64_t value = 0;
+  while (num_bits > 0) {
+    int offset = (int)(*position & 7);
+    int take = 8 - offset;
+    if (take > num_bits) {
+      take = num_bits;
+    }
+    uint8_t chunk = (uint8_t)((column[*position >> 3] >> (8 - offset - take)) &
+                              ((1U << take) - 1));
+    value = (value << take) | chunk;
+    *position += take;
+    num_bits -= take;
+  }
+  return value;
+}
+
+// sign extend the low "num_bits" bits of "value"
+static int64_t signExtend(uint64_t value, int num_bits) {
+  if (num_bits == 64) {
+    return (int64_t)value;
+  }
+  uint64_t sign = 1ULL << (num_bits - 1);
+  return (int64_t)((value ^ sign) - sign);
+}
+
+// does "value" fit in a "num_bits" bit two's complement field?
+static bool fitsSigned(int64_t value, int num_bits) {
+  return (value >= -(1LL << (num_bits - 1)) && value < (1LL << (num_bits - 1)));
+}
+
+// delta-of-delta buckets: '0' | '10' + 7 bits | '110' + 9 | '1110' + 12 |
+// '1111' + 64
+static const int s_dod_bits[] = {7, 9, 12, 64};
+
+// zigzag encode a signed delta (small magnitudes -> small unsigned values)
+static uint64_t zigzag(int64_t value) {
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+// ... and decode it
+static int64_t unzigzag(uint64_t value) {
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// fold a sample into an aggregate
+static void aggregateSample(time_series_aggregate_t *aggregate, long value) {
+  if (aggregate->count == 0 || value < aggregate->min) {
+    aggregate->min = value;
+  }
+  if (aggregate->count == 0 || value > aggregate->max) {
+    aggregate->max = value;
+  }
+  aggregate->sum += value;
+  ++aggregate->count;
+}
+
+// constructor
+TimeSeries::TimeSeries() { this->initialize(); }
+
+// destructor (no readers may be left)
+TimeSeries::~TimeSeries() { free(this->m_blocks); }
+
+// copy constructor
+TimeSeries::TimeSeries(const TimeSeries &series) {}
+
+// initialize
+void TimeSeries::initialize() {
+  this->m_key = 0;
+  this->m_generation = 0;
+  this->m_blocks = NULL;
+  this->m_ring = 0;
+  this->m_last_timestamp_ms = 0;
+  this->m_last_delta_ms = 0;
+  this->m_last_value = 0;
+  this->m_last_delta = 0;
+  this->m_last_leading = -1;
+  this->m_last_trailing = 0;
+  this->m_num_read_retries = 0;
+}
+
+// (re)start the series for a resource
+void TimeSeries::reset(const uint16_t object_id, const uint16_t instance_id,
+                       const uint16_t resource_id) {
+  this->resetKey(seriesKey(object_id, instance_id, resource_id));
+}
+
+// drop the samples (no resource)
+void TimeSeries::clear() { this->resetKey(0); }
+
+// drop the samples and switch resources... readers in flight see the
+// generation change and give up
+void TimeSeries::resetKey(uint64_t key) {
+  __atomic_add_fetch(&this->m_generation, 1, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&this->m_key, key, __ATOMIC_RELAXED);
+  __atomic_store_n(&this->m_ring, 0, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&this->m_generation, 1, __ATOMIC_SEQ_CST);
+}
+
+// is this the series of a resource?
+bool TimeSeries::isResource(const uint16_t object_id,
+                            const uint16_t instance_id,
+                            const uint16_t resource_id) {
+  return (__atomic_load_n(&this->m_key, __ATOMIC_ACQUIRE) ==
+          seriesKey(object_id, instance_id, resource_id));
+}
+
+// writer: open a block for modification (readers retry until writeEnd())
+void TimeSeries::writeBegin(time_series_block_t *block) {
+  __atomic_store_n(&block->sequence, block->sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+// writer: the block is consistent again
+void TimeSeries::writeEnd(time_series_block_t *block) {
+  __atomic_store_n(&block->sequence, block->sequence + 1, __ATOMIC_RELEASE);
+}
+
+// start a new block with its first (uncompressed) sample... reusing the
+// oldest one once the ring is full
+void TimeSeries::startBlock(int64_t timestamp_ms, long value) {
+  uint64_t ring = this->m_ring;
+  uint32_t head = (uint32_t)(ring >> 32);
+  uint32_t num_blocks = (uint32_t)ring;
+  if (num_blocks > 0) {
+    head = (head + 1) % TIME_SERIES_NUM_BLOCKS;
+  }
+  if (num_blocks < TIME_SERIES_NUM_BLOCKS) {
+    ++num_blocks;
+  }
+
+  time_series_block_t *block = &this->m_blocks[head];
+  this->writeBegin(block);
+  block->num_samples = 1;
+  block->timestamp_bits = 0;
+  block->value_bits = 0;
+  block->first_timestamp_ms = timestamp_ms;
+  block->last_timestamp_ms = timestamp_ms;
+  block->first_value = value;
+  block->min = value;
+  block->max = value;
+  block->sum = value;
+  memset(block->timestamps, 0, sizeof(block->timestamps));
+  memset(block->values, 0, sizeof(block->values));
+  this->writeEnd(block);
+  __atomic_store_n(&this->m_ring, ((uint64_t)head << 32) | num_blocks,
+                   __ATOMIC_RELEASE);
+
+  this->m_last_timestamp_ms = timestamp_ms;
+  this->m_last_delta_ms = 0;
+  this->m_last_value = value;
+  this->m_last_delta = 0;
+  this->m_last_leading = -1;
+  this->m_last_trailing = 0;
+}
+
+// append a sample
+void TimeSeries::append(int64_t timestamp_ms, long value) {
+  if (this->m_blocks == NULL) {
+    __atomic_store_n(&this->m_blocks,
+                     (time_series_block_t *)calloc(TIME_SERIES_NUM_BLOCKS,
+                                                   sizeof(time_series_block_t)),
+                     __ATOMIC_RELEASE);
+    if (this->m_blocks == NULL) {
+      return;
+    }
+  }
+  uint64_t ring = this->m_ring;
+  time_series_block_t *block = &this->m_blocks[ring >> 32];
+  if ((uint32_t)ring == 0 ||
+      block->timestamp_bits + TIME_SERIES_MAX_TIMESTAMP_BITS >
+          TIME_SERIES_COLUMN_BYTES * 8 ||
+      block->value_bits + TIME_SERIES_MAX_VALUE_BITS >
+          TIME_SERIES_COLUMN_BYTES * 8) {
+    this->startBlock(timestamp_ms, value);
+    return;
+  }
+
+  this->writeBegin(block);
+
+  // timestamp: delta-of-delta (0 for a regular interval... a single bit)
+  int64_t delta = timestamp_ms - this->m_last_timestamp_ms;
+  int64_t dod = delta - this->m_last_delta_ms;
+  if (dod == 0) {
+    writeBits(block->timestamps, &block->timestamp_bits, 0, 1);
+  } else {
+    int bucket = 0;
+    while (bucket < 3 && fitsSigned(dod, s_dod_bits[bucket]) == false) {
+      ++bucket;
+    }
+    // '10', '110', '1110' or '1111'
+    uint64_t prefix = (bucket < 3) ? (((1ULL << (bucket + 2)) - 1) - 1)
+                                   : 0xF;
+    writeBits(block->timestamps, &block->timestamp_bits, prefix,
+              (bucket < 3) ? (bucket + 2) : 4);
+    writeBits(block->timestamps, &block->timestamp_bits, (uint64_t)dod,
+              s_dod_bits[bucket]);
+  }
+
+  // value: our values are integers, so we XOR successive (zigzag) deltas
+  // rather than the raw values... a steady rate of change is a single bit,
+  // small changes a handful. Only the meaningful bits of the XOR are stored
+  uint64_t delta_value = zigzag((int64_t)value - (int64_t)this->m_last_value);
+  uint64_t xored = delta_value ^ this->m_last_delta;
+  if (xored == 0) {
+    writeBits(block->values, &block->value_bits, 0, 1);
+  } else {
+    int leading = __builtin_clzll(xored);
+    int trailing = __builtin_ctzll(xored);
+    if (this->m_last_leading >= 0 && leading >= this->m_last_leading &&
+        trailing >= this->m_last_trailing) {
+      // fits the previous window: '10' + the window's bits
+      int length = 64 - this->m_last_leading - this->m_last_trailing;
+      writeBits(block->values, &block->value_bits, 2, 2);
+      writeBits(block->values, &block->value_bits,
+                xored >> this->m_last_trailing, length);
+    } else {
+      // new window: '11' + 6 bits leading + 6 bits length + the bits
+      int length = 64 - leading - trailing;
+      writeBits(block->values, &block->value_bits, 3, 2);
+      writeBits(block->values, &block->value_bits, (uint64_t)leading, 6);
+      writeBits(block->values, &block->value_bits, (uint64_t)(length & 63), 6);
+      writeBits(block->values, &block->value_bits, xored >> trailing, length);
+      this->m_last_leading = leading;
+      this->m_last_trailing = trailing;
+    }
+  }
+
+  // block summary
+  ++block->num_samples;
+  block->last_timestamp_ms = timestamp_ms;
+  if (value < block->min) {
+    block->min = value;
+  }
+  if (value > block->max) {
+    block->max = value;
+  }
+  block->sum += value;
+  this->writeEnd(block);
+
+  this->m_last_delta_ms = delta;
+  this->m_last_timestamp_ms = timestamp_ms;
+  this->m_last_value = value;
+  this->m_last_delta = delta_value;
+}
+
+// reader: a consistent copy of a block (seqlock... retried if the writer
+// touched it while we copied)
+void TimeSeries::readBlock(int index, time_series_block_t *copy,
+                           bool header_only) {
+  const time_series_block_t *block = &this->m_blocks[index];
+  size_t length = (header_only == true)
+                      ? offsetof(time_series_block_t, timestamps)
+                      : sizeof(time_series_block_t);
+  while (true) {
+    uint64_t before = __atomic_load_n(&block->sequence, __ATOMIC_ACQUIRE);
+    if ((before & 1) == 0) {
+      memcpy(copy, block, length);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&block->sequence, __ATOMIC_RELAXED) == before) {
+        return;
+      }
+    }
+    __atomic_add_fetch(&this->m_num_read_retries, 1, __ATOMIC_RELAXED);
+    sched_yield();
+  }
+}
+
+// reader: is this (still) the resource's series?
+bool TimeSeries::readLock(uint64_t *generation, uint64_t key) {
+  *generation = __atomic_load_n(&this->m_generation, __ATOMIC_ACQUIRE);
+  return ((*generation & 1) == 0 &&
+          __atomic_load_n(&this->m_key, __ATOMIC_ACQUIRE) == key);
+}
+
+// reader: was the series reset while we read it?
+bool TimeSeries::readUnlock(uint64_t generation) {
+  return (__atomic_load_n(&this->m_generation, __ATOMIC_ACQUIRE) ==
+          generation);
+}
+
+// decode a block's samples within [from_ms, to_ms] into "samples" and/or
+// "aggregate"... returns the number of samples copied
+int TimeSeries::decodeBlock(const time_series_block_t *block, int64_t from_ms,
+                            int64_t to_ms, time_series_sample_t *samples,
+                            int max_samples, time_series_aggregate_t *aggregate) {
+  uint32_t timestamp_position = 0;
+  uint32_t value_position = 0;
+  int64_t timestamp_ms = block->first_timestamp_ms;
+  int64_t delta = 0;
+  long value = block->first_value;
+  uint64_t delta_value = 0;
+  int leading = 0;
+  int trailing = 0;
+  int num_copied = 0;
+  for (uint32_t i = 0; i < block->num_samples; ++i) {
+    if (i > 0) {
+      // timestamp
+      if (readBits(block->timestamps, &timestamp_position, 1) != 0) {
+        int bucket = 0;
+        while (bucket < 3 &&
+               readBits(block->timestamps, &timestamp_position, 1) != 0) {
+          ++bucket;
+        }
+        delta += signExtend(readBits(block->timestamps, &timestamp_position,
+                                     s_dod_bits[bucket]),
+                            s_dod_bits[bucket]);
+      }
+      timestamp_ms += delta;
+
+      // value
+      if (readBits(block->values, &value_position, 1) != 0) {
+        if (readBits(block->values, &value_position, 1) != 0) {
+          leading = (int)readBits(block->values, &value_position, 6);
+          int length = (int)readBits(block->values, &value_position, 6);
+          if (length == 0) {
+            length = 64;
+          }
+          trailing = 64 - leading - length;
+        }
+        delta_value ^= readBits(block->values, &value_position,
+                                64 - leading - trailing)
+                       << trailing;
+      }
+      value += (long)unzigzag(delta_value);
+    }
+    if (timestamp_ms > to_ms) {
+      break;
+    }
+    if (timestamp_ms >= from_ms) {
+      if (samples != NULL) {
+        if (num_copied == max_samples) {
+          break;
+        }
+        samples[num_copied].timestamp_ms = timestamp_ms;
+        samples[num_copied].value = value;
+        ++num_copied;
+      }
+      if (aggregate != NULL) {
+        aggregateSample(aggregate, value);
+      }
+    }
+  }
+  return num_copied;
+}
+
+// samples in [from_ms, to_ms], oldest first
+int TimeSeries::query(const uint16_t object_id, const uint16_t instance_id,
+                      const uint16_t resource_id, int64_t from_ms,
+                      int64_t to_ms, time_series_sample_t *samples,
+                      int max_samples) {
+  uint64_t generation = 0;
+  if (this->readLock(&generation,
+                     seriesKey(object_id, instance_id, resource_id)) == false) {
+    return -1;
+  }
+  int num_samples = 0;
+  time_series_block_t *blocks =
+      __atomic_load_n(&this->m_blocks, __ATOMIC_ACQUIRE);
+  if (blocks != NULL) {
+    uint64_t ring = __atomic_load_n(&this->m_ring, __ATOMIC_ACQUIRE);
+    uint32_t head = (uint32_t)(ring >> 32);
+    uint32_t num_blocks = (uint32_t)ring;
+    time_series_block_t copy;
+    for (uint32_t i = 0; i < num_blocks && num_samples < max_samples; ++i) {
+      int index = (int)((head + TIME_SERIES_NUM_BLOCKS - num_blocks + 1 + i) %
+                        TIME_SERIES_NUM_BLOCKS);
+
+      // skip blocks outside of the window on their summary alone
+      this->readBlock(index, &copy, true);
+      if (copy.last_timestamp_ms < from_ms ||
+          copy.first_timestamp_ms > to_ms) {
+        continue;
+      }
+      this->readBlock(index, &copy, false);
+      num_samples += this->decodeBlock(&copy, from_ms, to_ms,
+                                       samples + num_samples,
+                                       max_samples - num_samples, NULL);
+    }
+  }
+  return (this->readUnlock(generation) == true) ? num_samples : -1;
+}
+
+// count/min/max/sum/mean over [from_ms, to_ms]
+bool TimeSeries::aggregate(const uint16_t object_id,
+                           const uint16_t instance_id,
+                           const uint16_t resource_id, int64_t from_ms,
+                           int64_t to_ms, time_series_aggregate_t *aggregate) {
+  memset(aggregate, 0, sizeof(time_series_aggregate_t));
+  uint64_t generation = 0;
+  if (this->readLock(&generation,
+                     seriesKey(object_id, instance_id, resource_id)) == false) {
+    return false;
+  }
+  time_series_block_t *blocks =
+      __atomic_load_n(&this->m_blocks, __ATOMIC_ACQUIRE);
+  if (blocks != NULL) {
+    uint64_t ring = __atomic_load_n(&this->m_ring, __ATOMIC_ACQUIRE);
+    uint32_t head = (uint32_t)(ring >> 32);
+    uint32_t num_blocks = (uint32_t)ring;
+    time_series_block_t copy;
+    for (uint32_t i = 0; i < num_blocks; ++i) {
+      int index = (int)((head + TIME_SERIES_NUM_BLOCKS - num_blocks + 1 + i) %
+                        TIME_SERIES_NUM_BLOCKS);
+      this->readBlock(index, &copy, true);
+      if (copy.last_timestamp_ms < from_ms ||
+          copy.first_timestamp_ms > to_ms) {
+        continue;
+      }
+      if (copy.first_timestamp_ms >= from_ms &&
+          copy.last_timestamp_ms <= to_ms) {
+        // the whole block is in the window... its summary will do
+        if (aggregate->count == 0 || copy.min < aggregate->min) {
+          aggregate->min = copy.min;
+        }
+        if (aggregate->count == 0 || copy.max > aggregate->max) {
+          aggregate->max = copy.max;
+        }
+        aggregate->sum += copy.sum;
+        aggregate->count += copy.num_samples;
+        continue;
+      }
+      this->readBlock(index, &copy, false);
+      this->decodeBlock(&copy, from_ms, to_ms, NULL, 0, aggregate);
+    }
+  }
+  if (aggregate->count > 0) {
+    aggregate->mean = (double)aggregate->sum / aggregate->count;
+  }
+  return this->readUnlock(generation);
+}
+
+// get the number of samples retained
+uint64_t TimeSeries::getNumSamples() {
+  time_series_block_t *blocks =
+      __atomic_load_n(&this->m_blocks, __ATOMIC_ACQUIRE);
+  if (blocks == NULL) {
+    return 0;
+  }
+  uint64_t ring = __atomic_load_n(&this->m_ring, __ATOMIC_ACQUIRE);
+  uint64_t num_samples = 0;
+  for (uint32_t i = 0; i < (uint32_t)ring; ++i) {
+    num_samples += __atomic_load_n(&blocks[i].num_samples, __ATOMIC_RELAXED);
+  }
+  return num_samples;
+}
+
+// get the number of compressed bytes retained (block summaries included)
+size_t TimeSeries::getNumBytes() {
+  time_series_block_t *blocks =
+      __atomic_load_n(&this->m_blocks, __ATOMIC_ACQUIRE);
+  if (blocks == NULL) {
+    return 0;
+  }
+  uint64_t ring = __atomic_load_n(&this->m_ring, __ATOMIC_ACQUIRE);
+  size_t num_bytes = 0;
+  for (uint32_t i = 0; i < (uint32_t)ring; ++i) {
+    num_bytes += offsetof(time_series_block_t, timestamps) +
+                 (__atomic_load_n(&blocks[i].timestamp_bits, __ATOMIC_RELAXED) +
+                  7) / 8 +
+                 (__atomic_load_n(&blocks[i].value_bits, __ATOMIC_RELAXED) +
+                  7) / 8;
+  }
+  return num_bytes;
+}
+
+// get our (fixed) memory footprint
+size_t TimeSeries::getMemorySize() {
+  return (__atomic_load_n(&this->m_blocks, __ATOMIC_ACQUIRE) != NULL)
+             ? TIME_SERIES_NUM_BLOCKS * sizeof(time_series_block_t)
+             : 0;
+}
+
+// get the number of block copies retried by readers
+uint64_t TimeSeries::getNumReadRetries() {
+  return __atomic_load_n(&this->m_num_read_retries, __ATOMIC_RELAXED);
+}
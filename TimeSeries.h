@@ -0,0 +1,149 @@
+/**
+ * @file    TimeSeries.h
+ * @brief   mbed Edge Orchestrator compressed per-resource time series
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __TIME_SERIES_H__
+#define __TIME_SERIES_H__
+
+// system includes
+#include <stddef.h>
+#include <stdint.h>
+
+// Tunables for the time series
+#define TIME_SERIES_COLUMN_BYTES 240 // compressed bytes per column per block
+#define TIME_SERIES_NUM_BLOCKS 8     // blocks per series (oldest is reused)
+
+// a (timestamp, value) sample
+typedef struct time_series_sample {
+  int64_t timestamp_ms; // CLOCK_REALTIME
+  long value;
+} time_series_sample_t;
+
+// aggregates over a time window
+typedef struct time_series_aggregate {
+  uint64_t count;
+  long min;
+  long max;
+  int64_t sum;
+  double mean;
+} time_series_aggregate_t;
+
+// a block of compressed samples: a timestamp column (delta-of-delta) and a
+// value column (XOR of successive value deltas)... plus a summary of the block
+// so that aggregates over whole blocks need not decode them
+typedef struct time_series_block {
+  uint64_t sequence; // odd while the block is being written
+  uint32_t num_samples;
+  uint32_t timestamp_bits; // bits used in each column
+  uint32_t value_bits;
+  int64_t first_timestamp_ms;
+  int64_t last_timestamp_ms;
+  long first_value;
+  long min;
+  long max;
+  int64_t sum;
+  uint8_t timestamps[TIME_SERIES_COLUMN_BYTES];
+  uint8_t values[TIME_SERIES_COLUMN_BYTES];
+} time_series_block_t;
+
+// A fixed-memory history of one resource's values, compressed Gorilla-style:
+// regular timestamps cost a bit or two and slowly changing values not much
+// more. Samples are appended by a single writer (the owning shard) into a
+// ring of blocks; the oldest block is reused once the ring is full.
+//
+// Readers (any thread) never take a lock: each block is a seqlock, so a
+// reader copies a block and retries if the writer touched it meanwhile. A
+// reset (the resource changed) bumps the series generation... a query that
+// overlaps one gives up. The blocks are only allocated on the first append.
+class TimeSeries {
+public:
+  TimeSeries();
+  virtual ~TimeSeries();
+
+  // (re)start the series for a resource, dropping any samples (writer)
+  void reset(const uint16_t object_id, const uint16_t instance_id,
+             const uint16_t resource_id);
+
+  // drop the samples and stop answering for any resource (writer)
+  void clear();
+
+  // is this the series of a resource?
+  bool isResource(const uint16_t object_id, const uint16_t instance_id,
+                  const uint16_t resource_id);
+
+  // append a sample (writer... timestamps should not go backwards)
+  void append(int64_t timestamp_ms, long value);
+
+  // samples in [from_ms, to_ms], oldest first (any thread). Returns the
+  // number of samples copied, or -1 if this is not the resource's series
+  int query(const uint16_t object_id, const uint16_t instance_id,
+            const uint16_t resource_id, int64_t from_ms, int64_t to_ms,
+            time_series_sample_t *samples, int max_samples);
+
+  // count/min/max/sum/mean over [from_ms, to_ms] (any thread... false if
+  // this is not the resource's series)
+  bool aggregate(const uint16_t object_id, const uint16_t instance_id,
+                 const uint16_t resource_id, int64_t from_ms, int64_t to_ms,
+                 time_series_aggregate_t *aggregate);
+
+  // statistics
+  uint64_t getNumSamples();     // retained
+  size_t getNumBytes();         // compressed bytes retained
+  size_t getMemorySize();       // fixed footprint once allocated
+  uint64_t getNumReadRetries(); // block copies retried by readers
+
+private:
+  TimeSeries(const TimeSeries &series);
+  void initialize();
+  void resetKey(uint64_t key);
+  void startBlock(int64_t timestamp_ms, long value);
+  void readBlock(int index, time_series_block_t *copy, bool header_only);
+  void writeBegin(time_series_block_t *block);
+  void writeEnd(time_series_block_t *block);
+  int decodeBlock(const time_series_block_t *block, int64_t from_ms,
+                  int64_t to_ms, time_series_sample_t *samples,
+                  int max_samples, time_series_aggregate_t *aggregate);
+  bool readLock(uint64_t *generation, uint64_t key);
+  bool readUnlock(uint64_t generation);
+
+private:
+  // the resource (key) and generation (odd while resetting)
+  uint64_t m_key;
+  uint64_t m_generation;
+
+  // ring of blocks: (index of the block being written << 32) | blocks in
+  // use... one word so that readers see both change together
+  time_series_block_t *m_blocks;
+  uint64_t m_ring;
+
+  // encoder state (writer only)
+  int64_t m_last_timestamp_ms;
+  int64_t m_last_delta_ms;
+  long m_last_value;
+  uint64_t m_last_delta; // zigzag
+  int m_last_leading;
+  int m_last_trailing;
+
+  uint64_t m_num_read_retries;
+};
+
+#endif // __TIME_SERIES_H__
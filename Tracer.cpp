@@ -0,0 +1,302 @@
+/**
+ * @file    Tracer.cpp
+ * @brief   mbed Edge Orchestrator Per-Device Span Tracing Implementation
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Tracer.h"
+
+// system includes
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// the calling thread's buffer (and the name it is exported under)
+static __thread trace_buffer_t *thread_buffer = NULL;
+static __thread char thread_name[TRACE_THREAD_NAME_LENGTH] = "";
+
+// span names (as exported)
+static const char *span_names[TRACE_NUM_SPANS] = {
+    "tick", "enqueue", "coalesce", "pt_write_value",
+    "ack",  "write_received", "device_set"};
+
+// constructor
+Tracer::Tracer() { this->initialize(); }
+
+// destructor
+Tracer::~Tracer() {
+  for (size_t i = 0; i < this->m_buffers.size(); ++i) {
+    pthread_mutex_destroy(&this->m_buffers[i]->mutex);
+    free(this->m_buffers[i]->events);
+    free(this->m_buffers[i]);
+  }
+  pthread_mutex_destroy(&this->m_mutex);
+}
+
+// copy constructor
+Tracer::Tracer(const Tracer &tracer) {}
+
+// initialize
+void Tracer::initialize() {
+  pthread_mutex_init(&this->m_mutex, NULL);
+  this->m_threshold = 0;
+}
+
+// STATIC: the tracer shared by all of our threads
+Tracer *Tracer::shared() {
+  static Tracer tracer;
+  return &tracer;
+}
+
+// STATIC: span names
+const char *Tracer::spanName(TRACE_SPAN span) {
+  return (span < TRACE_NUM_SPANS) ? span_names[span] : "unknown";
+}
+
+// trace 1 in every "sample_every" devices (0 stops tracing)
+void Tracer::setSampling(unsigned int sample_every) {
+  uint64_t threshold =
+      (sample_every == 0) ? 0 : ((1ULL << 32) / sample_every);
+  __atomic_store_n(&this->m_threshold, threshold, __ATOMIC_RELAXED);
+
+  // DEBUG
+  if (sample_every == 0) {
+    printf("Tracer: tracing stopped\n");
+  } else {
+    printf("Tracer: tracing 1 in %u device(s)\n", sample_every);
+  }
+}
+
+// STATIC: name the calling thread in exported traces
+void Tracer::setThreadName(const char *name) {
+  snprintf(thread_name, sizeof(thread_name), "%s", name);
+  if (thread_buffer != NULL) {
+    pthread_mutex_lock(&thread_buffer->mutex);
+    snprintf(thread_buffer->name, sizeof(thread_buffer->name), "%s", name);
+    pthread_mutex_unlock(&thread_buffer->mutex);
+  }
+}
+
+// get (allocating on first use) the calling thread's buffer
+trace_buffer_t *Tracer::getThreadBuffer() {
+  if (thread_buffer == NULL) {
+    trace_buffer_t *buffer =
+        (trace_buffer_t *)calloc(1, sizeof(trace_buffer_t));
+    buffer->events =
+        (trace_event_t *)calloc(TRACE_BUFFER_EVENTS, sizeof(trace_event_t));
+    if (buffer->events == NULL) {
+      printf("Tracer: ERROR. Unable to allocate a trace buffer\n");
+      free(buffer);
+      return NULL;
+    }
+    pthread_mutex_init(&buffer->mutex, NULL);
+    buffer->tid = (long)syscall(SYS_gettid);
+    snprintf(buffer->name, sizeof(buffer->name), "%s", thread_name);
+    pthread_mutex_lock(&this->m_mutex);
+    this->m_buffers.push_back(buffer);
+    pthread_mutex_unlock(&this->m_mutex);
+    thread_buffer = buffer;
+  }
+  return thread_buffer;
+}
+
+// record a span into the calling thread's buffer
+void Tracer::record(TRACE_SPAN span, char phase, endpoint_handle_t endpoint,
+                    uint64_t start_ns, uint64_t end_ns) {
+  trace_buffer_t *buffer = this->getThreadBuffer();
+  if (buffer == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&buffer->mutex);
+  size_t index = (buffer->head + buffer->count) % TRACE_BUFFER_EVENTS;
+  if (buffer->count == TRACE_BUFFER_EVENTS) {
+    // full... the oldest span goes
+    buffer->head = (buffer->head + 1) % TRACE_BUFFER_EVENTS;
+    ++buffer->num_dropped;
+  } else {
+    ++buffer->count;
+  }
+  trace_event_t *event = &buffer->events[index];
+  event->start_ns = start_ns;
+  event->end_ns = end_ns;
+  event->endpoint = endpoint;
+  event->span = (uint8_t)span;
+  event->phase = (uint8_t)phase;
+  pthread_mutex_unlock(&buffer->mutex);
+}
+
+// record a span of a traced device
+void Tracer::complete(TRACE_SPAN span, endpoint_handle_t endpoint,
+                      uint64_t start_ns, uint64_t end_ns) {
+  if (this->isSampled(endpoint) == true) {
+    this->record(span, 'X', endpoint, start_ns, end_ns);
+  }
+}
+
+// begin an async span of a traced device
+void Tracer::begin(TRACE_SPAN span, endpoint_handle_t endpoint) {
+  if (this->isSampled(endpoint) == true) {
+    uint64_t now = Tracer::now();
+    this->record(span, 'b', endpoint, now, now);
+  }
+}
+
+// end an async span of a traced device
+void Tracer::end(TRACE_SPAN span, endpoint_handle_t endpoint) {
+  if (this->isSampled(endpoint) == true) {
+    uint64_t now = Tracer::now();
+    this->record(span, 'e', endpoint, now, now);
+  }
+}
+
+// write a JSON string (endpoint IDs come from the fleet configuration)
+static void writeJSONString(FILE *fp, const char *value) {
+  fputc('"', fp);
+  for (const char *p = value; *p != '\0'; ++p) {
+    if (*p == '"' || *p == '\\') {
+      fputc('\\', fp);
+      fputc(*p, fp);
+    } else if ((unsigned char)*p < 0x20) {
+      fprintf(fp, "\\u%04x", (unsigned char)*p);
+    } else {
+      fputc(*p, fp);
+    }
+  }
+  fputc('"', fp);
+}
+
+// write every buffered span to "path" (Chrome trace JSON: complete "X"
+// events and async "b"/"e" pairs keyed by device, timestamps in usec)
+bool Tracer::exportTo(const char *path) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // write to a temporary file and rename it into place, so a reader never
+  // sees a partial trace
+  char tmp_path[512];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+  FILE *fp = fopen(tmp_path, "w");
+  if (fp == NULL) {
+    printf("Tracer: ERROR. Unable to open %s: %s\n", tmp_path,
+           strerror(errno));
+    return false;
+  }
+  int pid = (int)getpid();
+  size_t num_spans = 0;
+  bool first = true;
+  fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+  // copy each buffer out under its lock... its thread keeps recording
+  pthread_mutex_lock(&this->m_mutex);
+  std::vector<trace_buffer_t *> buffers(this->m_buffers);
+  pthread_mutex_unlock(&this->m_mutex);
+  std::vector<trace_event_t> events;
+  for (size_t i = 0; i < buffers.size(); ++i) {
+    trace_buffer_t *buffer = buffers[i];
+    char name[TRACE_THREAD_NAME_LENGTH];
+    pthread_mutex_lock(&buffer->mutex);
+    events.resize(buffer->count);
+    for (size_t j = 0; j < buffer->count; ++j) {
+      events[j] = buffer->events[(buffer->head + j) % TRACE_BUFFER_EVENTS];
+    }
+    memcpy(name, buffer->name, sizeof(name));
+    pthread_mutex_unlock(&buffer->mutex);
+
+    // thread name
+    if (name[0] != '\0') {
+      fprintf(fp,
+              "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+              "\"tid\":%ld,\"args\":{\"name\":",
+              (first == true) ? "" : ",\n", pid, buffer->tid);
+      writeJSONString(fp, name);
+      fprintf(fp, "}}");
+      first = false;
+    }
+
+    // spans
+    for (size_t j = 0; j < events.size(); ++j) {
+      const trace_event_t *event = &events[j];
+      const char *device = EndpointTable::shared()->lookup(event->endpoint);
+      fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"device\",\"ph\":\"%c\","
+                  "\"ts\":%.3f,",
+              (first == true) ? "" : ",\n",
+              Tracer::spanName((TRACE_SPAN)event->span), (char)event->phase,
+              event->start_ns / 1000.0);
+      if (event->phase == 'X') {
+        fprintf(fp, "\"dur\":%.3f,",
+                (event->end_ns - event->start_ns) / 1000.0);
+      } else {
+        fprintf(fp, "\"id\":\"0x%x\",", (unsigned int)event->endpoint);
+      }
+      fprintf(fp, "\"pid\":%d,\"tid\":%ld,\"args\":{\"device\":", pid,
+              buffer->tid);
+      writeJSONString(fp, (device != NULL) ? device : "");
+      fprintf(fp, "}}");
+      first = false;
+    }
+    num_spans += events.size();
+  }
+  fprintf(fp, "\n]}\n");
+  bool written = (ferror(fp) == 0);
+  if (fclose(fp) != 0) {
+    written = false;
+  }
+  if (written == false || rename(tmp_path, path) != 0) {
+    printf("Tracer: ERROR. Unable to write %s: %s\n", path, strerror(errno));
+    unlink(tmp_path);
+    return false;
+  }
+
+  // DEBUG
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  printf("Tracer: exported %zu span(s) from %zu thread(s) to %s in %.1f ms\n",
+         num_spans, buffers.size(), path,
+         (end.tv_sec - start.tv_sec) * 1000.0 +
+             (end.tv_nsec - start.tv_nsec) / 1000000.0);
+  return true;
+}
+
+// get the number of spans currently buffered
+uint64_t Tracer::getNumSpans() {
+  uint64_t num_spans = 0;
+  pthread_mutex_lock(&this->m_mutex);
+  for (size_t i = 0; i < this->m_buffers.size(); ++i) {
+    pthread_mutex_lock(&this->m_buffers[i]->mutex);
+    num_spans += this->m_buffers[i]->count;
+    pthread_mutex_unlock(&this->m_buffers[i]->mutex);
+  }
+  pthread_mutex_unlock(&this->m_mutex);
+  return num_spans;
+}
+
+// get the number of spans overwritten before they were exported
+uint64_t Tracer::getNumDropped() {
+  uint64_t num_dropped = 0;
+  pthread_mutex_lock(&this->m_mutex);
+  for (size_t i = 0; i < this->m_buffers.size(); ++i) {
+    pthread_mutex_lock(&this->m_buffers[i]->mutex);
+    num_dropped += this->m_buffers[i]->num_dropped;
+    pthread_mutex_unlock(&this->m_buffers[i]->mutex);
+  }
+  pthread_mutex_unlock(&this->m_mutex);
+  return num_dropped;
+}
@@ -0,0 +1,175 @@
+/**
+ * @file    Tracer.h
+ * @brief   mbed Edge Orchestrator Per-Device Span Tracing
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __TRACER_H__
+#define __TRACER_H__
+
+// system includes
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// per-thread buffers
+#include <vector>
+
+// spans carry the (interned) endpoint ID of their device
+#include "EndpointTable.h"
+
+// Tunables for tracing
+#define TRACE_BUFFER_EVENTS 16384     // spans kept per thread (oldest dropped)
+#define TRACE_DEFAULT_SAMPLE_EVERY 100 // trace 1 in this many devices
+#define TRACE_THREAD_NAME_LENGTH 32
+
+// the spans we record. A counter change goes tick -> enqueue -> coalesce ->
+// pt_write_value -> ack, a cloud write goes write_received -> enqueue ->
+// device_set -> pt_write_value -> ack
+enum TRACE_SPAN {
+  TRACE_SPAN_TICK = 0,       // device tick handed to its shard (device thread)
+  TRACE_SPAN_ENQUEUE,        // event waiting in a shard lane
+  TRACE_SPAN_COALESCE,       // changed counter waiting to be forwarded (async)
+  TRACE_SPAN_PT_WRITE_VALUE, // the pt_write_value() call
+  TRACE_SPAN_ACK,            // pt_write_value() until acknowledged (async)
+  TRACE_SPAN_WRITE_RECEIVED, // cloud write looked up and queued (PT thread)
+  TRACE_SPAN_DEVICE_SET,     // written value handed to the device
+  TRACE_NUM_SPANS
+};
+
+// a recorded span (or one end of an async span)
+typedef struct trace_event {
+  uint64_t start_ns; // CLOCK_MONOTONIC
+  uint64_t end_ns;   // (async begin/end: same as start_ns)
+  endpoint_handle_t endpoint;
+  uint8_t span;  // TRACE_SPAN
+  uint8_t phase; // 'X' (complete), 'b' or 'e' (async begin/end)
+} trace_event_t;
+
+// a thread's spans (a ring... only its own thread writes to it)
+typedef struct trace_buffer {
+  pthread_mutex_t mutex; // writer vs. export
+  long tid;
+  char name[TRACE_THREAD_NAME_LENGTH];
+  trace_event_t *events;
+  size_t head;
+  size_t count;
+  uint64_t num_dropped; // overwritten before they were exported
+} trace_buffer_t;
+
+// Lightweight per-device spans, exported as Chrome trace (Perfetto) JSON.
+// Tracing is sampled by device: a traced device has every span of its tick
+// and write paths recorded, any other device costs one multiply and compare
+// per span site (nothing at all while tracing is off). Each thread records
+// into a buffer of its own, allocated the first time it records a span, so
+// recording never contends with other threads.
+class Tracer {
+public:
+  Tracer();
+  virtual ~Tracer();
+
+  // the tracer shared by all of our threads
+  static Tracer *shared();
+
+  // trace 1 in every "sample_every" devices (0 stops tracing)
+  void setSampling(unsigned int sample_every);
+  bool isEnabled() {
+    return (__atomic_load_n(&this->m_threshold, __ATOMIC_RELAXED) != 0);
+  }
+
+  // is this device traced? (a fixed hash of its handle, so a device is
+  // either traced on every path or on none)
+  bool isSampled(endpoint_handle_t endpoint) {
+    uint64_t threshold = __atomic_load_n(&this->m_threshold, __ATOMIC_RELAXED);
+    return (threshold != 0 &&
+            (uint64_t)(uint32_t)(endpoint * 2654435761u) < threshold);
+  }
+
+  // CLOCK_MONOTONIC (nsec)
+  static uint64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+
+  // record a span of a traced device (ignored for any other device)
+  void complete(TRACE_SPAN span, endpoint_handle_t endpoint, uint64_t start_ns,
+                uint64_t end_ns);
+
+  // async spans (e.g. a write until it is acknowledged): begin and end may be
+  // recorded on different threads
+  void begin(TRACE_SPAN span, endpoint_handle_t endpoint);
+  void end(TRACE_SPAN span, endpoint_handle_t endpoint);
+
+  // name the calling thread in exported traces
+  static void setThreadName(const char *name);
+
+  // write every buffered span to "path" (Chrome trace JSON)
+  bool exportTo(const char *path);
+
+  // statistics
+  uint64_t getNumSpans();
+  uint64_t getNumDropped();
+
+  // span names
+  static const char *spanName(TRACE_SPAN span);
+
+private:
+  Tracer(const Tracer &tracer);
+  void initialize();
+  void record(TRACE_SPAN span, char phase, endpoint_handle_t endpoint,
+              uint64_t start_ns, uint64_t end_ns);
+  trace_buffer_t *getThreadBuffer();
+
+private:
+  // sampled if the device's hash is below this (0: off, 2^32: every device)
+  uint64_t m_threshold;
+
+  // every thread's buffer (kept until we go away)
+  pthread_mutex_t m_mutex;
+  std::vector<trace_buffer_t *> m_buffers;
+};
+
+// records a span over its scope (for a traced device)
+class TraceScope {
+public:
+  TraceScope(TRACE_SPAN span, endpoint_handle_t endpoint)
+      : m_span(span), m_endpoint(endpoint), m_start_ns(0) {
+    if (Tracer::shared()->isSampled(endpoint) == true) {
+      this->m_start_ns = Tracer::now();
+    }
+  }
+  ~TraceScope() {
+    if (this->m_start_ns != 0) {
+      Tracer::shared()->complete(this->m_span, this->m_endpoint,
+                                 this->m_start_ns, Tracer::now());
+    }
+  }
+
+private:
+  TraceScope(const TraceScope &scope);
+
+private:
+  TRACE_SPAN m_span;
+  endpoint_handle_t m_endpoint;
+  uint64_t m_start_ns;
+};
+
+#endif // __TRACER_H__
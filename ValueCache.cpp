@@ -0,0 +1,205 @@
+/**
+ * @file    ValueCache.cpp
+ * @brief   mbed Edge Versioned (RCU-style) Resource Value Cache Implementation
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ValueCache.h"
+
+// system includes
+#include <stdlib.h>
+#include <string.h>
+
+// constructor
+ValueCache::ValueCache() { this->initialize(); }
+
+// destructor (no readers may be left)
+ValueCache::~ValueCache() {
+  for (size_t i = 0; i < this->m_retired.size(); ++i) {
+    free(this->m_retired[i].snapshot);
+  }
+  for (size_t i = 0; i < this->m_free.size(); ++i) {
+    free(this->m_free[i]);
+  }
+  free(this->m_current);
+  pthread_mutex_destroy(&this->m_write_mutex);
+}
+
+// copy constructor
+ValueCache::ValueCache(const ValueCache &cache) {}
+
+// initialize
+void ValueCache::initialize() {
+  pthread_mutex_init(&this->m_write_mutex, NULL);
+  this->m_current =
+      (value_cache_snapshot_t *)calloc(1, sizeof(value_cache_snapshot_t));
+  this->m_epoch = 0;
+  this->m_readers[0] = 0;
+  this->m_readers[1] = 0;
+  this->m_retired.reserve(VALUE_CACHE_MAX_FREE);
+  this->m_free.reserve(VALUE_CACHE_MAX_FREE);
+}
+
+// get a snapshot to fill in (write lock held)... reuses a reclaimed one if we
+// have one
+value_cache_snapshot_t *ValueCache::allocateSnapshot() {
+  if (this->m_free.empty() == false) {
+    value_cache_snapshot_t *snapshot = this->m_free.back();
+    this->m_free.pop_back();
+    return snapshot;
+  }
+  return (value_cache_snapshot_t *)malloc(sizeof(value_cache_snapshot_t));
+}
+
+// reset the cache to a new set of resources
+void ValueCache::reset(const value_cache_entry_t *entries, int num_entries) {
+  if (num_entries > VALUE_CACHE_MAX_VALUES) {
+    num_entries = VALUE_CACHE_MAX_VALUES;
+  }
+  pthread_mutex_lock(&this->m_write_mutex);
+  value_cache_snapshot_t *snapshot = this->allocateSnapshot();
+  memset(snapshot, 0, sizeof(value_cache_snapshot_t));
+  memcpy(snapshot->values, entries, num_entries * sizeof(value_cache_entry_t));
+  snapshot->num_values = num_entries;
+  snapshot->version = this->m_current->version + 1;
+  this->publishSnapshot(snapshot);
+  pthread_mutex_unlock(&this->m_write_mutex);
+}
+
+// publish a new value: copy, update and swap in the copy
+bool ValueCache::publish(const uint16_t object_id, const uint16_t instance_id,
+                         const uint16_t resource_id, long value) {
+  pthread_mutex_lock(&this->m_write_mutex);
+  const value_cache_snapshot_t *current = this->m_current;
+  int index = -1;
+  for (int i = 0; i < current->num_values && index < 0; ++i) {
+    if (current->values[i].object_id == object_id &&
+        current->values[i].instance_id == instance_id &&
+        current->values[i].resource_id == resource_id) {
+      index = i;
+    }
+  }
+  if (index < 0) {
+    pthread_mutex_unlock(&this->m_write_mutex);
+    return false;
+  }
+  if (current->values[index].value != value) {
+    value_cache_snapshot_t *snapshot = this->allocateSnapshot();
+    memcpy(snapshot, current, sizeof(value_cache_snapshot_t));
+    snapshot->values[index].value = value;
+    ++snapshot->version;
+    this->publishSnapshot(snapshot);
+  }
+  pthread_mutex_unlock(&this->m_write_mutex);
+  return true;
+}
+
+// swap in a new snapshot and retire the old one (write lock held)
+void ValueCache::publishSnapshot(value_cache_snapshot_t *snapshot) {
+  retired_snapshot_t retired;
+  retired.snapshot = this->m_current;
+  retired.drained[0] = false;
+  retired.drained[1] = false;
+  __atomic_store_n(&this->m_current, snapshot, __ATOMIC_SEQ_CST);
+
+  // new readers move to the other counter... so this one can drain
+  __atomic_add_fetch(&this->m_epoch, 1, __ATOMIC_SEQ_CST);
+  this->m_retired.push_back(retired);
+  this->reclaim();
+}
+
+// free the retired snapshots no reader can still see (write lock held). A
+// reader that enters after a counter has been seen at zero loads the current
+// snapshot after it was swapped in... so it cannot hold an older one
+void ValueCache::reclaim() {
+  bool drained[2];
+  drained[0] = (__atomic_load_n(&this->m_readers[0], __ATOMIC_SEQ_CST) == 0);
+  drained[1] = (__atomic_load_n(&this->m_readers[1], __ATOMIC_SEQ_CST) == 0);
+  size_t kept = 0;
+  for (size_t i = 0; i < this->m_retired.size(); ++i) {
+    retired_snapshot_t &retired = this->m_retired[i];
+    retired.drained[0] = retired.drained[0] || drained[0];
+    retired.drained[1] = retired.drained[1] || drained[1];
+    if (retired.drained[0] == true && retired.drained[1] == true) {
+      if (this->m_free.size() < VALUE_CACHE_MAX_FREE) {
+        this->m_free.push_back(retired.snapshot);
+      } else {
+        free(retired.snapshot);
+      }
+    } else {
+      this->m_retired[kept++] = retired;
+    }
+  }
+  this->m_retired.resize(kept);
+}
+
+// enter the read side and pin the current snapshot
+const value_cache_snapshot_t *ValueCache::readLock(int *slot) {
+  *slot = (int)(__atomic_load_n(&this->m_epoch, __ATOMIC_SEQ_CST) & 1);
+  __atomic_add_fetch(&this->m_readers[*slot], 1, __ATOMIC_SEQ_CST);
+  return __atomic_load_n(&this->m_current, __ATOMIC_SEQ_CST);
+}
+
+// leave the read side
+void ValueCache::readUnlock(int slot) {
+  __atomic_sub_fetch(&this->m_readers[slot], 1, __ATOMIC_RELEASE);
+}
+
+// read a single value
+bool ValueCache::read(const uint16_t object_id, const uint16_t instance_id,
+                      const uint16_t resource_id, long *value) {
+  int slot = 0;
+  bool found = false;
+  const value_cache_snapshot_t *snapshot = this->readLock(&slot);
+  for (int i = 0; i < snapshot->num_values && found == false; ++i) {
+    if (snapshot->values[i].object_id == object_id &&
+        snapshot->values[i].instance_id == instance_id &&
+        snapshot->values[i].resource_id == resource_id) {
+      *value = snapshot->values[i].value;
+      found = true;
+    }
+  }
+  this->readUnlock(slot);
+  return found;
+}
+
+// copy out a consistent view of all of the values... returns its version
+uint64_t ValueCache::snapshot(value_cache_snapshot_t *copy) {
+  int slot = 0;
+  const value_cache_snapshot_t *snapshot = this->readLock(&slot);
+  memcpy(copy, snapshot, sizeof(value_cache_snapshot_t));
+  this->readUnlock(slot);
+  return copy->version;
+}
+
+// get the current version
+uint64_t ValueCache::getVersion() {
+  int slot = 0;
+  uint64_t version = this->readLock(&slot)->version;
+  this->readUnlock(slot);
+  return version;
+}
+
+// get the number of snapshots awaiting reclamation
+size_t ValueCache::getNumRetired() {
+  pthread_mutex_lock(&this->m_write_mutex);
+  size_t num_retired = this->m_retired.size();
+  pthread_mutex_unlock(&this->m_write_mutex);
+  return num_retired;
+}
@@ -0,0 +1,110 @@
+/**
+ * @file    ValueCache.h
+ * @brief   mbed Edge Versioned (RCU-style) Resource Value Cache
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __VALUE_CACHE_H__
+#define __VALUE_CACHE_H__
+
+// system includes
+#include <pthread.h>
+#include <stdint.h>
+
+// retired snapshots awaiting reclamation
+#include <vector>
+
+// Tunables for the value cache
+#define VALUE_CACHE_MAX_VALUES 16 // max resources per cache (one per schema entry)
+#define VALUE_CACHE_MAX_FREE 4 // reclaimed snapshots kept for reuse
+
+// a cached resource value
+typedef struct value_cache_entry {
+  uint16_t object_id;
+  uint16_t instance_id;
+  uint16_t resource_id;
+  long value;
+} value_cache_entry_t;
+
+// an immutable, versioned view of all of a shadow's resource values
+typedef struct value_cache_snapshot {
+  uint64_t version;
+  int num_values;
+  value_cache_entry_t values[VALUE_CACHE_MAX_VALUES];
+} value_cache_snapshot_t;
+
+// Readers never block writers (and never block each other): a reader pins the
+// current snapshot for as long as it holds the read side, writers copy the
+// current snapshot, modify the copy and publish it with a single pointer
+// swap. Replaced snapshots are reclaimed by later writers once every reader
+// that could still see them has left (SRCU-style: two reader counters and an
+// epoch that flips on each publish so that the older counter drains).
+class ValueCache {
+public:
+  ValueCache();
+  virtual ~ValueCache();
+
+  // reset the cache to a new set of resources (all values 0)
+  void reset(const value_cache_entry_t *entries, int num_entries);
+
+  // publish a new value (false if the resource is not cached)
+  bool publish(const uint16_t object_id, const uint16_t instance_id,
+               const uint16_t resource_id, long value);
+
+  // read side: the returned snapshot is valid until readUnlock(slot)
+  const value_cache_snapshot_t *readLock(int *slot);
+  void readUnlock(int slot);
+
+  // convenience readers (each is a single consistent view)
+  bool read(const uint16_t object_id, const uint16_t instance_id,
+            const uint16_t resource_id, long *value);
+  uint64_t snapshot(value_cache_snapshot_t *copy);
+
+  // statistics
+  uint64_t getVersion();
+  size_t getNumRetired();
+
+private:
+  ValueCache(const ValueCache &cache);
+  void initialize();
+  value_cache_snapshot_t *allocateSnapshot();
+  void publishSnapshot(value_cache_snapshot_t *snapshot);
+  void reclaim();
+
+private:
+  value_cache_snapshot_t *m_current;
+  unsigned int m_epoch;
+  int m_readers[2];
+
+  // writers are serialized (readers never take this)
+  pthread_mutex_t m_write_mutex;
+
+  // replaced snapshots... freed once each reader slot has been seen empty
+  // since the snapshot was replaced
+  typedef struct retired_snapshot {
+    value_cache_snapshot_t *snapshot;
+    bool drained[2];
+  } retired_snapshot_t;
+  std::vector<retired_snapshot_t> m_retired;
+
+  // reclaimed snapshots reused by publish() (no allocation once warmed up)
+  std::vector<value_cache_snapshot_t *> m_free;
+};
+
+#endif // __VALUE_CACHE_H__
@@ -0,0 +1,237 @@
+/**
+ * @file    bench/AggregationWindowBench.cpp
+ * @brief   Aggregation window benchmarks
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmark harness
+#include "Benchmark.h"
+
+// fixture and PT stub counters
+#include "BenchFixture.h"
+#include "pt_stubs.h"
+
+// aggregation windows
+#include "AggregationWindow.h"
+
+// system includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Tunables for the aggregation benchmarks
+#define BENCH_AGGREGATION_CONFIG_FILE "./aggregation-bench.conf"
+#define BENCH_AGGREGATION_NUM_SAMPLES 1000000 // samples per sliding run
+#define BENCH_AGGREGATION_CHECK_SAMPLES 20000 // samples checked by brute force
+
+// the aggregate of samples [first, last) the hard way
+static long bruteForce(AGGREGATION_FUNCTION function,
+                       const aggregation_sample_t *samples, size_t first,
+                       size_t last) {
+  long count = 0, sum = 0, min = 0, max = 0;
+  for (size_t i = first; i < last; ++i) {
+    if (count == 0 || samples[i].value < min) {
+      min = samples[i].value;
+    }
+    if (count == 0 || samples[i].value > max) {
+      max = samples[i].value;
+    }
+    sum += samples[i].value;
+    ++count;
+  }
+  switch (function) {
+  case AGGREGATE_COUNT:
+    return count;
+  case AGGREGATE_SUM:
+    return sum;
+  case AGGREGATE_MIN:
+    return min;
+  case AGGREGATE_MAX:
+    return max;
+  case AGGREGATE_MEAN:
+    return (count > 0) ? sum / count : 0;
+  }
+  return 0;
+}
+
+// check a window against brute force over jittered samples... false on the
+// first mismatch
+static bool checkWindow(AGGREGATION_FUNCTION function, int window_ms,
+                        int slide_ms) {
+  aggregation_sample_t *samples = (aggregation_sample_t *)malloc(
+      BENCH_AGGREGATION_CHECK_SAMPLES * sizeof(aggregation_sample_t));
+  unsigned int seed = 42;
+  int64_t timestamp_ms = 1000;
+  for (int i = 0; i < BENCH_AGGREGATION_CHECK_SAMPLES; ++i) {
+    timestamp_ms += rand_r(&seed) % 5; // repeats, and the odd empty window
+    if (rand_r(&seed) % 500 == 0) {
+      timestamp_ms += 3 * window_ms;
+    }
+    samples[i].timestamp_ms = timestamp_ms;
+    samples[i].value = (long)(rand_r(&seed) % 2001) - 1000;
+  }
+
+  AggregationWindow window;
+  window.configure(function, window_ms, slide_ms, 0); // ring has to grow
+  int step = (slide_ms > 0) ? slide_ms : window_ms;
+  int64_t window_end_ms = 0;
+  size_t first = 0;
+  bool matched = true;
+  for (int i = 0; i < BENCH_AGGREGATION_CHECK_SAMPLES && matched; ++i) {
+    long result = 0;
+    bool closed = window.add(samples[i].timestamp_ms, samples[i].value, &result);
+
+    // the window that should have closed: [end - window_ms, end)
+    bool expected = false;
+    long expected_result = 0;
+    if (window_end_ms == 0) {
+      window_end_ms = (samples[i].timestamp_ms / step + 1) * step;
+    } else if (samples[i].timestamp_ms >= window_end_ms) {
+      while (samples[first].timestamp_ms < window_end_ms - window_ms) {
+        ++first;
+      }
+      if (first < (size_t)i) {
+        expected = true;
+        expected_result = bruteForce(function, samples, first, i);
+      }
+      window_end_ms = (samples[i].timestamp_ms / step + 1) * step;
+      if (slide_ms == 0) {
+        first = i; // tumbling: nothing carries over
+      }
+    }
+    matched = (closed == expected &&
+               (closed == false || result == expected_result));
+  }
+  free(samples);
+  return matched;
+}
+
+// tumbling windows: running totals, handed out per window
+static void BM_AggregationWindowTumbling(benchmark::State &state) {
+  AGGREGATION_FUNCTION function = (AGGREGATION_FUNCTION)state.range(0);
+  if (checkWindow(function, 100, 0) == false) {
+    state.SkipWithError("tumbling window does not match brute force");
+    return;
+  }
+  AggregationWindow window;
+  window.configure(function, 1000, 0, 10);
+  unsigned int seed = 42;
+  int64_t timestamp_ms = 0;
+  long result = 0;
+  while (state.KeepRunning()) {
+    timestamp_ms += 10;
+    benchmark::DoNotOptimize(
+        window.add(timestamp_ms, (long)rand_r(&seed), &result));
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["windows_closed"] = (double)window.getNumEmitted();
+}
+BENCHMARK(BM_AggregationWindowTumbling)
+    ->Arg(AGGREGATE_COUNT)
+    ->Arg(AGGREGATE_SUM)
+    ->Arg(AGGREGATE_MIN)
+    ->Arg(AGGREGATE_MAX)
+    ->Arg(AGGREGATE_MEAN);
+
+// sliding max over a window of "n" samples (publishing every n/10)... the
+// cost per sample should not grow with the window
+static void BM_AggregationWindowSliding(benchmark::State &state) {
+  if (checkWindow(AGGREGATE_MAX, 100, 20) == false ||
+      checkWindow(AGGREGATE_MIN, 100, 20) == false ||
+      checkWindow(AGGREGATE_MEAN, 100, 20) == false) {
+    state.SkipWithError("sliding window does not match brute force");
+    return;
+  }
+  int window_samples = (int)state.range(0);
+  AggregationWindow window;
+  window.configure(AGGREGATE_MAX, window_samples, window_samples / 10, 1);
+  unsigned int seed = 42;
+  int64_t timestamp_ms = 0;
+  long result = 0;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(
+        window.add(++timestamp_ms, (long)rand_r(&seed), &result));
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["windows_closed"] = (double)window.getNumEmitted();
+  state.counters["dropped"] = (double)window.getNumDropped();
+  state.counters["capacity"] = (double)window.getCapacity();
+}
+BENCHMARK(BM_AggregationWindowSliding)
+    ->Arg(10)
+    ->Arg(100)
+    ->Arg(1000)
+    ->Arg(10000);
+
+// write a one device configuration... raw counter, or the counter with
+// mean/max over 10ms tumbling windows
+static bool writeAggregationConfig(const char *path, bool aggregate) {
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    return false;
+  }
+  fprintf(fp, "# generated benchmark fleet\n");
+  fprintf(fp, "device Sensor-0 poll_interval_ms=0\n");
+  fprintf(fp, "  resource 3303/0/5700 r counter\n");
+  if (aggregate == true) {
+    fprintf(fp, "  resource 3303/0/5601 r mean window_ms=10\n");
+    fprintf(fp, "  resource 3303/0/5602 r max window_ms=10\n");
+  }
+  fclose(fp);
+  return true;
+}
+
+// high-rate sensor samples through the shadow: forwarded raw (0) or as window
+// aggregates (1)... pt_writes_per_iter is per sample
+static void BM_AggregatedForwarding(benchmark::State &state) {
+  bool aggregate = (state.range(0) != 0);
+  if (writeAggregationConfig(BENCH_AGGREGATION_CONFIG_FILE, aggregate) ==
+      false) {
+    state.SkipWithError("unable to write the configuration");
+    return;
+  }
+  BenchFixture fixture(BENCH_AGGREGATION_CONFIG_FILE, 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadow");
+    return;
+  }
+  DeviceShadow *shadow = fixture.getOrchestrator()->getDeviceShadow("Sensor-0");
+  if (shadow == NULL) {
+    state.SkipWithError("unable to find the shadow");
+    return;
+  }
+
+  // the shard is idle (nothing is polled), so we can drive the shadow directly
+  unsigned long writes_before = PT_STUB_COUNT(pt_stub_num_writes);
+  unsigned int seed = 42;
+  long value = 2000;
+  while (state.KeepRunning()) {
+    value += (long)(rand_r(&seed) % 7) - 3;
+    shadow->notifyCounterValueHasChanged((int)value);
+    shadow->processEvents();
+  }
+  state.SetItemsProcessed(state.iterations());
+  if (state.iterations() > 0) {
+    state.counters["pt_writes_per_iter"] =
+        (double)(PT_STUB_COUNT(pt_stub_num_writes) - writes_before) /
+        state.iterations();
+  }
+  unlink(BENCH_AGGREGATION_CONFIG_FILE);
+}
+BENCHMARK(BM_AggregatedForwarding)->Arg(0)->Arg(1);
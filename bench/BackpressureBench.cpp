@@ -0,0 +1,160 @@
+/**
+ * @file    BackpressureBench.cpp
+ * @brief   Backpressure benchmarks (slow edge-core consumer)
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Benchmark harness
+#include "Benchmark.h"
+
+// fixture and PT stub counters
+#include "BenchFixture.h"
+#include "pt_stubs.h"
+
+// system includes
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+// Tunables for the backpressure benchmarks
+#define BENCH_BACKPRESSURE_CONFIG_FILE "./backpressure-bench.conf"
+#define BENCH_BACKPRESSURE_POLL_MS 10       // every device is polled this often
+#define BENCH_BACKPRESSURE_WRITE_DELAY_US 100 // edge-core acknowledges 10k/sec
+#define BENCH_BACKPRESSURE_RUN_MS 3000        // run length
+#define BENCH_BACKPRESSURE_DRAIN_MS 5000      // max wait for the writes to drain
+#define BENCH_OVERFLOW_NUM_SHADOWS 1000       // shadows the overflow flood hits
+
+// write a fleet of "n" fast polled devices
+static bool writeBackpressureConfig(const char *path, long num_devices) {
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    return false;
+  }
+  fprintf(fp, "# generated benchmark fleet\n");
+  fprintf(fp, "defaults poll_interval_ms=%d\n", BENCH_BACKPRESSURE_POLL_MS);
+  for (long i = 0; i < num_devices; ++i) {
+    fprintf(fp, "device NonMbedDevice-%ld\n", i);
+  }
+  fclose(fp);
+  return true;
+}
+
+// "n" devices producing far more updates than a slow edge-core acknowledges:
+// without backpressure the writes in flight (and the outbound buffer behind
+// them) grow for as long as the run lasts... with it they stay bounded by
+// the critical threshold while edge-core is kept busy
+static void BM_SlowConsumer(benchmark::State &state) {
+  long num_devices = state.range(0);
+  if (writeBackpressureConfig(BENCH_BACKPRESSURE_CONFIG_FILE, num_devices) ==
+      false) {
+    state.SkipWithError("unable to write the configuration");
+    return;
+  }
+  BenchFixture fixture(BENCH_BACKPRESSURE_CONFIG_FILE, 2);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadows");
+    return;
+  }
+  Orchestrator *orchestrator = fixture.getOrchestrator();
+  unsigned long num_writes = 0;
+  while (state.KeepRunning()) {
+    pt_stub_set_write_delay(BENCH_BACKPRESSURE_WRITE_DELAY_US);
+    unsigned long start = PT_STUB_COUNT(pt_stub_num_writes);
+    usleep(BENCH_BACKPRESSURE_RUN_MS * 1000);
+    num_writes = PT_STUB_COUNT(pt_stub_num_writes) - start;
+    state.counters["peak_pending"] = (double)pt_stub_max_pending_writes;
+    state.counters["peak_in_flight"] =
+        (double)orchestrator->getMaxWritesInFlight();
+
+    // let edge-core catch up
+    pt_stub_set_write_delay(0);
+  }
+  for (int waited = 0; orchestrator->getNumWritesInFlight() > 0 &&
+                       waited < BENCH_BACKPRESSURE_DRAIN_MS;
+       ++waited) {
+    usleep(1000);
+  }
+  if (orchestrator->getNumWritesInFlight() > 0) {
+    state.SkipWithError("writes still in flight after the run");
+  }
+  state.SetItemsProcessed(num_writes);
+  state.counters["offered_per_sec"] =
+      (double)num_devices * 1000 / BENCH_BACKPRESSURE_POLL_MS;
+  state.counters["writes_per_sec"] =
+      num_writes * 1000.0 / BENCH_BACKPRESSURE_RUN_MS;
+  state.counters["coalesced"] = (double)orchestrator->getNumCoalesced();
+  state.counters["dropped"] = (double)orchestrator->getNumDropped();
+  unlink(BENCH_BACKPRESSURE_CONFIG_FILE);
+}
+BENCHMARK(BM_SlowConsumer)
+    ->Arg(1000)
+    ->Arg(10000)
+    ->Iterations(1)
+    ->Unit(benchmark::kMillisecond);
+
+// a PT thread (which never waits on a full lane) flooding a shard with
+// replayed values: its lane overflow stays bounded and the excess is shed
+typedef struct bench_overflow {
+  OrchestratorShard *shard;
+  std::vector<DeviceShadow *> shadows;
+  long num_offered;
+} bench_overflow_t;
+
+// overflow flood thread
+static void *overflowThread(void *ctx) {
+  bench_overflow_t *overflow = (bench_overflow_t *)ctx;
+  OrchestratorShard::setNonBlockingThread();
+  for (long i = 0; i < overflow->num_offered; ++i) {
+    overflow->shard->enqueueReplay(
+        overflow->shadows[i % overflow->shadows.size()], (int)i, 1);
+  }
+  return NULL;
+}
+
+// "n" replayed values offered at once to a single shard
+static void BM_OverflowShedding(benchmark::State &state) {
+  BenchFixture fixture(BENCH_OVERFLOW_NUM_SHADOWS, 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadows");
+    return;
+  }
+  Orchestrator *orchestrator = fixture.getOrchestrator();
+  bench_overflow_t overflow;
+  overflow.shard = orchestrator->getShardAt(0);
+  overflow.num_offered = state.range(0);
+  for (int i = 0; i < fixture.getNumDeviceShadows(); ++i) {
+    overflow.shadows.push_back(fixture.getDeviceShadow(i));
+  }
+  uint64_t shed_before = orchestrator->getNumShed();
+  while (state.KeepRunning()) {
+    pthread_t thread;
+    pthread_create(&thread, NULL, &overflowThread, &overflow);
+    pthread_join(thread, NULL);
+  }
+  uint64_t num_shed = orchestrator->getNumShed() - shed_before;
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.counters["shed"] = (double)num_shed;
+  state.counters["shed_pct"] =
+      100.0 * num_shed / (state.iterations() * state.range(0));
+}
+BENCHMARK(BM_OverflowShedding)
+    ->Arg(100000)
+    ->Iterations(3)
+    ->Unit(benchmark::kMillisecond);
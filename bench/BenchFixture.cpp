@@ -0,0 +1,118 @@
+/**
+ * @file    BenchFixture.cpp
+ * @brief   mbed Edge Orchestrator benchmark fixture implementation
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "BenchFixture.h"
+
+// system includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// constructor
+BenchFixture::BenchFixture(int num_shadows, int num_shards) {
+  this->m_num_shards = num_shards;
+  this->m_num_pt_connections = 1;
+  this->m_config_path = NULL;
+  this->m_device = new NonMbedDevice();
+  this->m_orchestrator = new Orchestrator((void *)this->m_device);
+
+  // shadows of the built-in device schema (not polled: no devices of their
+  // own)
+  fleet_device_config_t config;
+  FleetConfig::initializeDefaultDevice(&config, SAMPLE_DEVICE_PREFIX);
+  for (int i = 0; i < num_shadows; ++i) {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "-%d", i);
+    DeviceShadow *shadow =
+        new DeviceShadow((void *)this->m_orchestrator, NULL, &config, suffix);
+    this->m_orchestrator->addDeviceShadow(shadow);
+    this->m_device_shadows.push_back(shadow);
+  }
+}
+
+// constructor (shadows from a fleet configuration)
+BenchFixture::BenchFixture(const char *config_path, int num_shards) {
+  this->m_num_shards = num_shards;
+  this->m_num_pt_connections = 1;
+  this->m_config_path = config_path;
+  this->m_device = new NonMbedDevice();
+  this->m_orchestrator = new Orchestrator((void *)this->m_device);
+}
+
+// destructor
+BenchFixture::~BenchFixture() {
+  this->m_orchestrator->shutdown();
+  delete this->m_orchestrator;
+  delete this->m_device;
+}
+
+// copy constructor
+BenchFixture::BenchFixture(const BenchFixture &fixture) {}
+
+// set the number of PT connections
+void BenchFixture::setNumPTConnections(int num_connections) {
+  this->m_num_pt_connections = num_connections;
+}
+
+// connect to the (stubbed) PT and wait for registration
+bool BenchFixture::connect() {
+  char shards[16];
+  char connections[16];
+  snprintf(shards, sizeof(shards), "%d", this->m_num_shards);
+  snprintf(connections, sizeof(connections), "%d",
+           this->m_num_pt_connections);
+  char *argv[] = {(char *)"bench", (char *)"-n", (char *)"bench",
+                  (char *)"-s", shards, (char *)"--pt-connections",
+                  connections, (char *)"-c",
+                  (char *)this->m_config_path, NULL};
+  int argc = (this->m_config_path != NULL) ? 9 : 7;
+  if (this->m_orchestrator->connectToMbedEdgePT(argc, argv) == false) {
+    return false;
+  }
+  return this->waitForRegistration(BENCH_REGISTRATION_TIMEOUT_MS);
+}
+
+// wait (bounded) for all of our shadows to register
+bool BenchFixture::waitForRegistration(int timeout_ms) {
+  struct timespec pause = {0, 1000000L}; // 1ms
+  for (int waited = 0; waited < timeout_ms; ++waited) {
+    if (this->m_orchestrator->getNumRegisteredDeviceShadows() ==
+        this->m_orchestrator->getNumDeviceShadows()) {
+      return true;
+    }
+    nanosleep(&pause, NULL);
+  }
+  return false;
+}
+
+// get the orchestrator
+Orchestrator *BenchFixture::getOrchestrator() { return this->m_orchestrator; }
+
+// get a shadow
+DeviceShadow *BenchFixture::getDeviceShadow(int index) {
+  return this->m_device_shadows[index];
+}
+
+// get the number of shadows
+int BenchFixture::getNumDeviceShadows() {
+  return (int)this->m_device_shadows.size();
+}
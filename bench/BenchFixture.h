@@ -0,0 +1,68 @@
+/**
+ * @file    BenchFixture.h
+ * @brief   mbed Edge Orchestrator benchmark fixture (orchestrator over stubbed PT)
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BENCH_FIXTURE_H__
+#define __BENCH_FIXTURE_H__
+
+// Orchestrator
+#include "Orchestrator.h"
+
+// simulated device
+#include "NonMbedDevice.h"
+
+// Tunables for the fixture
+#define BENCH_REGISTRATION_TIMEOUT_MS 5000 // max wait for shadows to register
+
+// An Orchestrator with "n" registered shadows, connected to the stubbed PT
+// (see pt_stubs.c)... the simulated device is never started, so nothing
+// ticks unless a benchmark drives it
+class BenchFixture {
+public:
+  BenchFixture(int num_shadows, int num_shards);
+  BenchFixture(const char *config_path, int num_shards);
+  virtual ~BenchFixture();
+
+  // number of PT connections opened by connect() (default: 1)
+  void setNumPTConnections(int num_connections);
+
+  // connect and wait for every shadow to register
+  bool connect();
+
+  // accessors (shadows by index are only available without a configuration)
+  Orchestrator *getOrchestrator();
+  DeviceShadow *getDeviceShadow(int index);
+  int getNumDeviceShadows();
+
+private:
+  BenchFixture(const BenchFixture &fixture);
+  bool waitForRegistration(int timeout_ms);
+
+private:
+  NonMbedDevice *m_device;
+  Orchestrator *m_orchestrator;
+  int m_num_shards;
+  int m_num_pt_connections;
+  const char *m_config_path;
+  std::vector<DeviceShadow *> m_device_shadows; // owned by the orchestrator
+};
+
+#endif // __BENCH_FIXTURE_H__
@@ -0,0 +1,410 @@
+/**
+ * @file    Benchmark.cpp
+ * @brief   Minimal Google-Benchmark-style microbenchmark harness
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Benchmark.h"
+
+// system includes
+#include <fcntl.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace benchmark {
+
+// Tunables for the runner
+#define BENCHMARK_DEFAULT_MIN_TIME_SEC 0.5 // grow iterations until this long
+#define BENCHMARK_MAX_ITERATIONS 1000000000ULL
+
+// nanoseconds between two timestamps
+static double elapsedNs(const struct timespec *from,
+                        const struct timespec *to) {
+  return (to->tv_sec - from->tv_sec) * 1000000000.0 +
+         (to->tv_nsec - from->tv_nsec);
+}
+
+// registered benchmarks (deleted at exit... keeps leak checkers quiet)
+class BenchmarkRegistry {
+public:
+  ~BenchmarkRegistry() {
+    for (size_t i = 0; i < this->m_benchmarks.size(); ++i) {
+      delete this->m_benchmarks[i];
+    }
+  }
+  std::vector<Benchmark *> m_benchmarks;
+};
+static std::vector<Benchmark *> &registry() {
+  static BenchmarkRegistry benchmarks;
+  return benchmarks.m_benchmarks;
+}
+
+// State
+State::State(uint64_t max_iterations, const std::vector<long> &args)
+    : m_max_iterations(max_iterations), m_iterations(0), m_args(args),
+      m_started(false), m_running(false), m_real_ns(0), m_cpu_ns(0),
+      m_items_processed(0), m_bytes_processed(0) {}
+
+void State::startTimer() {
+  clock_gettime(CLOCK_MONOTONIC, &this->m_real_start);
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &this->m_cpu_start);
+  this->m_running = true;
+}
+
+void State::stopTimer() {
+  struct timespec real_end, cpu_end;
+  clock_gettime(CLOCK_MONOTONIC, &real_end);
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_end);
+  this->m_real_ns += elapsedNs(&this->m_real_start, &real_end);
+  this->m_cpu_ns += elapsedNs(&this->m_cpu_start, &cpu_end);
+  this->m_running = false;
+}
+
+bool State::KeepRunning() {
+  if (this->m_started == false) {
+    this->m_started = true;
+    this->startTimer();
+  }
+  if (this->m_iterations < this->m_max_iterations &&
+      this->m_error_message.empty()) {
+    ++this->m_iterations;
+    return true;
+  }
+  if (this->m_running == true) {
+    this->stopTimer();
+  }
+  return false;
+}
+
+void State::PauseTiming() {
+  if (this->m_running == true) {
+    this->stopTimer();
+  }
+}
+
+void State::ResumeTiming() {
+  if (this->m_running == false) {
+    this->startTimer();
+  }
+}
+
+long State::range(size_t index) const {
+  return (index < this->m_args.size()) ? this->m_args[index] : 0;
+}
+
+void State::SetItemsProcessed(uint64_t items) {
+  this->m_items_processed = items;
+}
+
+void State::SetBytesProcessed(uint64_t bytes) {
+  this->m_bytes_processed = bytes;
+}
+
+uint64_t State::iterations() const { return this->m_iterations; }
+
+void State::SkipWithError(const char *message) {
+  this->m_error_message = message;
+}
+
+double State::realTimeNs() const { return this->m_real_ns; }
+double State::cpuTimeNs() const { return this->m_cpu_ns; }
+uint64_t State::itemsProcessed() const { return this->m_items_processed; }
+uint64_t State::bytesProcessed() const { return this->m_bytes_processed; }
+const std::string &State::errorMessage() const {
+  return this->m_error_message;
+}
+
+// Benchmark
+Benchmark::Benchmark(const char *name, benchmark_fn *fn)
+    : m_name(name), m_fn(fn), m_iterations(0), m_unit(kNanosecond) {}
+
+Benchmark *Benchmark::Arg(long arg) {
+  this->m_args.push_back(std::vector<long>(1, arg));
+  return this;
+}
+
+Benchmark *Benchmark::Iterations(uint64_t iterations) {
+  this->m_iterations = iterations;
+  return this;
+}
+
+Benchmark *Benchmark::Unit(TimeUnit unit) {
+  this->m_unit = unit;
+  return this;
+}
+
+Benchmark *RegisterBenchmark(const char *name, benchmark_fn *fn) {
+  Benchmark *benchmark = new Benchmark(name, fn);
+  registry().push_back(benchmark);
+  return benchmark;
+}
+
+// a completed run
+typedef struct run_result {
+  std::string name;
+  uint64_t iterations;
+  double real_time;
+  double cpu_time;
+  TimeUnit unit;
+  double items_per_second;
+  double bytes_per_second;
+  std::map<std::string, double> counters;
+  std::string error_message;
+} run_result_t;
+
+static double unitDivisor(TimeUnit unit) {
+  return (unit == kMillisecond) ? 1000000.0
+                                : ((unit == kMicrosecond) ? 1000.0 : 1.0);
+}
+
+static const char *unitName(TimeUnit unit) {
+  return (unit == kMillisecond) ? "ms" : ((unit == kMicrosecond) ? "us" : "ns");
+}
+
+// run a single benchmark/argument combination
+static run_result_t runBenchmark(Benchmark *benchmark,
+                                 const std::vector<long> &args,
+                                 double min_time_sec) {
+  run_result_t result;
+  result.name = benchmark->m_name;
+  for (size_t i = 0; i < args.size(); ++i) {
+    char arg[32];
+    snprintf(arg, sizeof(arg), "/%ld", args[i]);
+    result.name += arg;
+  }
+  result.unit = benchmark->m_unit;
+
+  // grow the iteration count until the run takes long enough
+  uint64_t iterations =
+      (benchmark->m_iterations > 0) ? benchmark->m_iterations : 1;
+  while (true) {
+    State state(iterations, args);
+    benchmark->m_fn(state);
+
+    bool done = (benchmark->m_iterations > 0) ||
+                !state.errorMessage().empty() ||
+                state.realTimeNs() >= min_time_sec * 1000000000.0 ||
+                iterations >= BENCHMARK_MAX_ITERATIONS;
+    if (done == true) {
+      double seconds = state.realTimeNs() / 1000000000.0;
+      result.iterations = state.iterations();
+      result.real_time = state.realTimeNs() / result.iterations /
+                         unitDivisor(result.unit);
+      result.cpu_time =
+          state.cpuTimeNs() / result.iterations / unitDivisor(result.unit);
+      result.items_per_second =
+          (seconds > 0) ? state.itemsProcessed() / seconds : 0;
+      result.bytes_per_second =
+          (seconds > 0) ? state.bytesProcessed() / seconds : 0;
+      result.counters = state.counters;
+      result.error_message = state.errorMessage();
+      return result;
+    }
+
+    // predict how many iterations we need (grow by at most 10x per round)
+    double multiplier = 10.0;
+    if (state.realTimeNs() > 0) {
+      multiplier = (min_time_sec * 1000000000.0 * 1.4) / state.realTimeNs();
+      if (multiplier > 10.0) {
+        multiplier = 10.0;
+      }
+      if (multiplier < 2.0) {
+        multiplier = 2.0;
+      }
+    }
+    iterations = (uint64_t)(iterations * multiplier);
+    if (iterations > BENCHMARK_MAX_ITERATIONS) {
+      iterations = BENCHMARK_MAX_ITERATIONS;
+    }
+  }
+}
+
+// emit the results as Google Benchmark compatible JSON
+static void writeJSON(FILE *fp, const std::vector<run_result_t> &results) {
+  char hostname[256] = "unknown";
+  gethostname(hostname, sizeof(hostname));
+  char date[64] = "";
+  time_t now = time(NULL);
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+
+  fprintf(fp, "{\n  \"context\": {\n");
+  fprintf(fp, "    \"date\": \"%s\",\n", date);
+  fprintf(fp, "    \"host_name\": \"%s\",\n", hostname);
+  fprintf(fp, "    \"num_cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+#ifdef NDEBUG
+  fprintf(fp, "    \"library_build_type\": \"release\"\n");
+#else
+  fprintf(fp, "    \"library_build_type\": \"debug\"\n");
+#endif
+  fprintf(fp, "  },\n  \"benchmarks\": [\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const run_result_t &result = results[i];
+    fprintf(fp, "    {\n");
+    fprintf(fp, "      \"name\": \"%s\",\n", result.name.c_str());
+    fprintf(fp, "      \"run_name\": \"%s\",\n", result.name.c_str());
+    fprintf(fp, "      \"run_type\": \"iteration\",\n");
+    if (!result.error_message.empty()) {
+      fprintf(fp, "      \"error_occurred\": true,\n");
+      fprintf(fp, "      \"error_message\": \"%s\",\n",
+              result.error_message.c_str());
+    }
+    fprintf(fp, "      \"iterations\": %llu,\n",
+            (unsigned long long)result.iterations);
+    fprintf(fp, "      \"real_time\": %.6e,\n", result.real_time);
+    fprintf(fp, "      \"cpu_time\": %.6e,\n", result.cpu_time);
+    fprintf(fp, "      \"time_unit\": \"%s\"", unitName(result.unit));
+    if (result.items_per_second > 0) {
+      fprintf(fp, ",\n      \"items_per_second\": %.6e",
+              result.items_per_second);
+    }
+    if (result.bytes_per_second > 0) {
+      fprintf(fp, ",\n      \"bytes_per_second\": %.6e",
+              result.bytes_per_second);
+    }
+    for (std::map<std::string, double>::const_iterator it =
+             result.counters.begin();
+         it != result.counters.end(); ++it) {
+      fprintf(fp, ",\n      \"%s\": %.6e", it->first.c_str(), it->second);
+    }
+    fprintf(fp, "\n    }%s\n", (i + 1 < results.size()) ? "," : "");
+  }
+  fprintf(fp, "  ]\n}\n");
+}
+
+// human readable table
+static void writeConsole(FILE *fp, const run_result_t &result) {
+  fprintf(fp, "%-48s %12.1f %-2s %12.1f %-2s %12llu", result.name.c_str(),
+          result.real_time, unitName(result.unit), result.cpu_time,
+          unitName(result.unit), (unsigned long long)result.iterations);
+  if (result.items_per_second > 0) {
+    fprintf(fp, " items/s=%.4g", result.items_per_second);
+  }
+  for (std::map<std::string, double>::const_iterator it =
+           result.counters.begin();
+       it != result.counters.end(); ++it) {
+    fprintf(fp, " %s=%.4g", it->first.c_str(), it->second);
+  }
+  if (!result.error_message.empty()) {
+    fprintf(fp, " ERROR: %s", result.error_message.c_str());
+  }
+  fprintf(fp, "\n");
+  fflush(fp);
+}
+
+// run everything
+int RunSpecifiedBenchmarks(int argc, char **argv) {
+  const char *filter = NULL;
+  const char *out_file = NULL;
+  bool json = false;
+  bool verbose = false;
+  double min_time_sec = BENCHMARK_DEFAULT_MIN_TIME_SEC;
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--benchmark_filter=", 19) == 0) {
+      filter = argv[i] + 19;
+    } else if (strncmp(argv[i], "--benchmark_out=", 16) == 0) {
+      out_file = argv[i] + 16;
+    } else if (strcmp(argv[i], "--benchmark_format=json") == 0) {
+      json = true;
+    } else if (strncmp(argv[i], "--benchmark_min_time=", 21) == 0) {
+      min_time_sec = atof(argv[i] + 21);
+    } else if (strcmp(argv[i], "--benchmark_verbose") == 0) {
+      verbose = true;
+    } else {
+      fprintf(stderr,
+              "usage: %s [--benchmark_filter=<regex>] "
+              "[--benchmark_out=<file>] [--benchmark_format=json] "
+              "[--benchmark_min_time=<sec>] [--benchmark_verbose]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  regex_t regex;
+  if (filter != NULL && regcomp(&regex, filter, REG_EXTENDED | REG_NOSUB)) {
+    fprintf(stderr, "invalid --benchmark_filter: %s\n", filter);
+    return 1;
+  }
+
+  // the code under test is chatty on stdout... keep the report on the
+  // original stdout and send everything else to /dev/null
+  FILE *report = stdout;
+  if (verbose == false) {
+    fflush(stdout);
+    int report_fd = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (report_fd >= 0 && null_fd >= 0) {
+      dup2(null_fd, STDOUT_FILENO);
+      close(null_fd);
+      report = fdopen(report_fd, "w");
+    }
+  }
+
+  if (json == false) {
+    fprintf(report, "%-48s %15s %15s %12s\n", "Benchmark", "Time", "CPU",
+            "Iterations");
+  }
+
+  std::vector<run_result_t> results;
+  std::vector<Benchmark *> &benchmarks = registry();
+  for (size_t i = 0; i < benchmarks.size(); ++i) {
+    std::vector<std::vector<long> > arg_sets = benchmarks[i]->m_args;
+    if (arg_sets.empty()) {
+      arg_sets.push_back(std::vector<long>());
+    }
+    for (size_t j = 0; j < arg_sets.size(); ++j) {
+      std::string name = benchmarks[i]->m_name;
+      for (size_t k = 0; k < arg_sets[j].size(); ++k) {
+        char arg[32];
+        snprintf(arg, sizeof(arg), "/%ld", arg_sets[j][k]);
+        name += arg;
+      }
+      if (filter != NULL && regexec(&regex, name.c_str(), 0, NULL, 0) != 0) {
+        continue;
+      }
+      results.push_back(
+          runBenchmark(benchmarks[i], arg_sets[j], min_time_sec));
+      if (json == false) {
+        writeConsole(report, results.back());
+      }
+    }
+  }
+  if (filter != NULL) {
+    regfree(&regex);
+  }
+
+  if (json == true) {
+    writeJSON(report, results);
+  }
+  fflush(report);
+  if (out_file != NULL) {
+    FILE *fp = fopen(out_file, "w");
+    if (fp == NULL) {
+      fprintf(stderr, "unable to write %s\n", out_file);
+      return 1;
+    }
+    writeJSON(fp, results);
+    fclose(fp);
+  }
+  return 0;
+}
+
+} // namespace benchmark
@@ -0,0 +1,145 @@
+/**
+ * @file    Benchmark.h
+ * @brief   Minimal Google-Benchmark-style microbenchmark harness
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __BENCHMARK_H__
+#define __BENCHMARK_H__
+
+// system includes
+#include <stdint.h>
+#include <time.h>
+
+// registry/counters
+#include <map>
+#include <string>
+#include <vector>
+
+// The API mirrors the subset of Google Benchmark that we use so that the
+// benchmarks can move over to the real library unchanged if we ever vendor it:
+//
+//   static void BM_Something(benchmark::State &state) {
+//     while (state.KeepRunning()) { ... }
+//     state.SetItemsProcessed(state.iterations());
+//   }
+//   BENCHMARK(BM_Something)->Arg(10)->Arg(100);
+//
+// Results are printed as a table and, with --benchmark_out=<file> (or
+// --benchmark_format=json), emitted as Google Benchmark compatible JSON so
+// runs can be diffed between builds.
+namespace benchmark {
+
+enum TimeUnit { kNanosecond, kMicrosecond, kMillisecond };
+
+// per-run state handed to a benchmark function
+class State {
+public:
+  State(uint64_t max_iterations, const std::vector<long> &args);
+
+  // returns true while the benchmark should keep iterating
+  bool KeepRunning();
+
+  // exclude setup/teardown work from the measurement
+  void PauseTiming();
+  void ResumeTiming();
+
+  // benchmark arguments
+  long range(size_t index) const;
+
+  // throughput reporting
+  void SetItemsProcessed(uint64_t items);
+  void SetBytesProcessed(uint64_t bytes);
+  uint64_t iterations() const;
+
+  // abort the run with an error
+  void SkipWithError(const char *message);
+
+  // user counters (reported as-is)
+  std::map<std::string, double> counters;
+
+  // results (read by the runner)
+  double realTimeNs() const;
+  double cpuTimeNs() const;
+  uint64_t itemsProcessed() const;
+  uint64_t bytesProcessed() const;
+  const std::string &errorMessage() const;
+
+private:
+  void startTimer();
+  void stopTimer();
+
+private:
+  uint64_t m_max_iterations;
+  uint64_t m_iterations;
+  std::vector<long> m_args;
+  bool m_started;
+  bool m_running;
+  struct timespec m_real_start;
+  struct timespec m_cpu_start;
+  double m_real_ns;
+  double m_cpu_ns;
+  uint64_t m_items_processed;
+  uint64_t m_bytes_processed;
+  std::string m_error_message;
+};
+
+typedef void(benchmark_fn)(State &state);
+
+// a registered benchmark (and its argument sets)
+class Benchmark {
+public:
+  Benchmark(const char *name, benchmark_fn *fn);
+
+  // add an argument set
+  Benchmark *Arg(long arg);
+
+  // run a fixed number of iterations (for expensive benchmarks)
+  Benchmark *Iterations(uint64_t iterations);
+
+  // time unit used for reporting
+  Benchmark *Unit(TimeUnit unit);
+
+  std::string m_name;
+  benchmark_fn *m_fn;
+  std::vector<std::vector<long> > m_args;
+  uint64_t m_iterations;
+  TimeUnit m_unit;
+};
+
+// registration
+Benchmark *RegisterBenchmark(const char *name, benchmark_fn *fn);
+
+// run all (filtered) benchmarks... returns a process exit code
+int RunSpecifiedBenchmarks(int argc, char **argv);
+
+// prevent the compiler from optimizing away a result
+template <class T> inline void DoNotOptimize(T const &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+} // namespace benchmark
+
+#define BENCHMARK_CONCAT2(a, b) a##b
+#define BENCHMARK_CONCAT(a, b) BENCHMARK_CONCAT2(a, b)
+#define BENCHMARK(fn)                                                          \
+  static benchmark::Benchmark *BENCHMARK_CONCAT(_benchmark_, __LINE__) =     \
+      benchmark::RegisterBenchmark(#fn, &fn)
+
+#endif // __BENCHMARK_H__
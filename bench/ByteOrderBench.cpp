@@ -0,0 +1,52 @@
+/**
+ * @file    ByteOrderBench.cpp
+ * @brief   mbed Edge Orchestrator benchmarks - byte order conversions
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmark harness
+#include "Benchmark.h"
+
+// byte order utils
+#include "byte_order.h"
+
+// host -> network order (every counter/switch update does this)
+static void BM_ConvertToNetworkByteOrder(benchmark::State &state) {
+  uint8_t buffer[sizeof(long)];
+  long value = 0;
+  while (state.KeepRunning()) {
+    convert_long_value_to_network_byte_order(++value, buffer);
+    benchmark::DoNotOptimize(buffer);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ConvertToNetworkByteOrder);
+
+// network -> host order (every write request and counter compare does this)
+static void BM_ConvertToHostOrder(benchmark::State &state) {
+  uint8_t buffer[sizeof(long)];
+  convert_long_value_to_network_byte_order(123456789L, buffer);
+  long value = 0;
+  while (state.KeepRunning()) {
+    convert_value_to_host_order_long(buffer, &value);
+    benchmark::DoNotOptimize(value);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ConvertToHostOrder);
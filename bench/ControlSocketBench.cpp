@@ -0,0 +1,204 @@
+/**
+ * @file    ControlSocketBench.cpp
+ * @brief   Control socket benchmarks (command cost, data path impact)
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmark harness
+#include "Benchmark.h"
+
+// fixture
+#include "BenchFixture.h"
+
+// ControlSocket
+#include "ControlSocket.h"
+
+// system includes
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Tunables for the control socket benchmarks
+#define BENCH_CONTROL_NUM_SHADOWS 4096     // shadows in the registry
+#define BENCH_CONTROL_TICKS_PER_ITER 1024 // ticks enqueued per iteration
+#define BENCH_CONTROL_PATH "./control-bench.sock"
+
+// the commands we time (BM_ControlCommand argument)
+static const char *bench_commands[] = {"loglevel", "stats", "shadows 100",
+                                       "shadows"};
+
+// a client hammering the control socket
+typedef struct bench_control_client {
+  const char *command;
+  bool is_running;
+  uint64_t num_replies;
+} bench_control_client_t;
+
+// send a command and read its reply (up to the final "OK"/"ERROR" line)
+static bool roundTrip(int fd, const char *command, std::string *reply) {
+  std::string line = std::string(command) + "\n";
+  if (send(fd, line.data(), line.size(), MSG_NOSIGNAL) !=
+      (ssize_t)line.size()) {
+    return false;
+  }
+  reply->clear();
+  char buffer[16384];
+  for (;;) {
+    ssize_t length = recv(fd, buffer, sizeof(buffer), 0);
+    if (length <= 0) {
+      return false;
+    }
+    reply->append(buffer, length);
+
+    // done once the last line is "OK" or "ERROR ..."
+    if (reply->size() < 2 || (*reply)[reply->size() - 1] != '\n') {
+      continue;
+    }
+    size_t last = reply->rfind('\n', reply->size() - 2);
+    last = (last == std::string::npos) ? 0 : last + 1;
+    if (reply->compare(last, 3, "OK\n") == 0) {
+      return true;
+    }
+    if (reply->compare(last, 5, "ERROR") == 0) {
+      return false;
+    }
+  }
+}
+
+// connect to the control socket
+static int connectControl(const char *path) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+  if (fd >= 0 &&
+      connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+// client thread: one command after the other until told to stop (niced like
+// an admin tool would be, so it is the socket we measure)
+static void *controlClient(void *ctx) {
+  bench_control_client_t *client = (bench_control_client_t *)ctx;
+  setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), CONTROL_SOCKET_NICE);
+  int fd = connectControl(BENCH_CONTROL_PATH);
+  std::string reply;
+  while (fd >= 0 &&
+         __atomic_load_n(&client->is_running, __ATOMIC_RELAXED) == true &&
+         roundTrip(fd, client->command, &reply) == true) {
+    __atomic_add_fetch(&client->num_replies, 1, __ATOMIC_RELAXED);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  return NULL;
+}
+
+// cost of a command over a registry of shadows (run inline, no socket)
+static void BM_ControlCommand(benchmark::State &state) {
+  BenchFixture fixture(BENCH_CONTROL_NUM_SHADOWS, 2);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadows");
+    return;
+  }
+  ControlSocket control((void *)fixture.getOrchestrator(), BENCH_CONTROL_PATH);
+  const char *command = bench_commands[state.range(0)];
+  std::string reply;
+  size_t num_bytes = 0;
+  while (state.KeepRunning()) {
+    reply.clear();
+    control.execute(command, &reply);
+    num_bytes += reply.size();
+  }
+  if (reply.size() < 3 || reply.compare(reply.size() - 3, 3, "OK\n") != 0) {
+    state.SkipWithError("command failed");
+    return;
+  }
+  state.SetBytesProcessed(num_bytes);
+}
+BENCHMARK(BM_ControlCommand)
+    ->Arg(0)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(3)
+    ->Unit(benchmark::kMicrosecond);
+
+// tick throughput through two shards with no admin client (0) or a client
+// issuing "stats" (1) or full "shadows" listings (3) back to back over the
+// socket... the data path should not notice
+static void BM_ControlTickThroughput(benchmark::State &state) {
+  BenchFixture fixture(BENCH_CONTROL_NUM_SHADOWS, 2);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadows");
+    return;
+  }
+  Orchestrator *orchestrator = fixture.getOrchestrator();
+  std::vector<DeviceShadow *> shadows;
+  for (int i = 0; i < fixture.getNumDeviceShadows(); ++i) {
+    shadows.push_back(fixture.getDeviceShadow(i));
+  }
+  ControlSocket control((void *)orchestrator, BENCH_CONTROL_PATH);
+  bench_control_client_t client;
+  client.command = bench_commands[state.range(0)];
+  client.is_running = true;
+  client.num_replies = 0;
+  pthread_t thread;
+  bool has_client = false;
+  if (state.range(0) > 0) {
+    if (control.start() == false) {
+      state.SkipWithError("unable to start the control socket");
+      return;
+    }
+    has_client =
+        (pthread_create(&thread, NULL, &controlClient, (void *)&client) == 0);
+  }
+  int value = 0;
+  while (state.KeepRunning()) {
+    uint64_t target =
+        orchestrator->getNumEventsProcessed() + BENCH_CONTROL_TICKS_PER_ITER;
+    for (int i = 0; i < BENCH_CONTROL_TICKS_PER_ITER; ++i) {
+      orchestrator->processTick(shadows[i % shadows.size()], ++value);
+    }
+    while (orchestrator->getNumEventsProcessed() < target) {
+      sched_yield();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * BENCH_CONTROL_TICKS_PER_ITER);
+  if (has_client == true) {
+    __atomic_store_n(&client.is_running, false, __ATOMIC_RELAXED);
+    pthread_join(thread, NULL);
+    state.counters["replies"] = (double)client.num_replies;
+  }
+  control.stop();
+}
+BENCHMARK(BM_ControlTickThroughput)
+    ->Arg(0)
+    ->Arg(1)
+    ->Arg(3)
+    ->Unit(benchmark::kMicrosecond);
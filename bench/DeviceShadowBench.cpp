@@ -0,0 +1,315 @@
+/**
+ * @file    DeviceShadowBench.cpp
+ * @brief   mbed Edge Orchestrator benchmarks - DeviceShadow hot paths
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmark harness
+#include "Benchmark.h"
+
+// fixture, PT stub counters and allocation counter
+#include "BenchFixture.h"
+#include "alloc_counter.h"
+#include "pt_stubs.h"
+
+// byte order utils
+#include "byte_order.h"
+
+// cycle counter
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// current cycle count (0 where we have no cycle counter)
+static uint64_t cycleCount() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// report the number of pt_write_value() calls per iteration
+static void reportWritesPerIteration(benchmark::State &state,
+                                     unsigned long writes_before) {
+  if (state.iterations() > 0) {
+    state.counters["pt_writes_per_iter"] =
+        (double)(PT_STUB_COUNT(pt_stub_num_writes) - writes_before) /
+        state.iterations();
+  }
+}
+
+// resource lookup (walks the object/instance/resource lists)
+static void BM_GetResourceInstance(benchmark::State &state) {
+  BenchFixture fixture(1, 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadow");
+    return;
+  }
+  DeviceShadow *shadow = fixture.getDeviceShadow(0);
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(
+        shadow->getResourceInstance(COUNTER_OBJECT_ID, 0, COUNTER_RESOURCE_ID));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GetResourceInstance);
+
+// counter update pushed through PT (value changes every iteration)
+static void BM_UpdateCounterResourceValue(benchmark::State &state) {
+  BenchFixture fixture(1, 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadow");
+    return;
+  }
+  DeviceShadow *shadow = fixture.getDeviceShadow(0);
+  unsigned long writes_before = PT_STUB_COUNT(pt_stub_num_writes);
+  int value = 0;
+  while (state.KeepRunning()) {
+    shadow->updateCounterResourceValue(++value);
+  }
+  state.SetItemsProcessed(state.iterations());
+  reportWritesPerIteration(state, writes_before);
+}
+BENCHMARK(BM_UpdateCounterResourceValue);
+
+// cloud-initiated write to the switch resource
+static void BM_ProcessWriteRequest(benchmark::State &state) {
+  BenchFixture fixture(1, 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadow");
+    return;
+  }
+  DeviceShadow *shadow = fixture.getDeviceShadow(0);
+  uint8_t value[sizeof(long)];
+  unsigned long writes_before = PT_STUB_COUNT(pt_stub_num_writes);
+  long switch_state = 0;
+  uint64_t cycles = cycleCount();
+  while (state.KeepRunning()) {
+    convert_long_value_to_network_byte_order(switch_state ^= 1, value);
+    shadow->processWriteRequest(shadow->getEndpointID(), SWITCH_OBJECT_ID, 0,
+                                SWITCH_RESOURCE_ID, OPERATION_WRITE, value,
+                                sizeof(value));
+  }
+  cycles = cycleCount() - cycles;
+  state.SetItemsProcessed(state.iterations());
+  reportWritesPerIteration(state, writes_before);
+  if (cycles > 0 && state.iterations() > 0) {
+    state.counters["cycles_per_write"] = (double)cycles / state.iterations();
+  }
+}
+BENCHMARK(BM_ProcessWriteRequest);
+
+// device tick: notify the shadow and forward the change
+static void BM_NotifyAndProcessEvents(benchmark::State &state) {
+  BenchFixture fixture(1, 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadow");
+    return;
+  }
+  DeviceShadow *shadow = fixture.getDeviceShadow(0);
+  unsigned long writes_before = PT_STUB_COUNT(pt_stub_num_writes);
+  int value = 0;
+  while (state.KeepRunning()) {
+    shadow->notifyCounterValueHasChanged(++value);
+    shadow->processEvents();
+  }
+  state.SetItemsProcessed(state.iterations());
+  reportWritesPerIteration(state, writes_before);
+}
+BENCHMARK(BM_NotifyAndProcessEvents);
+
+// "n" cloud writes to one shadow, one at a time (one pt_write_value() each)
+static void BM_ProcessWriteRequestSingles(benchmark::State &state) {
+  BenchFixture fixture(1, 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadow");
+    return;
+  }
+  DeviceShadow *shadow = fixture.getDeviceShadow(0);
+  int num_writes = (int)state.range(0);
+  uint8_t value[sizeof(long)];
+  unsigned long writes_before = PT_STUB_COUNT(pt_stub_num_writes);
+  long switch_state = 0;
+  while (state.KeepRunning()) {
+    for (int i = 0; i < num_writes; ++i) {
+      convert_long_value_to_network_byte_order(switch_state ^= 1, value);
+      shadow->processWriteRequest(shadow->getEndpointID(), SWITCH_OBJECT_ID, 0,
+                                  SWITCH_RESOURCE_ID, OPERATION_WRITE, value,
+                                  sizeof(value));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * num_writes);
+  reportWritesPerIteration(state, writes_before);
+}
+BENCHMARK(BM_ProcessWriteRequestSingles)->Arg(2)->Arg(16);
+
+// the same "n" writes as a single batch (one pt_write_value() in total)
+static void BM_ProcessWriteRequestBatch(benchmark::State &state) {
+  BenchFixture fixture(1, 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadow");
+    return;
+  }
+  DeviceShadow *shadow = fixture.getDeviceShadow(0);
+  int num_writes = (int)state.range(0);
+  std::vector<device_shadow_write_t> writes(num_writes);
+  unsigned long writes_before = PT_STUB_COUNT(pt_stub_num_writes);
+  long switch_state = 0;
+  while (state.KeepRunning()) {
+    for (int i = 0; i < num_writes; ++i) {
+      writes[i].object_id = SWITCH_OBJECT_ID;
+      writes[i].instance_id = 0;
+      writes[i].resource_id = SWITCH_RESOURCE_ID;
+      writes[i].operation = OPERATION_WRITE;
+      writes[i].value = (switch_state ^= 1);
+    }
+    shadow->processWriteRequests(&writes[0], num_writes);
+  }
+  state.SetItemsProcessed(state.iterations() * num_writes);
+  reportWritesPerIteration(state, writes_before);
+}
+BENCHMARK(BM_ProcessWriteRequestBatch)->Arg(2)->Arg(16);
+
+// wait for a shadow's PT calls (made on the PT thread) to be acknowledged
+static void waitForPTCalls(DeviceShadow *shadow) {
+  struct timespec pause = {0, 100000L}; // 100us
+  while (shadow->hasPendingPTCalls() == true) {
+    nanosleep(&pause, NULL);
+  }
+}
+
+// shadow lifecycle at fleet scale: create + register "n" shadows, change their
+// schema (PT device freed and re-created) and destroy them. Run under
+// "make bench-asan" this doubles as a leak/double-free stress test of the PT
+// device and value buffer ownership
+static void BM_ShadowLifecycle(benchmark::State &state) {
+  BenchFixture fixture(1, 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadow");
+    return;
+  }
+  Orchestrator *orchestrator = fixture.getOrchestrator();
+  fleet_device_config_t config;
+  FleetConfig::initializeDefaultDevice(&config, "LifecycleDevice");
+  fleet_device_config_t changed = config;
+  changed.lifetime = config.lifetime + 1;
+  int num_shadows = (int)state.range(0);
+  std::vector<DeviceShadow *> shadows(num_shadows);
+  unsigned long registrations_before = PT_STUB_COUNT(pt_stub_num_registrations);
+  while (state.KeepRunning()) {
+    for (int i = 0; i < num_shadows; ++i) {
+      char suffix[16];
+      snprintf(suffix, sizeof(suffix), "-%d", i);
+      shadows[i] = new DeviceShadow(orchestrator, NULL, &config, suffix);
+      shadows[i]->setPTConnection(orchestrator->getPTConnectionAt(0));
+      shadows[i]->createAndRegister();
+    }
+    for (int i = 0; i < num_shadows; ++i) {
+      waitForPTCalls(shadows[i]);
+      shadows[i]->reconfigure(&changed);
+    }
+    for (int i = 0; i < num_shadows; ++i) {
+      waitForPTCalls(shadows[i]);
+      delete shadows[i];
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * num_shadows);
+  if (state.iterations() > 0) {
+    state.counters["registrations_per_shadow"] =
+        (double)(PT_STUB_COUNT(pt_stub_num_registrations) -
+                 registrations_before) /
+        (state.iterations() * num_shadows);
+  }
+}
+BENCHMARK(BM_ShadowLifecycle)->Arg(1000)->Arg(10000)->Unit(
+    benchmark::kMillisecond);
+
+// report the heap allocations per iteration... the hot paths must not make any
+static void reportAllocationsPerIteration(benchmark::State &state,
+                                          unsigned long allocations) {
+  if (state.iterations() > 0) {
+    state.counters["allocs_per_iter"] =
+        (double)allocations / state.iterations();
+  }
+  if (allocations > 0) {
+    state.SkipWithError("heap allocation on the hot path");
+  }
+}
+
+// cloud write hot path (lookup, value cache, callback, pt_write_value())
+static void BM_ProcessWriteRequestAllocations(benchmark::State &state) {
+  if (alloc_counter_supported() == 0) {
+    state.SkipWithError("allocation counting is not available in this build");
+    return;
+  }
+  BenchFixture fixture(1, 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadow");
+    return;
+  }
+  DeviceShadow *shadow = fixture.getDeviceShadow(0);
+  uint8_t value[sizeof(long)];
+  long switch_state = 0;
+
+  // warm up (value cache snapshot reuse, stdio buffers)
+  for (int i = 0; i < 8; ++i) {
+    convert_long_value_to_network_byte_order(switch_state ^= 1, value);
+    shadow->processWriteRequest(shadow->getEndpointID(), SWITCH_OBJECT_ID, 0,
+                                SWITCH_RESOURCE_ID, OPERATION_WRITE, value,
+                                sizeof(value));
+  }
+  alloc_counter_begin();
+  while (state.KeepRunning()) {
+    convert_long_value_to_network_byte_order(switch_state ^= 1, value);
+    shadow->processWriteRequest(shadow->getEndpointID(), SWITCH_OBJECT_ID, 0,
+                                SWITCH_RESOURCE_ID, OPERATION_WRITE, value,
+                                sizeof(value));
+  }
+  unsigned long allocations = alloc_counter_end();
+  state.SetItemsProcessed(state.iterations());
+  reportAllocationsPerIteration(state, allocations);
+}
+BENCHMARK(BM_ProcessWriteRequestAllocations);
+
+// counter update hot path (value cache, pt_write_value())
+static void BM_UpdateCounterResourceValueAllocations(benchmark::State &state) {
+  if (alloc_counter_supported() == 0) {
+    state.SkipWithError("allocation counting is not available in this build");
+    return;
+  }
+  BenchFixture fixture(1, 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadow");
+    return;
+  }
+  DeviceShadow *shadow = fixture.getDeviceShadow(0);
+  int value = 0;
+  for (int i = 0; i < 8; ++i) {
+    shadow->updateCounterResourceValue(++value);
+  }
+  alloc_counter_begin();
+  while (state.KeepRunning()) {
+    shadow->updateCounterResourceValue(++value);
+  }
+  unsigned long allocations = alloc_counter_end();
+  state.SetItemsProcessed(state.iterations());
+  reportAllocationsPerIteration(state, allocations);
+}
+BENCHMARK(BM_UpdateCounterResourceValueAllocations);
@@ -0,0 +1,161 @@
+/**
+ * @file    EndpointTableBench.cpp
+ * @brief   mbed Edge Orchestrator benchmarks - endpoint IDs and LwM2M paths
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmark harness
+#include "Benchmark.h"
+
+// fixture and allocation counter
+#include "BenchFixture.h"
+#include "alloc_counter.h"
+
+// endpoint table and path formatter
+#include "EndpointTable.h"
+#include "LwM2MPath.h"
+
+// system includes
+#include <stdio.h>
+
+// baseline registry
+#include <map>
+#include <string>
+#include <vector>
+
+// endpoint IDs "NonMbedDevice-<i>-0"
+static std::vector<std::string> endpointIDs(int num_endpoints) {
+  std::vector<std::string> endpoint_ids;
+  for (int i = 0; i < num_endpoints; ++i) {
+    char endpoint_id[64];
+    snprintf(endpoint_id, sizeof(endpoint_id), "NonMbedDevice-%d-0", i);
+    endpoint_ids.push_back(endpoint_id);
+  }
+  return endpoint_ids;
+}
+
+// interned lookup of "n" endpoint IDs
+static void BM_EndpointTableFind(benchmark::State &state) {
+  std::vector<std::string> endpoint_ids = endpointIDs((int)state.range(0));
+  EndpointTable table;
+  for (size_t i = 0; i < endpoint_ids.size(); ++i) {
+    table.intern(endpoint_ids[i].c_str());
+  }
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(table.find(endpoint_ids[i].c_str()));
+    i = (i + 1) % endpoint_ids.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["bytes_per_endpoint"] =
+      (double)table.getNumBytes() / table.getNumEndpoints();
+}
+BENCHMARK(BM_EndpointTableFind)->Arg(1000)->Arg(10000);
+
+// "does this value point into the table?" over "n" interned endpoint IDs (and
+// a pointer that does not)... what releasePTDevice() asks of every device
+// object string, so it should not grow with the number of chunks
+static void BM_EndpointTableIsInterned(benchmark::State &state) {
+  std::vector<std::string> endpoint_ids = endpointIDs((int)state.range(0));
+  std::vector<const char *> interned;
+  EndpointTable table;
+  for (size_t i = 0; i < endpoint_ids.size(); ++i) {
+    interned.push_back(table.lookup(table.intern(endpoint_ids[i].c_str())));
+  }
+  size_t i = 0;
+  size_t num_interned = 0;
+  while (state.KeepRunning()) {
+    num_interned += (table.isInterned(interned[i]) == true) ? 1 : 0;
+    benchmark::DoNotOptimize(table.isInterned(endpoint_ids[i].c_str()));
+    i = (i + 1) % interned.size();
+  }
+  if (num_interned != state.iterations()) {
+    state.SkipWithError("an interned endpoint ID was not found");
+    return;
+  }
+  state.SetItemsProcessed(2 * state.iterations());
+}
+BENCHMARK(BM_EndpointTableIsInterned)->Arg(1000)->Arg(100000)->Arg(1000000);
+
+// baseline: the std::string keyed registry we used to have
+static void BM_EndpointStringMapFind(benchmark::State &state) {
+  std::vector<std::string> endpoint_ids = endpointIDs((int)state.range(0));
+  std::map<std::string, int> index;
+  for (size_t i = 0; i < endpoint_ids.size(); ++i) {
+    index[endpoint_ids[i]] = (int)i;
+  }
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(index.find(endpoint_ids[i].c_str()));
+    i = (i + 1) % endpoint_ids.size();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EndpointStringMapFind)->Arg(1000)->Arg(10000);
+
+// shadow lookup through the orchestrator registry (PT write path)
+static void BM_GetDeviceShadowByEndpoint(benchmark::State &state) {
+  BenchFixture fixture((int)state.range(0), 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadows");
+    return;
+  }
+  Orchestrator *orchestrator = fixture.getOrchestrator();
+  std::vector<const char *> endpoint_ids;
+  for (int i = 0; i < fixture.getNumDeviceShadows(); ++i) {
+    endpoint_ids.push_back(fixture.getDeviceShadow(i)->getEndpointID());
+  }
+  size_t i = 0;
+  alloc_counter_begin();
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(orchestrator->getDeviceShadow(endpoint_ids[i]));
+    i = (i + 1) % endpoint_ids.size();
+  }
+  unsigned long allocations = alloc_counter_end();
+  state.SetItemsProcessed(state.iterations());
+  if (alloc_counter_supported() != 0 && state.iterations() > 0) {
+    state.counters["allocs_per_iter"] =
+        (double)allocations / state.iterations();
+  }
+}
+BENCHMARK(BM_GetDeviceShadowByEndpoint)->Arg(1000)->Arg(10000);
+
+// LwM2M path formatting into a stack buffer
+static void BM_LwM2MPathFormat(benchmark::State &state) {
+  uint16_t resource_id = 0;
+  while (state.KeepRunning()) {
+    LwM2MPath path("NonMbedDevice-1234-0", 3303, 0, ++resource_id);
+    benchmark::DoNotOptimize(path.c_str());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LwM2MPathFormat);
+
+// baseline: snprintf()
+static void BM_LwM2MPathSnprintf(benchmark::State &state) {
+  uint16_t resource_id = 0;
+  char path[LWM2M_PATH_MAX_LENGTH];
+  while (state.KeepRunning()) {
+    snprintf(path, sizeof(path), "%s/%d/%d/%d", "NonMbedDevice-1234-0", 3303, 0,
+             ++resource_id);
+    benchmark::DoNotOptimize(path[0]);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LwM2MPathSnprintf);
@@ -0,0 +1,172 @@
+/**
+ * @file    FleetConfigBench.cpp
+ * @brief   mbed Edge Orchestrator benchmarks - fleet configuration startup
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmark harness
+#include "Benchmark.h"
+
+// fleet configuration/Orchestrator
+#include "BenchFixture.h"
+#include "FleetConfig.h"
+#include "NonMbedDevice.h"
+#include "Orchestrator.h"
+
+// system includes
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// Tunables for the fleet configuration benchmarks
+#define BENCH_FLEET_CONFIG_FILE "./fleet-bench.conf"
+#define BENCH_FLEET_CONFIG_FILE_A "./fleet-bench-a.conf"
+#define BENCH_FLEET_CONFIG_FILE_B "./fleet-bench-b.conf"
+#define BENCH_FLEET_RELOAD_CHURN 100 // 1 in 100 devices added/removed/changed
+
+// write a configuration with "n" devices (every 4th has its own schema)
+static bool writeFleetConfig(const char *path, long num_devices) {
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    return false;
+  }
+  fprintf(fp, "# generated benchmark fleet\n");
+  fprintf(fp, "defaults lifetime=60 poll_interval_ms=25000\n");
+  fprintf(fp, "resource 123/0/4567 rw counter delta=1\n");
+  fprintf(fp, "resource 311/0/5850 rw switch\n");
+  for (long i = 0; i < num_devices; ++i) {
+    fprintf(fp, "device NonMbedDevice-%ld poll_interval_ms=%ld\n", i,
+            1000 + (i % 10) * 1000);
+    if (i % 4 == 0) {
+      fprintf(fp, "  resource 3303/0/5700 r counter min_interval_ms=5000\n");
+      fprintf(fp, "  resource 3311/0/5850 rw switch\n");
+      fprintf(fp, "  resource 3311/0/5851 rw none\n");
+    }
+  }
+  fclose(fp);
+  return true;
+}
+
+// count parsed devices
+static void countDeviceCB(const fleet_device_config_t *device, void *ctx) {
+  ++*(long *)ctx;
+}
+
+// parse only (mmap + single pass)
+static void BM_FleetConfigParse(benchmark::State &state) {
+  if (writeFleetConfig(BENCH_FLEET_CONFIG_FILE, state.range(0)) == false) {
+    state.SkipWithError("unable to write the fleet configuration");
+    return;
+  }
+  while (state.KeepRunning()) {
+    FleetConfig config;
+    long num_devices = 0;
+    config.parse(BENCH_FLEET_CONFIG_FILE, &countDeviceCB, &num_devices);
+    benchmark::DoNotOptimize(num_devices);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  unlink(BENCH_FLEET_CONFIG_FILE);
+}
+BENCHMARK(BM_FleetConfigParse)->Arg(1000)->Arg(10000)->Unit(
+    benchmark::kMillisecond);
+
+// startup: parse and build the shadow registry (shadows + devices)
+static void BM_FleetConfigLoad(benchmark::State &state) {
+  if (writeFleetConfig(BENCH_FLEET_CONFIG_FILE, state.range(0)) == false) {
+    state.SkipWithError("unable to write the fleet configuration");
+    return;
+  }
+  NonMbedDevice device;
+  while (state.KeepRunning()) {
+    state.PauseTiming();
+    Orchestrator *orchestrator = new Orchestrator((void *)&device);
+    state.ResumeTiming();
+    if (orchestrator->loadFleetConfig(BENCH_FLEET_CONFIG_FILE, NULL) ==
+        false) {
+      state.SkipWithError("unable to load the fleet configuration");
+    }
+    state.PauseTiming();
+    delete orchestrator;
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  unlink(BENCH_FLEET_CONFIG_FILE);
+}
+BENCHMARK(BM_FleetConfigLoad)->Arg(1000)->Arg(10000)->Unit(
+    benchmark::kMillisecond);
+
+// write devices [first, first + count)... "changed" alters the filter policy of
+// every BENCH_FLEET_RELOAD_CHURN'th device
+static bool writeReloadConfig(const char *path, long first, long count,
+                              bool changed) {
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    return false;
+  }
+  fprintf(fp, "defaults lifetime=60 poll_interval_ms=600000\n");
+  for (long i = first; i < first + count; ++i) {
+    fprintf(fp, "device NonMbedDevice-%ld\n", i);
+    fprintf(fp, "  resource 123/0/4567 rw counter delta=%d\n",
+            (changed == true && i % BENCH_FLEET_RELOAD_CHURN == 50) ? 2 : 1);
+  }
+  fclose(fp);
+  return true;
+}
+
+// hot reload of "n" devices where 1% are added, 1% removed and 1% changed
+// (timed until the shards have applied the difference)
+static void BM_FleetConfigReload(benchmark::State &state) {
+  long num_devices = state.range(0);
+  long churn = num_devices / BENCH_FLEET_RELOAD_CHURN;
+  if (writeReloadConfig(BENCH_FLEET_CONFIG_FILE_A, 0, num_devices, false) ==
+          false ||
+      writeReloadConfig(BENCH_FLEET_CONFIG_FILE_B, churn, num_devices, true) ==
+          false) {
+    state.SkipWithError("unable to write the fleet configurations");
+    return;
+  }
+  unlink(BENCH_FLEET_CONFIG_FILE);
+  link(BENCH_FLEET_CONFIG_FILE_A, BENCH_FLEET_CONFIG_FILE);
+  BenchFixture fixture(BENCH_FLEET_CONFIG_FILE, 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadows");
+    return;
+  }
+  Orchestrator *orchestrator = fixture.getOrchestrator();
+  bool use_b = true;
+  while (state.KeepRunning()) {
+    state.PauseTiming();
+    unlink(BENCH_FLEET_CONFIG_FILE);
+    link((use_b == true) ? BENCH_FLEET_CONFIG_FILE_B : BENCH_FLEET_CONFIG_FILE_A,
+         BENCH_FLEET_CONFIG_FILE);
+    use_b = !use_b;
+    uint64_t target = orchestrator->getNumEventsProcessed() + 3 * churn;
+    state.ResumeTiming();
+    orchestrator->reloadFleetConfig();
+    while (orchestrator->getNumEventsProcessed() < target) {
+      sched_yield();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * num_devices);
+  unlink(BENCH_FLEET_CONFIG_FILE);
+  unlink(BENCH_FLEET_CONFIG_FILE_A);
+  unlink(BENCH_FLEET_CONFIG_FILE_B);
+}
+BENCHMARK(BM_FleetConfigReload)->Arg(1000)->Arg(10000)->Unit(
+    benchmark::kMillisecond);
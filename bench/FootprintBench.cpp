@@ -0,0 +1,158 @@
+/**
+ * @file    FootprintBench.cpp
+ * @brief   Shadow memory footprint benchmarks
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Benchmark harness
+#include "Benchmark.h"
+
+// fixture
+#include "BenchFixture.h"
+
+// allocation counting
+#include "alloc_counter.h"
+
+// system includes
+#include <malloc.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+// resident set size (bytes)... after a malloc_trim(), as the shards leave
+// it once they have dropped idle shadows (see SHARD_IDLE_TRIM_THRESHOLD)
+static double residentBytes() {
+  malloc_trim(0);
+  long pages = 0, resident = 0;
+  FILE *fp = fopen("/proc/self/statm", "r");
+  if (fp != NULL) {
+    if (fscanf(fp, "%ld %ld", &pages, &resident) != 2) {
+      resident = 0;
+    }
+    fclose(fp);
+  }
+  return (double)resident * sysconf(_SC_PAGESIZE);
+}
+
+// heap in use (bytes)
+static double heapBytes() {
+  struct mallinfo2 info = mallinfo2();
+  return (double)info.uordblks;
+}
+
+// a fleet of "n" registered shadows, all of them idle: the memory held with
+// their PT structures built (as registered) and once they have been dropped
+// (as the shards do for idle shadows), along with the time to drop them all
+static void BM_IdleFleetFootprint(benchmark::State &state) {
+  int num_shadows = (int)state.range(0);
+  double base_rss = residentBytes();
+  double base_heap = heapBytes();
+  BenchFixture fixture(num_shadows, 2);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadows");
+    return;
+  }
+  double materialized_rss = residentBytes() - base_rss;
+  double materialized_heap = heapBytes() - base_heap;
+  int num_dropped = 0;
+  while (state.KeepRunning()) {
+    // (the shards are idle: nothing is polled, renewals are a lifetime away)
+    uint64_t far_future_ms = UINT64_MAX / 2;
+    for (int i = 0; i < num_shadows; ++i) {
+      if (fixture.getDeviceShadow(i)->dematerializeIfIdle(far_future_ms, 0) ==
+          true) {
+        ++num_dropped;
+      }
+    }
+  }
+  if (num_dropped != num_shadows) {
+    state.SkipWithError("not every shadow dropped its PT structures");
+    return;
+  }
+  double compact_rss = residentBytes() - base_rss;
+  double compact_heap = heapBytes() - base_heap;
+  state.SetItemsProcessed(num_shadows);
+  state.counters["rss_mb_materialized"] = materialized_rss / (1024 * 1024);
+  state.counters["rss_mb_compact"] = compact_rss / (1024 * 1024);
+  state.counters["heap_per_shadow_materialized"] =
+      materialized_heap / num_shadows;
+  state.counters["heap_per_shadow_compact"] = compact_heap / num_shadows;
+}
+BENCHMARK(BM_IdleFleetFootprint)
+    ->Arg(100000)
+    ->Iterations(1)
+    ->Unit(benchmark::kMillisecond);
+
+// a write to a shadow whose PT structures were dropped (rebuilt from its
+// value cache first), then dropped again
+static void BM_RematerializeOnWrite(benchmark::State &state) {
+  BenchFixture fixture(1, 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadow");
+    return;
+  }
+  DeviceShadow *shadow = fixture.getDeviceShadow(0);
+  uint64_t far_future_ms = UINT64_MAX / 2;
+  long switch_state = 0;
+  while (state.KeepRunning()) {
+    device_shadow_value_t value;
+    value.type = DEVICE_SHADOW_VALUE_INTEGER;
+    value.integer = (switch_state ^= 1);
+    shadow->dematerializeIfIdle(far_future_ms, 0);
+    shadow->processWriteRequest(shadow->getEndpointID(), SWITCH_OBJECT_ID, 0,
+                                SWITCH_RESOURCE_ID, OPERATION_WRITE, &value);
+  }
+  long current = -1;
+  if (shadow->getResourceValue(SWITCH_OBJECT_ID, 0, SWITCH_RESOURCE_ID,
+                               &current) == false ||
+      current != switch_state) {
+    state.SkipWithError("the write was lost across a rebuild");
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RematerializeOnWrite);
+
+// building a shadow's PT structures (device, resources and device object) and
+// dropping them again. The device object references the shadow's shared
+// profile, so building it allocates nothing of its own
+static void BM_MaterializeShadow(benchmark::State &state) {
+  BenchFixture fixture(1, 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadow");
+    return;
+  }
+  DeviceShadow *shadow = fixture.getDeviceShadow(0);
+  uint64_t far_future_ms = UINT64_MAX / 2;
+  bool counting = (alloc_counter_supported() != 0);
+  if (counting == true) {
+    alloc_counter_begin();
+  }
+  while (state.KeepRunning()) {
+    shadow->dematerializeIfIdle(far_future_ms, 0);
+    shadow->materialize();
+  }
+  unsigned long allocations = (counting == true) ? alloc_counter_end() : 0;
+  state.SetItemsProcessed(state.iterations());
+  if (counting == true && state.iterations() > 0) {
+    state.counters["allocs_per_build"] =
+        (double)allocations / state.iterations();
+  }
+}
+BENCHMARK(BM_MaterializeShadow);
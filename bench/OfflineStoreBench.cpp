@@ -0,0 +1,144 @@
+/**
+ * @file    OfflineStoreBench.cpp
+ * @brief   mbed Edge Orchestrator benchmarks - offline store
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmark harness
+#include "Benchmark.h"
+
+// Offline store
+#include "OfflineStore.h"
+
+// system includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Tunables for the offline store benchmarks
+#define BENCH_OFFLINE_STORE_DIR "./offline-store-bench"
+#define BENCH_OFFLINE_STORE_NUM_ENDPOINTS 100
+
+// replay callback (counts records)
+static void countRecordCB(const offline_store_record_t *record, void *ctx) {
+  ++*(long *)ctx;
+}
+
+// remove whatever a previous run left behind
+static void resetStore(OfflineStore *store) { store->replay(NULL, NULL); }
+
+// buffered update while PT is down (append + flush)
+static void BM_OfflineStoreAppend(benchmark::State &state) {
+  OfflineStore store(BENCH_OFFLINE_STORE_DIR);
+  if (store.open() == false) {
+    state.SkipWithError("unable to open the offline store");
+    return;
+  }
+  resetStore(&store);
+  char endpoint_id[32];
+  long value = 0;
+  while (state.KeepRunning()) {
+    snprintf(endpoint_id, sizeof(endpoint_id), "NonMbedDevice-%ld",
+             value % BENCH_OFFLINE_STORE_NUM_ENDPOINTS);
+    store.append(endpoint_id, 123, 0, 4567, ++value);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * sizeof(offline_store_record_t));
+  resetStore(&store);
+}
+BENCHMARK(BM_OfflineStoreAppend);
+
+// replay (read + compact + callback) of "n" buffered records
+static void BM_OfflineStoreReplay(benchmark::State &state) {
+  OfflineStore store(BENCH_OFFLINE_STORE_DIR);
+  if (store.open() == false) {
+    state.SkipWithError("unable to open the offline store");
+    return;
+  }
+  resetStore(&store);
+  long num_records = state.range(0);
+  char endpoint_id[32];
+  while (state.KeepRunning()) {
+    state.PauseTiming();
+    for (long i = 0; i < num_records; ++i) {
+      snprintf(endpoint_id, sizeof(endpoint_id), "NonMbedDevice-%ld",
+               i % BENCH_OFFLINE_STORE_NUM_ENDPOINTS);
+      store.append(endpoint_id, 123, 0, 4567, i);
+    }
+    state.ResumeTiming();
+    long num_replayed = 0;
+    store.replay(&countRecordCB, &num_replayed);
+    benchmark::DoNotOptimize(num_replayed);
+  }
+  state.SetItemsProcessed(state.iterations() * num_records);
+}
+BENCHMARK(BM_OfflineStoreReplay)->Arg(1000)->Arg(10000)->Unit(
+    benchmark::kMillisecond);
+
+// recovery from a torn record at the tail (a crash mid-append): the store is
+// reopened and appended to, and every whole record must replay (arg: number
+// of records on each side of the torn one)
+static void BM_OfflineStoreTornTail(benchmark::State &state) {
+  long num_records = state.range(0);
+  char endpoint_id[48];
+  while (state.KeepRunning()) {
+    state.PauseTiming();
+    OfflineStore *store = new OfflineStore(BENCH_OFFLINE_STORE_DIR);
+    if (store->open() == false) {
+      delete store;
+      state.SkipWithError("unable to open the offline store");
+      return;
+    }
+    resetStore(store);
+    for (long i = 0; i < num_records; ++i) {
+      snprintf(endpoint_id, sizeof(endpoint_id), "NonMbedDevice-%ld", i);
+      store->append(endpoint_id, 123, 0, 4567, i);
+    }
+    delete store;
+
+    // "crash" halfway through the next record
+    offline_store_record_t partial;
+    memset(&partial, 0xa5, sizeof(partial));
+    FILE *fp = fopen(BENCH_OFFLINE_STORE_DIR "/segment-00000000.log", "ab");
+    if (fp == NULL) {
+      state.SkipWithError("unable to open the offline store segment");
+      return;
+    }
+    fwrite(&partial, sizeof(partial) / 2, 1, fp);
+    fclose(fp);
+    state.ResumeTiming();
+
+    // restart, buffer some more and replay
+    store = new OfflineStore(BENCH_OFFLINE_STORE_DIR);
+    store->open();
+    for (long i = num_records; i < 2 * num_records; ++i) {
+      snprintf(endpoint_id, sizeof(endpoint_id), "NonMbedDevice-%ld", i);
+      store->append(endpoint_id, 123, 0, 4567, i);
+    }
+    long num_replayed = 0;
+    store->replay(&countRecordCB, &num_replayed);
+    delete store;
+    if (num_replayed != 2 * num_records) {
+      state.SkipWithError("records appended after a torn record were lost");
+      return;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * 2 * num_records);
+}
+BENCHMARK(BM_OfflineStoreTornTail)->Arg(100)->Unit(benchmark::kMillisecond);
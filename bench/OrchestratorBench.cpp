@@ -0,0 +1,260 @@
+/**
+ * @file    OrchestratorBench.cpp
+ * @brief   mbed Edge Orchestrator benchmarks - sharding, re-sync and teardown
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmark harness
+#include "Benchmark.h"
+
+// fixture
+#include "BenchFixture.h"
+
+// byte order utils
+#include "byte_order.h"
+
+// system includes
+#include <pthread.h>
+#include <sched.h>
+
+// Tunables for the orchestrator benchmarks
+#define BENCH_SHARD_NUM_SHADOWS 1024 // shadows spread across the shards
+#define BENCH_SHARD_TICKS_PER_ITER 1024 // ticks enqueued per iteration
+#define BENCH_FLEET_WRITE_NUM_SHADOWS 1000 // shadows in a fleet-wide setpoint
+#define BENCH_FLOOD_NUM_SHADOWS 1024 // shadows ticked by the telemetry flood
+
+// tick throughput through the shards (arg: number of shards)
+static void BM_ShardTickThroughput(benchmark::State &state) {
+  BenchFixture fixture(BENCH_SHARD_NUM_SHADOWS, (int)state.range(0));
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadows");
+    return;
+  }
+  Orchestrator *orchestrator = fixture.getOrchestrator();
+  std::vector<DeviceShadow *> shadows;
+  for (int i = 0; i < fixture.getNumDeviceShadows(); ++i) {
+    shadows.push_back(fixture.getDeviceShadow(i));
+  }
+  int value = 0;
+  while (state.KeepRunning()) {
+    uint64_t target =
+        orchestrator->getNumEventsProcessed() + BENCH_SHARD_TICKS_PER_ITER;
+    for (int i = 0; i < BENCH_SHARD_TICKS_PER_ITER; ++i) {
+      orchestrator->processTick(shadows[i % shadows.size()], ++value);
+    }
+    while (orchestrator->getNumEventsProcessed() < target) {
+      sched_yield();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * BENCH_SHARD_TICKS_PER_ITER);
+}
+BENCHMARK(BM_ShardTickThroughput)->Arg(1)->Arg(2)->Arg(4)->Unit(
+    benchmark::kMicrosecond);
+
+// re-sync of "n" shadows from memory after edge-core comes back (until every
+// shadow has re-registered on its shard)
+static void BM_ReconnectResync(benchmark::State &state) {
+  BenchFixture fixture((int)state.range(0), 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadows");
+    return;
+  }
+  Orchestrator *orchestrator = fixture.getOrchestrator();
+  while (state.KeepRunning()) {
+    state.PauseTiming();
+    for (int i = 0; i < fixture.getNumDeviceShadows(); ++i) {
+      fixture.getDeviceShadow(i)->connectionLost();
+    }
+    state.ResumeTiming();
+    orchestrator->ptRegisterSuccess(orchestrator->getPTConnectionAt(0));
+    while (orchestrator->getNumRegisteredDeviceShadows() <
+           (size_t)fixture.getNumDeviceShadows()) {
+      sched_yield();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ReconnectResync)->Arg(1000)->Arg(10000)->Unit(
+    benchmark::kMillisecond);
+
+// graceful shutdown (drain + deregister + PT close) of "n" shadows
+static void BM_ShutdownTeardown(benchmark::State &state) {
+  while (state.KeepRunning()) {
+    state.PauseTiming();
+    BenchFixture *fixture = new BenchFixture((int)state.range(0), 1);
+    if (fixture->connect() == false) {
+      delete fixture;
+      state.SkipWithError("unable to register the shadows");
+      return;
+    }
+    state.ResumeTiming();
+    fixture->getOrchestrator()->shutdown();
+    state.PauseTiming();
+    delete fixture;
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ShutdownTeardown)->Arg(1000)->Arg(10000)->Iterations(3)->Unit(
+    benchmark::kMillisecond);
+
+// a fleet-wide setpoint change (counter + switch on every shadow) pushed as
+// single cloud writes
+static void BM_FleetSetpointSingles(benchmark::State &state) {
+  BenchFixture fixture(BENCH_FLEET_WRITE_NUM_SHADOWS, 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadows");
+    return;
+  }
+  Orchestrator *orchestrator = fixture.getOrchestrator();
+  uint8_t value[sizeof(long)];
+  long setpoint = 0;
+  while (state.KeepRunning()) {
+    uint64_t target = orchestrator->getNumEventsProcessed() +
+                      2 * fixture.getNumDeviceShadows();
+    ++setpoint;
+    for (int i = 0; i < fixture.getNumDeviceShadows(); ++i) {
+      const char *endpoint_id = fixture.getDeviceShadow(i)->getEndpointID();
+      convert_long_value_to_network_byte_order(setpoint, value);
+      Orchestrator::processWriteRequestCB(
+          NULL, endpoint_id, COUNTER_OBJECT_ID, 0, COUNTER_RESOURCE_ID,
+          OPERATION_WRITE, value, sizeof(value), orchestrator);
+      convert_long_value_to_network_byte_order(setpoint & 1, value);
+      Orchestrator::processWriteRequestCB(
+          NULL, endpoint_id, SWITCH_OBJECT_ID, 0, SWITCH_RESOURCE_ID,
+          OPERATION_WRITE, value, sizeof(value), orchestrator);
+    }
+    while (orchestrator->getNumEventsProcessed() < target) {
+      sched_yield();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * 2 *
+                          fixture.getNumDeviceShadows());
+}
+BENCHMARK(BM_FleetSetpointSingles)->Unit(benchmark::kMillisecond);
+
+// the same setpoint change through the batch write API
+static void BM_FleetSetpointBatch(benchmark::State &state) {
+  BenchFixture fixture(BENCH_FLEET_WRITE_NUM_SHADOWS, 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadows");
+    return;
+  }
+  Orchestrator *orchestrator = fixture.getOrchestrator();
+  std::vector<orchestrator_write_t> writes(2 * fixture.getNumDeviceShadows());
+  long setpoint = 0;
+  while (state.KeepRunning()) {
+    uint64_t target =
+        orchestrator->getNumEventsProcessed() + fixture.getNumDeviceShadows();
+    ++setpoint;
+    for (int i = 0; i < fixture.getNumDeviceShadows(); ++i) {
+      orchestrator_write_t *write = &writes[2 * i];
+      write[0].endpoint_id = fixture.getDeviceShadow(i)->getEndpointID();
+      write[0].write.object_id = COUNTER_OBJECT_ID;
+      write[0].write.instance_id = 0;
+      write[0].write.resource_id = COUNTER_RESOURCE_ID;
+      write[0].write.operation = OPERATION_WRITE;
+      write[0].write.value = setpoint;
+      write[1] = write[0];
+      write[1].write.object_id = SWITCH_OBJECT_ID;
+      write[1].write.resource_id = SWITCH_RESOURCE_ID;
+      write[1].write.value = setpoint & 1;
+    }
+    orchestrator->writeResources(&writes[0], (int)writes.size());
+    while (orchestrator->getNumEventsProcessed() < target) {
+      sched_yield();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * writes.size());
+}
+BENCHMARK(BM_FleetSetpointBatch)->Unit(benchmark::kMillisecond);
+
+// a telemetry flood: ticks every shadow as fast as the shard will take them
+typedef struct bench_flood {
+  Orchestrator *orchestrator;
+  std::vector<DeviceShadow *> shadows;
+  volatile bool running;
+  pthread_t thread;
+} bench_flood_t;
+
+// flood thread
+static void *floodThread(void *ctx) {
+  bench_flood_t *flood = (bench_flood_t *)ctx;
+  int value = 0;
+  while (flood->running == true) {
+    flood->orchestrator->processTick(
+        flood->shadows[value % flood->shadows.size()], value);
+    ++value;
+  }
+  return NULL;
+}
+
+// cloud write (switch toggle) latency until the shard has applied it, with
+// the shard idle (0) or under a telemetry flood (1). The lane percentiles are
+// the shard's own enqueue -> processed latencies
+static void BM_ControlWriteLatency(benchmark::State &state) {
+  BenchFixture fixture(BENCH_FLOOD_NUM_SHADOWS, 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadows");
+    return;
+  }
+  Orchestrator *orchestrator = fixture.getOrchestrator();
+  bench_flood_t flood;
+  flood.orchestrator = orchestrator;
+  for (int i = 0; i < fixture.getNumDeviceShadows(); ++i) {
+    flood.shadows.push_back(fixture.getDeviceShadow(i));
+  }
+  flood.running = true;
+  if (state.range(0) != 0) {
+    pthread_create(&flood.thread, NULL, &floodThread, &flood);
+  }
+
+  const char *endpoint_id = fixture.getDeviceShadow(0)->getEndpointID();
+  uint8_t value[sizeof(long)];
+  long switch_state = 0;
+  uint64_t events_before = orchestrator->getNumEventsProcessed();
+  while (state.KeepRunning()) {
+    convert_long_value_to_network_byte_order(switch_state ^= 1, value);
+    Orchestrator::processWriteRequestCB(NULL, endpoint_id, SWITCH_OBJECT_ID, 0,
+                                        SWITCH_RESOURCE_ID, OPERATION_WRITE,
+                                        value, sizeof(value), orchestrator);
+    long current = -1;
+    while (orchestrator->readResourceValue(endpoint_id, SWITCH_OBJECT_ID, 0,
+                                           SWITCH_RESOURCE_ID, &current) ==
+               true &&
+           current != switch_state) {
+      sched_yield();
+    }
+  }
+  flood.running = false;
+  if (state.range(0) != 0) {
+    pthread_join(flood.thread, NULL);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["control_p50_us"] =
+      orchestrator->getLaneLatencyUs(SHARD_LANE_CONTROL, 50.0);
+  state.counters["control_p99_us"] =
+      orchestrator->getLaneLatencyUs(SHARD_LANE_CONTROL, 99.0);
+  state.counters["telemetry_p99_us"] =
+      orchestrator->getLaneLatencyUs(SHARD_LANE_TELEMETRY, 99.0);
+  state.counters["events"] =
+      (double)(orchestrator->getNumEventsProcessed() - events_before);
+}
+BENCHMARK(BM_ControlWriteLatency)->Arg(0)->Arg(1)->Unit(
+    benchmark::kMicrosecond);
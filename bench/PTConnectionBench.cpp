@@ -0,0 +1,116 @@
+/**
+ * @file    bench/PTConnectionBench.cpp
+ * @brief   PT connection fan-out benchmarks (throughput, spread, lookup)
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Benchmark harness
+#include "Benchmark.h"
+
+// fixture
+#include "BenchFixture.h"
+
+// PTConnection
+#include "PTConnection.h"
+
+// system includes
+#include <sched.h>
+#include <stdio.h>
+
+// Tunables for the PT connection benchmarks
+#define BENCH_PT_NUM_SHADOWS 1024    // shadows spread across the connections
+#define BENCH_PT_NUM_SHARDS 2        // shards feeding the connections
+#define BENCH_PT_TICKS_PER_ITER 1024 // ticks enqueued per iteration
+
+// report how evenly the shadows were spread (smallest/largest share of the
+// fleet held by a connection, in percent)
+static void reportSpread(benchmark::State &state, Orchestrator *orchestrator) {
+  size_t min = (size_t)-1;
+  size_t max = 0;
+  size_t total = 0;
+  for (size_t i = 0; i < orchestrator->getNumPTConnections(); ++i) {
+    size_t n = orchestrator->getPTConnectionAt(i)->getNumDeviceShadows();
+    min = (n < min) ? n : min;
+    max = (n > max) ? n : max;
+    total += n;
+  }
+  if (total > 0) {
+    state.counters["min_share_pct"] = (100.0 * min) / total;
+    state.counters["max_share_pct"] = (100.0 * max) / total;
+  }
+}
+
+// tick throughput with the shadows spread over "k" PT connections (arg: k)
+static void BM_PTConnectionTickThroughput(benchmark::State &state) {
+  BenchFixture fixture(BENCH_PT_NUM_SHADOWS, BENCH_PT_NUM_SHARDS);
+  fixture.setNumPTConnections((int)state.range(0));
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadows");
+    return;
+  }
+  Orchestrator *orchestrator = fixture.getOrchestrator();
+  if (orchestrator->getNumPTConnections() != (size_t)state.range(0)) {
+    state.SkipWithError("unexpected number of PT connections");
+    return;
+  }
+  std::vector<DeviceShadow *> shadows;
+  for (int i = 0; i < fixture.getNumDeviceShadows(); ++i) {
+    shadows.push_back(fixture.getDeviceShadow(i));
+  }
+  int value = 0;
+  while (state.KeepRunning()) {
+    uint64_t target =
+        orchestrator->getNumEventsProcessed() + BENCH_PT_TICKS_PER_ITER;
+    for (int i = 0; i < BENCH_PT_TICKS_PER_ITER; ++i) {
+      orchestrator->processTick(shadows[i % shadows.size()], ++value);
+    }
+    while (orchestrator->getNumEventsProcessed() < target) {
+      sched_yield();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * BENCH_PT_TICKS_PER_ITER);
+  reportSpread(state, orchestrator);
+}
+BENCHMARK(BM_PTConnectionTickThroughput)->Arg(1)->Arg(2)->Arg(4)->Unit(
+    benchmark::kMicrosecond);
+
+// endpoint -> connection lookup on the hash ring (arg: k)
+static void BM_PTConnectionLookup(benchmark::State &state) {
+  BenchFixture fixture(BENCH_PT_NUM_SHADOWS, 1);
+  fixture.setNumPTConnections((int)state.range(0));
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadows");
+    return;
+  }
+  Orchestrator *orchestrator = fixture.getOrchestrator();
+  std::vector<const char *> endpoints;
+  for (int i = 0; i < fixture.getNumDeviceShadows(); ++i) {
+    endpoints.push_back(fixture.getDeviceShadow(i)->getEndpointID());
+  }
+  size_t i = 0;
+  while (state.KeepRunning()) {
+    PTConnection *connection =
+        orchestrator->getPTConnection(endpoints[i++ % endpoints.size()]);
+    benchmark::DoNotOptimize(connection);
+  }
+  state.SetItemsProcessed(state.iterations());
+  reportSpread(state, orchestrator);
+}
+BENCHMARK(BM_PTConnectionLookup)->Arg(1)->Arg(4)->Arg(16);
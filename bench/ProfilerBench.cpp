@@ -0,0 +1,86 @@
+/**
+ * @file    bench/ProfilerBench.cpp
+ * @brief   CPU profiler benchmarks
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Benchmark harness
+#include "Benchmark.h"
+
+// fixture
+#include "BenchFixture.h"
+
+// Profiler
+#include "Profiler.h"
+
+// system includes
+#include <sched.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// Tunables for the profiler benchmarks
+#define BENCH_PROFILER_NUM_SHADOWS 1024 // shadows ticked through the shards
+#define BENCH_PROFILER_TICKS_PER_ITER 1024 // ticks enqueued per iteration
+#define BENCH_PROFILER_PREFIX "./profiler-bench"
+
+// tick throughput through two shards with the profiler off (0) or sampling
+// at "n" Hz... the shards' folded stacks are written (and removed) at the end
+static void BM_ProfilerTickThroughput(benchmark::State &state) {
+  BenchFixture fixture(BENCH_PROFILER_NUM_SHADOWS, 2);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadows");
+    return;
+  }
+  Orchestrator *orchestrator = fixture.getOrchestrator();
+  std::vector<DeviceShadow *> shadows;
+  for (int i = 0; i < fixture.getNumDeviceShadows(); ++i) {
+    shadows.push_back(fixture.getDeviceShadow(i));
+  }
+  Profiler::shared()->registerThread("bench");
+  if (state.range(0) > 0) {
+    Profiler::shared()->start((int)state.range(0));
+  }
+  int value = 0;
+  while (state.KeepRunning()) {
+    uint64_t target =
+        orchestrator->getNumEventsProcessed() + BENCH_PROFILER_TICKS_PER_ITER;
+    for (int i = 0; i < BENCH_PROFILER_TICKS_PER_ITER; ++i) {
+      orchestrator->processTick(shadows[i % shadows.size()], ++value);
+    }
+    while (orchestrator->getNumEventsProcessed() < target) {
+      sched_yield();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * BENCH_PROFILER_TICKS_PER_ITER);
+  if (state.range(0) > 0) {
+    state.counters["samples"] = (double)Profiler::shared()->getNumSamples();
+    state.counters["dropped"] = (double)Profiler::shared()->getNumDropped();
+    Profiler::shared()->stop(BENCH_PROFILER_PREFIX);
+    unlink(BENCH_PROFILER_PREFIX ".bench.folded");
+    unlink(BENCH_PROFILER_PREFIX ".shard-0.folded");
+    unlink(BENCH_PROFILER_PREFIX ".shard-1.folded");
+  }
+  Profiler::shared()->unregisterThread();
+}
+BENCHMARK(BM_ProfilerTickThroughput)
+    ->Arg(0)
+    ->Arg(PROFILER_DEFAULT_HZ)
+    ->Arg(PROFILER_MAX_HZ)
+    ->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,118 @@
+/**
+ * @file    bench/RenewalBench.cpp
+ * @brief   Registration renewal benchmarks
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmark harness
+#include "Benchmark.h"
+
+// fixture and PT stub counters
+#include "BenchFixture.h"
+#include "pt_stubs.h"
+
+// system includes
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+// Tunables for the renewal benchmarks
+#define BENCH_RENEWAL_CONFIG_FILE "./renewal-bench.conf"
+#define BENCH_RENEWAL_LIFETIME 4     // seconds (renewals start at half of it)
+#define BENCH_RENEWAL_LIFETIMES 3    // lifetimes observed per run
+#define BENCH_RENEWAL_BUCKET_MS 100  // renewal load is counted per bucket
+#define BENCH_RENEWAL_SAMPLE_US 1000 // sampling interval
+
+// write a fleet of "n" devices that all register together
+static bool writeRenewalConfig(const char *path, long num_devices) {
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) {
+    return false;
+  }
+  fprintf(fp, "# generated benchmark fleet\n");
+  fprintf(fp, "defaults lifetime=%d poll_interval_ms=0\n",
+          BENCH_RENEWAL_LIFETIME);
+  for (long i = 0; i < num_devices; ++i) {
+    fprintf(fp, "device NonMbedDevice-%ld\n", i);
+  }
+  fclose(fp);
+  return true;
+}
+
+// "n" shadows registered at once, then left to renew for a few lifetimes. The
+// renewal load (registrations per bucket) should stay flat: a fleet renewing
+// in lock step would put all "n" into a single bucket every lifetime
+static void BM_RenewalLoad(benchmark::State &state) {
+  long num_devices = state.range(0);
+  if (writeRenewalConfig(BENCH_RENEWAL_CONFIG_FILE, num_devices) == false) {
+    state.SkipWithError("unable to write the configuration");
+    return;
+  }
+  BenchFixture fixture(BENCH_RENEWAL_CONFIG_FILE, 2);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadows");
+    return;
+  }
+  int num_buckets =
+      BENCH_RENEWAL_LIFETIMES * BENCH_RENEWAL_LIFETIME * 1000 /
+      BENCH_RENEWAL_BUCKET_MS;
+  std::vector<unsigned long> buckets(num_buckets, 0);
+  while (state.KeepRunning()) {
+    // sample the registration count (everything after connect() is a renewal)
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned long last = PT_STUB_COUNT(pt_stub_num_registrations);
+    for (;;) {
+      usleep(BENCH_RENEWAL_SAMPLE_US);
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      long elapsed_ms = (now.tv_sec - start.tv_sec) * 1000L +
+                        (now.tv_nsec - start.tv_nsec) / 1000000L;
+      if (elapsed_ms / BENCH_RENEWAL_BUCKET_MS >= num_buckets) {
+        break;
+      }
+      unsigned long current = PT_STUB_COUNT(pt_stub_num_registrations);
+      buckets[elapsed_ms / BENCH_RENEWAL_BUCKET_MS] += current - last;
+      last = current;
+    }
+  }
+
+  // load once renewals have started (from half of the first lifetime)
+  int first = BENCH_RENEWAL_LIFETIME * 1000 * SHARD_RENEWAL_MIN_PERCENT / 100 /
+              BENCH_RENEWAL_BUCKET_MS;
+  unsigned long total = 0, peak = 0;
+  for (int i = first; i < num_buckets; ++i) {
+    total += buckets[i];
+    if (buckets[i] > peak) {
+      peak = buckets[i];
+    }
+  }
+  double mean = (double)total / (num_buckets - first);
+  state.SetItemsProcessed(total);
+  state.counters["renewals"] =
+      (double)fixture.getOrchestrator()->getNumRenewals();
+  state.counters["mean_per_bucket"] = mean;
+  state.counters["peak_per_bucket"] = (double)peak;
+  state.counters["peak_to_mean"] = (mean > 0) ? peak / mean : 0;
+  unlink(BENCH_RENEWAL_CONFIG_FILE);
+}
+BENCHMARK(BM_RenewalLoad)
+    ->Arg(1000)
+    ->Arg(10000)
+    ->Iterations(1)
+    ->Unit(benchmark::kMillisecond);
@@ -0,0 +1,165 @@
+/**
+ * @file    bench/RulesEngineBench.cpp
+ * @brief   Local rules engine benchmarks
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Benchmark harness
+#include "Benchmark.h"
+
+// fixture
+#include "BenchFixture.h"
+
+// rules engine
+#include "RulesEngine.h"
+
+// system includes
+#include <sched.h>
+#include <stdio.h>
+
+// registry
+#include <string>
+
+// Tunables for the rules engine benchmarks
+#define BENCH_RULES_THRESHOLD 50 // counter threshold used by the rules
+
+// one rule per device: "counter > threshold" switches the device on
+static std::string buildRules(int num_rules, const char *prefix) {
+  std::string rules;
+  char line[256];
+  for (int i = 0; i < num_rules; ++i) {
+    snprintf(line, sizeof(line),
+             "rule r%d when %s-%d:123/0/4567 > %d then %s-%d:311/0/5850 = 1 "
+             "else %s-%d:311/0/5850 = 0\n",
+             i, prefix, i, BENCH_RULES_THRESHOLD, prefix, i, prefix, i);
+    rules += line;
+  }
+  return rules;
+}
+
+// bytecode evaluation of a single (arithmetic + logic) condition
+static void BM_RuleEvaluate(benchmark::State &state) {
+  RulesEngine engine(NULL, NULL);
+  const char *rules = "rule r0 when (RuleDev-0:1/0/1 + RuleDev-0:1/0/2) * 2 "
+                      "> 100 && RuleDev-0:1/0/3 != 0 then RuleDev-0:1/0/4 = "
+                      "RuleDev-0:1/0/1 % 7\n";
+  if (engine.parse(rules, strlen(rules)) == false) {
+    state.SkipWithError("unable to compile the rule");
+    return;
+  }
+  endpoint_handle_t endpoint = EndpointTable::shared()->find("RuleDev-0");
+  engine.updateValue(endpoint, 1, 0, 2, 10);
+  engine.updateValue(endpoint, 1, 0, 3, 1);
+  long value = 0;
+  while (state.KeepRunning()) {
+    // each update re-evaluates the one rule that reads the resource
+    engine.updateValue(endpoint, 1, 0, 1, ++value & 63);
+    engine.flushActions();
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["actions"] = (double)engine.getNumActions();
+}
+BENCHMARK(BM_RuleEvaluate);
+
+// incremental evaluation: one resource change among "n" rules (only the
+// rules reading the changed resource are evaluated)
+static void BM_RulesIncremental(benchmark::State &state) {
+  RulesEngine engine(NULL, NULL);
+  int num_rules = (int)state.range(0);
+  std::string rules = buildRules(num_rules, "RuleFleet");
+  if (engine.parse(rules.c_str(), rules.length()) == false) {
+    state.SkipWithError("unable to compile the rules");
+    return;
+  }
+  std::vector<endpoint_handle_t> endpoints(num_rules);
+  for (int i = 0; i < num_rules; ++i) {
+    char endpoint_id[64];
+    snprintf(endpoint_id, sizeof(endpoint_id), "RuleFleet-%d", i);
+    endpoints[i] = EndpointTable::shared()->find(endpoint_id);
+  }
+  uint64_t evaluations_before = engine.getNumEvaluations();
+  long value = 0;
+  while (state.KeepRunning()) {
+    // counters climb through the threshold (one switch write per crossing)
+    ++value;
+    engine.updateValue(endpoints[value % num_rules], COUNTER_OBJECT_ID, 0,
+                       COUNTER_RESOURCE_ID, (value / num_rules) % 100);
+    engine.flushActions();
+  }
+  state.SetItemsProcessed(state.iterations());
+  if (state.iterations() > 0) {
+    state.counters["evaluations_per_update"] =
+        (double)(engine.getNumEvaluations() - evaluations_before) /
+        state.iterations();
+  }
+  state.counters["actions"] = (double)engine.getNumActions();
+}
+BENCHMARK(BM_RulesIncremental)->Arg(10)->Arg(1000)->Arg(100000);
+
+// counter change on one shadow -> rule -> switch write on another, through
+// the subscriptions, the engine thread and the shards
+static void BM_RuleRoundTrip(benchmark::State &state) {
+  BenchFixture fixture(2, 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadows");
+    return;
+  }
+  Orchestrator *orchestrator = fixture.getOrchestrator();
+  DeviceShadow *source = fixture.getDeviceShadow(0);
+  DeviceShadow *target = fixture.getDeviceShadow(1);
+  char rules[256];
+  snprintf(rules, sizeof(rules),
+           "rule follow when %s:123/0/4567 > %d then %s:311/0/5850 = 1 else "
+           "%s:311/0/5850 = 0\n",
+           source->getEndpointID(), BENCH_RULES_THRESHOLD,
+           target->getEndpointID(), target->getEndpointID());
+  RulesEngine engine(orchestrator, NULL);
+  if (engine.parse(rules, strlen(rules)) == false || engine.start() == false) {
+    state.SkipWithError("unable to start the rules engine");
+    return;
+  }
+
+  // the engine attaches (and evaluates the rule once) when it starts
+  long switch_state = -1;
+  while (orchestrator->readResourceValue(target->getEndpointID(),
+                                         SWITCH_OBJECT_ID, 0,
+                                         SWITCH_RESOURCE_ID,
+                                         &switch_state) == false ||
+         engine.getNumActions() == 0) {
+    sched_yield();
+  }
+
+  long expected = 0;
+  while (state.KeepRunning()) {
+    expected ^= 1;
+    // (through the shard... it has seen our subscription by then)
+    orchestrator->processTick(source,
+                              (expected == 1) ? (BENCH_RULES_THRESHOLD + 1) : 0);
+    do {
+      sched_yield();
+      orchestrator->readResourceValue(target->getEndpointID(),
+                                      SWITCH_OBJECT_ID, 0, SWITCH_RESOURCE_ID,
+                                      &switch_state);
+    } while (switch_state != expected);
+  }
+  engine.stop();
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RuleRoundTrip)->Unit(benchmark::kMicrosecond);
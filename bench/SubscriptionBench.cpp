@@ -0,0 +1,158 @@
+/**
+ * @file    bench/SubscriptionBench.cpp
+ * @brief   Local subscription (observe/notify) benchmarks
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Benchmark harness
+#include "Benchmark.h"
+
+// fixture
+#include "BenchFixture.h"
+
+// subscriptions
+#include "Subscription.h"
+
+// system includes
+#include <pthread.h>
+#include <sched.h>
+
+// Tunables for the subscription benchmarks
+#define BENCH_SUBSCRIPTION_CAPACITY 1024 // notifications queued per subscriber
+
+// a consumer thread draining its subscriptions as fast as it can
+typedef struct bench_consumer {
+  std::vector<Subscription *> *subscriptions;
+  uint64_t num_received;
+  volatile bool running;
+  pthread_t thread;
+} bench_consumer_t;
+
+// consumer thread
+static void *consumerThread(void *ctx) {
+  bench_consumer_t *consumer = (bench_consumer_t *)ctx;
+  resource_notification_t notification;
+  while (consumer->running == true) {
+    bool received = false;
+    for (size_t i = 0; i < consumer->subscriptions->size(); ++i) {
+      while ((*consumer->subscriptions)[i]->poll(&notification) == true) {
+        ++consumer->num_received;
+        received = true;
+      }
+    }
+    if (received == false) {
+      sched_yield();
+    }
+  }
+  return NULL;
+}
+
+// counter updates on one shadow fanned out to "n" local subscribers (0 is the
+// cost of the hook with nobody listening)
+static void BM_NotifyFanout(benchmark::State &state) {
+  BenchFixture fixture(1, 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadow");
+    return;
+  }
+  DeviceShadow *shadow = fixture.getDeviceShadow(0);
+
+  // the shard is idle (nothing ticks), so we can attach directly
+  std::vector<Subscription *> subscriptions;
+  for (int i = 0; i < (int)state.range(0); ++i) {
+    Subscription *subscription = new Subscription(
+        shadow->getEndpointID(), COUNTER_OBJECT_ID, 0, COUNTER_RESOURCE_ID,
+        BENCH_SUBSCRIPTION_CAPACITY);
+    subscriptions.push_back(subscription);
+    shadow->subscribe(subscription);
+  }
+  bench_consumer_t consumer;
+  consumer.subscriptions = &subscriptions;
+  consumer.num_received = 0;
+  consumer.running = true;
+  pthread_create(&consumer.thread, NULL, consumerThread, &consumer);
+
+  int value = 0;
+  while (state.KeepRunning()) {
+    shadow->updateCounterResourceValue(++value);
+  }
+  consumer.running = false;
+  pthread_join(consumer.thread, NULL);
+
+  // drops are the consumer falling behind (never the producer waiting)
+  uint64_t num_dropped = 0;
+  for (size_t i = 0; i < subscriptions.size(); ++i) {
+    num_dropped += subscriptions[i]->getNumDropped();
+    shadow->unsubscribe(subscriptions[i]);
+    delete subscriptions[i];
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["subscribers"] = (double)subscriptions.size();
+  state.counters["received"] = (double)consumer.num_received;
+  state.counters["dropped"] = (double)num_dropped;
+}
+BENCHMARK(BM_NotifyFanout)->Arg(0)->Arg(1)->Arg(8);
+
+// write -> notification round trip through Orchestrator::subscribe() and the
+// owning shard
+static void BM_SubscriptionRoundTrip(benchmark::State &state) {
+  BenchFixture fixture(1, 1);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadow");
+    return;
+  }
+  Orchestrator *orchestrator = fixture.getOrchestrator();
+  DeviceShadow *shadow = fixture.getDeviceShadow(0);
+  Subscription subscription(shadow->getEndpointID(), SWITCH_OBJECT_ID,
+                            SUBSCRIPTION_ANY_ID, SWITCH_RESOURCE_ID,
+                            BENCH_SUBSCRIPTION_CAPACITY);
+  if (orchestrator->subscribe(&subscription) == false) {
+    state.SkipWithError("unable to subscribe");
+    return;
+  }
+
+  orchestrator_write_t write;
+  write.endpoint_id = shadow->getEndpointID();
+  write.write.object_id = SWITCH_OBJECT_ID;
+  write.write.instance_id = 0;
+  write.write.resource_id = SWITCH_RESOURCE_ID;
+  write.write.operation = OPERATION_WRITE;
+  write.write.value = 0;
+  resource_notification_t notification;
+  while (state.KeepRunning()) {
+    write.write.value ^= 1;
+    orchestrator->writeResources(&write, 1);
+    while (subscription.poll(&notification) == false) {
+      sched_yield();
+    }
+    if (notification.value != write.write.value) {
+      state.SkipWithError("unexpected notification value");
+      break;
+    }
+  }
+
+  // wait for the shard to let go before the subscription goes away
+  orchestrator->unsubscribe(&subscription);
+  while (subscription.isAttached() == true) {
+    sched_yield();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SubscriptionRoundTrip);
@@ -0,0 +1,212 @@
+/**
+ * @file    bench/TimeSeriesBench.cpp
+ * @brief   Time series (resource history) benchmarks
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Benchmark harness
+#include "Benchmark.h"
+
+// time series
+#include "TimeSeries.h"
+
+// system includes
+#include <pthread.h>
+#include <stdlib.h>
+
+// Tunables for the time series benchmarks
+#define BENCH_TIME_SERIES_INTERVAL_MS 1000 // nominal sample interval
+#define BENCH_TIME_SERIES_MAX_SAMPLES 65536 // query buffer
+
+// sample patterns
+enum BENCH_TIME_SERIES_PATTERN {
+  BENCH_PATTERN_COUNTER = 0, // regular interval, +1 per sample
+  BENCH_PATTERN_SENSOR       // jittered interval, random walk
+};
+
+// a deterministic sample generator
+typedef struct bench_generator {
+  int pattern;
+  int64_t timestamp_ms;
+  long value;
+  unsigned int seed;
+} bench_generator_t;
+
+// initialize a generator
+static void initializeGenerator(bench_generator_t *generator, int pattern) {
+  generator->pattern = pattern;
+  generator->timestamp_ms = 1500000000000LL;
+  generator->value = 2000;
+  generator->seed = 42;
+}
+
+// next sample
+static void nextSample(bench_generator_t *generator, int64_t *timestamp_ms,
+                       long *value) {
+  if (generator->pattern == BENCH_PATTERN_COUNTER) {
+    generator->timestamp_ms += BENCH_TIME_SERIES_INTERVAL_MS;
+    ++generator->value;
+  } else {
+    generator->timestamp_ms += BENCH_TIME_SERIES_INTERVAL_MS - 10 +
+                               (long)(rand_r(&generator->seed) % 21);
+    generator->value += (long)(rand_r(&generator->seed) % 7) - 3;
+  }
+  *timestamp_ms = generator->timestamp_ms;
+  *value = generator->value;
+}
+
+// fill a series (wraps the ring a few times)
+static void fillSeries(TimeSeries *series, bench_generator_t *generator,
+                       int num_samples) {
+  int64_t timestamp_ms = 0;
+  long value = 0;
+  for (int i = 0; i < num_samples; ++i) {
+    nextSample(generator, &timestamp_ms, &value);
+    series->append(timestamp_ms, value);
+  }
+}
+
+// report the compression achieved over a raw (timestamp, value) array
+static void reportCompression(benchmark::State &state, TimeSeries *series) {
+  if (series->getNumBytes() > 0) {
+    state.counters["samples_retained"] = (double)series->getNumSamples();
+    state.counters["bytes_per_sample"] =
+        (double)series->getNumBytes() / series->getNumSamples();
+    state.counters["compression_ratio"] =
+        (double)(series->getNumSamples() * sizeof(time_series_sample_t)) /
+        series->getNumBytes();
+  }
+}
+
+// append (writer path) and the resulting compression
+static void BM_TimeSeriesAppend(benchmark::State &state) {
+  TimeSeries series;
+  series.reset(1, 0, 1);
+  bench_generator_t generator;
+  initializeGenerator(&generator, (int)state.range(0));
+  int64_t timestamp_ms = 0;
+  long value = 0;
+  while (state.KeepRunning()) {
+    nextSample(&generator, &timestamp_ms, &value);
+    series.append(timestamp_ms, value);
+  }
+  state.SetItemsProcessed(state.iterations());
+  reportCompression(state, &series);
+}
+BENCHMARK(BM_TimeSeriesAppend)
+    ->Arg(BENCH_PATTERN_COUNTER)
+    ->Arg(BENCH_PATTERN_SENSOR);
+
+// decode every retained sample (checked against the generator)
+static void BM_TimeSeriesQuery(benchmark::State &state) {
+  TimeSeries series;
+  series.reset(1, 0, 1);
+  bench_generator_t generator;
+  initializeGenerator(&generator, (int)state.range(0));
+  fillSeries(&series, &generator, 100000);
+  std::vector<time_series_sample_t> samples(BENCH_TIME_SERIES_MAX_SAMPLES);
+  int num_samples = 0;
+  while (state.KeepRunning()) {
+    num_samples = series.query(1, 0, 1, 0, INT64_MAX, &samples[0],
+                               (int)samples.size());
+  }
+  if (num_samples != (int)series.getNumSamples() ||
+      samples[num_samples - 1].timestamp_ms != generator.timestamp_ms ||
+      samples[num_samples - 1].value != generator.value) {
+    state.SkipWithError("decoded samples do not match");
+    return;
+  }
+  state.SetItemsProcessed(state.iterations() * num_samples);
+  reportCompression(state, &series);
+}
+BENCHMARK(BM_TimeSeriesQuery)
+    ->Arg(BENCH_PATTERN_COUNTER)
+    ->Arg(BENCH_PATTERN_SENSOR);
+
+// min/max/mean over the whole history (block summaries only) vs. a window
+// cutting through blocks (those are decoded)
+static void BM_TimeSeriesAggregate(benchmark::State &state) {
+  TimeSeries series;
+  series.reset(1, 0, 1);
+  bench_generator_t generator;
+  initializeGenerator(&generator, BENCH_PATTERN_SENSOR);
+  fillSeries(&series, &generator, 100000);
+  int64_t from_ms = 0;
+  int64_t to_ms = INT64_MAX;
+  if (state.range(0) != 0) {
+    // the last ~5 minutes
+    to_ms = generator.timestamp_ms - 30 * BENCH_TIME_SERIES_INTERVAL_MS;
+    from_ms = to_ms - 300 * BENCH_TIME_SERIES_INTERVAL_MS;
+  }
+  time_series_aggregate_t aggregate;
+  while (state.KeepRunning()) {
+    series.aggregate(1, 0, 1, from_ms, to_ms, &aggregate);
+    benchmark::DoNotOptimize(aggregate.mean);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["samples_aggregated"] = (double)aggregate.count;
+}
+BENCHMARK(BM_TimeSeriesAggregate)->Arg(0)->Arg(1);
+
+// a writer appending as fast as it can
+typedef struct bench_appender {
+  TimeSeries *series;
+  bench_generator_t generator;
+  volatile bool running;
+  pthread_t thread;
+} bench_appender_t;
+
+// appender thread
+static void *appenderThread(void *ctx) {
+  bench_appender_t *appender = (bench_appender_t *)ctx;
+  int64_t timestamp_ms = 0;
+  long value = 0;
+  while (appender->running == true) {
+    nextSample(&appender->generator, &timestamp_ms, &value);
+    appender->series->append(timestamp_ms, value);
+  }
+  return NULL;
+}
+
+// readers never lock the writer out (nor wait on it... beyond a retried
+// block copy)
+static void BM_TimeSeriesConcurrentAggregate(benchmark::State &state) {
+  TimeSeries series;
+  series.reset(1, 0, 1);
+  bench_appender_t appender;
+  appender.series = &series;
+  initializeGenerator(&appender.generator, BENCH_PATTERN_SENSOR);
+  fillSeries(&series, &appender.generator, 10000);
+  appender.running = true;
+  pthread_create(&appender.thread, NULL, appenderThread, &appender);
+  time_series_aggregate_t aggregate;
+  while (state.KeepRunning()) {
+    series.aggregate(1, 0, 1, 0, INT64_MAX, &aggregate);
+    benchmark::DoNotOptimize(aggregate.mean);
+  }
+  appender.running = false;
+  pthread_join(appender.thread, NULL);
+  state.SetItemsProcessed(state.iterations());
+  if (state.iterations() > 0) {
+    state.counters["retries_per_query"] =
+        (double)series.getNumReadRetries() / state.iterations();
+  }
+}
+BENCHMARK(BM_TimeSeriesConcurrentAggregate);
@@ -0,0 +1,126 @@
+/**
+ * @file    bench/TraceBench.cpp
+ * @brief   Per-device tracing benchmarks
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Benchmark harness
+#include "Benchmark.h"
+
+// fixture
+#include "BenchFixture.h"
+
+// Tracer
+#include "Tracer.h"
+
+// system includes
+#include <sched.h>
+#include <unistd.h>
+
+// Tunables for the tracing benchmarks
+#define BENCH_TRACE_NUM_SHADOWS 1024 // shadows ticked through the shards
+#define BENCH_TRACE_TICKS_PER_ITER 1024 // ticks enqueued per iteration
+#define BENCH_TRACE_EXPORT_FILE "./trace-bench.json"
+
+// tick throughput through two shards with tracing off (0) or 1 in "n" devices
+// traced... the cost of tracing at the default sampling should be lost in the
+// noise
+static void BM_TraceTickThroughput(benchmark::State &state) {
+  BenchFixture fixture(BENCH_TRACE_NUM_SHADOWS, 2);
+  if (fixture.connect() == false) {
+    state.SkipWithError("unable to register the shadows");
+    return;
+  }
+  Orchestrator *orchestrator = fixture.getOrchestrator();
+  std::vector<DeviceShadow *> shadows;
+  for (int i = 0; i < fixture.getNumDeviceShadows(); ++i) {
+    shadows.push_back(fixture.getDeviceShadow(i));
+  }
+  Tracer::shared()->setSampling((unsigned int)state.range(0));
+  uint64_t spans_before = Tracer::shared()->getNumSpans();
+  int value = 0;
+  while (state.KeepRunning()) {
+    uint64_t target =
+        orchestrator->getNumEventsProcessed() + BENCH_TRACE_TICKS_PER_ITER;
+    for (int i = 0; i < BENCH_TRACE_TICKS_PER_ITER; ++i) {
+      orchestrator->processTick(shadows[i % shadows.size()], ++value);
+    }
+    while (orchestrator->getNumEventsProcessed() < target) {
+      sched_yield();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * BENCH_TRACE_TICKS_PER_ITER);
+  state.counters["spans"] =
+      (double)(Tracer::shared()->getNumSpans() - spans_before);
+  Tracer::shared()->setSampling(0);
+}
+BENCHMARK(BM_TraceTickThroughput)
+    ->Arg(0)
+    ->Arg(TRACE_DEFAULT_SAMPLE_EVERY)
+    ->Arg(1)
+    ->Unit(benchmark::kMicrosecond);
+
+// a span site: a device that is not traced (0) or one that is (1)
+static void BM_TraceSpan(benchmark::State &state) {
+  Tracer::shared()->setSampling(TRACE_DEFAULT_SAMPLE_EVERY);
+  endpoint_handle_t endpoint = 0;
+  while (Tracer::shared()->isSampled(endpoint) != (state.range(0) != 0)) {
+    ++endpoint;
+  }
+  while (state.KeepRunning()) {
+    TraceScope scope(TRACE_SPAN_DEVICE_SET, endpoint);
+    benchmark::DoNotOptimize(endpoint);
+  }
+  state.SetItemsProcessed(state.iterations());
+  Tracer::shared()->setSampling(0);
+}
+BENCHMARK(BM_TraceSpan)->Arg(0)->Arg(1);
+
+// export of a full buffer (arg: number of threads that recorded one)
+static void *fillTraceBuffer(void *ctx) {
+  Tracer::setThreadName("bench-trace");
+  for (int i = 0; i < TRACE_BUFFER_EVENTS; ++i) {
+    uint64_t now = Tracer::now();
+    Tracer::shared()->complete(TRACE_SPAN_PT_WRITE_VALUE, 0, now, now + 1000);
+  }
+  return NULL;
+}
+static void BM_TraceExport(benchmark::State &state) {
+  Tracer::shared()->setSampling(1);
+  std::vector<pthread_t> threads(state.range(0));
+  for (size_t i = 0; i < threads.size(); ++i) {
+    pthread_create(&threads[i], NULL, &fillTraceBuffer, NULL);
+  }
+  for (size_t i = 0; i < threads.size(); ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  Tracer::shared()->setSampling(0);
+  while (state.KeepRunning()) {
+    if (Tracer::shared()->exportTo(BENCH_TRACE_EXPORT_FILE) == false) {
+      state.SkipWithError("unable to export the trace");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0) *
+                          TRACE_BUFFER_EVENTS);
+  unlink(BENCH_TRACE_EXPORT_FILE);
+}
+BENCHMARK(BM_TraceExport)->Arg(1)->Arg(4)->Iterations(3)->Unit(
+    benchmark::kMillisecond);
@@ -0,0 +1,177 @@
+/**
+ * @file    ValueCacheBench.cpp
+ * @brief   mbed Edge Orchestrator benchmarks - resource value cache
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmark harness
+#include "Benchmark.h"
+
+// value cache
+#include "ValueCache.h"
+
+// system includes
+#include <pthread.h>
+#include <string.h>
+
+// Tunables for the value cache benchmarks
+#define BENCH_VALUE_CACHE_NUM_VALUES 8 // resources per cached shadow
+
+// a writer thread publishing as fast as it can
+typedef struct bench_writer {
+  ValueCache *cache;
+  pthread_mutex_t *mutex; // mutex baseline only
+  long *values;           // mutex baseline only
+  volatile bool running;
+  pthread_t thread;
+} bench_writer_t;
+
+// populate a cache with our resources
+static void initializeCache(ValueCache *cache) {
+  value_cache_entry_t entries[BENCH_VALUE_CACHE_NUM_VALUES];
+  for (int i = 0; i < BENCH_VALUE_CACHE_NUM_VALUES; ++i) {
+    entries[i].object_id = 123;
+    entries[i].instance_id = 0;
+    entries[i].resource_id = 4567 + i;
+    entries[i].value = 0;
+  }
+  cache->reset(entries, BENCH_VALUE_CACHE_NUM_VALUES);
+}
+
+// writer thread
+static void *writerThread(void *ctx) {
+  bench_writer_t *writer = (bench_writer_t *)ctx;
+  long value = 0;
+  while (writer->running == true) {
+    ++value;
+    int index = (int)(value % BENCH_VALUE_CACHE_NUM_VALUES);
+    if (writer->cache != NULL) {
+      writer->cache->publish(123, 0, 4567 + index, value);
+    } else {
+      pthread_mutex_lock(writer->mutex);
+      writer->values[index] = value;
+      pthread_mutex_unlock(writer->mutex);
+    }
+  }
+  return NULL;
+}
+
+// start/stop "n" writer threads
+static void startWriters(bench_writer_t *writers, int num_writers) {
+  for (int i = 0; i < num_writers; ++i) {
+    writers[i].running = true;
+    pthread_create(&writers[i].thread, NULL, writerThread, &writers[i]);
+  }
+}
+static void stopWriters(bench_writer_t *writers, int num_writers) {
+  for (int i = 0; i < num_writers; ++i) {
+    writers[i].running = false;
+    pthread_join(writers[i].thread, NULL);
+  }
+}
+
+// single value reads with "n" concurrent writers
+static void BM_ValueCacheRead(benchmark::State &state) {
+  ValueCache cache;
+  initializeCache(&cache);
+  int num_writers = (int)state.range(0);
+  bench_writer_t writers[2];
+  memset(writers, 0, sizeof(writers));
+  for (int i = 0; i < num_writers; ++i) {
+    writers[i].cache = &cache;
+  }
+  uint64_t version_before = cache.getVersion();
+  startWriters(writers, num_writers);
+  long value = 0;
+  int index = 0;
+  while (state.KeepRunning()) {
+    cache.read(123, 0, 4567 + index, &value);
+    benchmark::DoNotOptimize(value);
+    index = (index + 1) % BENCH_VALUE_CACHE_NUM_VALUES;
+  }
+  stopWriters(writers, num_writers);
+  state.SetItemsProcessed(state.iterations());
+  state.counters["versions_published"] =
+      (double)(cache.getVersion() - version_before);
+  state.counters["retired_pending"] = (double)cache.getNumRetired();
+}
+BENCHMARK(BM_ValueCacheRead)->Arg(0)->Arg(1)->Arg(2);
+
+// consistent multi-resource view with "n" concurrent writers
+static void BM_ValueCacheSnapshot(benchmark::State &state) {
+  ValueCache cache;
+  initializeCache(&cache);
+  int num_writers = (int)state.range(0);
+  bench_writer_t writers[2];
+  memset(writers, 0, sizeof(writers));
+  for (int i = 0; i < num_writers; ++i) {
+    writers[i].cache = &cache;
+  }
+  startWriters(writers, num_writers);
+  value_cache_snapshot_t snapshot;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(cache.snapshot(&snapshot));
+  }
+  stopWriters(writers, num_writers);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ValueCacheSnapshot)->Arg(0)->Arg(1)->Arg(2);
+
+// baseline: the same reads under a mutex shared with the writers
+static void BM_ValueCacheReadMutexBaseline(benchmark::State &state) {
+  pthread_mutex_t mutex;
+  pthread_mutex_init(&mutex, NULL);
+  long values[BENCH_VALUE_CACHE_NUM_VALUES];
+  memset(values, 0, sizeof(values));
+  int num_writers = (int)state.range(0);
+  bench_writer_t writers[2];
+  memset(writers, 0, sizeof(writers));
+  for (int i = 0; i < num_writers; ++i) {
+    writers[i].mutex = &mutex;
+    writers[i].values = values;
+  }
+  startWriters(writers, num_writers);
+  int index = 0;
+  while (state.KeepRunning()) {
+    pthread_mutex_lock(&mutex);
+    long value = values[index];
+    pthread_mutex_unlock(&mutex);
+    benchmark::DoNotOptimize(value);
+    index = (index + 1) % BENCH_VALUE_CACHE_NUM_VALUES;
+  }
+  stopWriters(writers, num_writers);
+  pthread_mutex_destroy(&mutex);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ValueCacheReadMutexBaseline)->Arg(0)->Arg(1)->Arg(2);
+
+// publish cost (copy + swap + reclaim) with no readers
+static void BM_ValueCachePublish(benchmark::State &state) {
+  ValueCache cache;
+  initializeCache(&cache);
+  long value = 0;
+  while (state.KeepRunning()) {
+    ++value;
+    cache.publish(123, 0, 4567 + (int)(value % BENCH_VALUE_CACHE_NUM_VALUES),
+                  value);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["retired_pending"] = (double)cache.getNumRetired();
+}
+BENCHMARK(BM_ValueCachePublish);
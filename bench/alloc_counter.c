@@ -0,0 +1,82 @@
+/**
+ * @file    alloc_counter.c
+ * @brief   mbed Edge Orchestrator benchmarks - heap allocation counter (glibc)
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+
+// the sanitizer owns malloc()... no counting
+int alloc_counter_supported(void) { return 0; }
+void alloc_counter_begin(void) {}
+unsigned long alloc_counter_end(void) { return 0; }
+
+#else
+
+// glibc's allocator (what we forward to)
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+// per-thread counting state
+static __thread int alloc_counter_counting = 0;
+static __thread unsigned long alloc_counter_count = 0;
+
+// count an allocation made by this thread
+static inline void alloc_counter_count_one(void) {
+  if (alloc_counter_counting != 0) {
+    ++alloc_counter_count;
+  }
+}
+
+void *malloc(size_t size) {
+  alloc_counter_count_one();
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  alloc_counter_count_one();
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  alloc_counter_count_one();
+  return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) { __libc_free(ptr); }
+
+int alloc_counter_supported(void) { return 1; }
+
+// start counting this thread's allocations
+void alloc_counter_begin(void) {
+  alloc_counter_count = 0;
+  alloc_counter_counting = 1;
+}
+
+// stop counting... returns the number of allocations made since begin
+unsigned long alloc_counter_end(void) {
+  alloc_counter_counting = 0;
+  return alloc_counter_count;
+}
+
+#endif
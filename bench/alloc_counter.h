@@ -0,0 +1,34 @@
+/**
+ * @file    alloc_counter.h
+ * @brief   mbed Edge Orchestrator benchmarks - heap allocation counter
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __ALLOC_COUNTER_H__
+#define __ALLOC_COUNTER_H__
+
+// Counts the heap allocations (malloc/calloc/realloc... and so operator new)
+// made by the calling thread between begin and end. malloc() is interposed
+// for the whole benchmark binary, except under a sanitizer (which has its
+// own allocator): alloc_counter_supported() is then false.
+extern "C" int alloc_counter_supported(void);
+extern "C" void alloc_counter_begin(void);
+extern "C" unsigned long alloc_counter_end(void);
+
+#endif // __ALLOC_COUNTER_H__
@@ -0,0 +1,42 @@
+/**
+ * @file    main.cpp
+ * @brief   mbed Edge Orchestrator Sample - benchmark entry
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Benchmark harness
+#include "Benchmark.h"
+
+// PT stub counters
+#include "pt_stubs.h"
+
+// system includes
+#include <stdio.h>
+
+// main entry point... fails the run if any benchmark made a PT call off its
+// connection's event loop thread
+int main(int argc, char **argv) {
+  int status = benchmark::RunSpecifiedBenchmarks(argc, argv);
+  if (PT_STUB_COUNT(pt_stub_num_foreign_calls) > 0) {
+    printf("ERROR. %lu PT call(s) made off their PT event loop thread\n",
+           pt_stub_num_foreign_calls);
+    return 1;
+  }
+  return status;
+}
@@ -0,0 +1,523 @@
+/**
+ * @file    pt_stubs.c
+ * @brief   Offline PT client stubs for the benchmarks
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * These replace the parts of libpt-client that the Orchestrator and
+ * DeviceShadow use so that the hot paths can be benchmarked without an
+ * edge-core: the object model is built for real, registration/writes succeed
+ * and pt_client_start() "connects" and then runs a small event loop until
+ * pt_client_shutdown() is called on that connection (several may be open at
+ * once, one per PT thread). As with the real client, the responses are not
+ * made from within the calls: they are queued and made by the connection's
+ * event loop, as is anything handed to pt_api_send_to_event_loop(). A PT call
+ * made from any other thread than the connection's event loop is counted
+ * (pt_stub_num_foreign_calls) since the real client is not thread-safe.
+ * pt_stub_set_write_delay() turns the stub into a slow consumer: write
+ * completions are then queued and acknowledged one at a time by a separate
+ * thread.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ns_list.h"
+#include "pt-client/pt_api.h"
+#include "pt-client/pt_device_object.h"
+
+// call counters (see pt_stubs.h)
+unsigned long pt_stub_num_writes = 0;
+unsigned long pt_stub_num_registrations = 0;
+unsigned long pt_stub_num_deregistrations = 0;
+unsigned long pt_stub_num_foreign_calls = 0;
+
+// a response queued for a connection's event loop
+typedef struct pt_stub_response {
+  pt_device_response_handler device_handler;
+  pt_response_handler handler;
+  char *device_id;
+  void *userdata;
+  struct pt_stub_response *next;
+} pt_stub_response_t;
+
+// "connection" state: a slot per open connection (slots are reused but never
+// freed, so a late pt_client_shutdown() is harmless). Hand-offs to the event
+// loop go in a fixed table... handing off must not allocate
+#define PT_STUB_MAX_CONNECTIONS 64
+#define PT_STUB_MAX_HANDOFFS 16
+typedef struct pt_stub_connection {
+  int in_use;
+  int running;
+  int accepting; // responses are still made by the event loop
+  pthread_t thread;
+  pt_stub_response_t *responses_head;
+  pt_stub_response_t *responses_tail;
+  event_loop_callback_t handoffs[PT_STUB_MAX_HANDOFFS];
+  void *handoff_data[PT_STUB_MAX_HANDOFFS];
+  int num_handoffs;
+} pt_stub_connection_t;
+unsigned long pt_stub_num_connections = 0;
+static pthread_mutex_t pt_stub_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pt_stub_cond = PTHREAD_COND_INITIALIZER;
+static pt_stub_connection_t pt_stub_connections[PT_STUB_MAX_CONNECTIONS];
+
+// slow consumer: queued write completions
+typedef struct pt_stub_completion {
+  pt_stub_connection_t *stub;
+  pt_device_response_handler handler;
+  char *device_id;
+  void *userdata;
+  struct pt_stub_completion *next;
+} pt_stub_completion_t;
+unsigned long pt_stub_num_pending_writes = 0;
+unsigned long pt_stub_max_pending_writes = 0;
+static pthread_mutex_t pt_stub_consumer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pt_stub_consumer_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t pt_stub_consumer;
+static unsigned int pt_stub_write_delay_us = 0;
+static pt_stub_completion_t *pt_stub_completions_head = NULL;
+static pt_stub_completion_t *pt_stub_completions_tail = NULL;
+
+// queue a response for a connection's event loop (made at once, on the
+// calling thread, once that loop has gone)
+static void pt_stub_respond(pt_stub_connection_t *stub,
+                            pt_device_response_handler device_handler,
+                            pt_response_handler handler,
+                            const char *device_id, void *userdata) {
+  pthread_mutex_lock(&pt_stub_mutex);
+  if (stub->accepting == 0) {
+    pthread_mutex_unlock(&pt_stub_mutex);
+    if (device_handler != NULL) {
+      device_handler(device_id, userdata);
+    } else if (handler != NULL) {
+      handler(userdata);
+    }
+    return;
+  }
+  pt_stub_response_t *response =
+      (pt_stub_response_t *)calloc(1, sizeof(pt_stub_response_t));
+  response->device_handler = device_handler;
+  response->handler = handler;
+  response->device_id = (device_id != NULL) ? strdup(device_id) : NULL;
+  response->userdata = userdata;
+  if (stub->responses_tail != NULL) {
+    stub->responses_tail->next = response;
+  } else {
+    stub->responses_head = response;
+  }
+  stub->responses_tail = response;
+  pthread_cond_broadcast(&pt_stub_cond);
+  pthread_mutex_unlock(&pt_stub_mutex);
+}
+
+// a PT call: count it, check that it was made from the connection's event
+// loop and that the connection is still up
+static pt_status_t pt_stub_call(struct connection *connection,
+                                unsigned long *counter) {
+  pt_stub_connection_t *stub = (pt_stub_connection_t *)connection;
+  __sync_fetch_and_add(counter, 1);
+  if (stub == NULL) {
+    return PT_STATUS_NOT_CONNECTED;
+  }
+  if (pthread_equal(stub->thread, pthread_self()) == 0) {
+    __sync_fetch_and_add(&pt_stub_num_foreign_calls, 1);
+  }
+  pthread_mutex_lock(&pt_stub_mutex);
+  int running = stub->running;
+  pthread_mutex_unlock(&pt_stub_mutex);
+  return (running == 1) ? PT_STATUS_SUCCESS : PT_STATUS_NOT_CONNECTED;
+}
+
+pt_device_t *pt_create_device(char *device_id, const uint32_t lifetime,
+                              const queuemode_t queuemode,
+                              pt_status_t *status) {
+  pt_device_t *device = (pt_device_t *)calloc(1, sizeof(pt_device_t));
+  device->device_id = device_id; // ours now (as in PT)
+  device->lifetime = lifetime;
+  device->queuemode = queuemode;
+  device->objects = (pt_object_list_t *)calloc(1, sizeof(pt_object_list_t));
+  ns_list_init(device->objects);
+  *status = PT_STATUS_SUCCESS;
+  return device;
+}
+
+pt_object_t *pt_device_find_object(pt_device_t *device, uint16_t id) {
+  if (device == NULL) {
+    return NULL;
+  }
+  ns_list_foreach(pt_object_t, object, device->objects) {
+    if (object->id == id) {
+      return object;
+    }
+  }
+  return NULL;
+}
+
+pt_object_t *pt_device_add_object(pt_device_t *device, uint16_t id,
+                                  pt_status_t *status) {
+  pt_object_t *object = pt_device_find_object(device, id);
+  if (object != NULL) {
+    *status = PT_STATUS_ITEM_EXISTS;
+    return object;
+  }
+  object = (pt_object_t *)calloc(1, sizeof(pt_object_t));
+  object->id = id;
+  object->instances = (pt_object_instance_list_t *)calloc(
+      1, sizeof(pt_object_instance_list_t));
+  ns_list_init(object->instances);
+  ns_list_add_to_end(device->objects, object);
+  *status = PT_STATUS_SUCCESS;
+  return object;
+}
+
+pt_object_instance_t *pt_object_find_object_instance(pt_object_t *object,
+                                                     uint16_t id) {
+  if (object == NULL) {
+    return NULL;
+  }
+  ns_list_foreach(pt_object_instance_t, instance, object->instances) {
+    if (instance->id == id) {
+      return instance;
+    }
+  }
+  return NULL;
+}
+
+pt_object_instance_t *pt_object_add_object_instance(pt_object_t *object,
+                                                    uint16_t id,
+                                                    pt_status_t *status) {
+  pt_object_instance_t *instance = pt_object_find_object_instance(object, id);
+  if (instance != NULL) {
+    *status = PT_STATUS_ITEM_EXISTS;
+    return instance;
+  }
+  instance = (pt_object_instance_t *)calloc(1, sizeof(pt_object_instance_t));
+  instance->id = id;
+  instance->resources =
+      (pt_resource_list_t *)calloc(1, sizeof(pt_resource_list_t));
+  ns_list_init(instance->resources);
+  ns_list_add_to_end(object->instances, instance);
+  *status = PT_STATUS_SUCCESS;
+  return instance;
+}
+
+pt_resource_opaque_t *
+pt_object_instance_find_resource(pt_object_instance_t *instance, uint16_t id) {
+  if (instance == NULL) {
+    return NULL;
+  }
+  ns_list_foreach(pt_resource_opaque_t, resource, instance->resources) {
+    if (resource->id == id) {
+      return resource;
+    }
+  }
+  return NULL;
+}
+
+pt_resource_opaque_t *pt_object_instance_add_resource_with_callback(
+    pt_object_instance_t *instance, uint16_t id, Lwm2mResourceType type,
+    uint8_t operations, uint8_t *value, uint32_t value_size,
+    pt_status_t *status, pt_resource_callback callback) {
+  pt_resource_opaque_t *resource =
+      (pt_resource_opaque_t *)calloc(1, sizeof(pt_resource_opaque_t));
+  resource->id = id;
+  resource->type = type;
+  resource->operations = operations;
+  resource->value = value;
+  resource->value_size = value_size;
+  resource->callback = callback;
+  ns_list_add_to_end(instance->resources, resource);
+  *status = PT_STATUS_SUCCESS;
+  return resource;
+}
+
+void pt_device_free(pt_device_t *device) {
+  if (device == NULL) {
+    return;
+  }
+  ns_list_foreach_safe(pt_object_t, object, device->objects) {
+    ns_list_foreach_safe(pt_object_instance_t, instance, object->instances) {
+      ns_list_foreach_safe(pt_resource_opaque_t, resource,
+                           instance->resources) {
+        ns_list_remove(instance->resources, resource);
+        free(resource->value);
+        free(resource);
+      }
+      ns_list_remove(object->instances, instance);
+      free(instance->resources);
+      free(instance);
+    }
+    ns_list_remove(device->objects, object);
+    free(object->instances);
+    free(object);
+  }
+  free(device->objects);
+  free(device->device_id);
+  free(device);
+}
+
+pt_status_t ptdo_initialize_device_object(pt_device_t *device,
+                                          ptdo_device_object_data_t *data) {
+  pt_status_t status = PT_STATUS_SUCCESS;
+  pt_object_t *object = pt_device_add_object(device, 3, &status);
+  pt_object_instance_t *instance =
+      pt_object_add_object_instance(object, 0, &status);
+  char *values[] = {data->manufacturer,     data->model_number,
+                    data->serial_number,    data->firmware_version,
+                    data->hardware_version, data->software_version,
+                    data->device_type};
+  uint16_t ids[] = {0, 1, 2, 3, 18, 19, 17};
+  for (int i = 0; i < 7; ++i) {
+    pt_object_instance_add_resource_with_callback(
+        instance, ids[i], LWM2M_STRING, OPERATION_READ, (uint8_t *)values[i],
+        strlen(values[i]), &status, NULL);
+  }
+  pt_object_instance_add_resource_with_callback(
+      instance, 4, LWM2M_OPAQUE, OPERATION_EXECUTE, NULL, 0, &status,
+      data->reboot_callback);
+  return PT_STATUS_SUCCESS;
+}
+
+pt_status_t pt_register_device(struct connection *connection,
+                               pt_device_t *device,
+                               pt_device_response_handler success_handler,
+                               pt_device_response_handler failure_handler,
+                               void *userdata) {
+  pt_status_t status = pt_stub_call(connection, &pt_stub_num_registrations);
+  if (status == PT_STATUS_SUCCESS) {
+    pt_stub_respond((pt_stub_connection_t *)connection, success_handler, NULL,
+                    device->device_id, userdata);
+  }
+  return status;
+}
+
+pt_status_t pt_unregister_device(struct connection *connection,
+                                 pt_device_t *device,
+                                 pt_device_response_handler success_handler,
+                                 pt_device_response_handler failure_handler,
+                                 void *userdata) {
+  pt_status_t status = pt_stub_call(connection, &pt_stub_num_deregistrations);
+  if (status == PT_STATUS_SUCCESS) {
+    pt_stub_respond((pt_stub_connection_t *)connection, success_handler, NULL,
+                    device->device_id, userdata);
+  }
+  return status;
+}
+
+// slow consumer thread: acknowledge the queued writes, one per delay (once
+// the delay is cleared, whatever is left is acknowledged at once)
+static void *pt_stub_consume(void *ctx) {
+  pthread_mutex_lock(&pt_stub_consumer_mutex);
+  for (;;) {
+    while (pt_stub_completions_head == NULL && pt_stub_write_delay_us > 0) {
+      pthread_cond_wait(&pt_stub_consumer_cond, &pt_stub_consumer_mutex);
+    }
+    pt_stub_completion_t *completion = pt_stub_completions_head;
+    if (completion == NULL) {
+      break;
+    }
+    pt_stub_completions_head = completion->next;
+    if (pt_stub_completions_head == NULL) {
+      pt_stub_completions_tail = NULL;
+    }
+    --pt_stub_num_pending_writes;
+    unsigned int delay_us = pt_stub_write_delay_us;
+    pthread_mutex_unlock(&pt_stub_consumer_mutex);
+    if (delay_us > 0) {
+      usleep(delay_us);
+    }
+    pt_stub_respond(completion->stub, completion->handler, NULL,
+                    completion->device_id, completion->userdata);
+    free(completion->device_id);
+    free(completion);
+    pthread_mutex_lock(&pt_stub_consumer_mutex);
+  }
+  pthread_mutex_unlock(&pt_stub_consumer_mutex);
+  return NULL;
+}
+
+void pt_stub_set_write_delay(unsigned int delay_us) {
+  pthread_mutex_lock(&pt_stub_consumer_mutex);
+  unsigned int previous_us = pt_stub_write_delay_us;
+  pt_stub_write_delay_us = delay_us;
+  pt_stub_max_pending_writes = pt_stub_num_pending_writes;
+  pthread_cond_broadcast(&pt_stub_consumer_cond);
+  pthread_mutex_unlock(&pt_stub_consumer_mutex);
+  if (previous_us == 0 && delay_us > 0) {
+    pthread_create(&pt_stub_consumer, NULL, &pt_stub_consume, NULL);
+  } else if (previous_us > 0 && delay_us == 0) {
+    pthread_join(pt_stub_consumer, NULL);
+  }
+}
+
+pt_status_t pt_write_value(struct connection *connection, pt_device_t *device,
+                           pt_object_list_t *objects,
+                           pt_device_response_handler success_handler,
+                           pt_device_response_handler failure_handler,
+                           void *userdata) {
+  pt_status_t status = pt_stub_call(connection, &pt_stub_num_writes);
+  if (status != PT_STATUS_SUCCESS) {
+    return status;
+  }
+  pthread_mutex_lock(&pt_stub_consumer_mutex);
+  if (pt_stub_write_delay_us > 0) {
+    pt_stub_completion_t *completion =
+        (pt_stub_completion_t *)calloc(1, sizeof(pt_stub_completion_t));
+    completion->stub = (pt_stub_connection_t *)connection;
+    completion->handler = success_handler;
+    completion->device_id = strdup(device->device_id);
+    completion->userdata = userdata;
+    if (pt_stub_completions_tail != NULL) {
+      pt_stub_completions_tail->next = completion;
+    } else {
+      pt_stub_completions_head = completion;
+    }
+    pt_stub_completions_tail = completion;
+    if (++pt_stub_num_pending_writes > pt_stub_max_pending_writes) {
+      pt_stub_max_pending_writes = pt_stub_num_pending_writes;
+    }
+    pthread_cond_signal(&pt_stub_consumer_cond);
+    pthread_mutex_unlock(&pt_stub_consumer_mutex);
+    return PT_STATUS_SUCCESS;
+  }
+  pthread_mutex_unlock(&pt_stub_consumer_mutex);
+  pt_stub_respond((pt_stub_connection_t *)connection, success_handler, NULL,
+                  device->device_id, userdata);
+  return PT_STATUS_SUCCESS;
+}
+
+pt_status_t pt_register_protocol_translator(struct connection *connection,
+                                            pt_response_handler success_handler,
+                                            pt_response_handler failure_handler,
+                                            void *userdata) {
+  pt_stub_respond((pt_stub_connection_t *)connection, NULL, success_handler,
+                  NULL, userdata);
+  return PT_STATUS_SUCCESS;
+}
+
+pt_status_t pt_api_send_to_event_loop(struct connection *connection,
+                                      void *userdata,
+                                      event_loop_callback_t callback) {
+  pt_stub_connection_t *stub = (pt_stub_connection_t *)connection;
+  if (stub == NULL) {
+    return PT_STATUS_NOT_CONNECTED;
+  }
+  pthread_mutex_lock(&pt_stub_mutex);
+  if (stub->running == 0 || stub->num_handoffs == PT_STUB_MAX_HANDOFFS) {
+    pthread_mutex_unlock(&pt_stub_mutex);
+    return (stub->running == 0) ? PT_STATUS_NOT_CONNECTED : PT_STATUS_ERROR;
+  }
+  stub->handoffs[stub->num_handoffs] = callback;
+  stub->handoff_data[stub->num_handoffs] = userdata;
+  ++stub->num_handoffs;
+  pthread_cond_broadcast(&pt_stub_cond);
+  pthread_mutex_unlock(&pt_stub_mutex);
+  return PT_STATUS_SUCCESS;
+}
+
+int pt_client_start(const char *hostname, const int port, const char *name,
+                    const protocol_translator_callbacks_t *pt_cbs,
+                    void *userdata, struct connection **connection) {
+  pt_stub_connection_t *stub = NULL;
+  pthread_mutex_lock(&pt_stub_mutex);
+  for (int i = 0; i < PT_STUB_MAX_CONNECTIONS && stub == NULL; ++i) {
+    if (pt_stub_connections[i].in_use == 0) {
+      stub = &pt_stub_connections[i];
+    }
+  }
+  if (stub == NULL) {
+    pthread_mutex_unlock(&pt_stub_mutex);
+    return 1;
+  }
+  stub->in_use = 1;
+  stub->running = 1;
+  stub->accepting = 1;
+  stub->thread = pthread_self();
+  ++pt_stub_num_connections;
+  pthread_mutex_unlock(&pt_stub_mutex);
+  __atomic_store_n(connection, (struct connection *)stub, __ATOMIC_RELEASE);
+  if (pt_cbs->connection_ready_cb != NULL) {
+    pt_cbs->connection_ready_cb(*connection, userdata);
+  }
+
+  // "run" until we are shut down (and have made whatever is still queued)
+  event_loop_callback_t handoffs[PT_STUB_MAX_HANDOFFS];
+  void *handoff_data[PT_STUB_MAX_HANDOFFS];
+  pthread_mutex_lock(&pt_stub_mutex);
+  for (;;) {
+    while (stub->running == 1 && stub->responses_head == NULL &&
+           stub->num_handoffs == 0) {
+      pthread_cond_wait(&pt_stub_cond, &pt_stub_mutex);
+    }
+    if (stub->responses_head == NULL && stub->num_handoffs == 0) {
+      break;
+    }
+    pt_stub_response_t *responses = stub->responses_head;
+    stub->responses_head = NULL;
+    stub->responses_tail = NULL;
+    int num_handoffs = stub->num_handoffs;
+    memcpy(handoffs, stub->handoffs, num_handoffs * sizeof(handoffs[0]));
+    memcpy(handoff_data, stub->handoff_data,
+           num_handoffs * sizeof(handoff_data[0]));
+    stub->num_handoffs = 0;
+    pthread_mutex_unlock(&pt_stub_mutex);
+    for (int i = 0; i < num_handoffs; ++i) {
+      handoffs[i](handoff_data[i]);
+    }
+    while (responses != NULL) {
+      pt_stub_response_t *response = responses;
+      responses = response->next;
+      if (response->device_handler != NULL) {
+        response->device_handler(response->device_id, response->userdata);
+      } else if (response->handler != NULL) {
+        response->handler(response->userdata);
+      }
+      free(response->device_id);
+      free(response);
+    }
+    pthread_mutex_lock(&pt_stub_mutex);
+  }
+  stub->accepting = 0;
+  pthread_mutex_unlock(&pt_stub_mutex);
+  if (pt_cbs->connection_shutdown_cb != NULL) {
+    pt_cbs->connection_shutdown_cb(connection, userdata);
+  }
+  pthread_mutex_lock(&pt_stub_mutex);
+  stub->in_use = 0;
+  --pt_stub_num_connections;
+  pthread_mutex_unlock(&pt_stub_mutex);
+  return 0;
+}
+
+void pt_client_shutdown(struct connection *connection) {
+  pt_stub_connection_t *stub = (pt_stub_connection_t *)connection;
+  if (stub == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&pt_stub_mutex);
+  stub->running = 0;
+  pthread_cond_broadcast(&pt_stub_cond);
+  pthread_mutex_unlock(&pt_stub_mutex);
+}
+
+void pt_client_initialize_trace_api() {}
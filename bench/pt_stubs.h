@@ -0,0 +1,50 @@
+/**
+ * @file    pt_stubs.h
+ * @brief   Offline PT client stubs for the benchmarks
+ * @author  Doug Anson
+ * @version 1.0
+ * @see
+ *
+ * Copyright (c) 2018
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PT_STUBS_H__
+#define __PT_STUBS_H__
+
+// number of calls made into the stubbed PT client (all succeed... their
+// responses are made by the connection's event loop)
+extern "C" unsigned long pt_stub_num_writes;
+extern "C" unsigned long pt_stub_num_registrations;
+extern "C" unsigned long pt_stub_num_deregistrations;
+
+// PT calls made from another thread than their connection's event loop (the
+// real PT client is not thread-safe... this must stay 0)
+extern "C" unsigned long pt_stub_num_foreign_calls;
+
+// connections currently open (pt_client_start() calls still running)
+extern "C" unsigned long pt_stub_num_connections;
+
+// slow consumer: with a delay, writes are acknowledged one per "delay_us" by a
+// separate thread (0 acknowledges whatever is still queued and goes back to
+// completing immediately). The pending writes are the ones not acknowledged
+// yet... the peak is reset by every call
+extern "C" void pt_stub_set_write_delay(unsigned int delay_us);
+extern "C" unsigned long pt_stub_num_pending_writes;
+extern "C" unsigned long pt_stub_max_pending_writes;
+
+// reads one of the counters above (they are updated by the event loops)
+#define PT_STUB_COUNT(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+#endif // __PT_STUBS_H__
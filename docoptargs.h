@@ -35,10 +35,20 @@ typedef struct {
   /* options without arguments */
   int help;
   /* options with arguments */
+  char *config;
   char *endpoint_postfix;
   char *host;
   char *port;
   char *protocol_translator_name;
+  char *rules;
+  char *shards;
+  char *trace;
+  char *trace_sample;
+  char *profile;
+  char *profile_hz;
+  char *control;
+  char *log_level;
+  char *pt_connections;
   /* special */
   const char *usage_pattern;
   const char *help_message;
@@ -49,7 +59,10 @@ const char help_message[] =
     "\n"
     "Usage:\n"
     "  pt-doug --protocol-translator-name <name> [--endpoint-postfix <name>] "
-    "[--port <int>] [--host <hostname>]\n"
+    "[--port <int>] [--host <hostname>] [--shards <int>] "
+    "[--config <file>] [--rules <file>] [--trace <file>] "
+    "[--trace-sample <int>] [--profile <prefix>] [--profile-hz <int>] "
+    "[--control <path>] [--log-level <level>] [--pt-connections <int>]\n"
     "  pt-doug --help\n"
     "\n"
     "Options:\n"
@@ -57,18 +70,42 @@ const char help_message[] =
     "  -n --protocol-translator-name <name>      Name of the Protocol "
     "Translator.\n"
     "  -e --endpoint-postfix <postfix>           Name for the endpoint postfix "
-    "[default: -0]\n"
+    "[default: -0 (none with --config)]\n"
     "  -p --port <int>                           Edge Core port number "
     "[default: 22223].\n"
     "  --host <string>                           Edge Core host address "
     "[default: 127.0.0.1].\n"
+    "  -s --shards <int>                         Number of orchestrator shards "
+    "[default: number of CPUs].\n"
+    "  -c --config <file>                        Fleet configuration file "
+    "[default: one built-in device].\n"
+    "  -r --rules <file>                         Local rules file "
+    "[default: none].\n"
+    "  -t --trace <file>                         Export per-device spans "
+    "(Chrome trace JSON) on SIGUSR1 and at exit [default: none].\n"
+    "  --trace-sample <int>                      Trace 1 in this many devices "
+    "[default: 100].\n"
+    "  --profile <prefix>                        Profile CPU from the start, "
+    "SIGUSR2 stops/starts (folded stacks per thread) [default: "
+    "orchestrator-profile, on SIGUSR2 only].\n"
+    "  --profile-hz <int>                        CPU profile samples per "
+    "second of thread CPU time [default: 99].\n"
+    "  --control <path>                          Local admin control socket "
+    "(Unix domain) [default: none].\n"
+    "  --log-level <level>                       warning, info or debug "
+    "[default: debug].\n"
+    "  --pt-connections <int>                    PT connections to edge-core "
+    "(named <name>-<n> if more than one) [default: 1].\n"
     "\n"
     "";
 
 const char usage_pattern[] =
     "Usage:\n"
     "  pt-doug --protocol-translator-name <name> [--endpoint-postfix <name>] "
-    "[--port <int>] [--host <hostname>]\n"
+    "[--port <int>] [--host <hostname>] [--shards <int>] "
+    "[--config <file>] [--rules <file>] [--trace <file>] "
+    "[--trace-sample <int>] [--profile <prefix>] [--profile-hz <int>] "
+    "[--control <path>] [--log-level <level>] [--pt-connections <int>]\n"
     "  pt-doug --help";
 
 typedef struct {
@@ -290,6 +327,9 @@ int elems_to_args(Elements *elements, DocoptArgs *args, bool help,
       return 1;
     } else if (!strcmp(option->olong, "--help")) {
       args->help = option->value;
+    } else if (!strcmp(option->olong, "--config")) {
+      if (option->argument)
+        args->config = option->argument;
     } else if (!strcmp(option->olong, "--endpoint-postfix")) {
       if (option->argument)
         args->endpoint_postfix = option->argument;
@@ -302,6 +342,33 @@ int elems_to_args(Elements *elements, DocoptArgs *args, bool help,
     } else if (!strcmp(option->olong, "--protocol-translator-name")) {
       if (option->argument)
         args->protocol_translator_name = option->argument;
+    } else if (!strcmp(option->olong, "--rules")) {
+      if (option->argument)
+        args->rules = option->argument;
+    } else if (!strcmp(option->olong, "--shards")) {
+      if (option->argument)
+        args->shards = option->argument;
+    } else if (!strcmp(option->olong, "--trace")) {
+      if (option->argument)
+        args->trace = option->argument;
+    } else if (!strcmp(option->olong, "--trace-sample")) {
+      if (option->argument)
+        args->trace_sample = option->argument;
+    } else if (!strcmp(option->olong, "--profile")) {
+      if (option->argument)
+        args->profile = option->argument;
+    } else if (!strcmp(option->olong, "--profile-hz")) {
+      if (option->argument)
+        args->profile_hz = option->argument;
+    } else if (!strcmp(option->olong, "--control")) {
+      if (option->argument)
+        args->control = option->argument;
+    } else if (!strcmp(option->olong, "--log-level")) {
+      if (option->argument)
+        args->log_level = option->argument;
+    } else if (!strcmp(option->olong, "--pt-connections")) {
+      if (option->argument)
+        args->pt_connections = option->argument;
     }
   }
   /* commands */
@@ -320,8 +387,10 @@ int elems_to_args(Elements *elements, DocoptArgs *args, bool help,
  */
 
 DocoptArgs docopt(int argc, char *argv[], bool help, const char *version) {
-  DocoptArgs args = {0,    (char *)"-0",  (char *)"127.0.0.1", (char *)"22223",
-                     NULL, usage_pattern, help_message};
+  DocoptArgs args = {0,    NULL, NULL, (char *)"127.0.0.1", (char *)"22223",
+                     NULL, NULL, NULL, NULL,
+                     NULL, NULL, NULL, NULL,
+                     NULL, NULL, usage_pattern, help_message};
   Tokens ts;
   Command commands[] = {};
   Argument arguments[] = {};
@@ -329,8 +398,18 @@ DocoptArgs docopt(int argc, char *argv[], bool help, const char *version) {
                       {"-e", "--endpoint-postfix", 1, 0, NULL},
                       {NULL, "--host", 1, 0, NULL},
                       {"-p", "--port", 1, 0, NULL},
-                      {"-n", "--protocol-translator-name", 1, 0, NULL}};
-  Elements elements = {0, 0, 5, commands, arguments, options};
+                      {"-n", "--protocol-translator-name", 1, 0, NULL},
+                      {"-s", "--shards", 1, 0, NULL},
+                      {"-c", "--config", 1, 0, NULL},
+                      {"-r", "--rules", 1, 0, NULL},
+                      {"-t", "--trace", 1, 0, NULL},
+                      {NULL, "--trace-sample", 1, 0, NULL},
+                      {NULL, "--profile", 1, 0, NULL},
+                      {NULL, "--profile-hz", 1, 0, NULL},
+                      {NULL, "--control", 1, 0, NULL},
+                      {NULL, "--log-level", 1, 0, NULL},
+                      {NULL, "--pt-connections", 1, 0, NULL}};
+  Elements elements = {0, 0, 15, commands, arguments, options};
 
   ts = tokens_new(argc, argv);
   if (parse_args(&ts, &elements))
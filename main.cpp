@@ -29,19 +29,43 @@
 // Utils
 #include "utils.h"
 
-// global instances
+// global instances (the signal handlers run on the main thread only: our
+// worker threads block the signals, see Threads)
 static Orchestrator *orchestrator = NULL;
 
-// shutdown handler
-extern "C" void end_program() {
-  printf("Program ending...\n");
-  exit(0);
+// shutdown handler (signal context: async-signal-safe work only... the
+// orchestrator's event loop performs the actual shutdown)
+extern "C" void shutdown_handler(int signum) {
+  Orchestrator *instance = __atomic_load_n(&orchestrator, __ATOMIC_ACQUIRE);
+  if (instance != NULL) {
+    instance->requestShutdown(signum);
+  }
 }
 
-extern "C" void shutdown_handler(int signum) {
-  printf("Shutdown handler when interrupt %d is received\n", signum);
-  if (orchestrator != NULL) {
-    orchestrator->shutdown();
+// reload handler (signal context: the orchestrator's event loop reloads the
+// fleet configuration)
+extern "C" void reload_handler(int signum) {
+  Orchestrator *instance = __atomic_load_n(&orchestrator, __ATOMIC_ACQUIRE);
+  if (instance != NULL) {
+    instance->requestReload(signum);
+  }
+}
+
+// trace export handler (signal context: the orchestrator's event loop writes
+// the trace file)
+extern "C" void trace_export_handler(int signum) {
+  Orchestrator *instance = __atomic_load_n(&orchestrator, __ATOMIC_ACQUIRE);
+  if (instance != NULL) {
+    instance->requestTraceExport(signum);
+  }
+}
+
+// profile toggle handler (signal context: the orchestrator's event loop
+// starts/stops the CPU profile)
+extern "C" void profile_toggle_handler(int signum) {
+  Orchestrator *instance = __atomic_load_n(&orchestrator, __ATOMIC_ACQUIRE);
+  if (instance != NULL) {
+    instance->requestProfileToggle(signum);
   }
 }
 
@@ -62,26 +86,39 @@ int main(int argc, char **argv) {
     // the orchestrator will coordinate/orchestrate events/actions between the
     // NonMbedDevice and a "device shadow" that represents the device in mbed
     // Cloud
-    orchestrator = new Orchestrator(non_mbed_device);
+    Orchestrator *instance = new Orchestrator(non_mbed_device);
+    __atomic_store_n(&orchestrator, instance, __ATOMIC_RELEASE);
 
     // register our "tick" handler to be the Orchestrator... which will
     // manipulate the device shadow...
     non_mbed_device->setEventCallbackHandler(Orchestrator::tickHandler,
-                                             (void *)orchestrator);
+                                             (void *)instance);
 
     // next we connect our orchestrator to mbed edge via PT...
-    if (orchestrator->connectToMbedEdgePT(argc, argv) == true) {
+    if (instance->connectToMbedEdgePT(argc, argv) == true) {
       // we are connected to mbed-edge via PT... so start the orchestrator event
-      // loop (trival sleeping...)
+      // loop (trival sleeping...). It returns once shutdown has completed.
       printf("Main: now processing events...\n");
-      orchestrator->processEvents();
+      instance->processEvents();
     } else {
       // unable to bind to mbed-edge via PT... so exit
       printf("Main: ERROR: Unable to bind to mbed-edge via PT. Exiting...\n");
+      instance->shutdown();
+    }
+
+    // clean up: uninstall our signal handlers before the orchestrator goes
+    // away. If a PT thread outlived the shutdown it may still call back into
+    // the orchestrator (and its shadows and devices)... leave them to the
+    // process exit
+    teardown_signals();
+    __atomic_store_n(&orchestrator, (Orchestrator *)NULL, __ATOMIC_RELEASE);
+    if (instance->isSafeToDelete() == true) {
+      delete instance;
+      delete non_mbed_device;
     }
   }
 
   // we reached the end...
   printf("Main: processing has ended!. Exiting...\n");
-  shutdown_handler(0);
+  return 0;
 }
@@ -28,17 +28,24 @@
 #include <stdbool.h>
 #include <signal.h>
 
-// shutdown handler in main.cpp
+// shutdown, reload, trace export and profile toggle handlers in main.cpp
 extern void shutdown_handler(int signo);
+extern void reload_handler(int signo);
+extern void trace_export_handler(int signo);
+extern void profile_toggle_handler(int signo);
 
 /**
  * \brief Set up the signal handler for catching signals from OS.
  * This example signal handler setup catches SIGTERM and SIGINT for shutting down
- * the protocol translator client gracefully.
+ * the protocol translator client gracefully, and SIGHUP for reloading the
+ * fleet configuration.
  */
 bool setup_signals(void)
 {
     struct sigaction sa = { .sa_handler = shutdown_handler, };
+    struct sigaction sa_reload = { .sa_handler = reload_handler, };
+    struct sigaction sa_trace = { .sa_handler = trace_export_handler, };
+    struct sigaction sa_profile = { .sa_handler = profile_toggle_handler, };
     struct sigaction sa_pipe = { .sa_handler = SIG_IGN, };
     int ret_val;
 
@@ -51,6 +58,24 @@ bool setup_signals(void)
     if (sigaction(SIGINT, &sa, NULL) != 0) {
         return false;
     }
+    if (sigemptyset(&sa_reload.sa_mask) != 0) {
+        return false;
+    }
+    if (sigaction(SIGHUP, &sa_reload, NULL) != 0) {
+        return false;
+    }
+    if (sigemptyset(&sa_trace.sa_mask) != 0) {
+        return false;
+    }
+    if (sigaction(SIGUSR1, &sa_trace, NULL) != 0) {
+        return false;
+    }
+    if (sigemptyset(&sa_profile.sa_mask) != 0) {
+        return false;
+    }
+    if (sigaction(SIGUSR2, &sa_profile, NULL) != 0) {
+        return false;
+    }
     ret_val = sigaction(SIGPIPE, &sa_pipe, NULL);
     if (ret_val != 0) {
         printf("setup_signals: sigaction with SIGPIPE returned error=(%d) errno=(%d) strerror=(%s)\n",
@@ -60,3 +85,24 @@ bool setup_signals(void)
     }
     return true;
 }
+
+/**
+ * \brief Restore the default handling of the signals caught by setup_signals()
+ * (SIGPIPE stays ignored). Called before the orchestrator is deleted.
+ */
+bool teardown_signals(void)
+{
+    const int signals[] = { SIGTERM, SIGINT, SIGHUP, SIGUSR1, SIGUSR2 };
+    struct sigaction sa_default = { .sa_handler = SIG_DFL, };
+    size_t i;
+
+    if (sigemptyset(&sa_default.sa_mask) != 0) {
+        return false;
+    }
+    for (i = 0; i < sizeof(signals) / sizeof(signals[0]); ++i) {
+        if (sigaction(signals[i], &sa_default, NULL) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -24,5 +24,6 @@
 #define __UTILS_H__
 
 extern "C" bool setup_signals(void);
+extern "C" bool teardown_signals(void);
 
 #endif // __UTILS_H__